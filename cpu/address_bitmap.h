@@ -0,0 +1,116 @@
+//
+// Created by dimitrije on 10/19/26.
+//
+
+#ifndef EMULATOR_M0_ADDRESS_BITMAP_H
+#define EMULATOR_M0_ADDRESS_BITMAP_H
+
+#include <cstdint>
+#include <vector>
+#include <unordered_set>
+#include "mmu.h"
+
+/**
+ * A set of half-word addresses that is looked up on the hot paths, for example the addresses with a hook. Bit N of
+ * the code bitmap is set if the half-word at CODE_BEGIN + 2 * N is in the set, the sram bitmap is the same from
+ * SRAM_BEGIN. The bitmaps only grow up to the last address in them and never past the end of their region, the
+ * addresses outside of the regions are kept in a small set that is only looked at when it is not empty.
+ */
+class address_bitmap {
+
+private:
+
+    /**
+     * The bitmaps of the code region and of the sram
+     */
+    std::vector<uint64_t> code;
+    std::vector<uint64_t> sram;
+
+    /**
+     * The addresses outside of the regions
+     */
+    std::unordered_set<uint32_t> others;
+
+    /**
+     * Checks the bit of an address in a bitmap
+     */
+    static inline bool test(const std::vector<uint64_t> &bitmap, uint32_t offset) {
+        uint32_t index = offset >> 1;
+        return ((bitmap[index >> 6] >> (index & 63)) & 1) != 0;
+    }
+
+    /**
+     * Sets or clears the bit of an address if the bitmap can cover it
+     * @param region_size - the size of the region of the bitmap
+     * @return false if the address is past the end of the region
+     */
+    static inline bool mark(std::vector<uint64_t> &bitmap, uint32_t offset, uint32_t region_size, bool value) {
+
+        uint32_t index = offset >> 1;
+        if ((index >> 6) >= ((uint64_t) region_size + 127) / 128) {
+            return false;
+        }
+
+        if ((index >> 6) >= bitmap.size()) {
+            if (!value) {
+                return true;
+            }
+            bitmap.resize((index >> 6) + 1, 0);
+        }
+
+        if (value) {
+            bitmap[index >> 6] |= 1ull << (index & 63);
+        } else {
+            bitmap[index >> 6] &= ~(1ull << (index & 63));
+        }
+        return true;
+    }
+
+public:
+
+    /**
+     * Checks if the address is in the set
+     * @param address - the half-word address
+     * @return true if it is
+     */
+    inline bool contains(uint32_t address) const {
+
+        uint32_t offset = address - CODE_BEGIN;
+        if ((offset >> 7) < code.size()) {
+            return test(code, offset);
+        }
+
+        offset = address - SRAM_BEGIN;
+        if ((offset >> 7) < sram.size()) {
+            return test(sram, offset);
+        }
+
+        return !others.empty() && others.count(address) != 0;
+    }
+
+    /**
+     * Adds an address to the set
+     * @param address - the half-word address
+     * @param memory - the mmu with the sizes of the regions
+     */
+    inline void insert(uint32_t address, const mmu *memory) {
+        if (!mark(code, address - CODE_BEGIN, memory->get_code_size(), true) &&
+            !mark(sram, address - SRAM_BEGIN, memory->get_sram_size(), true)) {
+            others.insert(address);
+        }
+    }
+
+    /**
+     * Removes an address from the set
+     * @param address - the half-word address
+     * @param memory - the mmu with the sizes of the regions
+     */
+    inline void erase(uint32_t address, const mmu *memory) {
+        if (!mark(code, address - CODE_BEGIN, memory->get_code_size(), false) &&
+            !mark(sram, address - SRAM_BEGIN, memory->get_sram_size(), false)) {
+            others.erase(address);
+        }
+    }
+};
+
+#endif //EMULATOR_M0_ADDRESS_BITMAP_H
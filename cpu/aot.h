@@ -0,0 +1,104 @@
+//
+// Created by dimitrije on 10/2/26.
+//
+
+#ifndef EMULATOR_M0_AOT_H
+#define EMULATOR_M0_AOT_H
+
+#include <cstdint>
+#include "registers.h"
+
+/**
+ * The version of the interface between the emulator and the translated libraries,
+ * a library with a different version is not loaded
+ */
+const uint32_t AOT_ABI_VERSION = 3;
+
+/**
+ * The version of the emulator, the cached translations are keyed by it so it needs to be bumped
+ * every time the translator or the interpreter semantics change
+ */
+#define EMULATOR_M0_VERSION "1.5"
+
+/**
+ * The state a translated block operates on, it points directly into the cpu so that the translated code
+ * and the interpreter can hand the execution over to each other without copying anything
+ */
+struct aot_context {
+
+    /**
+     * The registers of the cpu
+     */
+    arm_register_t *registers;
+
+    /**
+     * The program status register of the cpu
+     */
+    psr *psr_register;
+
+    /**
+     * The memory the callbacks below operate on (the mmu of the cpu)
+     */
+    void *memory;
+
+    /**
+     * The memory access callbacks, the translated code does not link against the emulator so it goes through these
+     */
+    uint32_t (*read32)(void *memory, uint32_t address);
+    uint16_t (*read16)(void *memory, uint32_t address);
+    uint32_t (*read8)(void *memory, uint32_t address);
+    void (*write32)(void *memory, uint32_t address, uint32_t value);
+    void (*write16)(void *memory, uint32_t address, uint16_t value);
+    void (*write8)(void *memory, uint32_t address, uint8_t value);
+
+    /**
+     * The cpu the code runs on and the callback it calls after an instruction that can lower the stack pointer,
+     * with the address of the instruction, so the cpu keeps its stack watermark and limit
+     */
+    void *instance;
+    void (*stack_written)(void *instance, uint32_t pc);
+};
+
+/**
+ * A translated basic block, it executes the whole block and returns the address of the next instruction. The address
+ * has AOT_TAKEN_BRANCH set if the block left through a taken branch, the cpu only looks for the hooks and tells the
+ * branch observers then, like the interpreter does.
+ */
+typedef uint32_t (*aot_block_fn)(aot_context *context);
+
+/**
+ * The bit of the returned address that marks a taken branch, the instructions are at even addresses
+ */
+const uint32_t AOT_TAKEN_BRANCH = 1;
+
+/**
+ * The description of a translated block
+ */
+struct aot_block {
+
+    /**
+     * The address of the first instruction of the block
+     */
+    uint32_t address;
+
+    /**
+     * The number of instructions the block executes
+     */
+    uint32_t length;
+
+    /**
+     * The function that executes the block
+     */
+    aot_block_fn execute;
+};
+
+/**
+ * The names of the symbols every translated library exports
+ */
+#define AOT_BLOCKS_SYMBOL "aot_blocks"
+#define AOT_BLOCK_COUNT_SYMBOL "aot_block_count"
+#define AOT_ABI_VERSION_SYMBOL "aot_abi_version"
+#define AOT_CODE_SIZE_SYMBOL "aot_code_size"
+#define AOT_CODE_HASH_SYMBOL "aot_code_hash"
+
+#endif //EMULATOR_M0_AOT_H
@@ -0,0 +1,140 @@
+//
+// Created by dimitrije on 10/16/26.
+//
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include "bbv.h"
+
+bbv_collector::bbv_collector(cpu *instance, uint64_t interval) : instance(instance), interval(interval), counts(1, 0) {
+
+    if (interval == 0) {
+        throw std::runtime_error("the interval of the basic block vectors has to be larger than 0");
+    }
+
+    // the intervals are aligned to the start of the run
+    block_start = instance->get_instructions();
+    interval_end = (block_start / interval + 1) * interval;
+    block = number(instance->get_registers()[15].to_uint - 2);
+
+    instance->add_branch_observer(this);
+}
+
+bbv_collector::~bbv_collector() {
+    instance->remove_branch_observer(this);
+}
+
+uint32_t bbv_collector::number(uint32_t address) {
+
+    auto it = blocks.emplace(address, (uint32_t) blocks.size() + 1).first;
+    if (it->second == counts.size()) {
+        counts.push_back(0);
+    }
+
+    return it->second;
+}
+
+void bbv_collector::on_branch(uint32_t target, uint64_t instruction) {
+    count(instruction);
+    block = number(target);
+}
+
+void bbv_collector::count(uint64_t instruction) {
+
+    // the cpu was moved back, there is nothing to count
+    if (instruction < block_start) {
+        block_start = instruction;
+        return;
+    }
+
+    while (true) {
+
+        uint64_t end = std::min(instruction, interval_end);
+        if (end != block_start) {
+            if (counts[block] == 0) {
+                touched.push_back(block);
+            }
+            counts[block] += end - block_start;
+        }
+        block_start = end;
+
+        if (instruction < interval_end) {
+            return;
+        }
+
+        // the interval is finished, its vector is ordered by the number of the block
+        std::sort(touched.begin(), touched.end());
+
+        std::vector<std::pair<uint32_t, uint64_t>> finished;
+        finished.reserve(touched.size());
+        for (uint32_t touched_block : touched) {
+            finished.emplace_back(touched_block, counts[touched_block]);
+            counts[touched_block] = 0;
+        }
+
+        vectors.push_back(std::move(finished));
+        touched.clear();
+        interval_end += interval;
+    }
+}
+
+void bbv_collector::run(size_t n_instr) {
+    instance->run(n_instr);
+    count(instance->get_instructions());
+}
+
+void bbv_collector::write(std::ostream &output) {
+
+    count(instance->get_instructions());
+
+    for (const auto &vector : vectors) {
+        output << "T";
+        for (const auto &entry : vector) {
+            output << ":" << entry.first << ":" << entry.second << " ";
+        }
+        output << "\n";
+    }
+
+    // the interval that is not finished yet
+    if (!touched.empty()) {
+        std::vector<uint32_t> ordered = touched;
+        std::sort(ordered.begin(), ordered.end());
+
+        output << "T";
+        for (uint32_t touched_block : ordered) {
+            output << ":" << touched_block << ":" << counts[touched_block] << " ";
+        }
+        output << "\n";
+    }
+}
+
+std::vector<simulation_point> read_simulation_points(std::istream &points, std::istream &weights) {
+
+    // the weight of every cluster
+    std::map<uint64_t, double> cluster_weights;
+    double weight;
+    uint64_t cluster;
+    while (weights >> weight >> cluster) {
+        cluster_weights[cluster] = weight;
+    }
+
+    std::vector<simulation_point> read;
+    uint64_t interval;
+    while (points >> interval >> cluster) {
+
+        auto it = cluster_weights.find(cluster);
+        if (it == cluster_weights.end()) {
+            throw std::runtime_error("the simulation point of the cluster " + std::to_string(cluster) +
+                                     " has no weight");
+        }
+
+        read.push_back(simulation_point{interval, it->second});
+    }
+
+    std::sort(read.begin(), read.end(), [](const simulation_point &a, const simulation_point &b) {
+        return a.interval < b.interval;
+    });
+
+    return read;
+}
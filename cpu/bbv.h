@@ -0,0 +1,163 @@
+//
+// Created by dimitrije on 10/16/26.
+//
+
+#ifndef EMULATOR_M0_BBV_H
+#define EMULATOR_M0_BBV_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "cpu.h"
+
+/**
+ * The default number of instructions in an interval of the basic block vectors
+ */
+const uint64_t BBV_INTERVAL = 10000000;
+
+/**
+ * A representative interval of the run picked by SimPoint and the part of the run it stands for
+ */
+struct simulation_point {
+
+    /**
+     * The number of the interval, the interval N starts at the instruction N times the length of the intervals
+     */
+    uint64_t interval;
+
+    /**
+     * The fraction of the intervals of the run that are like this one
+     */
+    double weight;
+};
+
+/**
+ * Collects the basic block vectors of a run, for every interval of the run how many instructions were executed in
+ * each basic block. The vectors are written in the input format of SimPoint, which picks the intervals that
+ * represent the run. Only those intervals then have to be simulated in detail (see sharded_run::select).
+ *
+ * A basic block starts at the target of a branch and runs until the next branch that is taken, the not taken
+ * conditional branches do not end it. The blocks are numbered from 1 in the order they are first executed. The
+ * position in the run is the number of instructions the cpu has retired, so the timing model and the sleeping do not
+ * change the vectors.
+ */
+class bbv_collector : private branch_observer {
+
+private:
+
+    /**
+     * The cpu we collect from
+     */
+    cpu *instance;
+
+    /**
+     * The number of instructions in an interval
+     */
+    uint64_t interval;
+
+    /**
+     * The number of every block by its address
+     */
+    std::unordered_map<uint32_t, uint32_t> blocks;
+
+    /**
+     * The instructions executed in every block during the current interval, indexed by the number of the block,
+     * and the blocks that have some
+     */
+    std::vector<uint64_t> counts;
+    std::vector<uint32_t> touched;
+
+    /**
+     * The vectors of the finished intervals, the number of the block and the instructions executed in it
+     */
+    std::vector<std::vector<std::pair<uint32_t, uint64_t>>> vectors;
+
+    /**
+     * The number of the block we are in and the instruction it was entered at or the current interval started at
+     */
+    uint32_t block;
+    uint64_t block_start;
+
+    /**
+     * The instruction the current interval ends at
+     */
+    uint64_t interval_end;
+
+    /**
+     * Starts a new block
+     */
+    void on_branch(uint32_t target, uint64_t instruction) override;
+
+    /**
+     * Adds the instructions of the current block up to an instruction, finishing the intervals on the way
+     * @param instruction the number of retired instructions
+     */
+    void count(uint64_t instruction);
+
+    /**
+     * Returns the number of the block that starts at an address
+     * @param address the address
+     * @return the number
+     */
+    uint32_t number(uint32_t address);
+
+public:
+
+    /**
+     * Starts collecting the vectors of a cpu from its current instruction
+     * @param instance the cpu
+     * @param interval the number of instructions in an interval
+     */
+    bbv_collector(cpu *instance, uint64_t interval = BBV_INTERVAL);
+
+    /**
+     * Stops collecting
+     */
+    ~bbv_collector() override;
+
+    /**
+     * Runs the cpu for N instructions collecting the vectors
+     * @param n_instr the number of instructions
+     */
+    void run(size_t n_instr);
+
+    /**
+     * Writes the vectors in the SimPoint format, a line for every interval that starts with T and has :block:count
+     * for every block executed in it. The last interval is written even if it is not finished.
+     * @param output the stream
+     */
+    void write(std::ostream &output);
+
+    /**
+     * Returns the number of finished intervals
+     * @return the number of intervals
+     */
+    inline size_t get_interval_count() const { return vectors.size(); }
+
+    /**
+     * Returns the number of blocks seen so far
+     * @return the number of blocks
+     */
+    inline size_t get_block_count() const { return blocks.size(); }
+
+    /**
+     * Returns the vector of a finished interval
+     * @param index the index of the interval
+     * @return the numbers of the blocks and the instructions executed in them
+     */
+    inline const std::vector<std::pair<uint32_t, uint64_t>> &get_vector(size_t index) const { return vectors[index]; }
+};
+
+/**
+ * Reads the simulation points picked by SimPoint, the points file has the interval and the cluster on every line
+ * and the weights file the weight and the cluster
+ * @param points the points file
+ * @param weights the weights file
+ * @return the simulation points ordered by their interval
+ */
+std::vector<simulation_point> read_simulation_points(std::istream &points, std::istream &weights);
+
+#endif //EMULATOR_M0_BBV_H
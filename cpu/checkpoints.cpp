@@ -0,0 +1,289 @@
+//
+// Created by dimitrije on 10/12/26.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "checkpoints.h"
+
+checkpoints::checkpoints(cpu *instance, uint64_t interval, size_t budget) : instance(instance),
+                                                                            interval(interval),
+                                                                            budget(budget),
+                                                                            used(0) {
+    if (interval == 0) {
+        throw std::runtime_error("the checkpoint interval has to be larger than 0");
+    }
+}
+
+uint8_t *checkpoints::sram(cpu *target) {
+    uint32_t region_begin, region_end;
+    return target->get_mmu()->resolve_region(SRAM_BEGIN, region_begin, region_end);
+}
+
+void checkpoints::take() {
+
+    // we already have this part of the run
+    if (!saved.empty() && saved.back().state.instructions >= instance->get_instructions()) {
+        return;
+    }
+
+    uint8_t *memory = sram(instance);
+    uint32_t size = instance->get_mmu()->get_sram_size();
+
+    checkpoint taken;
+    taken.state = instance->save_state();
+
+    if (saved.empty()) {
+
+        // the first checkpoint has the whole sram
+        base.assign(memory, memory + size);
+        reference = base;
+    } else {
+
+        // the others only have the pages that changed since the previous one
+        for (uint32_t offset = 0; offset < size; offset += CHECKPOINT_PAGE_SIZE) {
+            uint32_t length = std::min(CHECKPOINT_PAGE_SIZE, size - offset);
+            if (memcmp(memory + offset, reference.data() + offset, length) != 0) {
+                taken.pages.push_back(offset / CHECKPOINT_PAGE_SIZE);
+                taken.data.insert(taken.data.end(), memory + offset, memory + offset + length);
+                memcpy(reference.data() + offset, memory + offset, length);
+            }
+        }
+    }
+
+    used += sizeof(checkpoint) + taken.pages.size() * sizeof(uint32_t) + taken.data.size();
+    saved.push_back(std::move(taken));
+
+    fit_budget();
+}
+
+void checkpoints::fit_budget() {
+
+    while (saved.size() > 1 && get_memory() > budget) {
+
+        // the second checkpoint becomes the oldest one, so its pages go into the base
+        checkpoint &next = saved[1];
+        const uint8_t *data = next.data.data();
+        for (uint32_t page : next.pages) {
+            uint32_t offset = page * CHECKPOINT_PAGE_SIZE;
+            uint32_t length = std::min(CHECKPOINT_PAGE_SIZE, (uint32_t) base.size() - offset);
+            memcpy(base.data() + offset, data, length);
+            data += length;
+        }
+
+        used -= sizeof(checkpoint) + next.pages.size() * sizeof(uint32_t) + next.data.size();
+        std::vector<uint32_t>().swap(next.pages);
+        std::vector<uint8_t>().swap(next.data);
+
+        saved.pop_front();
+    }
+}
+
+std::vector<const uint8_t *> checkpoints::pages_at(size_t index) const {
+
+    std::vector<const uint8_t *> pages;
+    for (uint32_t offset = 0; offset < base.size(); offset += CHECKPOINT_PAGE_SIZE) {
+        pages.push_back(base.data() + offset);
+    }
+
+    // the newest one is the reference
+    if (index == saved.size() - 1) {
+        for (size_t page = 0; page < pages.size(); ++page) {
+            pages[page] = reference.data() + page * CHECKPOINT_PAGE_SIZE;
+        }
+        return pages;
+    }
+
+    // apply the changes up to the checkpoint
+    for (size_t i = 1; i <= index; ++i) {
+        const uint8_t *data = saved[i].data.data();
+        for (uint32_t page : saved[i].pages) {
+            pages[page] = data;
+            data += std::min(CHECKPOINT_PAGE_SIZE, (uint32_t) base.size() - page * CHECKPOINT_PAGE_SIZE);
+        }
+    }
+
+    return pages;
+}
+
+void checkpoints::load(size_t index, cpu *target) const {
+
+    uint8_t *memory = sram(target);
+    std::vector<const uint8_t *> pages = pages_at(index);
+    for (size_t page = 0; page < pages.size(); ++page) {
+        uint32_t offset = (uint32_t) page * CHECKPOINT_PAGE_SIZE;
+        memcpy(memory + offset, pages[page], std::min(CHECKPOINT_PAGE_SIZE, (uint32_t) base.size() - offset));
+    }
+
+    target->restore_state(saved[index].state);
+}
+
+bool checkpoints::matches(size_t index, cpu *target) const {
+
+    const cpu_state &expected = saved[index].state;
+    cpu_state state = target->save_state();
+    if (state.instructions != expected.instructions) {
+        return false;
+    }
+
+    for (int r = 0; r < 16; ++r) {
+        if (state.registers[r].to_uint != expected.registers[r].to_uint) {
+            return false;
+        }
+    }
+
+    const uint8_t *memory = sram(target);
+    std::vector<const uint8_t *> pages = pages_at(index);
+    for (size_t page = 0; page < pages.size(); ++page) {
+        uint32_t offset = (uint32_t) page * CHECKPOINT_PAGE_SIZE;
+        uint32_t length = std::min(CHECKPOINT_PAGE_SIZE, (uint32_t) base.size() - offset);
+        if (memcmp(memory + offset, pages[page], length) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void checkpoints::write(cpu *source, std::ostream &output) {
+
+    uint32_t size = source->get_mmu()->get_sram_size();
+    cpu_state state = source->save_state();
+
+    output.write((const char *) &CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    output.write((const char *) &size, sizeof(size));
+    output.write((const char *) &state, sizeof(state));
+    output.write((const char *) sram(source), size);
+
+    if (!output) {
+        throw std::runtime_error("could not write the checkpoint");
+    }
+}
+
+void checkpoints::read(std::istream &input, cpu *target) {
+
+    uint64_t magic = 0;
+    uint32_t size = 0;
+    input.read((char *) &magic, sizeof(magic));
+    input.read((char *) &size, sizeof(size));
+
+    if (!input || magic != CHECKPOINT_MAGIC) {
+        throw std::runtime_error("the file is not a checkpoint");
+    }
+
+    if (size != target->get_mmu()->get_sram_size()) {
+        throw std::runtime_error("the checkpoint has " + std::to_string(size) + " bytes of sram and the cpu has " +
+                                 std::to_string(target->get_mmu()->get_sram_size()));
+    }
+
+    // read everything before we touch the cpu
+    cpu_state state;
+    std::vector<uint8_t> memory(size);
+    input.read((char *) &state, sizeof(state));
+    input.read((char *) memory.data(), size);
+
+    if (!input) {
+        throw std::runtime_error("the checkpoint is truncated");
+    }
+
+    memcpy(sram(target), memory.data(), size);
+    target->restore_state(state);
+}
+
+size_t checkpoints::find(uint64_t instruction) const {
+
+    auto it = std::upper_bound(saved.begin(), saved.end(), instruction, [](uint64_t i, const checkpoint &taken) {
+        return i < taken.state.instructions;
+    });
+
+    if (it == saved.begin()) {
+        throw std::runtime_error("the instruction " + std::to_string(instruction) + " is before the oldest checkpoint");
+    }
+
+    return (size_t) (it - saved.begin()) - 1;
+}
+
+void checkpoints::run_to(uint64_t instruction) {
+
+    // a sleeping cpu executes the WFE or the WFI again without retiring it, so it can take more than one run
+    while (instance->get_instructions() < instruction && !instance->is_halted()) {
+        instance->run((size_t) (instruction - instance->get_instructions()));
+    }
+}
+
+void checkpoints::run(size_t n_instr) {
+
+    while (n_instr != 0) {
+
+        uint64_t now = instance->get_instructions();
+        take();
+
+        // run up to the next checkpoint
+        uint64_t next = (now / interval + 1) * interval;
+        size_t chunk = (size_t) std::min<uint64_t>(n_instr, next - now);
+        run_to(now + chunk);
+
+        // the cpu has stopped
+        uint64_t executed = instance->get_instructions() - now;
+        if (executed < chunk) {
+            return;
+        }
+
+        n_instr -= chunk;
+    }
+}
+
+void checkpoints::run_back_to(uint64_t instruction) {
+
+    load(find(instruction), instance);
+    run_to(instruction);
+}
+
+void checkpoints::reverse_step() {
+
+    uint64_t now = instance->get_instructions();
+    if (now > get_oldest()) {
+        run_back_to(now - 1);
+    }
+}
+
+bool checkpoints::reverse_continue(const std::function<bool(cpu *instance)> &stop) {
+
+    uint64_t now = instance->get_instructions();
+    if (saved.empty() || now <= get_oldest()) {
+        return false;
+    }
+
+    // look for the last stop in the intervals between the checkpoints, from the newest to the oldest
+    uint64_t end = now;
+    for (size_t index = find(now - 1) + 1; index-- > 0;) {
+
+        load(index, instance);
+
+        uint64_t found = UINT64_MAX;
+        while (instance->get_instructions() < end) {
+            if (stop(instance)) {
+                found = instance->get_instructions();
+            }
+
+            // the cpu has stopped
+            uint64_t before = instance->get_instructions();
+            run_to(before + 1);
+            if (instance->get_instructions() == before) {
+                break;
+            }
+        }
+
+        if (found != UINT64_MAX) {
+            run_back_to(found);
+            return true;
+        }
+
+        end = saved[index].state.instructions;
+    }
+
+    // there was none, stay where we were
+    run_back_to(now);
+    return false;
+}
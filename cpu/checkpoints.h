@@ -0,0 +1,222 @@
+//
+// Created by dimitrije on 10/12/26.
+//
+
+#ifndef EMULATOR_M0_CHECKPOINTS_H
+#define EMULATOR_M0_CHECKPOINTS_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "cpu.h"
+
+/**
+ * The size of the sram pages we compare and store in the checkpoints
+ */
+const uint32_t CHECKPOINT_PAGE_SIZE = 4096;
+
+/**
+ * Marks the start of a checkpoint written to a file
+ */
+const uint64_t CHECKPOINT_MAGIC = 0x6D30636B70743031ull;
+
+/**
+ * Runs the cpu taking a checkpoint of its state and the changed sram pages every interval instructions, so that it
+ * can go back to any earlier instruction by restoring the nearest checkpoint before it and executing forward. Going
+ * back then takes time proportional to the interval and not to the whole run.
+ *
+ * The position in the run is the number of instructions the cpu has retired, the cycles are not used because a
+ * sleeping cpu skips them. The state of the peripherals and their scheduled events are not in the checkpoints, the
+ * re-execution is the same as the run only if they do not change it (replay the inputs with an input log if they
+ * do).
+ */
+class checkpoints {
+
+private:
+
+    /**
+     * The state of the cpu and the sram pages that changed since the previous checkpoint
+     */
+    struct checkpoint {
+
+        /**
+         * The state of the cpu
+         */
+        cpu_state state;
+
+        /**
+         * The indices of the changed pages and their content one after another
+         */
+        std::vector<uint32_t> pages;
+        std::vector<uint8_t> data;
+    };
+
+    /**
+     * The cpu we are running
+     */
+    cpu *instance;
+
+    /**
+     * The number of instructions between two checkpoints
+     */
+    uint64_t interval;
+
+    /**
+     * The memory the checkpoints are allowed to use in bytes, the oldest ones are dropped when we go over it
+     */
+    size_t budget;
+
+    /**
+     * The checkpoints from the oldest to the newest, the oldest one has no pages because its sram is the base
+     */
+    std::deque<checkpoint> saved;
+
+    /**
+     * The sram at the oldest checkpoint
+     */
+    std::vector<uint8_t> base;
+
+    /**
+     * The sram at the newest checkpoint, the next checkpoint stores the pages that differ from it
+     */
+    std::vector<uint8_t> reference;
+
+    /**
+     * The memory used by the diffs of the checkpoints
+     */
+    size_t used;
+
+    /**
+     * Returns the host memory of the sram of a cpu
+     * @param target the cpu
+     * @return the sram
+     */
+    static uint8_t *sram(cpu *target);
+
+    /**
+     * Finds the content every sram page had at a checkpoint
+     * @param index the index of the checkpoint
+     * @return the content of every page, in the base or in the diff of the last checkpoint that changed it
+     */
+    std::vector<const uint8_t *> pages_at(size_t index) const;
+
+    /**
+     * Merges the second oldest checkpoint into the oldest one until we fit into the budget
+     */
+    void fit_budget();
+
+    /**
+     * Finds the newest checkpoint at or before an instruction
+     * @param instruction the number of retired instructions
+     * @return the index of the checkpoint
+     */
+    size_t find(uint64_t instruction) const;
+
+    /**
+     * Runs the cpu until it has retired a number of instructions or it stops
+     * @param instruction the number of retired instructions
+     */
+    void run_to(uint64_t instruction);
+
+public:
+
+    /**
+     * Creates the checkpoints of a cpu
+     * @param instance the cpu
+     * @param interval the number of instructions between two checkpoints
+     * @param budget the memory the checkpoints are allowed to use in bytes
+     */
+    checkpoints(cpu *instance, uint64_t interval, size_t budget);
+
+    /**
+     * Takes a checkpoint now unless we already have one at or after the current instruction
+     */
+    void take();
+
+    /**
+     * Runs the cpu for N instructions taking the checkpoints on the way
+     * @param n_instr the number of instructions
+     */
+    void run(size_t n_instr);
+
+    /**
+     * Goes back to the state the cpu had after retiring a number of instructions by restoring the nearest
+     * checkpoint before it and executing forward from there
+     * @param instruction the number of retired instructions, it can not be before the oldest checkpoint
+     */
+    void run_back_to(uint64_t instruction);
+
+    /**
+     * Goes back one instruction
+     */
+    void reverse_step();
+
+    /**
+     * Goes back to the last instruction before the current one where the condition holds, the condition is
+     * checked before every instruction is executed
+     * @param stop the condition, for example a breakpoint on the PC
+     * @return true if we found one, false if we stayed where we were
+     */
+    bool reverse_continue(const std::function<bool(cpu *instance)> &stop);
+
+    /**
+     * Puts a cpu into the state of a checkpoint, it can be another cpu with the same sram size. The checkpoints are
+     * only read so the cpus of other threads can be loaded at the same time
+     * @param index the index of the checkpoint
+     * @param target the cpu
+     */
+    void load(size_t index, cpu *target) const;
+
+    /**
+     * Checks if a cpu is in the state of a checkpoint, its registers, its retired instructions and its sram
+     * @param index the index of the checkpoint
+     * @param target the cpu, it can be another cpu with the same sram size
+     * @return true if it is
+     */
+    bool matches(size_t index, cpu *target) const;
+
+    /**
+     * Writes the state of a cpu and its whole sram, so that a later run can start from there, for example at a
+     * simulation point. The peripherals are not written, the same as in the checkpoints.
+     * @param source the cpu
+     * @param output the stream
+     */
+    static void write(cpu *source, std::ostream &output);
+
+    /**
+     * Puts a cpu into the state written by write, it has to have the sram size of the cpu that was written
+     * @param input the stream
+     * @param target the cpu
+     */
+    static void read(std::istream &input, cpu *target);
+
+    /**
+     * Returns the state of the cpu at a checkpoint
+     * @param index the index of the checkpoint
+     * @return the state
+     */
+    inline const cpu_state &get_state(size_t index) const { return saved[index].state; }
+
+    /**
+     * Returns the number of checkpoints we have
+     * @return the number of checkpoints
+     */
+    inline size_t get_count() const { return saved.size(); }
+
+    /**
+     * Returns the instruction of the oldest checkpoint, we can not go back further than that
+     * @return the number of retired instructions
+     */
+    inline uint64_t get_oldest() const { return saved.empty() ? 0 : saved.front().state.instructions; }
+
+    /**
+     * Returns the memory the checkpoints are using
+     * @return the memory in bytes
+     */
+    inline size_t get_memory() const { return base.size() + reference.size() + used; }
+};
+
+#endif //EMULATOR_M0_CHECKPOINTS_H
@@ -2,11 +2,17 @@
 // Created by dimitrije on 9/11/17.
 //
 
+#include <algorithm>
 #include <exception>
 #include <stdexcept>
 #include <iostream>
+#include <sstream>
+#include <cstdint>
+#include <dlfcn.h>
 #include "cpu.h"
 #include "util.h"
+#include "instructions.h"
+#include "timing.h"
 
 void cpu::move_shifted_register(uint16_t instr) {
 
@@ -454,6 +460,11 @@ void cpu::hi_register_operations_branch_exchange(uint16_t instr) {
 
             registers[(instr & 7) + 8].to_uint += registers[(instr >> 3) & 7].to_uint;
 
+            // is this the stack pointer
+            if ((instr & 7) == 5) {
+                stack_written(registers[15].to_uint - 4);
+            }
+
             // is this the PC register
             if ((instr & 7) == 7) {
                 registers[15].to_uint &= 0xFFFFFFFE;
@@ -467,6 +478,11 @@ void cpu::hi_register_operations_branch_exchange(uint16_t instr) {
         case 0b0011: {
             registers[(instr & 7) + 8].to_uint += registers[((instr >> 3) & 7) + 8].to_uint;
 
+            // is this the stack pointer
+            if ((instr & 7) == 5) {
+                stack_written(registers[15].to_uint - 4);
+            }
+
             // is this the PC register
             if ((instr & 7) == 7) {
                 registers[15].to_uint &= 0xFFFFFFFE;
@@ -530,6 +546,11 @@ void cpu::hi_register_operations_branch_exchange(uint16_t instr) {
         case 0b1010: {
             registers[(instr & 7) + 8].to_uint = registers[(instr >> 3) & 7].to_uint;
 
+            // is this the stack pointer
+            if ((instr & 7) == 5) {
+                stack_written(registers[15].to_uint - 4);
+            }
+
             // is this the PC register
             if ((instr & 7) == 7) {
                 registers[15].to_uint &= 0xFFFFFFFE;
@@ -543,6 +564,11 @@ void cpu::hi_register_operations_branch_exchange(uint16_t instr) {
         case 0b1011: {
             registers[(instr & 7) + 8].to_uint = registers[((instr >> 3) & 7) + 8].to_uint;
 
+            // is this the stack pointer
+            if ((instr & 7) == 5) {
+                stack_written(registers[15].to_uint - 4);
+            }
+
             // is this the PC register
             if ((instr & 7) == 7) {
                 registers[15].to_uint &= 0xFFFFFFFE;
@@ -572,14 +598,18 @@ void cpu::hi_register_operations_branch_exchange(uint16_t instr) {
             } else {
                 throw std::runtime_error("Going to ARM state is not possible on a M0 cpu");
             }
+            break;
         }
             // BLX Rs this is used to
         case 0b1110:
             // BLX Rs this is used to
         case 0b1111: {
             int base = (instr >> 3) & 15;
-            registers[14].to_uint = registers[15].to_uint;
-            registers[15].to_uint = registers[base].to_uint;
+            uint32_t target = registers[base].to_uint;
+
+            // return to the next instruction in the thumb state
+            registers[14].to_uint = (registers[15].to_uint - 2) | 1;
+            registers[15].to_uint = target;
 
             if ((registers[15].to_uint & 1) != 0u) {
                 // we are in thumb state because the address had a 1 bit set
@@ -593,6 +623,7 @@ void cpu::hi_register_operations_branch_exchange(uint16_t instr) {
             } else {
                 throw std::runtime_error("Going to ARM state is not possible on a M0 cpu");
             }
+            break;
         }
         default:
             std::runtime_error("The operation in the alu is unsupported!");
@@ -762,6 +793,7 @@ void cpu::add_offset_to_stack_pointer(uint16_t instr) {
     } else {
         // ADD SP, #-Imm
         registers[13].to_uint -= offset;
+        stack_written(registers[15].to_uint - 4);
     }
 
 }
@@ -770,6 +802,9 @@ void cpu::push_pop_registers(uint16_t instr) {
 
     int flag = ((instr >> 8) & 0b1) | ((instr >> 1) & 0b10);
 
+    // the values of the transferred registers in the order they are in the memory
+    uint32_t values[9];
+
     switch (flag) {
 
         case 0b00 : {
@@ -780,17 +815,12 @@ void cpu::push_pop_registers(uint16_t instr) {
             uint32_t address = temp & 0xFFFFFFFC;
 
             // push the selected registers from R0-R7
-            push_reg(instr, address, 1, 0);
-            push_reg(instr, address, 2, 1);
-            push_reg(instr, address, 4, 2);
-            push_reg(instr, address, 8, 3);
-            push_reg(instr, address, 16, 4);
-            push_reg(instr, address, 32, 5);
-            push_reg(instr, address, 64, 6);
-            push_reg(instr, address, 128, 7);
+            int count = gather_registers(instr & 0xFF, values);
+            mmu_ptr->write_block(address, values, count);
 
             // set the new stack pointer
             registers[13].to_uint = temp;
+            stack_written(registers[15].to_uint - 4);
             break;
         }
         case 0b01 : {
@@ -801,18 +831,13 @@ void cpu::push_pop_registers(uint16_t instr) {
             uint32_t address = temp & 0xFFFFFFFC;
 
             // push the registers selected registers from R0-R7 including the link register
-            push_reg(instr, address, 1, 0);
-            push_reg(instr, address, 2, 1);
-            push_reg(instr, address, 4, 2);
-            push_reg(instr, address, 8, 3);
-            push_reg(instr, address, 16, 4);
-            push_reg(instr, address, 32, 5);
-            push_reg(instr, address, 64, 6);
-            push_reg(instr, address, 128, 7);
-            push_reg(instr, address, 256, 14);
+            int count = gather_registers(instr & 0xFF, values);
+            values[count++] = registers[14].to_uint;
+            mmu_ptr->write_block(address, values, count);
 
             // set the new stack pointer
             registers[13].to_uint = temp;
+            stack_written(registers[15].to_uint - 4);
             break;
         }
         case 0b10 : {
@@ -825,14 +850,8 @@ void cpu::push_pop_registers(uint16_t instr) {
             uint32_t temp = registers[13].to_uint + 4 * cpu_bits_set[instr & 0xFF];
 
             // pop each selected register (R0-R7) from the stack
-            pop_reg(instr, address, 1, 0);
-            pop_reg(instr, address, 2, 1);
-            pop_reg(instr, address, 4, 2);
-            pop_reg(instr, address, 8, 3);
-            pop_reg(instr, address, 16, 4);
-            pop_reg(instr, address, 32, 5);
-            pop_reg(instr, address, 64, 6);
-            pop_reg(instr, address, 128, 7);
+            mmu_ptr->read_block(address, values, cpu_bits_set[instr & 0xFF]);
+            scatter_registers(instr & 0xFF, values);
 
             // sets the new stack pointer
             registers[13].to_uint = temp;
@@ -848,17 +867,12 @@ void cpu::push_pop_registers(uint16_t instr) {
             // add 4 * the number of selected registers)
             uint32_t temp = registers[13].to_uint + 4 + 4 * cpu_bits_set[instr & 0xFF];
 
-            pop_reg(instr, address, 1, 0);
-            pop_reg(instr, address, 2, 1);
-            pop_reg(instr, address, 4, 2);
-            pop_reg(instr, address, 8, 3);
-            pop_reg(instr, address, 16, 4);
-            pop_reg(instr, address, 32, 5);
-            pop_reg(instr, address, 64, 6);
-            pop_reg(instr, address, 128, 7);
+            // pop the selected registers and the program counter that is right after them
+            mmu_ptr->read_block(address, values, cpu_bits_set[instr & 0xFF] + 1);
+            int count = scatter_registers(instr & 0xFF, values);
 
             // read the program counter from this
-            registers[15].to_uint = (mmu_ptr->read32(address) & 0xFFFFFFFE);
+            registers[15].to_uint = (values[count] & 0xFFFFFFFE);
 
             // set the next pc to be the read value
             next_pc = registers[15].to_uint;
@@ -884,6 +898,9 @@ void cpu::multiple_load_store(uint16_t instr) {
     // extract the relevant flag
     int flag = (instr >> 11) & 0b1;
 
+    // the values of the transferred registers in the order they are in the memory
+    uint32_t values[8];
+
     if (flag != 0) {
         // STMIA Rb!, { Rlist }
 
@@ -895,14 +912,8 @@ void cpu::multiple_load_store(uint16_t instr) {
         uint32_t temp = registers[reg].to_uint + 4 * cpu_bits_set[instr & 0xff];
 
         // store the selected registers
-        thumb_stm_reg(instr, address, 1, 0);
-        thumb_stm_reg(instr, address, 2, 1);
-        thumb_stm_reg(instr, address, 4, 2);
-        thumb_stm_reg(instr, address, 8, 3);
-        thumb_stm_reg(instr, address, 16, 4);
-        thumb_stm_reg(instr, address, 32, 5);
-        thumb_stm_reg(instr, address, 64, 6);
-        thumb_stm_reg(instr, address, 128, 7);
+        int count = gather_registers(instr & 0xFF, values);
+        mmu_ptr->write_block(address, values, count);
 
         // write back the base address
         registers[reg].to_uint = temp;
@@ -912,18 +923,12 @@ void cpu::multiple_load_store(uint16_t instr) {
         uint32_t address = registers[reg].to_uint & 0xFFFFFFFC;
 
         // load the selected registers
-        thumb_ldm_reg(instr, address, 1, 0);
-        thumb_ldm_reg(instr, address, 2, 1);
-        thumb_ldm_reg(instr, address, 4, 2);
-        thumb_ldm_reg(instr, address, 8, 3);
-        thumb_ldm_reg(instr, address, 16, 4);
-        thumb_ldm_reg(instr, address, 32, 5);
-        thumb_ldm_reg(instr, address, 64, 6);
-        thumb_ldm_reg(instr, address, 128, 7);
+        mmu_ptr->read_block(address, values, cpu_bits_set[instr & 0xFF]);
+        int count = scatter_registers(instr & 0xFF, values);
 
         // if the register was not written to we write back the base address
         if (!(instr & (1 << reg))) {
-            registers[reg].to_uint = address;
+            registers[reg].to_uint = address + 4 * count;
         }
     }
 }
@@ -1129,12 +1134,24 @@ void cpu::software_interrupt(uint16_t instr) {
 }
 
 void cpu::data_mem_sync_barier(uint32_t instr) {
-    // TODO figure out what this does!
-    std::runtime_error("Data Memory Barrier and Data Synchronization Barrier not implemented yet!");
+
+    // ISB has the same first half-word
+    if ((instr & 0xFFF0) == 0x8F60) {
+        instruction_sync_barier(instr);
+        return;
+    }
+
+    // the other cpus that share the sram see our accesses before the ones after the barrier
+    std::atomic_thread_fence(std::memory_order_seq_cst);
 }
 
 void cpu::cpsi_d_e(uint16_t instr) {
-    std::runtime_error("CPSIE and CPSID are not implemented yet!");
+
+    // CPSID I sets PRIMASK, CPSIE I clears it
+    primask = ((instr >> 4) & 1) != 0;
+
+    // an interrupt might have been waiting for this
+    update_next_event();
 }
 
 void cpu::supervisor_call(uint16_t instr) {
@@ -1142,19 +1159,71 @@ void cpu::supervisor_call(uint16_t instr) {
 }
 
 void cpu::breakpoint(uint16_t instr) {
-    std::runtime_error("The breakpoint instruction is not implemented yet!");
+
+    // BKPT 0xAB is a semihosting call, the result goes to R0
+    if ((instr & 0xFF) == SEMIHOSTING_BKPT) {
+
+        // the firmware marks its region of interest
+        if (registers[0].to_uint == SYS_RUN_MODE) {
+            set_run_mode(registers[1].to_uint != 0 ? RUN_DETAILED : RUN_FAST);
+            registers[0].to_uint = 0;
+            return;
+        }
+
+        access_origin previous = mmu_ptr->set_origin(ACCESS_HOST);
+        registers[0].to_uint = host->call(registers[0].to_uint, registers[1].to_uint);
+        mmu_ptr->set_origin(previous);
+
+        // the firmware has asked us to stop
+        if (host->has_exited()) {
+            halt();
+        }
+        return;
+    }
+
+    // any other breakpoint halts the cpu
+    halt();
 }
 
 void cpu::wait_for_interupt_event(uint16_t instr) {
-    std::runtime_error("Wait For Event and Wait For Interrupt are not implemented yet!");
+
+    // WFI waits for an interrupt, WFE for the event register or an interrupt
+    bool wfi = ((instr >> 4) & 1) != 0;
+    if (pending_interrupts != 0 || (!wfi && event_register.exchange(false, std::memory_order_acquire))) {
+        sleeping = false;
+        return;
+    }
+
+    // execute the instruction again, it does not retire until we wake up
+    sleeping = true;
+    --instructions;
+    registers[15].to_uint -= 2;
+    next_pc = registers[15].to_uint - 2;
+    redirect_fetch(next_pc);
+
+    // nothing can wake us up, the firmware waits forever
+    uint64_t wake = std::min(next_event, sleep_limit);
+    if (wake == UINT64_MAX) {
+        halt();
+        return;
+    }
+
+    // skip the cycles until something can happen, the tick of this instruction takes us to it
+    if (wake > cycles + 1) {
+        cycles = wake - 1;
+    }
 }
 
 void cpu::send_event(uint16_t instr) {
-    std::runtime_error("Send Event is not implemented yet!");
+    if (event_sender) {
+        event_sender();
+    } else {
+        set_event();
+    }
 }
 
 void cpu::instruction_sync_barier(uint32_t instr) {
-    std::runtime_error("Instruction Synchronization Barrier is not implemented yet");
+    // the instructions are always fetched from the current memory, there is nothing to flush
 }
 
 void cpu::sign_zero_extend_byte_halfword(uint32_t instr) {
@@ -1163,105 +1232,364 @@ void cpu::sign_zero_extend_byte_halfword(uint32_t instr) {
 
 void cpu::execute_op(uint16_t instruction) {
 
-    if (instruction == 0b0100011011000000) {
-        nop(instruction);
-    } else if ((0b1111111111101111 & instruction) == 0b1011011001100010) {
-        cpsi_d_e(instruction);
-    } else if ((0b1111111111101111 & instruction) == 0b1011111100100000) {
-        wait_for_interupt_event(instruction);
-    } else if (instruction == 0b1011111101000000) {
-        send_event(instruction);
-    } else if ((instruction & 0xFF00) == 0b1101111100000000) {
-        supervisor_call(instruction);
-    } else if ((instruction & 0xFF00) == 0b1101111000000000) {
-        breakpoint(instruction);
-    } else if ((instruction & 0xFF00) == 0b1101111100000000) {
-        software_interrupt(instruction);
-    } else if ((instruction & 0xFF00) == 0b1011000000000000) {
-        add_offset_to_stack_pointer(instruction);
-    } else if ((instruction & 0b1111001000000000) == 0b0101000000000000) {
-        load_store_with_register_offset(instruction);
-    } else if ((instruction & 0b1111001000000000) == 0b0101001000000000) {
-        load_store_sign_extended_byte_halfword(instruction);
-    } else if ((instruction & 0b1111011000000000) == 0b1011010000000000) {
-        push_pop_registers(instruction);
-    } else if ((instruction & 0b1111110000000000) == 0b0100000000000000) {
-        alu_operations(instruction);
-    } else if ((instruction & 0b1111110000000000) == 0b0100010000000000) {
-        hi_register_operations_branch_exchange(instruction);
-    } else if ((instruction & 0b1111100000000000) == 0b0001100000000000) {
-        add_subtract(instruction);
-    } else if ((instruction & 0b1111100000000000) == 0b0100100000000000) {
-        pc_relative_load(instruction);
-    } else if ((instruction & 0b1111100000000000) == 0b0111000000000000) {
-        unconditional_branch(instruction);
-    } else if ((instruction & 0b1111100000000000) == 0b0111000000000000) {
-        unconditional_branch(instruction);
-    } else if ((instruction & 0b1111000000000000) == 0b1000000000000000) {
-        load_store_halfword_immediate_offset(instruction);
-    } else if ((instruction & 0b1111000000000000) == 0b1001000000000000) {
-        sp_relative_load_store(instruction);
-    } else if ((instruction & 0b1111000000000000) == 0b1010000000000000) {
-        load_address(instruction);
-    } else if ((instruction & 0b1111000000000000) == 0b1100000000000000) {
-        multiple_load_store(instruction);
-    } else if ((instruction & 0b1111000000000000) == 0b1101000000000000) {
-        conditional_branch(instruction);
-    } else if ((instruction & 0b1111000000000000) == 0b1111000000000000) {
-        long_branch_with_link(instruction);
-    } else if ((instruction & 0b1110000000000000) == 0b0010000000000000) {
-        move_compare_add_subtract_immediate(instruction);
-    } else if ((instruction & 0b1110000000000000) == 0b0000000000000000) {
-        move_shifted_register(instruction);
-    } else if ((instruction & 0b1110000000000000) == 0b0110000000000000) {
-        load_store_with_immediate_offset(instruction);
-    } else {
-        std::runtime_error("This instruction is unknown or unimplemented");
+    switch (decode(instruction)) {
+        case NOP: nop(instruction); break;
+        case CPSI_D_E: cpsi_d_e(instruction); break;
+        case WAIT_FOR_INTERUPT_EVENT: wait_for_interupt_event(instruction); break;
+        case SEND_EVENT: send_event(instruction); break;
+        case SUPERVISOR_CALL: supervisor_call(instruction); break;
+        case BREAKPOINT: breakpoint(instruction); break;
+        case ADD_OFFSET_TO_STACK_POINTER: add_offset_to_stack_pointer(instruction); break;
+        case LOAD_STORE_WITH_REGISTER_OFFSET: load_store_with_register_offset(instruction); break;
+        case LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD: load_store_sign_extended_byte_halfword(instruction); break;
+        case PUSH_POP_REGISTERS: push_pop_registers(instruction); break;
+        case ALU_OPERATIONS: alu_operations(instruction); break;
+        case HI_REGISTER_OPERATIONS_BRANCH_EXCHANGE: hi_register_operations_branch_exchange(instruction); break;
+        case ADD_SUBTRACT: add_subtract(instruction); break;
+        case PC_RELATIVE_LOAD: pc_relative_load(instruction); break;
+        case UNCONDITIONAL_BRANCH: unconditional_branch(instruction); break;
+        case LOAD_STORE_HALFWORD_IMMEDIATE_OFFSET: load_store_halfword_immediate_offset(instruction); break;
+        case SP_RELATIVE_LOAD_STORE: sp_relative_load_store(instruction); break;
+        case LOAD_ADDRESS: load_address(instruction); break;
+        case MULTIPLE_LOAD_STORE: multiple_load_store(instruction); break;
+        case CONDITIONAL_BRANCH: conditional_branch(instruction); break;
+        case LONG_BRANCH_WITH_LINK: long_branch_with_link(instruction); break;
+        case MEMORY_BARRIER: data_mem_sync_barier(((uint32_t) instruction << 16) | fetch()); break;
+        case MOVE_COMPARE_ADD_SUBTRACT_IMMEDIATE: move_compare_add_subtract_immediate(instruction); break;
+        case MOVE_SHIFTED_REGISTER: move_shifted_register(instruction); break;
+        case LOAD_STORE_WITH_IMMEDIATE_OFFSET: load_store_with_immediate_offset(instruction); break;
+        default:
+            std::runtime_error("This instruction is unknown or unimplemented");
     }
 }
 
 
 void cpu::prefetch() {
-    cpu_prefetch[0] = mmu_ptr->read16(next_pc);
-    cpu_prefetch[1] = mmu_ptr->read16(next_pc + 2);
+
+    // the branch goes to a function that runs on the host
+    if (has_hook(next_pc)) {
+        run_hook();
+    }
+
+    // the branch returns from an exception or from a function called by the host
+    if (next_pc >= CALL_RETURN_ADDRESS) {
+        if (next_pc == CALL_RETURN_ADDRESS) {
+            halt();
+            return;
+        }
+        if (next_pc >= (EXC_RETURN_HANDLER & 0xFFFFFFFE)) {
+
+            // only a handler can return from an exception, in the thread mode the address can not be executed
+            if (current_mode != HANDLER_MODE) {
+                std::stringstream message;
+                message << "HardFault : branch to 0x" << std::hex << (next_pc | 1) << " in the thread mode";
+                throw std::runtime_error(message.str());
+            }
+            exception_return(next_pc);
+        }
+    }
+
+    // the region of interest starts or ends here
+    if (has_mode_switch(next_pc)) {
+        set_run_mode(mode_switches[next_pc]);
+    }
+
+    for (auto observer : branch_observers) {
+        observer->on_branch(next_pc, instructions + branch_retiring);
+    }
+
+    redirect_fetch(next_pc);
+}
+
+void cpu::run_hook() {
+
+    // the hook accesses the memory on behalf of the firmware
+    access_origin previous = mmu_ptr->set_origin(ACCESS_HOST);
+    hooks[next_pc](this);
+    mmu_ptr->set_origin(previous);
+
+    // return to the caller
+    next_pc = registers[14].to_uint & 0xFFFFFFFE;
+    registers[15].to_uint = next_pc + 2;
+}
+
+void cpu::add_hook(uint32_t address, hle_hook hook) {
+
+    address &= 0xFFFFFFFE;
+    hooks[address] = std::move(hook);
+
+    // mark it in the bitmap
+    hook_bitmap.insert(address, mmu_ptr);
+}
+
+void cpu::add_branch_observer(branch_observer *observer) {
+    if (std::find(branch_observers.begin(), branch_observers.end(), observer) == branch_observers.end()) {
+        branch_observers.push_back(observer);
+    }
+}
+
+void cpu::remove_branch_observer(branch_observer *observer) {
+    branch_observers.erase(std::remove(branch_observers.begin(), branch_observers.end(), observer),
+                           branch_observers.end());
+}
+
+void cpu::set_run_mode(run_mode new_mode) {
+
+    if (new_mode == active_mode) {
+        return;
+    }
+
+    active_mode = new_mode;
+    update_dispatch();
+
+    if (listener) {
+        listener(this, active_mode);
+    }
+}
+
+void cpu::switch_mode_at_cycle(uint64_t cycle, run_mode new_mode) {
+    schedule(cycle > cycles ? cycle - cycles : 0, [this, new_mode]() { set_run_mode(new_mode); });
+}
+
+void cpu::switch_mode_at_instruction(uint64_t instruction, run_mode new_mode) {
+    switch_instruction = instruction;
+    switch_instruction_mode = new_mode;
+}
+
+void cpu::switch_mode_reached() {
+    switch_instruction = UINT64_MAX;
+    set_run_mode(switch_instruction_mode);
+}
+
+void cpu::switch_mode_at_pc(uint32_t address, run_mode new_mode) {
+
+    address &= 0xFFFFFFFE;
+    mode_switches[address] = new_mode;
+
+    // mark it in the bitmap
+    switch_bitmap.insert(address, mmu_ptr);
+}
+
+void cpu::remove_hook(uint32_t address) {
+
+    address &= 0xFFFFFFFE;
+    if (!has_hook(address)) {
+        return;
+    }
+
+    hooks.erase(address);
+    hook_bitmap.erase(address, mmu_ptr);
+}
+
+void cpu::service_events() {
+
+    // the instruction that was executed again through the peripherals has retired
+    if (flat != nullptr) {
+        mmu_ptr->set_flat_access(true);
+    }
+
+    // run the peripheral events
+    servicing = true;
+    events.run_due(cycles);
+    servicing = false;
+
+    // take the pending interrupt with the lowest number
+    if (pending_interrupts != 0 && !primask && current_mode == THREAD_MODE) {
+        uint32_t irq = __builtin_ctz(pending_interrupts);
+        pending_interrupts &= ~(1u << irq);
+        enter_exception(IRQ_EXCEPTION_NUMBER + irq);
+    }
+
+    update_next_event();
 }
 
-void cpu::prefetch_next() {
-    cpu_prefetch[1] = mmu_ptr->read16(next_pc + 2);
+void cpu::update_next_event() {
+
+    // an interrupt can be taken right away
+    if (pending_interrupts != 0 && !primask && current_mode == THREAD_MODE) {
+        next_event = cycles;
+        return;
+    }
+
+    next_event = events.next_due();
 }
 
-void cpu::push_reg(uint16_t instr, uint32_t &address, int val, int reg) {
-    if (instr & val) {
-        mmu_ptr->write32(address, registers[reg].to_uint);
-        address += 4;
+void cpu::enter_exception(uint32_t exception_number) {
+
+    // the interrupt wakes up a sleeping cpu, it returns after the WFE or the WFI
+    if (sleeping) {
+        sleeping = false;
+        registers[15].to_uint += 2;
+        ++instructions;
     }
+
+    // the frame that is stacked : R0, R1, R2, R3, R12, LR, the return address and the xPSR
+    uint32_t frame[8] = {registers[0].to_uint, registers[1].to_uint, registers[2].to_uint, registers[3].to_uint,
+                         registers[12].to_uint, registers[14].to_uint, registers[15].to_uint - 2, pack_psr()};
+
+    registers[13].to_uint -= sizeof(frame);
+    mmu_ptr->write_block(registers[13].to_uint & 0xFFFFFFFC, frame, 8);
+
+    // we are now in the handler, the frame is on its stack
+    current_mode = HANDLER_MODE;
+    stack_written(registers[15].to_uint - 2);
+    psr_register.exception_number = (uint8_t) exception_number;
+    registers[14].to_uint = EXC_RETURN_THREAD;
+
+    // jump to the handler
+    uint32_t vector = IRQ_VECTOR_ADDRESS + 4 * (exception_number - IRQ_EXCEPTION_NUMBER);
+    next_pc = mmu_ptr->read32(vector) & 0xFFFFFFFE;
+    registers[15].to_uint = next_pc + 2;
+
+    // the interrupted instruction has already retired
+    for (auto observer : branch_observers) {
+        observer->on_branch(next_pc, instructions);
+    }
+
+    redirect_fetch(next_pc);
+}
+
+void cpu::exception_return(uint32_t exc_return) {
+
+    // unstack the frame
+    uint32_t frame[8];
+    mmu_ptr->read_block(registers[13].to_uint & 0xFFFFFFFC, frame, 8);
+    registers[13].to_uint += sizeof(frame);
+
+    registers[0].to_uint = frame[0];
+    registers[1].to_uint = frame[1];
+    registers[2].to_uint = frame[2];
+    registers[3].to_uint = frame[3];
+    registers[12].to_uint = frame[4];
+    registers[14].to_uint = frame[5];
+    unpack_psr(frame[7]);
+
+    // the mode we return to is in the EXC_RETURN value
+    current_mode = (exc_return & 0x8) != 0 ? THREAD_MODE : HANDLER_MODE;
+
+    // continue where the exception was taken
+    next_pc = frame[6] & 0xFFFFFFFE;
+    registers[15].to_uint = next_pc + 2;
+
+    // we can take the next interrupt
+    update_next_event();
+}
+
+uint32_t cpu::pack_psr() const {
+    return ((uint32_t) psr_register.n << 31) | ((uint32_t) psr_register.z << 30) |
+           ((uint32_t) psr_register.c << 29) | ((uint32_t) psr_register.v << 28) |
+           ((uint32_t) psr_register.t << 24) | psr_register.exception_number;
+}
+
+void cpu::unpack_psr(uint32_t xpsr) {
+    psr_register.n = ((xpsr >> 31) & 1) != 0;
+    psr_register.z = ((xpsr >> 30) & 1) != 0;
+    psr_register.c = ((xpsr >> 29) & 1) != 0;
+    psr_register.v = ((xpsr >> 28) & 1) != 0;
+    psr_register.t = ((xpsr >> 24) & 1) != 0;
+    psr_register.exception_number = (uint8_t) (xpsr & 0x3F);
+}
+
+void cpu::schedule(uint64_t delay, std::function<void()> action) {
+    events.schedule(cycles + delay, std::move(action));
+    update_next_event();
 }
 
-void cpu::pop_reg(uint16_t instr, uint32_t &address, int val, int reg) {
-    if (instr & val) {
-        registers[reg].to_uint = mmu_ptr->read32(address);
-        address += 4;
+void cpu::set_pending_interrupt(uint32_t irq) {
+
+    if (irq >= IRQ_COUNT) {
+        throw std::runtime_error("the interrupt " + std::to_string(irq) + " does not exist");
+    }
+
+    // the interrupts we replay come from the log
+    if (inputs != nullptr) {
+        if (inputs->is_replaying()) {
+            return;
+        }
+        // outside of the events the interrupt is first seen by the events of the next cycle
+        inputs->interrupt(irq, servicing ? cycles : cycles + 1);
     }
+
+    pending_interrupts |= 1u << irq;
+    update_next_event();
 }
 
-void cpu::thumb_stm_reg(uint32_t instr, uint32_t &address, int val, int r) {
-    if (instr & val) {
-        mmu_ptr->write32(address, registers[r].to_uint);
-        address += 4;
+void cpu::record_inputs(const std::string &file) {
+
+    close_inputs();
+
+    inputs = new input_log(file, false, cycles);
+    host->set_input_log(inputs);
+}
+
+void cpu::replay_inputs(const std::string &file) {
+
+    close_inputs();
+
+    inputs = new input_log(file, true, cycles);
+    host->set_input_log(inputs);
+
+    replay_next_interrupt();
+}
+
+void cpu::close_inputs() {
+
+    host->set_input_log(nullptr);
+
+    // the interrupts scheduled from this log are dropped
+    ++replayed_log;
+
+    delete inputs;
+    inputs = nullptr;
+}
+
+void cpu::replay_next_interrupt() {
+
+    uint64_t due;
+    uint32_t irq;
+    if (!inputs->next_interrupt(due, irq)) {
+        return;
     }
+
+    events.schedule(due, [this, irq, log = replayed_log] {
+        if (log != replayed_log) {
+            return;
+        }
+        pending_interrupts |= 1u << irq;
+        replay_next_interrupt();
+    });
+    update_next_event();
 }
 
-void cpu::thumb_ldm_reg(uint32_t instr, uint32_t &address, int val, int r) {
-    if (instr & (val)) {
-        registers[(r)].to_uint = mmu_ptr->read32(address);
-        address += 4;
+void cpu::redirect_fetch(uint32_t address) {
+
+    uint32_t region_begin, region_end;
+    const uint8_t *region = mmu_ptr->resolve_region(address, region_begin, region_end);
+
+    // point directly into the region
+    if (region != nullptr && (address & 1) == 0 && region_end - address >= 2) {
+        fetch_ptr = (const uint16_t *) (region + (address - region_begin));
+        fetch_end = (const uint16_t *) (region + ((region_end - region_begin) & 0xFFFFFFFE));
+        return;
     }
+
+    // there is nothing to point to, we fetch this one instruction through the mmu
+    fetch_buffer = mmu_ptr->read16(address);
+    fetch_ptr = &fetch_buffer;
+    fetch_end = &fetch_buffer + 1;
 }
 
-cpu::cpu(uint32_t flash_size, uint32_t sram_size) {
+cpu::cpu(uint32_t flash_size, uint32_t sram_size) : call_stack(0), inputs(nullptr), replayed_log(0), servicing(false), event_register(false), sleeping(false),
+        sleep_limit(UINT64_MAX), active_mode(RUN_FAST), translate(false), tracing(false), looping(false), redispatch(false),
+        switch_instruction(UINT64_MAX), switch_instruction_mode(RUN_FAST),
+        branch_retiring(1), last_hit(), watch_triggered(false), stack_limit(0), overflow(),
+        translation_handle(nullptr), flat(nullptr) {
 
     // init the mmu by allocating the flash region and the sram region
-    mmu_ptr = new mmu(new uint8_t[flash_size], new uint8_t[sram_size]);
+    mmu_ptr = new mmu(new uint8_t[flash_size], new uint8_t[sram_size], flash_size, sram_size);
+
+    // the semihosting works on the memory of the mmu
+    host = new semihosting(mmu_ptr);
 
     // resets the cpu
     reset();
@@ -1270,10 +1598,17 @@ cpu::cpu(uint32_t flash_size, uint32_t sram_size) {
     init_cpu_bits_set();
 }
 
-cpu::cpu(uint8_t *flash, uint8_t *sram) {
+cpu::cpu(uint8_t *flash, uint8_t *sram) : call_stack(0), inputs(nullptr), replayed_log(0), servicing(false), event_register(false), sleeping(false),
+        sleep_limit(UINT64_MAX), active_mode(RUN_FAST), translate(false), tracing(false), looping(false), redispatch(false),
+        switch_instruction(UINT64_MAX), switch_instruction_mode(RUN_FAST),
+        branch_retiring(1), last_hit(), watch_triggered(false), stack_limit(0), overflow(),
+        translation_handle(nullptr), flat(nullptr) {
     // init the mmu by allocating the flash region and the sram region
     mmu_ptr = new mmu(flash, sram);
 
+    // the semihosting works on the memory of the mmu
+    host = new semihosting(mmu_ptr);
+
     // resets the cpu
     reset();
 
@@ -1281,82 +1616,632 @@ cpu::cpu(uint8_t *flash, uint8_t *sram) {
     init_cpu_bits_set();
 }
 
+cpu::cpu(uint8_t *flash, uint32_t flash_size, uint8_t *sram, uint32_t sram_size) : call_stack(0), inputs(nullptr), replayed_log(0), servicing(false), event_register(false), sleeping(false),
+        sleep_limit(UINT64_MAX), active_mode(RUN_FAST), translate(false), tracing(false), looping(false), redispatch(false),
+        switch_instruction(UINT64_MAX), switch_instruction_mode(RUN_FAST),
+        branch_retiring(1), last_hit(), watch_triggered(false), stack_limit(0), overflow(),
+        translation_handle(nullptr), flat(nullptr) {
+    // init the mmu with the provided flash region and sram region
+    mmu_ptr = new mmu(flash, sram, flash_size, sram_size);
+
+    // the semihosting works on the memory of the mmu
+    host = new semihosting(mmu_ptr);
+
+    // resets the cpu
+    reset();
+
+    // initializes the cpu bits set
+    init_cpu_bits_set();
+}
+
+cpu::~cpu() {
+    mmu_ptr->remove_observer(this);
+    if (translation_handle != nullptr) {
+        dlclose(translation_handle);
+    }
+    delete flat;
+    delete host;
+    delete inputs;
+}
+
+void cpu::enable_flat_memory() {
+
+    if (flat != nullptr) {
+        return;
+    }
+
+    // the cpu that was created over regions of unknown size can not move them
+    if (mmu_ptr->get_code_size() == 0 || mmu_ptr->get_sram_size() == 0) {
+        throw std::runtime_error("the flat memory needs a cpu created with the sizes of its regions");
+    }
+
+    // move the regions into the flat memory
+    flat = new flat_memory(mmu_ptr->get_code_size(), mmu_ptr->get_sram_size());
+    mmu_ptr->map_flat(flat);
+
+    // the fetch has to be pointed to the new regions
+    fetch_ptr = fetch_end = nullptr;
+}
+
+bool cpu::restart_in_peripherals(uint32_t address) {
+
+    // only the loads and the stores of the instructions use the flat accessors, the rest of the addresses that are
+    // not in a region are a HardFault
+    if (!mmu_ptr->uses_flat_access() || address - PERIPHERAL_BEGIN > PERIPHERAL_END - PERIPHERAL_BEGIN) {
+        return false;
+    }
+
+    // the access came before the instruction changed anything, so it starts over through the peripherals and the
+    // flat accessors come back with the events after it retires
+    mmu_ptr->set_flat_access(false);
+    set_pc(registers[15].to_uint - 4);
+    next_event = cycles;
+    return true;
+}
+
 void cpu::reset() {
 
     // the default cpu mode is thread mode
     current_mode = THREAD_MODE;
 
+    // clear the registers and the flags
+    for (auto &reg : registers) {
+        reg.to_uint = 0;
+    }
+    psr_register = psr();
+
     // set the psr
     psr_register.t = true;
 
+    // we are not holding
+    holdState = false;
+    host->clear_exit();
+
+    // no interrupts are pending and they are enabled
+    pending_interrupts = 0;
+    primask = false;
+    cycles = 0;
+    instructions = 0;
+
+    // the events of the peripherals are dropped with their state
+    events.clear();
+    mmu_ptr->reset_peripherals();
+    update_next_event();
+
+    // a hook that faulted might have left the origin behind
+    mmu_ptr->set_origin(ACCESS_CPU);
+
+    // we are awake and no event was sent
+    sleeping = false;
+    event_register.store(false, std::memory_order_relaxed);
+
+    // the stack was not used yet
+    stack_low[THREAD_MODE] = stack_low[HANDLER_MODE] = UINT32_MAX;
+    overflowed = false;
+
     // initializes the programming counter
     next_pc = mmu_ptr->read32(PC_INIT_ADDRESS);
 
     registers[15].to_uint = next_pc + 2;
 }
 
-void cpu::run() {
+namespace {
+
+/**
+ * The limits of the run loops : how many instructions a translated block can have and if we can run more
+ */
+struct no_limit {
+    inline size_t budget(const cpu *) const { return SIZE_MAX; }
+    inline bool more(const cpu *) const { return true; }
+    inline void executed(size_t) {}
+};
+
+struct instruction_limit {
+    size_t &remaining;
+    inline size_t budget(const cpu *) const { return remaining; }
+    inline bool more(const cpu *) const { return remaining != 0; }
+    inline void executed(size_t n) { remaining -= n; }
+};
+
+struct cycle_limit {
+    uint64_t cycle;
+    inline size_t budget(const cpu *instance) const { return (size_t) (cycle - instance->get_cycles()); }
+    inline bool more(const cpu *instance) const { return instance->get_cycles() < cycle; }
+    inline void executed(size_t) {}
+};
+
+/**
+ * Stops a limit at a retired instruction count, the run is split there instead of checking it with every instruction
+ */
+template <typename limit>
+struct instruction_stop {
+    limit &inner;
+    uint64_t stop;
+    inline size_t budget(const cpu *instance) const {
+        return std::min(inner.budget(instance), (size_t) (stop - instance->get_instructions()));
+    }
+    inline bool more(const cpu *instance) const { return instance->get_instructions() < stop && inner.more(instance); }
+    inline void executed(size_t n) { inner.executed(n); }
+};
 
-    do {
+}
 
-        uint16_t instr = cpu_prefetch[0];
-        cpu_prefetch[0] = cpu_prefetch[1];
+template <typename limit>
+void cpu::run_loops(limit &&bounds) {
 
-        next_pc = registers[15].to_uint;
-        registers[15].to_uint += 2;
+    // a switch of the tracing that stopped the loop does not halt the cpu after it
+    auto leave = [this] {
+        looping = false;
+        if (redispatch) {
+            redispatch = false;
+            holdState = false;
+        }
+    };
+
+    // runs the loop of the current mode
+    auto loop = [this](auto &loop_bounds) {
+        if (tracing) {
+            this->template run_loop<true>(loop_bounds);
+        } else {
+            this->template run_loop<false>(loop_bounds);
+        }
+    };
+
+    looping = true;
+
+    try {
+        guarded([&] {
+
+            // start fetching from the current instruction
+            redirect_fetch(registers[15].to_uint - 2);
+
+            for (;;) {
+
+                // a mode switch at a retired instruction splits the run there
+                bool staged = switch_instruction != UINT64_MAX;
+                if (staged) {
+                    instruction_stop<typename std::remove_reference<limit>::type> stop{bounds, switch_instruction};
+                    loop(stop);
+                } else {
+                    loop(bounds);
+                }
+
+                bool reached = staged && !holdState && instructions >= switch_instruction;
+                if (reached) {
+                    switch_mode_reached();
+                }
 
-        // fetch the next instruction
-        prefetch_next();
+                // the loop was stopped because the tracing was switched, we go on in the loop of the new mode
+                if (redispatch) {
+                    redispatch = false;
+                    holdState = false;
+                } else if (!reached || holdState) {
+                    break;
+                }
+            }
+        });
+    } catch (...) {
+        leave();
+        throw;
+    }
+
+    leave();
+}
+
+template <bool traced, typename limit>
+void cpu::run_loop(limit &bounds) {
 
+    while (!holdState && bounds.more(this)) {
+
+        // run the translated block if it fits in the budget
+        if (!traced && translate) {
+            size_t budget = bounds.budget(this);
+            size_t before = budget;
+            if (run_translated(budget)) {
+                bounds.executed(before - budget);
+                continue;
+            }
+        }
+
+        // in the detailed mode the tracer sees the instruction first
+        uint16_t instr = fetch();
+        if (traced) {
+            tracer(this, instr);
+        }
         execute_op(instr);
+        retire(1);
 
-    } while (!holdState);
+        bounds.executed(1);
+    }
+}
+
+void cpu::run() {
+    run_loops(no_limit());
 }
 
 void cpu::run(size_t n_instr) {
+    run_loops(instruction_limit{n_instr});
+}
 
-    prefetch();
+void cpu::run_until(uint64_t cycle) {
 
-    do {
+    sleep_limit = cycle;
+    run_loops(cycle_limit{cycle});
+    sleep_limit = UINT64_MAX;
+}
 
-        uint16_t instr = cpu_prefetch[0];
-        cpu_prefetch[0] = cpu_prefetch[1];
+template <typename timing>
+void cpu::run_timed(size_t n_instr, timing &model) {
 
-        next_pc = registers[15].to_uint;
-        registers[15].to_uint += 2;
+    guarded([&] {
 
-        // fetch the next instruction
-        prefetch_next();
+        // start fetching from the current instruction
+        redirect_fetch(registers[15].to_uint - 2);
 
-        execute_op(instr);
+        while (!holdState && n_instr != 0) {
+
+            uint32_t address = registers[15].to_uint - 2;
+            uint16_t instr = fetch();
+            if (tracing) {
+                tracer(this, instr);
+            }
+            execute_op(instr);
 
-    } while (!holdState && --n_instr);
+            // the model needs to know where we went to
+            retire(model.instruction(address, instr, registers[15].to_uint - 2));
+
+            // this loop looks at the tracer with every instruction, so it can look at the mode switch too
+            if (instructions == switch_instruction) {
+                switch_mode_reached();
+            }
+
+            --n_instr;
+        }
+    });
+}
+
+// the models we have
+template void cpu::run_timed<pipeline_timing>(size_t n_instr, pipeline_timing &model);
+
+uint32_t cpu::call(uint32_t address, std::initializer_list<uint32_t> args, size_t budget) {
+
+    // the first four arguments are passed in the registers
+    const uint32_t *arg = args.begin();
+    for (int i = 0; i < 4; ++i) {
+        registers[i].to_uint = arg != args.end() ? *arg++ : 0;
+    }
+
+    // the rest goes on the stack, it stays aligned to 8 bytes
+    uint32_t sp = call_stack != 0 ? call_stack : mmu_ptr->read32(CODE_BEGIN);
+    if (arg != args.end()) {
+        auto stacked = (uint32_t) (args.end() - arg);
+        sp = (sp - stacked * sizeof(uint32_t)) & 0xFFFFFFF8;
+        access_origin previous = mmu_ptr->set_origin(ACCESS_HOST);
+        mmu_ptr->write_block(sp, arg, stacked);
+        mmu_ptr->set_origin(previous);
+    }
+    registers[13].to_uint = sp;
+
+    // the function returns to the sentinel
+    registers[14].to_uint = CALL_RETURN_ADDRESS | 1;
+    psr_register.t = true;
+    holdState = false;
+
+    // branch to the function, it might have a hook
+    next_pc = address & 0xFFFFFFFE;
+    registers[15].to_uint = next_pc + 2;
+    guarded([&] { prefetch(); });
+
+    run(budget);
+
+    if (next_pc != CALL_RETURN_ADDRESS) {
+        std::stringstream message;
+        message << "The function at 0x" << std::hex << address << " did not return";
+        throw std::runtime_error(message.str());
+    }
+
+    // the cpu can be used again
+    holdState = false;
+    return registers[0].to_uint;
+}
+
+cpu_state cpu::save_state() const {
+
+    cpu_state state{};
+    std::copy(std::begin(registers), std::end(registers), state.registers);
+    state.psr_register = psr_register;
+    state.current_mode = current_mode;
+    state.pending_interrupts = pending_interrupts;
+    state.primask = primask;
+    state.cycles = cycles;
+    state.instructions = instructions;
+
+    return state;
+}
+
+void cpu::restore_state(const cpu_state &state) {
+
+    std::copy(std::begin(state.registers), std::end(state.registers), registers);
+    psr_register = state.psr_register;
+    current_mode = state.current_mode;
+    pending_interrupts = state.pending_interrupts;
+    primask = state.primask;
+    cycles = state.cycles;
+    instructions = state.instructions;
+    update_next_event();
+
+    // continue at the saved PC
+    holdState = false;
+    next_pc = registers[15].to_uint - 2;
+}
+
+bool cpu::run_translated(size_t &n_instr) {
+
+    // the instruction we are about to execute
+    uint32_t index = (registers[15].to_uint - 2) >> 1;
+
+    if (index >= translated_blocks.size() || translated_blocks[index] == nullptr ||
+        translated_blocks[index]->length > n_instr) {
+        return false;
+    }
+
+    // run the block and continue where it left of
+    const aot_block *block = translated_blocks[index];
+    uint32_t exit = block->execute(&translation_context);
+    next_pc = exit & ~AOT_TAKEN_BRANCH;
+
+    // only a taken branch goes through the hooks and the branch observers, like in the interpreter
+    registers[15].to_uint = next_pc + 2;
+    if ((exit & AOT_TAKEN_BRANCH) != 0) {
+        branch_retiring = block->length;
+        prefetch();
+        branch_retiring = 1;
+    } else {
+        redirect_fetch(next_pc);
+    }
+
+    n_instr -= block->length;
+    instructions += block->length;
+    tick(block->length);
+    return true;
+}
+
+namespace {
+
+// the memory callbacks of the translated code, the memory is the mmu of the cpu. A block can not start over in the
+// middle, so they dispatch the peripherals instead of faulting on them in the flat memory
+
+uint32_t translated_read32(void *memory, uint32_t address) {
+    return ((mmu *) memory)->read_dispatched<uint32_t>(address);
+}
+uint16_t translated_read16(void *memory, uint32_t address) {
+    return ((mmu *) memory)->read_dispatched<uint16_t>(address);
+}
+uint32_t translated_read8(void *memory, uint32_t address) {
+    return ((mmu *) memory)->read_dispatched<uint8_t>(address);
+}
+void translated_write32(void *memory, uint32_t address, uint32_t value) {
+    ((mmu *) memory)->write_dispatched<uint32_t>(address, value);
+}
+void translated_write16(void *memory, uint32_t address, uint16_t value) {
+    ((mmu *) memory)->write_dispatched<uint16_t>(address, value);
+}
+void translated_write8(void *memory, uint32_t address, uint8_t value) {
+    ((mmu *) memory)->write_dispatched<uint8_t>(address, value);
+}
+
+}
+
+void cpu::load_translation(const std::string &library) {
+
+    void *handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        throw std::runtime_error("could not load the translation : " + std::string(dlerror()));
+    }
+
+    // grab the description of the translation
+    auto blocks = (const aot_block *) dlsym(handle, AOT_BLOCKS_SYMBOL);
+    auto block_count = (const uint32_t *) dlsym(handle, AOT_BLOCK_COUNT_SYMBOL);
+    auto abi_version = (const uint32_t *) dlsym(handle, AOT_ABI_VERSION_SYMBOL);
+    auto code_size = (const uint32_t *) dlsym(handle, AOT_CODE_SIZE_SYMBOL);
+    auto code_hash = (const uint64_t *) dlsym(handle, AOT_CODE_HASH_SYMBOL);
+
+    if (blocks == nullptr || block_count == nullptr || abi_version == nullptr || code_size == nullptr ||
+        code_hash == nullptr || *abi_version != AOT_ABI_VERSION || *code_size > mmu_ptr->get_code_size()) {
+        dlclose(handle);
+        throw std::runtime_error("the library " + library + " is not a translation this emulator can use");
+    }
+
+    // make sure the library was translated from the code we are running
+    uint64_t hash = fnv1a(nullptr, 0);
+    for (uint32_t i = 0; i < *code_size; ++i) {
+        auto byte = (uint8_t) mmu_ptr->read8(CODE_BEGIN + i);
+        hash = fnv1a(&byte, 1, hash);
+    }
+
+    if (hash != *code_hash) {
+        dlclose(handle);
+        throw std::runtime_error("the library " + library + " was translated from a different code region");
+    }
+
+    // replace the previous translation
+    if (translation_handle != nullptr) {
+        dlclose(translation_handle);
+    }
+    translation_handle = handle;
+
+    // index the blocks by the half-word they start at
+    translated_blocks.assign((*code_size + 1) / 2, nullptr);
+    for (uint32_t i = 0; i < *block_count; ++i) {
+        translated_blocks[blocks[i].address >> 1] = &blocks[i];
+    }
+    update_dispatch();
+
+    // the translated code works directly on our state
+    translation_context.registers = registers;
+    translation_context.psr_register = &psr_register;
+    translation_context.memory = mmu_ptr;
+    translation_context.read32 = translated_read32;
+    translation_context.read16 = translated_read16;
+    translation_context.read8 = translated_read8;
+    translation_context.write32 = translated_write32;
+    translation_context.write16 = translated_write16;
+    translation_context.write8 = translated_write8;
+    translation_context.instance = this;
+    translation_context.stack_written = translated_stack_written;
+}
+
+void cpu::translated_stack_written(void *instance, uint32_t pc) {
+    ((cpu *) instance)->stack_written(pc);
+}
+
+stop_reason cpu::debug_run(size_t n_instr) {
+
+    // resume after a BKPT unless the firmware has exited
+    if (!host->has_exited()) {
+        holdState = false;
+    }
+
+    stop_reason reason = STOP_BUDGET;
+    watch_triggered = false;
+
+    guarded([&] {
+
+        // start fetching from the current instruction
+        redirect_fetch(registers[15].to_uint - 2);
+
+        for (bool first = true; n_instr != 0; first = false, --n_instr) {
+
+            if (holdState) {
+                reason = STOP_HALTED;
+                return;
+            }
+
+            // we stop before the instruction with the breakpoint
+            if (!first && has_breakpoint(registers[15].to_uint - 2)) {
+                reason = STOP_BREAKPOINT;
+                return;
+            }
+
+            execute_op(fetch());
+            retire(1);
+
+            // and after the instruction that accessed a watched value
+            if (watch_triggered) {
+                reason = STOP_WATCHPOINT;
+                return;
+            }
+        }
+
+        if (holdState) {
+            reason = STOP_HALTED;
+        }
+    });
+
+    return reason;
+}
+
+void cpu::add_breakpoint(uint32_t address) {
+    breakpoint_bitmap.insert(address & 0xFFFFFFFE, mmu_ptr);
+}
+
+void cpu::remove_breakpoint(uint32_t address) {
+    breakpoint_bitmap.erase(address & 0xFFFFFFFE, mmu_ptr);
+}
+
+void cpu::add_watchpoint(uint32_t address, uint32_t length, watch_kind kind) {
+
+    if (length == 0) {
+        throw std::runtime_error("a watchpoint has to be at least 1 byte long");
+    }
+
+    // the mmu tells us about the accesses to the pages of the range
+    mmu_ptr->mark_slow(address, length);
+    mmu_ptr->add_observer(this);
+
+    watchpoints.push_back({address, length, kind});
+}
+
+void cpu::remove_watchpoint(uint32_t address, uint32_t length, watch_kind kind) {
+
+    auto it = std::find_if(watchpoints.begin(), watchpoints.end(), [&](const watchpoint &watched) {
+        return watched.address == address && watched.length == length && watched.kind == kind;
+    });
+
+    if (it != watchpoints.end()) {
+        mmu_ptr->unmark_slow(address, length);
+        watchpoints.erase(it);
+    }
+}
+
+void cpu::on_read(uint32_t address, uint32_t size, uint32_t value) {
+    watch_access(address, size, false, value, value);
+}
+
+void cpu::on_write(uint32_t address, uint32_t size, uint32_t old_value, uint32_t new_value) {
+    watch_access(address, size, true, old_value, new_value);
+}
+
+void cpu::watch_access(uint32_t address, uint32_t size, bool write, uint32_t old_value, uint32_t new_value) {
+
+    // we only report the first hit of an instruction
+    if (watch_triggered) {
+        return;
+    }
+
+    for (auto &watched : watchpoints) {
+
+        // the access has to be of the right kind and overlap the range
+        if ((watched.kind & (write ? WATCH_WRITE : WATCH_READ)) == 0 ||
+            (address - watched.address >= watched.length && watched.address - address >= size)) {
+            continue;
+        }
+
+        // the instruction is at r15 - 4 while it executes
+        last_hit = {watched.address, watched.kind, registers[15].to_uint - 4, mmu_ptr->get_origin(), address, size,
+                    write, old_value, new_value};
+        watch_triggered = true;
+        return;
+    }
+}
+
+void cpu::stack_overflowed(uint32_t pc) {
+
+    // only the first one is reported
+    if (!overflowed) {
+        overflow = {pc, registers[13].to_uint, stack_limit, current_mode, cycles};
+        overflowed = true;
+    }
+
+    halt();
+}
+
+void cpu::set_pc(uint32_t address) {
+    next_pc = address & 0xFFFFFFFE;
+    registers[15].to_uint = next_pc + 2;
 }
 
 void cpu::verbose_run(size_t n_instr) {
 
     // print out the starting PC
-    std::cout << std::hex << "The starting PC : " << next_pc << std::endl;
+    std::cout << std::hex << "The starting PC : " << registers[15].to_uint - 2 << std::endl;
 
-    // prefetch the starting instructions
-    prefetch();
+    guarded([&] {
 
-    do {
+        // start fetching from the current instruction
+        redirect_fetch(registers[15].to_uint - 2);
 
-        uint16_t instr = cpu_prefetch[0];
-        cpu_prefetch[0] = cpu_prefetch[1];
+        do {
 
-        std::cout << "Executing instruction :" << std::hex << instr << std::endl;
+            uint16_t instr = fetch();
 
-        next_pc = registers[15].to_uint;
-        registers[15].to_uint += 2;
+            std::cout << "Executing instruction :" << std::hex << instr << std::endl;
 
-        // fetch the next instruction
-        prefetch_next();
-
-        execute_op(instr);
+            execute_op(instr);
+            retire(1);
 
-    } while (!holdState && --n_instr);
+        } while (!holdState && --n_instr);
+    });
 }
 
 
@@ -1389,4 +2274,19 @@ void cpu::print() {
     std::cout << "C : " << psr_register.c << std::endl;
     std::cout << "N : " << psr_register.n << std::endl;
     std::cout << "V : " << psr_register.v << std::endl;
+
+    // how deep the stacks went
+    if (stack_low[THREAD_MODE] != UINT32_MAX) {
+        std::cout << "The lowest stack pointer in the thread mode : " << std::hex << stack_low[THREAD_MODE] << std::endl;
+    }
+    if (stack_low[HANDLER_MODE] != UINT32_MAX) {
+        std::cout << "The lowest stack pointer in the handler mode : " << std::hex << stack_low[HANDLER_MODE]
+                  << std::endl;
+    }
+
+    if (overflowed) {
+        std::cout << "The stack pointer went below the limit " << std::hex << overflow.limit << " to " << overflow.sp
+                  << " at the instruction " << overflow.pc << " in the cycle " << std::dec << overflow.cycle
+                  << std::endl;
+    }
 }
@@ -7,9 +7,19 @@
 
 #include <cstdint>
 #include <vector>
+#include <string>
 #include "registers.h"
+#include "aot.h"
 #include "../pheripherals/peripheral.h"
 #include "mmu.h"
+#include "address_bitmap.h"
+#include "scheduler.h"
+#include "semihosting.h"
+#include "input_log.h"
+#include <atomic>
+#include <functional>
+#include <initializer_list>
+#include <unordered_map>
 
 enum mode {
     THREAD_MODE,
@@ -21,73 +31,211 @@ enum mode {
  */
 const uint32_t PC_INIT_ADDRESS = 0x00000004;
 
-struct psr {
+/**
+ * The address of the handler of the first interrupt (IRQ 0) in the vector table
+ */
+const uint32_t IRQ_VECTOR_ADDRESS = 0x00000040;
+
+/**
+ * The exception number of the first interrupt (IRQ 0)
+ */
+const uint32_t IRQ_EXCEPTION_NUMBER = 16;
+
+/**
+ * The number of interrupts the cpu supports
+ */
+const uint32_t IRQ_COUNT = 32;
+
+/**
+ * The values of the link register in an exception handler, branching to them returns from the exception
+ * to the handler mode or to the thread mode
+ */
+const uint32_t EXC_RETURN_HANDLER = 0xFFFFFFF1;
+const uint32_t EXC_RETURN_THREAD = 0xFFFFFFF9;
+
+/**
+ * The return address of a function called from the host, it is right below the EXC_RETURN values so that
+ * the branches only need one compare to recognize both
+ */
+const uint32_t CALL_RETURN_ADDRESS = 0xFFFFFFEE;
+
+/**
+ * The state of the cpu without the memory, used to go back to the same state before every call from the host
+ */
+struct cpu_state {
+
+    /**
+     * The registers R0-R15
+     */
+    arm_register_t registers[16];
+
+    /**
+     * The program status register
+     */
+    psr psr_register;
+
+    /**
+     * THREAD_MODE or HANDLER_MODE
+     */
+    mode current_mode;
+
+    /**
+     * The pending interrupts and PRIMASK
+     */
+    uint32_t pending_interrupts;
+    bool primask;
+
+    /**
+     * The number of cycles the cpu has run
+     */
+    uint64_t cycles;
+
+    /**
+     * The number of instructions the cpu has retired
+     */
+    uint64_t instructions;
+};
+
+/**
+ * Why debug_run stopped
+ */
+enum stop_reason {
+
+    /**
+     * It ran all the instructions it was asked to
+     */
+    STOP_BUDGET,
+
+    /**
+     * The next instruction has a breakpoint
+     */
+    STOP_BREAKPOINT,
+
+    /**
+     * The last instruction accessed a watched value
+     */
+    STOP_WATCHPOINT,
+
+    /**
+     * The cpu was halted by a BKPT or the firmware exited
+     */
+    STOP_HALTED
+};
+
+/**
+ * The accesses a watchpoint stops at
+ */
+enum watch_kind {
+    WATCH_WRITE = 1,
+    WATCH_READ = 2,
+    WATCH_ACCESS = WATCH_WRITE | WATCH_READ
+};
+
+/**
+ * An access that hit a watchpoint
+ */
+struct watch_hit {
 
     /**
-     * Exception number
+     * The address of the watchpoint and its kind
      */
-    uint8_t exception_number;
+    uint32_t address;
+    watch_kind kind;
 
     /**
-     * Thumb state bit
+     * The address of the instruction that made the access, or the one that was executing if the cpu did not make it
      */
-    bool t;
+    uint32_t pc;
 
     /**
-     * Overflow flag
+     * Who made the access, the dma, a library hook or a semihosting call are not the instruction at the pc
      */
-    bool v;
+    access_origin origin;
 
     /**
-     * Carry or borrow flag
+     * The accessed address, the size of the access in bytes and if it was a write
      */
-    bool c;
+    uint32_t access_address;
+    uint32_t size;
+    bool write;
 
     /**
-     * Zero flag
+     * The value before and after the access, they are the same for a read
      */
-    bool z;
+    uint32_t old_value;
+    uint32_t new_value;
+};
+
+/**
+ * The instruction that moved the stack pointer below the stack limit
+ */
+struct stack_overflow {
 
     /**
-     * Negative flag
+     * The address of the instruction, the interrupted one for an exception entry
      */
-    bool n;
+    uint32_t pc;
+
+    /**
+     * The stack pointer after it and the limit it crossed
+     */
+    uint32_t sp;
+    uint32_t limit;
+
+    /**
+     * The mode the cpu was in and the cycle it happened at
+     */
+    mode in_mode;
+    uint64_t cycle;
+};
+
+class cpu;
+
+/**
+ * A function that runs on the host instead of the firmware function it replaces, it takes the arguments from R0-R3
+ * and puts the result into R0. The cpu returns to LR after it.
+ */
+typedef std::function<void(cpu *instance)> hle_hook;
+
+/**
+ * How the cpu runs. The fast mode uses the translated blocks and does not trace, the detailed mode interprets and
+ * traces every instruction. The rest of the instrumentation (the observers, the timing of the peripherals) is
+ * switched by the mode listener.
+ */
+enum run_mode {
+    RUN_FAST,
+    RUN_DETAILED
 };
 
 /**
- * The register type
+ * Called when the cpu switches its run mode, it turns the instrumentation of the mode on or off
+ */
+typedef std::function<void(cpu *instance, run_mode mode)> mode_listener;
+
+/**
+ * Called in the detailed mode with every instruction before it is executed, the PC is already past it
  */
-union arm_register_t {
-
-  /**
-   * Used to get the bytes (assuming little endian)
-   */
-  struct
-  {
-    uint8_t B0;
-    uint8_t B1;
-    uint8_t B2;
-    uint8_t B3;
-
-  } to_bytes;
-
-  /**
-   * Used to get the 16 words (assuming little endian)
-   */
-  struct
-  {
-    uint16_t W0;
-    uint16_t W1;
-
-  } to_half_words;
-
-  /**
-   * Used to get the unsigned 32-bit word
-   */
-  uint32_t to_uint;
+typedef std::function<void(cpu *instance, uint16_t instr)> instruction_tracer;
+
+/**
+ * Gets told where the control flow of the cpu goes, by the taken branches, the exception entries and the exception
+ * returns. The instructions in between run straight through.
+ */
+class branch_observer {
+
+public:
+
+    virtual ~branch_observer() = default;
+
+    /**
+     * Called when the cpu continues at a new address
+     * @param target the address of the next instruction
+     * @param instruction the number of instructions retired when the instruction before it has finished
+     */
+    virtual void on_branch(uint32_t target, uint64_t instruction) = 0;
 };
 
-class cpu {
+class cpu : private memory_observer {
 
 private:
 
@@ -98,7 +246,7 @@ private:
     const uint8_t OFFSET_5_MASK = 0b0000000000011111;
     const uint8_t OFFSET_8_MASK = 0b0000000011111111;
     const uint8_t OPERATION_2_MASK = 0b0000000000000011;
-    const uint8_t OPERATION_4_MASK = 0b0000000000000111;
+    const uint8_t OPERATION_4_MASK = 0b0000000000001111;
     const uint8_t FLAG_MASK = 0b0000000000000001;
     const uint8_t FLAG_MASK_2 = 0b0000000000000011;
     const uint8_t FLAG_MASK_4 = 0b0000000000001111;
@@ -152,9 +300,19 @@ private:
     arm_register_t registers[16];
 
     /**
-     * The pre-fetched instructions
+     * Points to the host memory of the next instruction we are going to fetch
+     */
+    const uint16_t *fetch_ptr;
+
+    /**
+     * Points after the last instruction of the region we are fetching from
+     */
+    const uint16_t *fetch_end;
+
+    /**
+     * Used to fetch an instruction that is not in the code or sram region
      */
-    uint16_t cpu_prefetch[2];
+    uint16_t fetch_buffer;
 
     /**
      * Flag to indicate if the processor currently is in hold mode.
@@ -162,7 +320,7 @@ private:
     bool holdState;
 
     /**
-     * The next instruction we need to prefetch
+     * The address of the instruction we continue at after a branch
      */
     uint32_t next_pc;
 
@@ -171,6 +329,37 @@ private:
      */
     psr psr_register;
 
+    /**
+     * The number of cycles the cpu has run, an instruction takes one cycle unless a timing model says otherwise and
+     * a sleeping cpu skips the cycles until it can wake up
+     */
+    uint64_t cycles;
+
+    /**
+     * The number of instructions the cpu has retired, a WFE or WFI that sleeps retires when it wakes up
+     */
+    uint64_t instructions;
+
+    /**
+     * The cycle at which we have to look at the scheduled events and the pending interrupts
+     */
+    uint64_t next_event;
+
+    /**
+     * The events scheduled by the peripherals
+     */
+    scheduler events;
+
+    /**
+     * The pending interrupts, bit N is IRQ N
+     */
+    uint32_t pending_interrupts;
+
+    /**
+     * PRIMASK, when it is set the interrupts stay pending (set by CPSID I, cleared by CPSIE I)
+     */
+    bool primask;
+
     /**
      * Inactive stack pointer - used to swap between the PSP and MSP this values is used for the stack pointer that is
      * currently inactive
@@ -182,6 +371,320 @@ private:
      */
     mmu *mmu_ptr;
 
+    /**
+     * The stack pointer the functions called from the host start with, 0 means the initial stack pointer
+     * from the vector table
+     */
+    uint32_t call_stack;
+
+    /**
+     * Executes the semihosting calls (BKPT 0xAB)
+     */
+    semihosting *host;
+
+    /**
+     * The log we record the inputs to or replay them from, nullptr if there is none
+     */
+    input_log *inputs;
+
+    /**
+     * Counts the closed input logs, the interrupts scheduled from a log that was closed are dropped
+     */
+    uint64_t replayed_log;
+
+    /**
+     * Set while the due events are running
+     */
+    bool servicing;
+
+    /**
+     * The event register WFE waits for, SEV sets it on this or another cpu so it can be set from another thread
+     */
+    std::atomic<bool> event_register;
+
+    /**
+     * True while the cpu sleeps in WFE or WFI, the instruction is executed again until something wakes it up
+     */
+    bool sleeping;
+
+    /**
+     * The cycle a sleeping cpu skips to at most when nothing is scheduled before it, run_until sets it to the
+     * cycle it runs to
+     */
+    uint64_t sleep_limit;
+
+    /**
+     * What SEV does, nullptr if it only sets the event register of this cpu
+     */
+    std::function<void()> event_sender;
+
+    /**
+     * Schedules the next interrupt from the replayed log
+     */
+    void replay_next_interrupt();
+
+    /**
+     * The functions that run on the host by the address of the firmware function they replace
+     */
+    std::unordered_map<uint32_t, hle_hook> hooks;
+
+    /**
+     * The addresses with a hook, the bitmaps only cover the code and the sram up to the last hook
+     */
+    address_bitmap hook_bitmap;
+
+    /**
+     * Checks if the function at the address has a hook
+     * @param address - the address of the function
+     * @return true if it does
+     */
+    inline bool has_hook(uint32_t address) const { return hook_bitmap.contains(address); }
+
+    /**
+     * Runs the hook of the function at next_pc and returns to LR
+     */
+    void run_hook();
+
+    /**
+     * The run mode, and what it means for the run loops : use the translated blocks if there are any and call the
+     * tracer if there is one
+     */
+    run_mode active_mode;
+    bool translate;
+    bool tracing;
+
+    /**
+     * Set while a run loop is running, and when the tracing was switched on or off while it was, the loop is then
+     * stopped with holdState so that the loop of the new mode takes over
+     */
+    bool looping;
+    bool redispatch;
+
+    /**
+     * The tracer of the detailed mode and the listener of the mode switches, empty if there are none
+     */
+    instruction_tracer tracer;
+    mode_listener listener;
+
+    /**
+     * The retired instruction count the mode switches at and the mode, UINT64_MAX if there is no switch
+     */
+    uint64_t switch_instruction;
+    run_mode switch_instruction_mode;
+
+    /**
+     * Switches to the mode of the retired instruction count once it is reached
+     */
+    void switch_mode_reached();
+
+    /**
+     * The modes we switch to when the cpu branches to an address
+     */
+    std::unordered_map<uint32_t, run_mode> mode_switches;
+
+    /**
+     * The addresses a branch to switches the mode, like the hook bitmap
+     */
+    address_bitmap switch_bitmap;
+
+    /**
+     * Checks if a branch to the address switches the mode
+     * @param address - the address
+     * @return true if it does
+     */
+    inline bool has_mode_switch(uint32_t address) const { return switch_bitmap.contains(address); }
+
+    /**
+     * Runs the instructions with the loop of the current mode until the cpu halts or the limit is reached. A loop is
+     * only left when the tracing is switched, so the fast loop does not look at the tracer with every instruction
+     * @param bounds - how long we can run
+     */
+    template <typename limit>
+    void run_loops(limit &&bounds);
+
+    /**
+     * Fetches and executes the instructions until the cpu halts, the limit is reached or the tracing is switched,
+     * the traced loop gives every instruction to the tracer first and the other one runs the translated blocks
+     * @param bounds - how long we can run
+     */
+    template <bool traced, typename limit>
+    void run_loop(limit &bounds);
+
+    /**
+     * Halts the cpu, a pending switch of the run loop would not halt it
+     */
+    inline void halt() {
+        holdState = true;
+        redispatch = false;
+    }
+
+    /**
+     * Figures out translate and tracing from the mode
+     */
+    inline void update_dispatch() {
+        bool traced = tracing;
+        translate = active_mode == RUN_FAST && !translated_blocks.empty();
+        tracing = active_mode == RUN_DETAILED && tracer;
+
+        // the running loop does not look at the tracer, stop it so that the loop of the new mode takes over
+        if (tracing != traced && looping && !holdState) {
+            holdState = true;
+            redispatch = true;
+        }
+    }
+
+    /**
+     * The observers of the branches, they are only looked up when the cpu branches
+     */
+    std::vector<branch_observer *> branch_observers;
+
+    /**
+     * The number of instructions the code that ends with the branch prefetch is handling still has to retire, 1 for
+     * an instruction and the length of a translated block
+     */
+    uint64_t branch_retiring;
+
+    /**
+     * The addresses with a breakpoint, the bitmaps only cover the code and the sram up to the last breakpoint. Only
+     * debug_run looks at it so the other runs do not pay for the breakpoints.
+     */
+    address_bitmap breakpoint_bitmap;
+
+    /**
+     * Checks if the instruction at the address has a breakpoint
+     * @param address - the address of the instruction
+     * @return true if it does
+     */
+    inline bool has_breakpoint(uint32_t address) const { return breakpoint_bitmap.contains(address); }
+
+    /**
+     * A watched range of the memory
+     */
+    struct watchpoint {
+        uint32_t address;
+        uint32_t length;
+        watch_kind kind;
+    };
+
+    /**
+     * The watchpoints, their pages are slow in the mmu so only the accesses to them are checked
+     */
+    std::vector<watchpoint> watchpoints;
+
+    /**
+     * The first access that hit a watchpoint since debug_run started
+     */
+    watch_hit last_hit;
+
+    /**
+     * True if an access hit a watchpoint since debug_run started
+     */
+    bool watch_triggered;
+
+    /**
+     * Checks the accesses to the slow pages against the watchpoints
+     */
+    void on_read(uint32_t address, uint32_t size, uint32_t value) override;
+    void on_write(uint32_t address, uint32_t size, uint32_t old_value, uint32_t new_value) override;
+
+    /**
+     * Records the access if it hits a watchpoint
+     * @param address - the accessed address
+     * @param size - the size of the access in bytes
+     * @param write - true if it is a write
+     * @param old_value - the value before the access
+     * @param new_value - the value after the access
+     */
+    void watch_access(uint32_t address, uint32_t size, bool write, uint32_t old_value, uint32_t new_value);
+
+    /**
+     * The lowest stack pointer of the thread mode and of the handler mode, UINT32_MAX if it was not written
+     */
+    uint32_t stack_low[2];
+
+    /**
+     * The cpu halts when the stack pointer goes below it, 0 if there is no limit
+     */
+    uint32_t stack_limit;
+
+    /**
+     * The instruction that crossed the stack limit and whether one did
+     */
+    stack_overflow overflow;
+    bool overflowed;
+
+    /**
+     * Called after an instruction or an exception entry wrote the stack pointer, only those pay for the watermark
+     * @param pc - the address of the instruction
+     */
+    inline void stack_written(uint32_t pc) {
+        uint32_t sp = registers[13].to_uint;
+        if (sp < stack_low[current_mode]) {
+            stack_low[current_mode] = sp;
+        }
+        if (sp < stack_limit) {
+            stack_overflowed(pc);
+        }
+    }
+
+    /**
+     * The stack callback of the translated code, the blocks call it at the instructions that can lower the stack
+     * pointer, a crossed limit halts the cpu after the block
+     * @param instance - the cpu
+     * @param pc - the address of the instruction
+     */
+    static void translated_stack_written(void *instance, uint32_t pc);
+
+    /**
+     * Records the instruction that crossed the stack limit and halts the cpu
+     * @param pc - the address of the instruction
+     */
+    void stack_overflowed(uint32_t pc);
+
+    /**
+     * The translated blocks indexed by the half-word they start at, empty if no translation is loaded
+     */
+    std::vector<const aot_block*> translated_blocks;
+
+    /**
+     * The state the translated blocks operate on
+     */
+    aot_context translation_context;
+
+    /**
+     * The handle of the loaded translation library
+     */
+    void *translation_handle;
+
+    /**
+     * The flat memory the regions are mapped into, nullptr if we are not using one
+     */
+    flat_memory *flat;
+
+    /**
+     * Goes on after an access to the flat memory faulted, the instruction that accessed a peripheral is executed
+     * again through the peripherals
+     * @param address - the guest address of the access
+     * @return true if the instruction is executed again, false if the access is a HardFault
+     */
+    bool restart_in_peripherals(uint32_t address);
+
+    /**
+     * Runs the body, if we are using a flat memory an access of an instruction to a peripheral faults and the
+     * body starts over from that instruction, and an access to an unmapped address in it is turned into a
+     * HardFault (a runtime_error). The frames of the body are not unwound, see flat_memory::guard
+     * @param body - the function we want to run
+     */
+    template <typename F>
+    inline void guarded(F &&body) {
+        if (flat == nullptr) {
+            body();
+            return;
+        }
+        mmu_ptr->set_flat_access(true);
+        flat->guard(body, [this](uint32_t address) { return restart_in_peripherals(address); });
+    }
+
     /**
      * Initializes the cpu bits set - this is used to figure out how many registers are selected
      */
@@ -203,14 +706,87 @@ private:
     void execute_op(uint16_t instruction);
 
     /**
-     * Prefetch does a prefetch based on the programming counter
+     * Prefetch redirects the instruction fetch to next_pc, it is called after every branch.
+     * A branch to an EXC_RETURN value returns from the exception instead, and a branch to
+     * CALL_RETURN_ADDRESS stops the cpu.
      */
     void prefetch();
 
     /**
-     * Prefetches the next instruction
+     * Advances the cycle count, if an event is due or an interrupt can be taken it is handled
+     * @param n - the number of cycles
+     */
+    inline void tick(uint64_t n) {
+        cycles += n;
+        if (cycles >= next_event) {
+            service_events();
+        }
+    }
+
+    /**
+     * Counts an executed instruction and advances the cycle count by the cycles it took
+     * @param n - the number of cycles
+     */
+    inline void retire(uint64_t n) {
+        ++instructions;
+        tick(n);
+    }
+
+    /**
+     * Runs the due events and takes the pending interrupt with the lowest number if the interrupts are enabled
+     */
+    void service_events();
+
+    /**
+     * Figures out when we next have to call service_events
+     */
+    void update_next_event();
+
+    /**
+     * Stacks the state of the cpu and jumps to the exception handler from the vector table, only taken in thread mode
+     * @param exception_number - the number of the exception
+     */
+    void enter_exception(uint32_t exception_number);
+
+    /**
+     * Restores the state stacked by enter_exception and continues where the exception was taken
+     * @param exc_return - the EXC_RETURN value we branched to
+     */
+    void exception_return(uint32_t exc_return);
+
+    /**
+     * Packs the program status register into the xPSR word
+     * @return the xPSR
+     */
+    uint32_t pack_psr() const;
+
+    /**
+     * Unpacks the xPSR word into the program status register
+     * @param xpsr - the xPSR
      */
-    void prefetch_next();
+    void unpack_psr(uint32_t xpsr);
+
+    /**
+     * Points the instruction fetch to the host memory of the region containing the address, the sequential
+     * instructions after it are then fetched without going through the mmu until we leave the region
+     * @param address - the address of the next instruction
+     */
+    void redirect_fetch(uint32_t address);
+
+    /**
+     * Fetches the instruction at PC - 2 and advances the PC
+     * @return the instruction
+     */
+    inline uint16_t fetch() {
+
+        // we crossed the end of the region
+        if (fetch_ptr >= fetch_end) {
+            redirect_fetch(registers[15].to_uint - 2);
+        }
+
+        registers[15].to_uint += 2;
+        return *fetch_ptr++;
+    }
 
     /**
      * Decodes the 16 bit instruction of the format
@@ -442,10 +1018,11 @@ private:
     /**
      * Data Synchronization Barrier or Data Memory Barrier - this thing is a 32 bit instruction
      * | 1 1 1 1 0 0 1 1 1 0 1 1 1 1 1 1 1 0 0 0 1 1 1 1 0 1 0 F 1 1 1 1 |
-     * TODO 32 bit instruction
      * F is 1 it means Data Memory Barrier (DMB)
      * F is 0 it means Data Synchronization Barrier (DSB)
-     * @param instr - the instruction
+     * Both are a full fence on the host, so the accesses of the cpus that share the sram are ordered. The ISB
+     * encoding is passed on to instruction_sync_barier.
+     * @param instr - the instruction, the first half-word is in the upper 16 bits
      */
     void data_mem_sync_barier(uint32_t instr);
     
@@ -487,17 +1064,18 @@ private:
     
     /**
      * | 1 0 1 1 1 1 1 1 0 0 1 F 0 0 0 0 |
-     * TODO not implemented
      * F - is 0 means Wait For Event
      * F - is 1 means Wait For Interrupt
+     * WFE continues if the event register is set and clears it, WFI continues if an interrupt is pending. Otherwise
+     * the cpu sleeps, the cycles until the next event (or sleep_limit) are skipped and the instruction is executed
+     * again. An interrupt that is taken while sleeping returns after the instruction.
      * 
      * @param instr - the instruction
      */
     void wait_for_interupt_event(uint16_t instr);
     
     /**
-     * Send Event instruction
-     * TODO not implemented
+     * Send Event instruction, sets the event register of every cpu that shares the event (see set_event_sender)
      * | 1 0 1 1 1 1 1 1 0 1 0 0 0 0 0 0 |
      * 
      * @param instr - the instruction
@@ -510,26 +1088,39 @@ private:
     void sign_zero_extend_byte_halfword(uint32_t instr);
 
     /**
-     * Pushes the register
-     * @param instr - the instruction
-     * @param address the address
-     * @param val - the mask of the register
-     * @param reg - the register we want to to push
+     * Copies the values of the registers selected in the register list (R0-R7) into an array in ascending order
+     * @param rlist - the register list, bit 0 selects R0 and bit 7 selects R7
+     * @param values - the array we are copying to
+     * @return the number of copied registers
      */
-    void push_reg(uint16_t instr, uint32_t &address, int val, int reg);
+    inline int gather_registers(uint32_t rlist, uint32_t *values) {
+        int count = 0;
+        for (; rlist != 0; rlist &= rlist - 1) {
+            values[count++] = registers[__builtin_ctz(rlist)].to_uint;
+        }
+        return count;
+    }
 
     /**
-     * Pop the register
-     * @param instr - the instruction
-     * @param address - the address
-     * @param val - the mask of the register
-     * @param reg - the register we want to push
+     * Copies the values from an array into the registers selected in the register list (R0-R7) in ascending order
+     * @param rlist - the register list, bit 0 selects R0 and bit 7 selects R7
+     * @param values - the array we are copying from
+     * @return the number of copied registers
      */
-    void pop_reg(uint16_t instr, uint32_t &address, int val, int reg);
-
-    void thumb_stm_reg(uint32_t instr, uint32_t &address, int val, int r);
+    inline int scatter_registers(uint32_t rlist, const uint32_t *values) {
+        int count = 0;
+        for (; rlist != 0; rlist &= rlist - 1) {
+            registers[__builtin_ctz(rlist)].to_uint = values[count++];
+        }
+        return count;
+    }
 
-    void thumb_ldm_reg(uint32_t opcode, uint32_t &address, int val, int r);
+    /**
+     * Runs the translated block that starts at the current instruction if there is one and it fits the budget
+     * @param n_instr - the number of instructions we are still allowed to run, decreased by the block length
+     * @return true if a block was executed
+     */
+    bool run_translated(size_t &n_instr);
 
 public:
 
@@ -541,14 +1132,30 @@ public:
     cpu(uint32_t flash_size, uint32_t sram_size);
 
     /**
-     * Creates an instance of the cpu
+     * Creates an instance of the cpu, the sizes of the memories are not known so the instructions are fetched
+     * through the mmu and the flat memory can not be used
      * @param the flash memory we want to use
      * @param the sram memory we want to use
      */
     cpu(uint8_t *flash, uint8_t *sram);
 
     /**
-     * Initializes the cpu to the state it is supposed to boot up
+     * Creates an instance of the cpu
+     * @param flash the flash memory we want to use
+     * @param flash_size the size of the flash memory in bytes
+     * @param sram the sram memory we want to use
+     * @param sram_size the size of the sram memory in bytes
+     */
+    cpu(uint8_t *flash, uint32_t flash_size, uint8_t *sram, uint32_t sram_size);
+
+    /**
+     * Unloads the translation if there is one
+     */
+    ~cpu();
+
+    /**
+     * Initializes the cpu to the state it is supposed to boot up, the scheduled events are dropped and the
+     * peripherals are reset
      */
     void reset();
 
@@ -562,12 +1169,363 @@ public:
      */
     void run(size_t n_instr);
 
+    /**
+     * Run the processor until its cycle count reaches a cycle, a cpu that sleeps in WFE or WFI skips to the
+     * cycle at most
+     * @param cycle - the cycle
+     */
+    void run_until(uint64_t cycle);
+
+    /**
+     * Run the processor for N instructions with a timing model, the model is told about every executed instruction
+     * and returns the cycles it took (see pipeline_timing in timing.h). The translated blocks are not used. The
+     * other run loops do not have a model so they do not pay for it.
+     * @param n_instr - the number of instructions
+     * @param model - the timing model
+     */
+    template <typename timing>
+    void run_timed(size_t n_instr, timing &model);
+
+    /**
+     * Sets the event register, a cpu sleeping in WFE wakes up. It can be called from another thread.
+     */
+    inline void set_event() { event_register.store(true, std::memory_order_release); }
+
+    /**
+     * Replaces what SEV does, by default it only sets the event register of this cpu
+     * @param sender - the function that sets the event registers of the cpus
+     */
+    inline void set_event_sender(std::function<void()> sender) { event_sender = std::move(sender); }
+
+    /**
+     * Returns true if the cpu sleeps in WFE or WFI
+     * @return true if it does
+     */
+    inline bool is_sleeping() const { return sleeping; }
+
+    /**
+     * Run the processor for N instructions stopping at the breakpoints and the watchpoints, a breakpoint at the
+     * first instruction is ignored so that we can continue from it. The translated blocks are not used.
+     * @param n_instr - the number of instructions
+     * @return why it stopped
+     */
+    stop_reason debug_run(size_t n_instr);
+
+    /**
+     * Executes one instruction
+     * @return why it stopped
+     */
+    inline stop_reason step() { return debug_run(1); }
+
+    /**
+     * Sets a breakpoint, debug_run stops before the instruction at the address is executed
+     * @param address - the address of the instruction
+     */
+    void add_breakpoint(uint32_t address);
+
+    /**
+     * Removes the breakpoint at the address
+     * @param address - the address of the instruction
+     */
+    void remove_breakpoint(uint32_t address);
+
+    /**
+     * Watches a range of the memory, debug_run stops after the instruction that accesses it. The pages of the range
+     * are made slow in the mmu so the accesses to the other pages cost the same as without the watchpoint.
+     * @param address - the address of the range, it has to be in the code or the sram
+     * @param length - the length of the range in bytes
+     * @param kind - the accesses to stop at
+     */
+    void add_watchpoint(uint32_t address, uint32_t length, watch_kind kind = WATCH_WRITE);
+
+    /**
+     * Removes a watchpoint
+     * @param address - the address of the range
+     * @param length - the length of the range in bytes
+     * @param kind - the accesses it stops at
+     */
+    void remove_watchpoint(uint32_t address, uint32_t length, watch_kind kind = WATCH_WRITE);
+
+    /**
+     * Returns the access that stopped debug_run at a watchpoint
+     * @return the access
+     */
+    inline const watch_hit &get_watch_hit() const { return last_hit; }
+
+    /**
+     * Halts the cpu when an instruction or an exception entry moves the stack pointer below the limit. It is checked
+     * at every instruction that lowers the stack pointer, so a stack that is already below it halts at the next one.
+     * @param limit - the lowest address the stack can use, 0 removes the limit
+     */
+    inline void set_stack_limit(uint32_t limit) { stack_limit = limit; }
+
+    /**
+     * Returns the lowest value the stack pointer had in a mode since the reset. It is tracked only at the
+     * instructions that write the stack pointer (PUSH, SUB SP, ADD and MOV to SP) and at the exception entries, in
+     * the translated blocks too.
+     * @param in_mode - the mode
+     * @return the stack pointer or UINT32_MAX if it was not written in the mode
+     */
+    inline uint32_t get_stack_low(mode in_mode) const { return stack_low[in_mode]; }
+
+    /**
+     * Returns true if the cpu halted because the stack pointer went below the stack limit
+     * @return true if it did
+     */
+    inline bool is_stack_overflowed() const { return overflowed; }
+
+    /**
+     * Returns the instruction that moved the stack pointer below the stack limit
+     * @return the overflow
+     */
+    inline const stack_overflow &get_stack_overflow() const { return overflow; }
+
+    /**
+     * Returns the address of the next instruction
+     * @return the address
+     */
+    inline uint32_t get_pc() const { return registers[15].to_uint - 2; }
+
+    /**
+     * Makes the cpu continue at an address
+     * @param address - the address of the next instruction
+     */
+    void set_pc(uint32_t address);
+
+    /**
+     * Returns the program status register packed into the xPSR word
+     * @return the xPSR
+     */
+    inline uint32_t get_xpsr() const { return pack_psr(); }
+
+    /**
+     * Sets the program status register from the xPSR word
+     * @param xpsr - the xPSR
+     */
+    inline void set_xpsr(uint32_t xpsr) { unpack_psr(xpsr); }
+
     /**
      * Run the processor for N instructions in verbose mode
      * The verbose mode prints out the starting PC and the instructions that are being run
      */
     void verbose_run(size_t n_instr);
 
+    /**
+     * Calls a firmware function and runs it until it returns. The first four arguments go to R0-R3 and the rest
+     * are pushed on the stack, the link register is set to CALL_RETURN_ADDRESS so the return stops the cpu.
+     * The registers are left as the function left them, use save_state and restore_state to undo the call.
+     * @param address - the address of the function
+     * @param args - the arguments of the function
+     * @param budget - the maximum number of instructions the function is allowed to run
+     * @return the result of the function (R0)
+     */
+    uint32_t call(uint32_t address, std::initializer_list<uint32_t> args, size_t budget = SIZE_MAX);
+
+    /**
+     * Sets the stack pointer the functions called from the host start with
+     * @param stack - the stack pointer, 0 to use the initial stack pointer from the vector table
+     */
+    inline void set_call_stack(uint32_t stack) { call_stack = stack; }
+
+    /**
+     * Returns the state of the cpu, the memory is not included
+     * @return the state
+     */
+    cpu_state save_state() const;
+
+    /**
+     * Puts the cpu back into a saved state
+     * @param state - the state
+     */
+    void restore_state(const cpu_state &state);
+
+    /**
+     * Reserves the 4 GB guest address space in the host and maps the code and sram regions into it, the content of
+     * the regions is copied over. The loads and the stores then add the address to the base of the host memory
+     * without looking at it, everything else is inaccessible and faults. The instruction that faulted on a
+     * peripheral is executed again through the peripherals (the detailed mode traces it twice), and an access to
+     * an unmapped address stops the run with a HardFault (a runtime_error) instead of being ignored. The cpu has to
+     * be created with the sizes of its regions.
+     */
+    void enable_flat_memory();
+
+    /**
+     * Returns the number of accesses to the peripherals that faulted in the flat memory and were executed again
+     * @return the number of accesses, 0 without a flat memory
+     */
+    inline uint64_t get_peripheral_faults() const { return flat == nullptr ? 0 : flat->get_recovered(); }
+
+    /**
+     * Loads a library created by the ahead of time translator (aot_m0), the blocks it contains are executed
+     * instead of being interpreted. The library has to be translated from the code region the cpu is running.
+     * @param library - the path to the shared object
+     */
+    void load_translation(const std::string &library);
+
+    /**
+     * Schedules an event, used by the peripherals to model the time their operations take
+     * @param delay - the number of cycles from now the event is due at
+     * @param action - what the event does
+     */
+    void schedule(uint64_t delay, std::function<void()> action);
+
+    /**
+     * Makes an interrupt pending, it is taken once the interrupts are enabled and the cpu is in thread mode.
+     * While replaying an input log the interrupts come from the log and the calls are ignored.
+     * @param irq - the number of the interrupt
+     */
+    void set_pending_interrupt(uint32_t irq);
+
+    /**
+     * Starts recording the inputs from outside of the emulated system into a log, these are the interrupts, the
+     * reads of the input peripherals and the semihosting calls that depend on the host. Call it after reset.
+     * @param file - the path of the log
+     */
+    void record_inputs(const std::string &file);
+
+    /**
+     * Starts replaying the inputs from a log recorded by record_inputs, so that the run is the same as the
+     * recorded one. Call it after reset.
+     * @param file - the path of the log
+     */
+    void replay_inputs(const std::string &file);
+
+    /**
+     * Stops recording or replaying the inputs, the recorded log is written out
+     */
+    void close_inputs();
+
+    /**
+     * Returns the input log, the input peripherals pass the values they read through it
+     * @return the input log, nullptr if we are not recording or replaying
+     */
+    inline input_log *get_input_log() const { return inputs; }
+
+    /**
+     * Returns the pending interrupts
+     * @return bit N is set if IRQ N is pending
+     */
+    inline uint32_t get_pending_interrupts() const { return pending_interrupts; }
+
+    /**
+     * Returns the number of cycles the cpu has run
+     * @return the cycles
+     */
+    inline uint64_t get_cycles() const { return cycles; }
+
+    /**
+     * Returns the number of instructions the cpu has retired, unlike the cycles it is the position in the program
+     * no matter how long the instructions took or how long the cpu slept
+     * @return the instructions
+     */
+    inline uint64_t get_instructions() const { return instructions; }
+
+    /**
+     * Returns the current mode of the cpu
+     * @return THREAD_MODE or HANDLER_MODE
+     */
+    inline mode get_mode() const { return current_mode; }
+
+    /**
+     * Returns true if the cpu is holding, after a BKPT, the end of a called function or the exit of the firmware
+     * @return true if it is
+     */
+    inline bool is_halted() const { return holdState; }
+
+    /**
+     * Returns true if a branch to the address runs a hook
+     * @param address - the address
+     * @return true if it does
+     */
+    inline bool is_hooked(uint32_t address) const { return has_hook(address & 0xFFFFFFFE); }
+
+    /**
+     * Replaces the firmware function at the address with a function that runs on the host. The hook is
+     * only looked up when the cpu branches, so the code without hooks does not pay for them.
+     * @param address - the address of the firmware function
+     * @param hook - the function that replaces it
+     */
+    void add_hook(uint32_t address, hle_hook hook);
+
+    /**
+     * Removes the hook of the firmware function at the address
+     * @param address - the address of the firmware function
+     */
+    void remove_hook(uint32_t address);
+
+    /**
+     * Adds an observer that gets told about every branch, the cpu does not own it
+     * @param observer - the observer
+     */
+    void add_branch_observer(branch_observer *observer);
+
+    /**
+     * Removes an observer of the branches
+     * @param observer - the observer
+     */
+    void remove_branch_observer(branch_observer *observer);
+
+    /**
+     * Switches the run mode, it takes effect at the next instruction and the mode listener is called
+     * @param new_mode - the mode
+     */
+    void set_run_mode(run_mode new_mode);
+
+    /**
+     * Returns the run mode
+     * @return the mode
+     */
+    inline run_mode get_run_mode() const { return active_mode; }
+
+    /**
+     * Sets the function that is called when the run mode switches
+     * @param new_listener - the listener, an empty one removes it
+     */
+    inline void set_mode_listener(mode_listener new_listener) { listener = std::move(new_listener); }
+
+    /**
+     * Sets the function that is called with every instruction in the detailed mode
+     * @param new_tracer - the tracer, an empty one removes it
+     */
+    inline void set_tracer(instruction_tracer new_tracer) { tracer = std::move(new_tracer); update_dispatch(); }
+
+    /**
+     * Switches the run mode when the cycle count reaches a cycle, it is a scheduled event so the instructions
+     * before it do not pay for it
+     * @param cycle - the cycle
+     * @param new_mode - the mode
+     */
+    void switch_mode_at_cycle(uint64_t cycle, run_mode new_mode);
+
+    /**
+     * Switches the run mode when the cpu has retired a number of instructions, unlike the cycle it does not drift
+     * with the sleeping WFE and WFI or the timing model. The runs are split at the count, so the instructions
+     * before it do not pay for it. There is one such switch, a new one replaces it.
+     * @param instruction - the number of retired instructions
+     * @param new_mode - the mode
+     */
+    void switch_mode_at_instruction(uint64_t instruction, run_mode new_mode);
+
+    /**
+     * Switches the run mode when the cpu branches to an address, for example the function with the region of
+     * interest. It is only looked up when the cpu branches like the hooks, so the address has to be a branch target.
+     * @param address - the address
+     * @param new_mode - the mode
+     */
+    void switch_mode_at_pc(uint32_t address, run_mode new_mode);
+
+    /**
+     * Returns true if the firmware has stopped the cpu through the semihosting SYS_EXIT call
+     * @return true if it has
+     */
+    inline bool has_exited() const { return host->has_exited(); }
+
+    /**
+     * Returns the exit code the firmware passed to the semihosting SYS_EXIT call
+     * @return the exit code, 0 if it has not exited
+     */
+    inline int get_exit_code() const { return host->get_exit_code(); }
+
     /**
      * Returns the mmu connected to this cpu
      * @return the mmu
@@ -0,0 +1,110 @@
+//
+// Created by dimitrije on 10/6/26.
+//
+
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "flat_memory.h"
+#include "mmu.h"
+
+thread_local flat_memory::fault_scope *flat_memory::current_scope = nullptr;
+
+namespace {
+
+/**
+ * The handler of SIGSEGV that was installed before ours
+ */
+struct sigaction previous_action;
+
+/**
+ * Set while our handler is installed
+ */
+bool handler_installed = false;
+
+/**
+ * Rounds the size up to the whole pages
+ */
+size_t page_align(size_t size) {
+    auto page = (size_t) sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+}
+
+flat_memory::flat_memory(uint32_t code_size, uint32_t sram_size) : code_size(code_size), sram_size(sram_size),
+                                                                   recovered(0) {
+
+    // reserve the address space, nothing is accessible yet
+    void *memory = mmap(nullptr, FLAT_MEMORY_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error("could not reserve the address space for the flat memory");
+    }
+    base = (uint8_t *) memory;
+
+    // make the code and the sram region accessible
+    if (mprotect(base + CODE_BEGIN, page_align(code_size), PROT_READ | PROT_WRITE) != 0 ||
+        mprotect(base + SRAM_BEGIN, page_align(sram_size), PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, FLAT_MEMORY_SIZE);
+        throw std::runtime_error("could not map the code and the sram region into the flat memory");
+    }
+
+    install_fault_handler();
+}
+
+flat_memory::~flat_memory() {
+    munmap(base, FLAT_MEMORY_SIZE);
+}
+
+void flat_memory::fault_handler(int signal, siginfo_t *info, void *context) {
+
+    fault_scope *scope = current_scope;
+
+    // the fault is in the memory of the guard we are running in
+    if (scope != nullptr && scope->memory->contains(info->si_addr)) {
+        scope->address = (uint32_t) ((uint8_t *) info->si_addr - scope->memory->base);
+        siglongjmp(scope->buffer, 1);
+    }
+
+    // this is not ours, it goes to the handler that was installed before us and ours stays in place
+    if ((previous_action.sa_flags & SA_SIGINFO) != 0) {
+        previous_action.sa_sigaction(signal, info, context);
+        return;
+    }
+    if (previous_action.sa_handler != SIG_DFL && previous_action.sa_handler != SIG_IGN) {
+        previous_action.sa_handler(signal);
+        return;
+    }
+
+    // the default action kills the process when the instruction faults again, so we are not installed anymore
+    struct sigaction action = {};
+    action.sa_handler = SIG_DFL;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, nullptr);
+    handler_installed = false;
+}
+
+void flat_memory::install_fault_handler() {
+
+    if (handler_installed) {
+        return;
+    }
+
+    struct sigaction action = {};
+    action.sa_sigaction = fault_handler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGSEGV, &action, &previous_action) != 0) {
+        throw std::runtime_error("could not install the flat memory fault handler");
+    }
+
+    handler_installed = true;
+}
+
+void flat_memory::hard_fault(uint32_t address) {
+    std::ostringstream out;
+    out << "HardFault : invalid memory access at address 0x" << std::hex << address;
+    throw std::runtime_error(out.str());
+}
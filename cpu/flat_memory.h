@@ -0,0 +1,171 @@
+//
+// Created by dimitrije on 10/6/26.
+//
+
+#ifndef EMULATOR_M0_FLAT_MEMORY_H
+#define EMULATOR_M0_FLAT_MEMORY_H
+
+#include <cstdint>
+#include <csetjmp>
+#include <csignal>
+
+/**
+ * The size of the guest address space
+ */
+const uint64_t FLAT_MEMORY_SIZE = 1ull << 32;
+
+/**
+ * Reserves the whole 4 GB guest address space in the host address space. The code region is mapped at its guest
+ * offset, the sram region at 0x20000000 and everything else is left inaccessible, so a guest address is translated
+ * by adding it to the base. Only the pages that are touched take up physical memory.
+ *
+ * An access to an inaccessible page raises SIGSEGV, within guard() the fault is handed to the caller, which can go on
+ * through the peripherals, or is turned into a guest HardFault.
+ */
+class flat_memory {
+
+private:
+
+    /**
+     * The state of the guard we are currently running in
+     */
+    struct fault_scope {
+
+        /**
+         * Where we jump back to on a fault
+         */
+        sigjmp_buf buffer;
+
+        /**
+         * The memory the guard protects
+         */
+        const flat_memory *memory;
+
+        /**
+         * The guest address of the access that faulted
+         */
+        volatile uint32_t address;
+
+        /**
+         * The guard we were in before this one
+         */
+        fault_scope *previous;
+    };
+
+    /**
+     * The guard the current thread is running in, nullptr if none
+     */
+    static thread_local fault_scope *current_scope;
+
+    /**
+     * The handler of SIGSEGV, jumps back to the guard if the fault is in its memory
+     */
+    static void fault_handler(int signal, siginfo_t *info, void *context);
+
+    /**
+     * Installs the fault handler, it does nothing if the handler is installed
+     */
+    static void install_fault_handler();
+
+    /**
+     * Throws the runtime_error that describes the HardFault
+     * @param address the guest address of the access that faulted
+     */
+    [[noreturn]] static void hard_fault(uint32_t address);
+
+    /**
+     * The host address of the guest address 0
+     */
+    uint8_t *base;
+
+    /**
+     * The number of bytes accessible in the code region
+     */
+    uint32_t code_size;
+
+    /**
+     * The number of bytes accessible in the sram region
+     */
+    uint32_t sram_size;
+
+    /**
+     * The number of faults the caller went on from
+     */
+    uint64_t recovered;
+
+public:
+
+    /**
+     * Reserves the address space and makes the code and sram regions accessible, the regions are zeroed
+     * @param code_size the size of the code region in bytes
+     * @param sram_size the size of the sram region in bytes
+     */
+    flat_memory(uint32_t code_size, uint32_t sram_size);
+
+    /**
+     * Releases the address space
+     */
+    ~flat_memory();
+
+    /**
+     * Returns the host address of the guest address 0
+     * @return the base
+     */
+    inline uint8_t *get_base() const { return base; }
+
+    /**
+     * Checks if a host address is in the reserved address space
+     * @param host the host address
+     * @return true if it is
+     */
+    inline bool contains(const void *host) const {
+        return (const uint8_t *) host >= base && (uint64_t) ((const uint8_t *) host - base) < FLAT_MEMORY_SIZE;
+    }
+
+    /**
+     * Returns the number of faults the guards went on from
+     * @return the number of faults
+     */
+    inline uint64_t get_recovered() const { return recovered; }
+
+    /**
+     * Runs the body, if it accesses an inaccessible part of the memory the body is abandoned and the recovery is
+     * called with the guest address. If it returns true the body is run again from its start, it has to keep its
+     * progress outside of its frame, otherwise a runtime_error describing the HardFault is thrown.
+     *
+     * The body is left with siglongjmp, so the destructors of the frames between the access and the guard are not
+     * run. The code that can fault must not hold objects with non-trivial destructors (strings, vectors, locks)
+     * while it accesses the guest memory, the code that has to hold them uses mmu::read_bytes and
+     * mmu::write_bytes which never fault.
+     * @param body the function we want to run
+     * @param recover called with the guest address of the access that faulted
+     */
+    template <typename F, typename R>
+    void guard(F &&body, R &&recover) {
+
+        fault_scope scope;
+        scope.memory = this;
+        scope.address = 0;
+        scope.previous = current_scope;
+
+        // we come back here from the fault handler, the body starts over if the caller can go on
+        if (sigsetjmp(scope.buffer, 1) != 0) {
+            current_scope = scope.previous;
+            if (!recover((uint32_t) scope.address)) {
+                hard_fault(scope.address);
+            }
+            ++recovered;
+        }
+
+        current_scope = &scope;
+        try {
+            body();
+        } catch (...) {
+            current_scope = scope.previous;
+            throw;
+        }
+        current_scope = scope.previous;
+    }
+};
+
+#endif //EMULATOR_M0_FLAT_MEMORY_H
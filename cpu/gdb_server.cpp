@@ -0,0 +1,569 @@
+//
+// Created by dimitrije on 10/13/26.
+//
+
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "gdb_server.h"
+#include "cpu.h"
+
+namespace {
+
+/**
+ * The number of registers GDB knows about, R0-R15 and xPSR
+ */
+const uint32_t REGISTER_COUNT = 17;
+
+/**
+ * The signals we report the stops with
+ */
+const char *SIGNAL_TRAP = "S05";
+const char *SIGNAL_INTERRUPT = "S02";
+const char *SIGNAL_SEGMENTATION_FAULT = "S0b";
+
+/**
+ * The description of the registers we send to GDB
+ */
+const char TARGET_XML[] =
+        "<?xml version=\"1.0\"?>"
+        "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+        "<target version=\"1.0\">"
+        "<architecture>arm</architecture>"
+        "<feature name=\"org.gnu.gdb.arm.m-profile\">"
+        "<reg name=\"r0\" bitsize=\"32\"/><reg name=\"r1\" bitsize=\"32\"/><reg name=\"r2\" bitsize=\"32\"/>"
+        "<reg name=\"r3\" bitsize=\"32\"/><reg name=\"r4\" bitsize=\"32\"/><reg name=\"r5\" bitsize=\"32\"/>"
+        "<reg name=\"r6\" bitsize=\"32\"/><reg name=\"r7\" bitsize=\"32\"/><reg name=\"r8\" bitsize=\"32\"/>"
+        "<reg name=\"r9\" bitsize=\"32\"/><reg name=\"r10\" bitsize=\"32\"/><reg name=\"r11\" bitsize=\"32\"/>"
+        "<reg name=\"r12\" bitsize=\"32\"/><reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+        "<reg name=\"lr\" bitsize=\"32\"/><reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+        "<reg name=\"xpsr\" bitsize=\"32\"/>"
+        "</feature>"
+        "</target>";
+
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+/**
+ * Appends a byte as two hex digits
+ */
+void put_byte(std::string &out, uint8_t value) {
+    out.push_back(HEX_DIGITS[value >> 4]);
+    out.push_back(HEX_DIGITS[value & 0xF]);
+}
+
+/**
+ * Appends a register as 8 hex digits in the target byte order (little endian)
+ */
+void put_word(std::string &out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        put_byte(out, (uint8_t) (value >> (8 * i)));
+    }
+}
+
+/**
+ * Returns the value of a hex digit
+ */
+int digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    throw std::runtime_error(std::string("not a hex digit : ") + c);
+}
+
+/**
+ * Reads a byte from two hex digits
+ */
+uint8_t get_byte(const std::string &in, size_t position) {
+    if (position + 2 > in.size()) {
+        throw std::runtime_error("the packet is too short");
+    }
+    return (uint8_t) (digit(in[position]) << 4 | digit(in[position + 1]));
+}
+
+/**
+ * Reads a register from 8 hex digits in the target byte order
+ */
+uint32_t get_word(const std::string &in, size_t position) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= (uint32_t) get_byte(in, position + 2 * i) << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * Reads a big endian hex number until the first character that is not a hex digit
+ */
+uint32_t get_number(const std::string &in, size_t &position) {
+    uint32_t value = 0;
+    while (position < in.size() && isxdigit((unsigned char) in[position])) {
+        value = value << 4 | (uint32_t) digit(in[position++]);
+    }
+    return value;
+}
+
+/**
+ * Finds the host memory of a guest byte, the peripherals have none
+ * @return the host memory or nullptr
+ */
+uint8_t *host_byte(mmu *memory, uint32_t address) {
+    uint32_t region_begin, region_end;
+    uint8_t *region = memory->resolve_region(address, region_begin, region_end);
+    return region != nullptr && address < region_end ? region + (address - region_begin) : nullptr;
+}
+
+/**
+ * Checks if the debugger can access the guest byte, it can not access the unmapped addresses
+ */
+bool accessible(mmu *memory, uint32_t address, uint8_t *&host) {
+    host = host_byte(memory, address);
+    return host != nullptr || (address >= PERIPHERAL_BEGIN && address <= PERIPHERAL_END);
+}
+
+}
+
+gdb_server::gdb_server(cpu *instance) : instance(instance), listener(-1), connection(-1), last_stop(SIGNAL_TRAP) {}
+
+gdb_server::~gdb_server() {
+    if (connection >= 0) {
+        close(connection);
+    }
+    if (listener >= 0) {
+        close(listener);
+    }
+}
+
+void gdb_server::listen_tcp(uint16_t port) {
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw std::runtime_error("could not create the gdb socket");
+    }
+
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    // only the local debuggers can connect
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(listener, (sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 1) < 0) {
+        throw std::runtime_error("could not listen for gdb on the port " + std::to_string(port));
+    }
+}
+
+void gdb_server::listen_unix(const std::string &path) {
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw std::runtime_error("could not create the gdb socket");
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("the gdb socket path is too long : " + path);
+    }
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    // a socket left by a previous run is replaced
+    unlink(path.c_str());
+
+    if (bind(listener, (sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 1) < 0) {
+        throw std::runtime_error("could not listen for gdb on " + path);
+    }
+}
+
+void gdb_server::serve() {
+
+    if (listener < 0) {
+        throw std::runtime_error("the gdb server is not listening");
+    }
+
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+        throw std::runtime_error("could not accept the gdb connection");
+    }
+
+    // the packets are small and we wait for every reply
+    int no_delay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    serve(fd);
+}
+
+void gdb_server::serve(int fd) {
+
+    connection = fd;
+
+    std::string packet;
+    while (receive(packet)) {
+
+        // kill has no reply
+        if (packet == "k") {
+            break;
+        }
+
+        send(handle(packet));
+
+        if (!packet.empty() && packet[0] == 'D') {
+            break;
+        }
+    }
+
+    close(connection);
+    connection = -1;
+}
+
+bool gdb_server::receive(std::string &packet) {
+
+    char c;
+    while (true) {
+
+        // skip everything until the start of a packet, the acks and the interrupts included
+        do {
+            if (read(connection, &c, 1) != 1) {
+                return false;
+            }
+        } while (c != '$');
+
+        packet.clear();
+        uint8_t sum = 0;
+        while (true) {
+            if (read(connection, &c, 1) != 1) {
+                return false;
+            }
+            if (c == '#') {
+                break;
+            }
+            packet.push_back(c);
+            sum += (uint8_t) c;
+        }
+
+        char checksum[2];
+        if (read(connection, &checksum[0], 1) != 1 || read(connection, &checksum[1], 1) != 1) {
+            return false;
+        }
+
+        // ask for it again if it got corrupted
+        bool valid = isxdigit((unsigned char) checksum[0]) && isxdigit((unsigned char) checksum[1]) &&
+                     (digit(checksum[0]) << 4 | digit(checksum[1])) == sum;
+        if (write(connection, valid ? "+" : "-", 1) != 1) {
+            return false;
+        }
+        if (valid) {
+            return true;
+        }
+    }
+}
+
+void gdb_server::send(const std::string &packet) {
+
+    uint8_t sum = 0;
+    for (char c : packet) {
+        sum += (uint8_t) c;
+    }
+
+    std::string framed = "$" + packet + "#";
+    put_byte(framed, sum);
+
+    // send it until it is acknowledged
+    char ack = '-';
+    while (ack == '-') {
+        if (write(connection, framed.data(), framed.size()) != (ssize_t) framed.size() ||
+            read(connection, &ack, 1) != 1) {
+            return;
+        }
+    }
+}
+
+bool gdb_server::interrupted() {
+
+    if (connection < 0) {
+        return false;
+    }
+
+    pollfd descriptor = {connection, POLLIN, 0};
+    char c;
+    return poll(&descriptor, 1, 0) > 0 && read(connection, &c, 1) == 1 && c == 0x03;
+}
+
+std::string gdb_server::resume(bool single) {
+
+    while (true) {
+
+        stop_reason reason;
+        try {
+            reason = single ? instance->step() : instance->debug_run(GDB_CONTINUE_CHUNK);
+        } catch (std::runtime_error &e) {
+            // a HardFault
+            return SIGNAL_SEGMENTATION_FAULT;
+        }
+
+        switch (reason) {
+            case STOP_BREAKPOINT:
+                return SIGNAL_TRAP;
+            case STOP_WATCHPOINT: {
+                // the address is a big endian number
+                const watch_hit &hit = instance->get_watch_hit();
+                std::string reply = hit.kind == WATCH_WRITE ? "T05watch:" :
+                                    hit.kind == WATCH_READ ? "T05rwatch:" : "T05awatch:";
+                uint32_t address = hit.address;
+                for (int shift = 28; shift >= 0; shift -= 4) {
+                    reply.push_back(HEX_DIGITS[(address >> shift) & 0xF]);
+                }
+                return reply + ";";
+            }
+            case STOP_HALTED: {
+                if (!instance->has_exited()) {
+                    return SIGNAL_TRAP;
+                }
+                std::string reply = "W";
+                put_byte(reply, (uint8_t) instance->get_exit_code());
+                return reply;
+            }
+            case STOP_BUDGET:
+                if (single) {
+                    return SIGNAL_TRAP;
+                }
+                if (interrupted()) {
+                    return SIGNAL_INTERRUPT;
+                }
+                break;
+        }
+    }
+}
+
+uint32_t gdb_server::read_register(uint32_t number) {
+    if (number == 15) {
+        return instance->get_pc();
+    }
+    return number == 16 ? instance->get_xpsr() : instance->get_registers()[number].to_uint;
+}
+
+void gdb_server::write_register(uint32_t number, uint32_t value) {
+    if (number == 15) {
+        instance->set_pc(value);
+    } else if (number == 16) {
+        instance->set_xpsr(value);
+    } else {
+        instance->get_registers()[number].to_uint = value;
+    }
+}
+
+std::string gdb_server::handle(const std::string &packet) {
+
+    if (packet.empty()) {
+        return "";
+    }
+
+    try {
+
+        mmu *memory = instance->get_mmu();
+        size_t position = 1;
+
+        switch (packet[0]) {
+
+            case '?':
+                return last_stop;
+
+            case 'g': {
+                std::string reply;
+                for (uint32_t i = 0; i < REGISTER_COUNT; ++i) {
+                    put_word(reply, read_register(i));
+                }
+                return reply;
+            }
+
+            case 'G': {
+                for (uint32_t i = 0; i < REGISTER_COUNT; ++i) {
+                    write_register(i, get_word(packet, 1 + 8 * i));
+                }
+                return "OK";
+            }
+
+            case 'p': {
+                uint32_t number = get_number(packet, position);
+                if (number >= REGISTER_COUNT) {
+                    return "E01";
+                }
+                std::string reply;
+                put_word(reply, read_register(number));
+                return reply;
+            }
+
+            case 'P': {
+                uint32_t number = get_number(packet, position);
+                if (number >= REGISTER_COUNT || position >= packet.size() || packet[position] != '=') {
+                    return "E01";
+                }
+                write_register(number, get_word(packet, position + 1));
+                return "OK";
+            }
+
+            case 'm': {
+                uint32_t address = get_number(packet, position);
+                ++position;
+                uint32_t length = get_number(packet, position);
+
+                // the registers of the peripherals read as zeros, reading them could change their state
+                std::string reply;
+                for (uint32_t i = 0; i < length; ++i) {
+                    uint8_t *host;
+                    if (!accessible(memory, address + i, host)) {
+                        return i == 0 ? "E14" : reply;
+                    }
+                    put_byte(reply, host != nullptr ? *host : 0);
+                }
+                return reply;
+            }
+
+            case 'M': {
+                uint32_t address = get_number(packet, position);
+                ++position;
+                uint32_t length = get_number(packet, position);
+                ++position;
+
+                for (uint32_t i = 0; i < length; ++i) {
+                    uint8_t *host;
+                    if (!accessible(memory, address + i, host)) {
+                        return "E14";
+                    }
+                    uint8_t value = get_byte(packet, position + 2 * i);
+                    if (host != nullptr) {
+                        *host = value;
+                    } else {
+                        memory->write8(address + i, value);
+                    }
+                }
+                return "OK";
+            }
+
+            case 'c':
+            case 's': {
+                // continue at the address if there is one
+                if (packet.size() > 1) {
+                    instance->set_pc(get_number(packet, position));
+                }
+                last_stop = resume(packet[0] == 's');
+                return last_stop;
+            }
+
+            case 'Z':
+            case 'z':
+                return breakpoint(packet);
+
+            case 'q':
+                return query(packet);
+
+            case 'H':
+            case 'T':
+            case 'D':
+                return "OK";
+
+            default:
+                // the packets we do not support get an empty reply
+                return "";
+        }
+    } catch (std::runtime_error &e) {
+        // a malformed packet
+        return "E01";
+    }
+}
+
+std::string gdb_server::query(const std::string &packet) {
+
+    if (packet.compare(0, 11, "qSupported:") == 0 || packet == "qSupported") {
+        return "PacketSize=4000;qXfer:features:read+";
+    }
+
+    // qXfer:features:read:target.xml:OFFSET,LENGTH
+    const std::string features = "qXfer:features:read:target.xml:";
+    if (packet.compare(0, features.size(), features) == 0) {
+        size_t position = features.size();
+        uint32_t offset = get_number(packet, position);
+        ++position;
+        uint32_t length = get_number(packet, position);
+
+        std::string description(TARGET_XML);
+        if (offset >= description.size()) {
+            return "l";
+        }
+        std::string part = description.substr(offset, length);
+        return (offset + part.size() < description.size() ? "m" : "l") + part;
+    }
+
+    if (packet == "qAttached") {
+        return "1";
+    }
+    if (packet == "qC") {
+        return "QC1";
+    }
+    if (packet == "qfThreadInfo") {
+        return "m1";
+    }
+    if (packet == "qsThreadInfo") {
+        return "l";
+    }
+
+    return "";
+}
+
+std::string gdb_server::breakpoint(const std::string &packet) {
+
+    // Z/z TYPE,ADDRESS,KIND
+    bool insert = packet[0] == 'Z';
+    size_t position = 1;
+    uint32_t type = get_number(packet, position);
+    ++position;
+    uint32_t address = get_number(packet, position);
+    ++position;
+    uint32_t kind = get_number(packet, position);
+
+    switch (type) {
+
+        // the software and hardware breakpoints are the same for us
+        case 0:
+        case 1:
+            if (insert) {
+                instance->add_breakpoint(address);
+            } else {
+                instance->remove_breakpoint(address);
+            }
+            return "OK";
+
+        // the write, read and access watchpoints, the kind is the length of the value
+        case 2:
+        case 3:
+        case 4: {
+            if (kind == 0) {
+                return "E01";
+            }
+            auto watched = type == 2 ? WATCH_WRITE : type == 3 ? WATCH_READ : WATCH_ACCESS;
+            try {
+                if (insert) {
+                    instance->add_watchpoint(address, kind, watched);
+                } else {
+                    instance->remove_watchpoint(address, kind, watched);
+                }
+            } catch (std::runtime_error &e) {
+                // the range is not in the memory
+                return "E01";
+            }
+            return "OK";
+        }
+
+        default:
+            return "";
+    }
+}
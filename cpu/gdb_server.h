@@ -0,0 +1,137 @@
+//
+// Created by dimitrije on 10/13/26.
+//
+
+#ifndef EMULATOR_M0_GDB_SERVER_H
+#define EMULATOR_M0_GDB_SERVER_H
+
+#include <cstdint>
+#include <string>
+
+class cpu;
+
+/**
+ * The number of instructions we run between two checks for the interrupt (Ctrl-C) from the debugger
+ */
+const size_t GDB_CONTINUE_CHUNK = 100000;
+
+/**
+ * A server of the GDB remote serial protocol, it lets GDB read and write the registers and the memory, step,
+ * continue and set breakpoints and watchpoints. It serves one debugger connected over a local TCP port or a Unix
+ * socket, the register layout is described to GDB as an M-profile target (R0-R15 and xPSR).
+ */
+class gdb_server {
+
+private:
+
+    /**
+     * The cpu we are debugging
+     */
+    cpu *instance;
+
+    /**
+     * The socket we are accepting the connection on, -1 if we are not listening
+     */
+    int listener;
+
+    /**
+     * The connection to the debugger, -1 if there is none
+     */
+    int connection;
+
+    /**
+     * The reply to the last stop, sent for the ? packet
+     */
+    std::string last_stop;
+
+    /**
+     * Reads a packet from the connection and acknowledges it
+     * @param packet the content of the packet
+     * @return false if the connection was closed
+     */
+    bool receive(std::string &packet);
+
+    /**
+     * Sends a packet to the debugger
+     * @param packet the content of the packet
+     */
+    void send(const std::string &packet);
+
+    /**
+     * Checks if the debugger has sent the interrupt (Ctrl-C) without waiting
+     * @return true if it has
+     */
+    bool interrupted();
+
+    /**
+     * Runs the cpu until it stops
+     * @param single true to execute only one instruction
+     * @return the stop reply
+     */
+    std::string resume(bool single);
+
+    /**
+     * Handles the query packets (q...)
+     * @param packet the packet
+     * @return the reply
+     */
+    std::string query(const std::string &packet);
+
+    /**
+     * Handles the breakpoint and watchpoint packets (Z... and z...)
+     * @param packet the packet
+     * @return the reply
+     */
+    std::string breakpoint(const std::string &packet);
+
+    /**
+     * Reads and writes the registers by their GDB number (0-15 are R0-R15, 16 is xPSR)
+     */
+    uint32_t read_register(uint32_t number);
+    void write_register(uint32_t number, uint32_t value);
+
+public:
+
+    /**
+     * Creates the server of a cpu
+     * @param instance the cpu
+     */
+    explicit gdb_server(cpu *instance);
+
+    /**
+     * Closes the sockets
+     */
+    ~gdb_server();
+
+    /**
+     * Starts listening on a TCP port of the loopback interface
+     * @param port the port
+     */
+    void listen_tcp(uint16_t port);
+
+    /**
+     * Starts listening on a Unix socket
+     * @param path the path of the socket
+     */
+    void listen_unix(const std::string &path);
+
+    /**
+     * Waits for the debugger to connect and serves it until it detaches or kills the target
+     */
+    void serve();
+
+    /**
+     * Serves a debugger connected over a file descriptor until it detaches or kills the target
+     * @param fd the file descriptor, it is closed when we are done
+     */
+    void serve(int fd);
+
+    /**
+     * Handles a packet
+     * @param packet the content of the packet
+     * @return the content of the reply
+     */
+    std::string handle(const std::string &packet);
+};
+
+#endif //EMULATOR_M0_GDB_SERVER_H
@@ -0,0 +1,178 @@
+//
+// Created by dimitrije on 10/17/26.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include "heatmap.h"
+
+memory_heatmap::memory_heatmap(cpu *instance, uint64_t interval) : instance(instance), interval(interval), stamp(1) {
+
+    if (interval == 0) {
+        throw std::runtime_error("the interval of the working set has to be larger than 0");
+    }
+
+    mmu *memory = instance->get_mmu();
+    code_size = memory->get_code_size();
+    sram_size = memory->get_sram_size();
+
+    // a counter for every line of the regions
+    code_lines.resize((code_size + HEATMAP_LINE_SIZE - 1) >> HEATMAP_LINE_SHIFT, line_counts());
+    sram_lines.resize((sram_size + HEATMAP_LINE_SIZE - 1) >> HEATMAP_LINE_SHIFT, line_counts());
+    code_seen.resize(code_lines.size(), 0);
+    sram_seen.resize(sram_lines.size(), 0);
+
+    // the intervals are aligned to the start of the run
+    block_start = instance->get_instructions();
+    block_address = instance->get_registers()[15].to_uint - 2;
+    interval_end = (block_start / interval + 1) * interval;
+    current = {interval_end - interval, 0, 0};
+
+    // every data access goes through the observer
+    memory->mark_slow(CODE_BEGIN, code_size);
+    memory->mark_slow(SRAM_BEGIN, sram_size);
+    memory->add_observer(this);
+
+    instance->add_branch_observer(this);
+}
+
+memory_heatmap::~memory_heatmap() {
+
+    mmu *memory = instance->get_mmu();
+    memory->remove_observer(this);
+    memory->unmark_slow(CODE_BEGIN, code_size);
+    memory->unmark_slow(SRAM_BEGIN, sram_size);
+
+    instance->remove_branch_observer(this);
+}
+
+void memory_heatmap::on_read(uint32_t address, uint32_t, uint32_t) {
+
+    // the fetches of the finished interval have to be counted in it
+    if (instance->get_instructions() >= interval_end) {
+        count_fetches(instance->get_instructions());
+    }
+
+    line_counts *line = touch(address);
+    if (line != nullptr) {
+        line->reads++;
+    }
+}
+
+void memory_heatmap::on_write(uint32_t address, uint32_t, uint32_t, uint32_t) {
+
+    // the fetches of the finished interval have to be counted in it
+    if (instance->get_instructions() >= interval_end) {
+        count_fetches(instance->get_instructions());
+    }
+
+    line_counts *line = touch(address);
+    if (line != nullptr) {
+        line->writes++;
+    }
+}
+
+void memory_heatmap::on_branch(uint32_t target, uint64_t instruction) {
+    count_fetches(instruction);
+    block_address = target;
+}
+
+void memory_heatmap::count_fetches(uint64_t instruction) {
+
+    // the cpu was moved back, there is nothing to count
+    if (instruction < block_start) {
+        block_start = instruction;
+        return;
+    }
+
+    while (true) {
+
+        // the instructions of the block in this interval, a line at a time
+        uint64_t end = std::min(instruction, interval_end);
+        uint64_t remaining = end - block_start;
+        while (remaining != 0) {
+
+            line_counts *line = touch(block_address);
+            if (line == nullptr) {
+                break;
+            }
+
+            uint32_t left = (HEATMAP_LINE_SIZE - (block_address & (HEATMAP_LINE_SIZE - 1))) / 2;
+            uint64_t in_line = std::min<uint64_t>(remaining, left);
+            line->fetches += in_line;
+            block_address += 2 * in_line;
+            remaining -= in_line;
+        }
+        block_start = end;
+
+        if (instruction < interval_end) {
+            return;
+        }
+
+        // the interval is finished, the lines are touched again in the next one
+        working_sets.push_back(current);
+        current = {interval_end, 0, 0};
+        interval_end += interval;
+        stamp++;
+    }
+}
+
+void memory_heatmap::run(size_t n_instr) {
+    instance->run(n_instr);
+    count_fetches(instance->get_instructions());
+}
+
+void memory_heatmap::write_lines(std::ostream &output, uint32_t begin, const std::vector<line_counts> &lines) {
+
+    char address[16];
+    for (size_t i = 0; i < lines.size(); ++i) {
+
+        const line_counts &line = lines[i];
+        if (line.reads == 0 && line.writes == 0 && line.fetches == 0) {
+            continue;
+        }
+
+        snprintf(address, sizeof(address), "0x%08x", (uint32_t) (begin + (i << HEATMAP_LINE_SHIFT)));
+        output << address << " " << line.reads << " " << line.writes << " " << line.fetches << "\n";
+    }
+}
+
+void memory_heatmap::write_histogram(std::ostream &output) {
+
+    count_fetches(instance->get_instructions());
+
+    output << "# address reads writes fetches\n";
+    write_lines(output, CODE_BEGIN, code_lines);
+    write_lines(output, SRAM_BEGIN, sram_lines);
+}
+
+void memory_heatmap::write_working_set(std::ostream &output) {
+
+    count_fetches(instance->get_instructions());
+
+    output << "# instruction code_lines sram_lines bytes\n";
+    for (const working_set &set : working_sets) {
+        output << set.start << " " << set.code_lines << " " << set.sram_lines << " "
+               << (uint64_t) (set.code_lines + set.sram_lines) * HEATMAP_LINE_SIZE << "\n";
+    }
+
+    // the interval that is not finished yet
+    if (current.code_lines != 0 || current.sram_lines != 0) {
+        output << current.start << " " << current.code_lines << " " << current.sram_lines << " "
+               << (uint64_t) (current.code_lines + current.sram_lines) * HEATMAP_LINE_SIZE << "\n";
+    }
+}
+
+const line_counts &memory_heatmap::get_line(uint32_t address) const {
+
+    if (address - CODE_BEGIN < code_size) {
+        return code_lines[(address - CODE_BEGIN) >> HEATMAP_LINE_SHIFT];
+    }
+
+    if (address - SRAM_BEGIN < sram_size) {
+        return sram_lines[(address - SRAM_BEGIN) >> HEATMAP_LINE_SHIFT];
+    }
+
+    throw std::runtime_error("the address is not in the code or the sram region");
+}
@@ -0,0 +1,211 @@
+//
+// Created by dimitrije on 10/17/26.
+//
+
+#ifndef EMULATOR_M0_HEATMAP_H
+#define EMULATOR_M0_HEATMAP_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "cpu.h"
+
+/**
+ * The number of bytes in a line of the heatmap
+ */
+const uint32_t HEATMAP_LINE_SHIFT = 5;
+const uint32_t HEATMAP_LINE_SIZE = 1u << HEATMAP_LINE_SHIFT;
+
+/**
+ * The default number of instructions in an interval of the working set
+ */
+const uint64_t HEATMAP_INTERVAL = 1000000;
+
+/**
+ * The accesses to a line of the memory
+ */
+struct line_counts {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t fetches;
+};
+
+/**
+ * The lines of the memory touched during an interval of the run
+ */
+struct working_set {
+
+    /**
+     * The instruction the interval starts at
+     */
+    uint64_t start;
+
+    /**
+     * The number of lines of the code region and of the sram region that were read, written or executed from
+     */
+    uint32_t code_lines;
+    uint32_t sram_lines;
+};
+
+/**
+ * Counts the reads, the writes and the instruction fetches of every 32 byte line of the code and the sram region,
+ * and the number of lines touched in every interval of the run (the working set).
+ *
+ * The data accesses come from the mmu, the whole code and sram regions are marked as slow while the heatmap exists
+ * so every access goes to it and the other accesses keep their cost. The instructions are fetched without the mmu,
+ * they are counted a block at a time when the cpu branches, a block runs straight through from the branch target so
+ * the instructions the cpu retired in it were fetched one after another. The counters are arrays indexed by the line,
+ * sized to the regions of the cpu.
+ */
+class memory_heatmap : private memory_observer, private branch_observer {
+
+private:
+
+    /**
+     * The cpu we count the accesses of
+     */
+    cpu *instance;
+
+    /**
+     * The number of instructions in an interval of the working set
+     */
+    uint64_t interval;
+
+    /**
+     * The sizes of the code and the sram region
+     */
+    uint32_t code_size;
+    uint32_t sram_size;
+
+    /**
+     * The counts of every line of the code region and of the sram region
+     */
+    std::vector<line_counts> code_lines;
+    std::vector<line_counts> sram_lines;
+
+    /**
+     * The number of the interval (starting from 1) every line was last touched in
+     */
+    std::vector<uint32_t> code_seen;
+    std::vector<uint32_t> sram_seen;
+
+    /**
+     * The working sets of the finished intervals and of the current one
+     */
+    std::vector<working_set> working_sets;
+    working_set current;
+
+    /**
+     * The number of the current interval, starting from 1, and the instruction it ends at
+     */
+    uint32_t stamp;
+    uint64_t interval_end;
+
+    /**
+     * The address the instructions are fetched from and the instruction they started at
+     */
+    uint32_t block_address;
+    uint64_t block_start;
+
+    /**
+     * Counts a read or a write of a slow page
+     */
+    void on_read(uint32_t address, uint32_t size, uint32_t value) override;
+    void on_write(uint32_t address, uint32_t size, uint32_t old_value, uint32_t new_value) override;
+
+    /**
+     * Counts the fetches of the block that ended and starts a new one
+     */
+    void on_branch(uint32_t target, uint64_t instruction) override;
+
+    /**
+     * Returns the counts of the line with an address and marks it as touched in the current interval
+     * @param address the address
+     * @return the counts or nullptr if the address is not in the code or the sram region
+     */
+    inline line_counts *touch(uint32_t address) {
+
+        if (address - CODE_BEGIN < code_size) {
+            uint32_t line = (address - CODE_BEGIN) >> HEATMAP_LINE_SHIFT;
+            if (code_seen[line] != stamp) {
+                code_seen[line] = stamp;
+                current.code_lines++;
+            }
+            return &code_lines[line];
+        }
+
+        if (address - SRAM_BEGIN < sram_size) {
+            uint32_t line = (address - SRAM_BEGIN) >> HEATMAP_LINE_SHIFT;
+            if (sram_seen[line] != stamp) {
+                sram_seen[line] = stamp;
+                current.sram_lines++;
+            }
+            return &sram_lines[line];
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * Counts the fetches of the current block up to an instruction, finishing the intervals on the way
+     * @param instruction the number of retired instructions
+     */
+    void count_fetches(uint64_t instruction);
+
+    /**
+     * Writes the lines of a region that were accessed
+     * @param output the stream
+     * @param begin the first address of the region
+     * @param lines the counts of the lines of the region
+     */
+    static void write_lines(std::ostream &output, uint32_t begin, const std::vector<line_counts> &lines);
+
+public:
+
+    /**
+     * Starts counting the accesses of a cpu from its current instruction
+     * @param instance the cpu
+     * @param interval the number of instructions in an interval of the working set
+     */
+    memory_heatmap(cpu *instance, uint64_t interval = HEATMAP_INTERVAL);
+
+    /**
+     * Stops counting, the pages of the regions are not slow anymore
+     */
+    ~memory_heatmap() override;
+
+    /**
+     * Runs the cpu for N instructions counting the accesses
+     * @param n_instr the number of instructions
+     */
+    void run(size_t n_instr);
+
+    /**
+     * Writes the histogram of the accesses, a line with the address, the reads, the writes and the fetches for every
+     * line of the memory that was accessed, ordered by the address
+     * @param output the stream
+     */
+    void write_histogram(std::ostream &output);
+
+    /**
+     * Writes the working set over time, a line with the start instruction, the code lines, the sram lines and the bytes
+     * touched for every interval. The last interval is written even if it is not finished.
+     * @param output the stream
+     */
+    void write_working_set(std::ostream &output);
+
+    /**
+     * Returns the counts of the line that contains an address
+     * @param address the address, it has to be in the code or the sram region
+     * @return the counts
+     */
+    const line_counts &get_line(uint32_t address) const;
+
+    /**
+     * Returns the working sets of the finished intervals
+     * @return the working sets
+     */
+    inline const std::vector<working_set> &get_working_sets() const { return working_sets; }
+};
+
+#endif //EMULATOR_M0_HEATMAP_H
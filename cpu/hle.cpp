@@ -0,0 +1,214 @@
+//
+// Created by dimitrije on 10/10/26.
+//
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "hle.h"
+#include "cpu.h"
+
+void symbol_table::load(const std::string &file) {
+
+    std::ifstream in(file);
+    if (!in.is_open()) {
+        throw std::runtime_error("could not open the symbol file : " + file);
+    }
+
+    // every line is ADDRESS TYPE NAME, the undefined symbols have no address and are skipped
+    std::string line;
+    while (std::getline(in, line)) {
+
+        std::istringstream fields(line);
+        std::string address, type, name;
+        if (!(fields >> address >> type >> name)) {
+            continue;
+        }
+
+        add(name, (uint32_t) std::stoul(address, nullptr, 16));
+    }
+}
+
+void symbol_table::add(const std::string &name, uint32_t address) {
+    symbols[name] = address & 0xFFFFFFFE;
+    names[address & 0xFFFFFFFE] = name;
+}
+
+bool symbol_table::find(const std::string &name, uint32_t &address) const {
+
+    auto it = symbols.find(name);
+    if (it == symbols.end()) {
+        return false;
+    }
+
+    address = it->second;
+    return true;
+}
+
+bool symbol_table::nearest(uint32_t address, std::string &name, uint32_t &offset) const {
+
+    // the first symbol after the address, the one before it is the closest
+    auto it = names.upper_bound(address);
+    if (it == names.begin()) {
+        return false;
+    }
+
+    --it;
+    name = it->second;
+    offset = address - it->first;
+    return true;
+}
+
+namespace hle {
+
+namespace {
+
+/**
+ * Returns the host memory of a guest buffer if the whole buffer is in one region and its accesses are not observed
+ */
+uint8_t *host_buffer(mmu *memory, uint32_t address, uint32_t length) {
+    uint32_t region_begin, region_end;
+    uint8_t *region = memory->resolve_region(address, region_begin, region_end);
+    return region != nullptr && region_end - address >= length && !memory->is_slow(address, length) ?
+           region + (address - region_begin) : nullptr;
+}
+
+/**
+ * The table of the zlib CRC-32
+ */
+struct crc32_table {
+
+    uint32_t values[256];
+
+    crc32_table() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) != 0 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            values[i] = c;
+        }
+    }
+};
+
+}
+
+void memcpy(cpu *instance) {
+    // the overlapping copy is undefined for memcpy so memmove does it too
+    memmove(instance);
+}
+
+void memmove(cpu *instance) {
+
+    arm_register_t *r = instance->get_registers();
+    mmu *memory = instance->get_mmu();
+    uint32_t destination = r[0].to_uint, source = r[1].to_uint, length = r[2].to_uint;
+
+    uint8_t *to = host_buffer(memory, destination, length);
+    uint8_t *from = host_buffer(memory, source, length);
+
+    if (to != nullptr && from != nullptr) {
+        std::memmove(to, from, length);
+    } else {
+        std::vector<uint8_t> data(length);
+        memory->read_bytes(source, data.data(), length);
+        memory->write_bytes(destination, data.data(), length);
+    }
+
+    // the destination is returned, it is already in R0
+}
+
+void memset(cpu *instance) {
+
+    arm_register_t *r = instance->get_registers();
+    mmu *memory = instance->get_mmu();
+    uint32_t destination = r[0].to_uint, length = r[2].to_uint;
+    auto value = (uint8_t) r[1].to_uint;
+
+    uint8_t *to = host_buffer(memory, destination, length);
+
+    if (to != nullptr) {
+        std::memset(to, value, length);
+    } else {
+        for (uint32_t i = 0; i < length; ++i) {
+            memory->write8(destination + i, value);
+        }
+    }
+}
+
+void strlen(cpu *instance) {
+
+    arm_register_t *r = instance->get_registers();
+    mmu *memory = instance->get_mmu();
+    uint32_t address = r[0].to_uint;
+
+    // look for the terminator in the host memory of the region
+    uint32_t region_begin, region_end;
+    uint8_t *region = memory->resolve_region(address, region_begin, region_end);
+    if (region != nullptr && !memory->is_slow(address, region_end - address)) {
+        const uint8_t *start = region + (address - region_begin);
+        auto end = (const uint8_t *) std::memchr(start, 0, region_end - address);
+        if (end != nullptr) {
+            r[0].to_uint = (uint32_t) (end - start);
+            return;
+        }
+    }
+
+    // the string leaves the region, go byte by byte
+    uint32_t length = 0;
+    while (memory->read8(address + length) != 0) {
+        ++length;
+    }
+    r[0].to_uint = length;
+}
+
+void crc32(cpu *instance) {
+
+    static const crc32_table table;
+
+    arm_register_t *r = instance->get_registers();
+    mmu *memory = instance->get_mmu();
+    uint32_t crc = ~r[0].to_uint, address = r[1].to_uint, length = r[2].to_uint;
+
+    // the data is read in chunks so that we do not have to go through the mmu for every byte
+    uint8_t chunk[4096];
+    while (length != 0) {
+        uint32_t size = length < sizeof(chunk) ? length : (uint32_t) sizeof(chunk);
+        memory->read_bytes(address, chunk, size);
+
+        for (uint32_t i = 0; i < size; ++i) {
+            crc = table.values[(crc ^ chunk[i]) & 0xFF] ^ (crc >> 8);
+        }
+
+        address += size;
+        length -= size;
+    }
+
+    r[0].to_uint = ~crc;
+}
+
+int install_library_hooks(cpu *instance, const symbol_table &symbols) {
+
+    const std::pair<const char *, void (*)(cpu *)> library[] = {
+            {"memcpy", memcpy},
+            {"memmove", memmove},
+            {"memset", memset},
+            {"strlen", strlen},
+            {"crc32", crc32}
+    };
+
+    int installed = 0;
+    for (auto &function : library) {
+        uint32_t address;
+        if (symbols.find(function.first, address)) {
+            instance->add_hook(address, function.second);
+            ++installed;
+        }
+    }
+
+    return installed;
+}
+
+}
@@ -0,0 +1,104 @@
+//
+// Created by dimitrije on 10/10/26.
+//
+
+#ifndef EMULATOR_M0_HLE_H
+#define EMULATOR_M0_HLE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+class cpu;
+
+/**
+ * The addresses of the functions in the firmware by their name, loaded from the output of nm
+ */
+class symbol_table {
+
+private:
+
+    /**
+     * The addresses by the name of the symbol
+     */
+    std::map<std::string, uint32_t> symbols;
+
+    /**
+     * The names of the symbols by their address
+     */
+    std::map<uint32_t, std::string> names;
+
+public:
+
+    /**
+     * Loads the symbols from the output of nm (ADDRESS TYPE NAME per line), the thumb bit of the addresses is cleared
+     * @param file the path of the file
+     */
+    void load(const std::string &file);
+
+    /**
+     * Adds a symbol
+     * @param name the name of the symbol
+     * @param address the address of the symbol
+     */
+    void add(const std::string &name, uint32_t address);
+
+    /**
+     * Finds a symbol
+     * @param name the name of the symbol
+     * @param address the address is stored here if it is found
+     * @return true if it was found
+     */
+    bool find(const std::string &name, uint32_t &address) const;
+
+    /**
+     * Finds the symbol an address belongs to, the closest one at or before it
+     * @param address the address
+     * @param name the name of the symbol is stored here if it is found
+     * @param offset the distance of the address from the symbol is stored here if it is found
+     * @return true if it was found
+     */
+    bool nearest(uint32_t address, std::string &name, uint32_t &offset) const;
+};
+
+/**
+ * The host implementations of the library functions, they follow the C signatures of the functions they replace
+ */
+namespace hle {
+
+/**
+ * void *memcpy(void *destination, const void *source, size_t length)
+ */
+void memcpy(cpu *instance);
+
+/**
+ * void *memmove(void *destination, const void *source, size_t length)
+ */
+void memmove(cpu *instance);
+
+/**
+ * void *memset(void *destination, int value, size_t length)
+ */
+void memset(cpu *instance);
+
+/**
+ * size_t strlen(const char *string)
+ */
+void strlen(cpu *instance);
+
+/**
+ * uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length) - the zlib CRC-32
+ */
+void crc32(cpu *instance);
+
+/**
+ * Hooks the library functions above that are in the symbol table
+ * @param instance the cpu
+ * @param symbols the symbols of the firmware
+ * @return the number of functions that were hooked
+ */
+int install_library_hooks(cpu *instance, const symbol_table &symbols);
+
+}
+
+#endif //EMULATOR_M0_HLE_H
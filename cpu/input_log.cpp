@@ -0,0 +1,163 @@
+//
+// Created by dimitrije on 10/11/26.
+//
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include "input_log.h"
+
+namespace {
+
+/**
+ * The first bytes of a log file
+ */
+const char LOG_MAGIC[4] = {'M', '0', 'I', 'N'};
+
+/**
+ * Reads a LEB128 encoded number
+ * @param in the file
+ * @param value the number is stored here
+ * @return false if the file ended
+ */
+bool get(FILE *in, uint64_t &value) {
+
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(in);
+        if (c == EOF) {
+            return false;
+        }
+        value |= (uint64_t) (c & 0x7F) << shift;
+        if ((c & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    throw std::runtime_error("the input log is corrupted");
+}
+
+}
+
+input_log::input_log(const std::string &path, bool replaying, const uint64_t &cycles) : cycles(cycles),
+                                                                                        file(nullptr),
+                                                                                        last_cycle(0) {
+
+    if (!replaying) {
+        file = fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            throw std::runtime_error("could not create the input log : " + path);
+        }
+        fwrite(LOG_MAGIC, 1, sizeof(LOG_MAGIC), file);
+        return;
+    }
+
+    FILE *in = fopen(path.c_str(), "rb");
+    if (in == nullptr) {
+        throw std::runtime_error("could not open the input log : " + path);
+    }
+
+    char magic[sizeof(LOG_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, LOG_MAGIC, sizeof(magic)) != 0) {
+        fclose(in);
+        throw std::runtime_error("not an input log : " + path);
+    }
+
+    // load all the entries, the cycles are stored as the zigzag encoded difference to the previous entry
+    uint64_t delta, kind, address, length, cycle = 0;
+    while (get(in, delta)) {
+
+        if (!get(in, kind) || !get(in, address) || !get(in, length)) {
+            fclose(in);
+            throw std::runtime_error("the input log is truncated : " + path);
+        }
+
+        cycle += (delta >> 1) ^ (0 - (delta & 1));
+        entry e{cycle, (input_kind) kind, (uint32_t) address, std::vector<uint8_t>(length)};
+        if (fread(e.data.data(), 1, length, in) != length) {
+            fclose(in);
+            throw std::runtime_error("the input log is truncated : " + path);
+        }
+
+        (e.kind == INPUT_INTERRUPT ? interrupts : values).push_back(std::move(e));
+    }
+
+    fclose(in);
+}
+
+input_log::~input_log() {
+    if (file != nullptr) {
+        fclose(file);
+    }
+}
+
+void input_log::put(uint64_t value) {
+    do {
+        auto c = (uint8_t) (value & 0x7F);
+        value >>= 7;
+        fputc(value != 0 ? c | 0x80 : c, file);
+    } while (value != 0);
+}
+
+void input_log::record(uint64_t cycle, input_kind kind, uint32_t address, const std::vector<uint8_t> &data) {
+
+    // the entries are in the order they came but an interrupt can be stamped with the next cycle,
+    // so the difference is zigzag encoded to keep the small negative ones small
+    auto delta = (int64_t) (cycle - last_cycle);
+    put(((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));
+    put(kind);
+    put(address);
+    put(data.size());
+    fwrite(data.data(), 1, data.size(), file);
+    last_cycle = cycle;
+}
+
+void input_log::input(input_kind kind, uint32_t address, std::vector<uint8_t> &data) {
+
+    if (file != nullptr) {
+        record(cycles, kind, address, data);
+        return;
+    }
+
+    // the firmware has to ask for the same input at the same time as in the recorded run
+    if (values.empty() || values.front().cycle != cycles || values.front().kind != kind ||
+        values.front().address != address) {
+        std::stringstream message;
+        message << "the replay has diverged from the input log at cycle " << cycles
+                << " reading the input 0x" << std::hex << address;
+        throw std::runtime_error(message.str());
+    }
+
+    data.swap(values.front().data);
+    values.pop_front();
+}
+
+uint32_t input_log::input(uint32_t address, uint32_t value) {
+
+    std::vector<uint8_t> data(sizeof(value));
+    memcpy(data.data(), &value, sizeof(value));
+
+    input(INPUT_MMIO_READ, address, data);
+    if (data.size() != sizeof(value)) {
+        throw std::runtime_error("the input log is corrupted");
+    }
+
+    memcpy(&value, data.data(), sizeof(value));
+    return value;
+}
+
+void input_log::interrupt(uint32_t irq, uint64_t cycle) {
+    record(cycle, INPUT_INTERRUPT, irq, {});
+}
+
+bool input_log::next_interrupt(uint64_t &cycle, uint32_t &irq) {
+
+    if (interrupts.empty()) {
+        return false;
+    }
+
+    cycle = interrupts.front().cycle;
+    irq = interrupts.front().address;
+    interrupts.pop_front();
+    return true;
+}
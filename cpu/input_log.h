@@ -0,0 +1,145 @@
+//
+// Created by dimitrije on 10/11/26.
+//
+
+#ifndef EMULATOR_M0_INPUT_LOG_H
+#define EMULATOR_M0_INPUT_LOG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * The kinds of the inputs that come from outside of the emulated system
+ */
+enum input_kind : uint8_t {
+
+    /**
+     * A value read from the register of an input peripheral, the address is the address of the register
+     */
+    INPUT_MMIO_READ = 1,
+
+    /**
+     * An interrupt made pending, the address is the number of the interrupt
+     */
+    INPUT_INTERRUPT = 2,
+
+    /**
+     * The result of a semihosting call, the address is the operation
+     */
+    INPUT_SEMIHOSTING = 3
+};
+
+/**
+ * Records the inputs of a run with the cycle they came at into an append-only binary file, or replays them from it.
+ * When replaying the inputs are taken from the log instead of the host, so the same firmware and log always make
+ * the same run. Every entry is | cycle delta | kind | address | length | data | and the numbers are LEB128 encoded.
+ */
+class input_log {
+
+private:
+
+    /**
+     * One input
+     */
+    struct entry {
+        uint64_t cycle;
+        input_kind kind;
+        uint32_t address;
+        std::vector<uint8_t> data;
+    };
+
+    /**
+     * The cycle count of the cpu
+     */
+    const uint64_t &cycles;
+
+    /**
+     * The file we are recording to, nullptr if we are replaying
+     */
+    FILE *file;
+
+    /**
+     * The cycle of the last recorded entry, the entries store the difference to it
+     */
+    uint64_t last_cycle;
+
+    /**
+     * The logged inputs we still have to replay, the interrupts are kept apart because the cpu makes them pending
+     * on its own while the other inputs are taken when the firmware asks for them
+     */
+    std::deque<entry> values;
+    std::deque<entry> interrupts;
+
+    /**
+     * Appends a LEB128 encoded number to the file
+     * @param value the number
+     */
+    void put(uint64_t value);
+
+    /**
+     * Appends an entry to the file
+     * @param cycle the cycle of the entry
+     * @param kind the kind of the input
+     * @param address the address of the input
+     * @param data the data of the input
+     */
+    void record(uint64_t cycle, input_kind kind, uint32_t address, const std::vector<uint8_t> &data);
+
+public:
+
+    /**
+     * Opens the log
+     * @param path the path of the log file
+     * @param replaying true to replay the log, false to record into it
+     * @param cycles the cycle count of the cpu, the inputs are stamped with it
+     */
+    input_log(const std::string &path, bool replaying, const uint64_t &cycles);
+
+    /**
+     * Closes the log file
+     */
+    ~input_log();
+
+    /**
+     * Returns true if we are replaying
+     * @return true if we are
+     */
+    inline bool is_replaying() const { return file == nullptr; }
+
+    /**
+     * Passes an input through the log. When recording the data is logged, when replaying it is replaced with
+     * the logged data, which has to be the same kind of input from the same address at the same cycle.
+     * @param kind the kind of the input
+     * @param address the address of the input
+     * @param data the data of the input
+     */
+    void input(input_kind kind, uint32_t address, std::vector<uint8_t> &data);
+
+    /**
+     * Passes a value read from an input peripheral through the log
+     * @param address the address of the register
+     * @param value the value the peripheral has
+     * @return the value the firmware gets
+     */
+    uint32_t input(uint32_t address, uint32_t value);
+
+    /**
+     * Records an interrupt that was made pending
+     * @param irq the number of the interrupt
+     * @param cycle the cycle it has to be made pending at in the replay
+     */
+    void interrupt(uint32_t irq, uint64_t cycle);
+
+    /**
+     * Takes the next interrupt we have to replay
+     * @param cycle the cycle it was made pending at
+     * @param irq the number of the interrupt
+     * @return false if there are no more interrupts
+     */
+    bool next_interrupt(uint64_t &cycle, uint32_t &irq);
+};
+
+#endif //EMULATOR_M0_INPUT_LOG_H
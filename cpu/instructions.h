@@ -0,0 +1,109 @@
+//
+// Created by dimitrije on 10/2/26.
+//
+
+#ifndef EMULATOR_M0_INSTRUCTIONS_H
+#define EMULATOR_M0_INSTRUCTIONS_H
+
+#include <cstdint>
+
+/**
+ * The instruction formats the cpu knows how to execute, each one maps to a method of the cpu with the same name
+ */
+enum instruction_class {
+    NOP,
+    CPSI_D_E,
+    WAIT_FOR_INTERUPT_EVENT,
+    SEND_EVENT,
+    SUPERVISOR_CALL,
+    BREAKPOINT,
+    ADD_OFFSET_TO_STACK_POINTER,
+    LOAD_STORE_WITH_REGISTER_OFFSET,
+    LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD,
+    PUSH_POP_REGISTERS,
+    ALU_OPERATIONS,
+    HI_REGISTER_OPERATIONS_BRANCH_EXCHANGE,
+    ADD_SUBTRACT,
+    PC_RELATIVE_LOAD,
+    UNCONDITIONAL_BRANCH,
+    LOAD_STORE_HALFWORD_IMMEDIATE_OFFSET,
+    SP_RELATIVE_LOAD_STORE,
+    LOAD_ADDRESS,
+    MULTIPLE_LOAD_STORE,
+    CONDITIONAL_BRANCH,
+    LONG_BRANCH_WITH_LINK,
+    MOVE_COMPARE_ADD_SUBTRACT_IMMEDIATE,
+    MOVE_SHIFTED_REGISTER,
+    LOAD_STORE_WITH_IMMEDIATE_OFFSET,
+    MEMORY_BARRIER,
+    UNKNOWN_INSTRUCTION
+};
+
+/**
+ * Figures out the format of a 16 bit instruction, this is shared by the interpreter and the translator
+ * so that they always agree on what an instruction does
+ * @param instruction - the instruction
+ * @return the instruction class
+ */
+inline instruction_class decode(uint16_t instruction) {
+
+    if (instruction == 0b0100011011000000) {
+        return NOP;
+    } else if ((0b1111111111101111 & instruction) == 0b1011011001100010) {
+        return CPSI_D_E;
+    } else if ((0b1111111111101111 & instruction) == 0b1011111100100000) {
+        return WAIT_FOR_INTERUPT_EVENT;
+    } else if (instruction == 0b1011111101000000) {
+        return SEND_EVENT;
+    } else if ((instruction & 0xFF00) == 0b1101111100000000) {
+        return SUPERVISOR_CALL;
+    } else if ((instruction & 0xFF00) == 0b1011111000000000) {
+        return BREAKPOINT;
+    } else if ((instruction & 0xFF00) == 0b1101111000000000) {
+        // UDF is permanently undefined
+        return UNKNOWN_INSTRUCTION;
+    } else if ((instruction & 0xFF00) == 0b1011000000000000) {
+        return ADD_OFFSET_TO_STACK_POINTER;
+    } else if ((instruction & 0b1111001000000000) == 0b0101000000000000) {
+        return LOAD_STORE_WITH_REGISTER_OFFSET;
+    } else if ((instruction & 0b1111001000000000) == 0b0101001000000000) {
+        return LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD;
+    } else if ((instruction & 0b1111011000000000) == 0b1011010000000000) {
+        return PUSH_POP_REGISTERS;
+    } else if ((instruction & 0b1111110000000000) == 0b0100000000000000) {
+        return ALU_OPERATIONS;
+    } else if ((instruction & 0b1111110000000000) == 0b0100010000000000) {
+        return HI_REGISTER_OPERATIONS_BRANCH_EXCHANGE;
+    } else if ((instruction & 0b1111100000000000) == 0b0001100000000000) {
+        return ADD_SUBTRACT;
+    } else if ((instruction & 0b1111100000000000) == 0b0100100000000000) {
+        return PC_RELATIVE_LOAD;
+    } else if ((instruction & 0b1111100000000000) == 0b0111000000000000) {
+        return UNCONDITIONAL_BRANCH;
+    } else if ((instruction & 0b1111000000000000) == 0b1000000000000000) {
+        return LOAD_STORE_HALFWORD_IMMEDIATE_OFFSET;
+    } else if ((instruction & 0b1111000000000000) == 0b1001000000000000) {
+        return SP_RELATIVE_LOAD_STORE;
+    } else if ((instruction & 0b1111000000000000) == 0b1010000000000000) {
+        return LOAD_ADDRESS;
+    } else if ((instruction & 0b1111000000000000) == 0b1100000000000000) {
+        return MULTIPLE_LOAD_STORE;
+    } else if ((instruction & 0b1111000000000000) == 0b1101000000000000) {
+        return CONDITIONAL_BRANCH;
+    } else if (instruction == 0b1111001110111111) {
+        // the first half-word of DMB, DSB and ISB, the second one tells them apart
+        return MEMORY_BARRIER;
+    } else if ((instruction & 0b1111000000000000) == 0b1111000000000000) {
+        return LONG_BRANCH_WITH_LINK;
+    } else if ((instruction & 0b1110000000000000) == 0b0010000000000000) {
+        return MOVE_COMPARE_ADD_SUBTRACT_IMMEDIATE;
+    } else if ((instruction & 0b1110000000000000) == 0b0000000000000000) {
+        return MOVE_SHIFTED_REGISTER;
+    } else if ((instruction & 0b1110000000000000) == 0b0110000000000000) {
+        return LOAD_STORE_WITH_IMMEDIATE_OFFSET;
+    }
+
+    return UNKNOWN_INSTRUCTION;
+}
+
+#endif //EMULATOR_M0_INSTRUCTIONS_H
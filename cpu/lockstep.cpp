@@ -0,0 +1,804 @@
+//
+// Created by dimitrije on 10/14/26.
+//
+
+#include <algorithm>
+#include "lockstep.h"
+#include "instructions.h"
+
+// the helpers below are internal, so the ABI of their vector arguments does not matter
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace {
+
+/**
+ * The flag helpers of util.h for all the lanes at once, they give 0 or 1 in every lane
+ */
+inline lane_vector neg(lane_vector i) { return i >> 31; }
+inline lane_vector pos(lane_vector i) { return (~i) >> 31; }
+inline lane_vector is_zero(lane_vector i) { return (lane_vector) (i == lane_vector{}) & 1; }
+
+inline lane_vector add_carry(lane_vector a, lane_vector b, lane_vector c) {
+    return (neg(a) & neg(b)) | (neg(a) & pos(c)) | (neg(b) & pos(c));
+}
+
+inline lane_vector add_overflow(lane_vector a, lane_vector b, lane_vector c) {
+    return (neg(a) & neg(b) & pos(c)) | (pos(a) & pos(b) & neg(c));
+}
+
+inline lane_vector sub_carry(lane_vector a, lane_vector b, lane_vector c) {
+    return (neg(a) & pos(b)) | (neg(a) & pos(c)) | (pos(b) & pos(c));
+}
+
+inline lane_vector sub_overflow(lane_vector a, lane_vector b, lane_vector c) {
+    return (neg(a) & pos(b) & pos(c)) | (pos(a) & neg(b) & neg(c));
+}
+
+/**
+ * Puts the same value into every lane
+ */
+inline lane_vector splat(uint32_t value) { return lane_vector{} + value; }
+
+/**
+ * Checks if an access stays in the code or the sram region and does not touch a slow page, the mmu can then make
+ * it without the peripherals, the observers and the time of the cpu
+ */
+inline bool is_direct(const mmu *memory, uint32_t address, uint32_t size) {
+
+    if (address > SRAM_END) {
+        return false;
+    }
+
+    uint32_t region_size = address <= CODE_END ? memory->get_code_size() : memory->get_sram_size();
+    uint32_t offset = address <= CODE_END ? address - CODE_BEGIN : address - SRAM_BEGIN;
+
+    return offset < region_size && region_size - offset >= size && !memory->is_slow(address, size);
+}
+
+}
+
+lockstep::lockstep(const std::vector<cpu *> &lanes) : lanes(lanes),
+                                                      states(lanes.size()),
+                                                      remaining(lanes.size(), 0),
+                                                      branch_target(0),
+                                                      vector_instructions(0),
+                                                      scalar_instructions(0),
+                                                      split_lanes(0),
+                                                      rejoined_lanes(0) {
+    for (cpu *lane : lanes) {
+        memories.push_back(lane->get_mmu());
+    }
+}
+
+void lockstep::load(lane_group &group, size_t position) {
+
+    const cpu_state &state = states[group.members[position]];
+    lane_block &block = group.blocks[position / LOCKSTEP_WIDTH];
+    size_t lane = position % LOCKSTEP_WIDTH;
+
+    for (int i = 0; i < 15; ++i) {
+        block.registers[i][lane] = state.registers[i].to_uint;
+    }
+    block.n[lane] = state.psr_register.n;
+    block.z[lane] = state.psr_register.z;
+    block.c[lane] = state.psr_register.c;
+    block.v[lane] = state.psr_register.v;
+}
+
+void lockstep::save(lane_group &group, size_t position, uint32_t address) {
+
+    size_t member = group.members[position];
+    cpu_state &state = states[member];
+    const lane_block &block = group.blocks[position / LOCKSTEP_WIDTH];
+    size_t lane = position % LOCKSTEP_WIDTH;
+
+    for (int i = 0; i < 15; ++i) {
+        state.registers[i].to_uint = block.registers[i][lane];
+    }
+    state.registers[15].to_uint = address + 2;
+    state.psr_register.n = block.n[lane] != 0;
+    state.psr_register.z = block.z[lane] != 0;
+    state.psr_register.c = block.c[lane] != 0;
+    state.psr_register.v = block.v[lane] != 0;
+    state.cycles += group.unsynced;
+    state.instructions += group.unsynced;
+    remaining[member] -= group.unsynced;
+}
+
+void lockstep::sync(lane_group &group) {
+
+    if (group.unsynced == 0) {
+        return;
+    }
+
+    for (size_t position = 0; position < group.members.size(); ++position) {
+        save(group, position, group.pc);
+    }
+
+    group.budget -= group.unsynced;
+    group.unsynced = 0;
+}
+
+void lockstep::attach(lane_group &group, size_t member) {
+
+    // the cpu did not run the vector instructions the group ran so far, the next sync adds them to every cpu
+    states[member].cycles -= group.unsynced;
+    states[member].instructions -= group.unsynced;
+    remaining[member] += group.unsynced;
+
+    group.members.push_back(member);
+    group.blocks.resize((group.members.size() + LOCKSTEP_WIDTH - 1) / LOCKSTEP_WIDTH);
+    group.budget = std::min<uint64_t>(group.budget, remaining[member]);
+    load(group, group.members.size() - 1);
+}
+
+void lockstep::detach(lane_group &group, size_t position, uint32_t address) {
+
+    save(group, position, address);
+
+    // the last cpu of the group takes the place
+    size_t last = group.members.size() - 1;
+    if (position != last) {
+        lane_block &to = group.blocks[position / LOCKSTEP_WIDTH];
+        const lane_block &from = group.blocks[last / LOCKSTEP_WIDTH];
+        size_t to_lane = position % LOCKSTEP_WIDTH;
+        size_t from_lane = last % LOCKSTEP_WIDTH;
+
+        for (int i = 0; i < 15; ++i) {
+            to.registers[i][to_lane] = from.registers[i][from_lane];
+        }
+        to.n[to_lane] = from.n[from_lane];
+        to.z[to_lane] = from.z[from_lane];
+        to.c[to_lane] = from.c[from_lane];
+        to.v[to_lane] = from.v[from_lane];
+        group.members[position] = group.members[last];
+    }
+
+    group.members.pop_back();
+    group.blocks.resize((group.members.size() + LOCKSTEP_WIDTH - 1) / LOCKSTEP_WIDTH);
+}
+
+size_t lockstep::find(uint32_t address) const {
+
+    // there are only a few groups, they are looked through directly
+    size_t index = 0;
+    while (index < groups.size() && groups[index].pc != address) {
+        ++index;
+    }
+
+    return index;
+}
+
+void lockstep::place(const std::vector<size_t> &candidates) {
+
+    // the groups that were there before, the cpus that join them rejoin
+    size_t existing = groups.size();
+
+    for (size_t member : candidates) {
+
+        // the cpu is done, its state goes back at the end of the run
+        if (remaining[member] == 0) {
+            continue;
+        }
+
+        uint32_t address = states[member].registers[15].to_uint - 2;
+        size_t index = find(address);
+        if (index == groups.size()) {
+            groups.push_back({address, {}, {}, 0, UINT64_MAX});
+        } else if (index < existing) {
+            ++rejoined_lanes;
+        }
+
+        attach(groups[index], member);
+    }
+}
+
+void lockstep::remove(size_t index) {
+    groups[index] = std::move(groups.back());
+    groups.pop_back();
+}
+
+void lockstep::regroup(size_t index) {
+
+    lane_group group = std::move(groups[index]);
+    remove(index);
+
+    sync(group);
+    place(group.members);
+}
+
+void lockstep::merge(size_t index) {
+
+    // the smaller group joins the bigger one
+    size_t other = 0;
+    while (other == index || groups[other].pc != groups[index].pc) {
+        ++other;
+    }
+    if (groups[index].members.size() > groups[other].members.size()) {
+        std::swap(index, other);
+    }
+
+    lane_group &group = groups[index];
+    sync(group);
+    for (size_t member : group.members) {
+        attach(groups[other], member);
+    }
+    rejoined_lanes += group.members.size();
+
+    remove(index);
+}
+
+void lockstep::count_split(const std::vector<size_t> &candidates) {
+
+    // the most common instruction keeps the group, the cpus at the others are split out
+    std::vector<uint32_t> addresses;
+    for (size_t member : candidates) {
+        addresses.push_back(states[member].registers[15].to_uint);
+    }
+    std::sort(addresses.begin(), addresses.end());
+
+    size_t most = 0;
+    for (size_t i = 0, j; i < addresses.size(); i = j) {
+        for (j = i; j < addresses.size() && addresses[j] == addresses[i]; ++j);
+        most = std::max(most, j - i);
+    }
+
+    split_lanes += addresses.size() - most;
+}
+
+size_t lockstep::lowest() const {
+
+    size_t index = 0;
+    for (size_t i = 1; i < groups.size(); ++i) {
+        if (groups[i].pc < groups[index].pc) {
+            index = i;
+        }
+    }
+
+    return index;
+}
+
+bool lockstep::transfer(lane_group &group, memory_access access, uint32_t rd) {
+
+    static const uint32_t sizes[] = {4, 2, 2, 1, 1, 4, 2, 1};
+    uint32_t size = sizes[access];
+    size_t count = group.members.size();
+
+    // every cpu has to be able to make its access, or none of them makes it here
+    for (size_t position = 0; position < count; ++position) {
+        uint32_t address = group.blocks[position / LOCKSTEP_WIDTH].address[position % LOCKSTEP_WIDTH];
+        if (!is_direct(memories[group.members[position]], address, size)) {
+            return false;
+        }
+    }
+
+    for (size_t position = 0; position < count; ++position) {
+
+        mmu *memory = memories[group.members[position]];
+        lane_block &block = group.blocks[position / LOCKSTEP_WIDTH];
+        size_t lane = position % LOCKSTEP_WIDTH;
+        uint32_t address = block.address[lane];
+        uint32_t value = block.registers[rd][lane];
+
+        switch (access) {
+            case LOAD_WORD: value = memory->read32(address); break;
+            case LOAD_HALF: value = memory->read16(address); break;
+            case LOAD_SIGNED_HALF: value = (uint32_t) (int16_t) memory->read16s(address); break;
+            case LOAD_BYTE: value = memory->read8(address); break;
+            case LOAD_SIGNED_BYTE: value = (uint32_t) (int8_t) memory->read8(address); break;
+            case STORE_WORD: memory->write32(address, value); break;
+            case STORE_HALF: memory->write16(address, (uint16_t) value); break;
+            default: memory->write8(address, (uint8_t) value); break;
+        }
+
+        if (access < STORE_WORD) {
+            block.registers[rd][lane] = value;
+        }
+    }
+
+    return true;
+}
+
+lockstep::step_result lockstep::execute_vector(lane_group &group, uint16_t instr) {
+
+    // the lanes past the end of the group are computed too, nobody looks at them
+    size_t count = group.blocks.size();
+    lane_block *block = group.blocks.data();
+    uint32_t rd = instr & 7;
+    uint32_t rs = (instr >> 3) & 7;
+
+    switch (decode(instr)) {
+
+        // LSL, LSR and ASR by an immediate, the shifts by 0 are left to the cpu
+        case MOVE_SHIFTED_REGISTER: {
+
+            uint32_t offset5 = (instr >> 6) & 31;
+            uint32_t op = (instr >> 11) & 3;
+            if (offset5 == 0) {
+                return STEP_SCALAR;
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                lane_block &b = block[i];
+                lane_vector value = b.registers[rs];
+                if (op == 0) {
+                    b.c = (value >> (32 - offset5)) & 1;
+                    value = value << offset5;
+                } else if (op == 1) {
+                    b.c = (value >> (offset5 - 1)) & 1;
+                    value = value >> offset5;
+                } else {
+                    b.c = (lane_vector) ((signed_lane_vector) value >> (int) (offset5 - 1)) & 1;
+                    value = (lane_vector) ((signed_lane_vector) value >> (int) offset5);
+                }
+                b.registers[rd] = value;
+                b.n = neg(value);
+                b.z = is_zero(value);
+            }
+            break;
+        }
+
+        // ADD and SUB with a register or a 3 bit immediate, the flags are computed like the cpu does
+        case ADD_SUBTRACT: {
+
+            uint32_t rn_offset3 = (instr >> 6) & 7;
+            bool subtract = ((instr >> 9) & 1) != 0;
+            bool immediate = ((instr >> 10) & 1) != 0;
+
+            for (size_t i = 0; i < count; ++i) {
+                lane_block &b = block[i];
+                lane_vector value = immediate ? splat(rn_offset3) : b.registers[rn_offset3];
+                b.registers[rd] = subtract ? b.registers[rs] - value : b.registers[rs] + value;
+                b.z = is_zero(b.registers[rd]);
+                b.n = neg(b.registers[rd]);
+                b.c = add_carry(b.registers[rs], value, b.registers[rd]);
+                b.v = add_overflow(b.registers[rs], value, b.registers[rd]);
+            }
+            break;
+        }
+
+        // MOV, CMP, ADD and SUB with an 8 bit immediate
+        case MOVE_COMPARE_ADD_SUBTRACT_IMMEDIATE: {
+
+            uint32_t offset8 = instr & 0xFF;
+            uint32_t op = (instr >> 11) & 3;
+            rd = (instr >> 8) & 7;
+
+            for (size_t i = 0; i < count; ++i) {
+                lane_block &b = block[i];
+                lane_vector lhs = b.registers[rd];
+                lane_vector rhs = splat(offset8);
+                switch (op) {
+                    case 0b00: {
+                        b.registers[rd] = rhs;
+                        b.n = lane_vector{};
+                        b.z = is_zero(rhs);
+                        break;
+                    }
+                    case 0b01: {
+                        lane_vector res = lhs - rhs;
+                        b.z = is_zero(res);
+                        b.n = neg(res);
+                        b.c = sub_carry(lhs, rhs, res);
+                        b.v = sub_overflow(lhs, rhs, res);
+                        break;
+                    }
+                    case 0b10: {
+                        lane_vector res = lhs + rhs;
+                        b.registers[rd] = res;
+                        b.z = is_zero(res);
+                        b.n = neg(res);
+                        b.c = add_carry(lhs, rhs, res);
+                        b.v = add_overflow(lhs, rhs, res);
+                        break;
+                    }
+                    default: {
+                        lane_vector res = lhs - rhs;
+                        b.registers[rd] = res;
+                        b.z = is_zero(res);
+                        b.n = neg(res);
+                        b.c = add_carry(lhs, rhs, res);
+                        b.v = sub_overflow(lhs, rhs, res);
+                        break;
+                    }
+                }
+            }
+            break;
+        }
+
+        // the ALU operations, the shifts and rotations by a register are left to the cpu
+        case ALU_OPERATIONS: {
+
+            uint32_t op = (instr >> 6) & 15;
+            if (op == 0b0010 || op == 0b0011 || op == 0b0100 || op == 0b0111 || op == 0b1000) {
+                return STEP_SCALAR;
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                lane_block &b = block[i];
+                lane_vector lhs = b.registers[rd];
+                lane_vector rhs = b.registers[rs];
+                lane_vector res;
+                switch (op) {
+                    case 0b0000: res = b.registers[rd] = lhs & rhs; break;
+                    case 0b0001: res = b.registers[rd] = lhs ^ rhs; break;
+                    case 0b0101: {
+                        res = b.registers[rd] = lhs + rhs + b.c;
+                        b.c = add_carry(lhs, rhs, res);
+                        b.v = add_overflow(lhs, rhs, res);
+                        break;
+                    }
+                    case 0b0110: {
+                        res = b.registers[rd] = lhs - rhs - (b.c ^ 1);
+                        b.c = sub_carry(lhs, rhs, res);
+                        b.v = sub_overflow(lhs, rhs, res);
+                        break;
+                    }
+                    case 0b1001: res = lhs & rhs; break;
+                    case 0b1010: {
+                        res = b.registers[rd] = lane_vector{} - rhs;
+                        b.c = sub_carry(lane_vector{}, rhs, res);
+                        b.v = sub_overflow(lane_vector{}, rhs, res);
+                        break;
+                    }
+                    case 0b1011: {
+                        res = lhs + rhs;
+                        b.c = add_carry(lhs, rhs, res);
+                        b.v = add_overflow(lhs, rhs, res);
+                        break;
+                    }
+                    case 0b1100: res = b.registers[rd] = lhs | rhs; break;
+                    case 0b1101: res = b.registers[rd] = rhs * lhs; break;
+                    case 0b1110: res = b.registers[rd] = lhs & ~rhs; break;
+                    default: res = b.registers[rd] = ~rhs; break;
+                }
+                b.n = neg(res);
+                b.z = is_zero(res);
+            }
+            break;
+        }
+
+        // ADD, CMP and MOV with the high registers, unless they use the PC or move the stack pointer, and BX
+        case HI_REGISTER_OPERATIONS_BRANCH_EXCHANGE: {
+
+            uint32_t op_h1_h2 = (instr >> 6) & 15;
+            uint32_t hd = rd + ((op_h1_h2 & 2) != 0 ? 8 : 0);
+            uint32_t hs = rs + ((op_h1_h2 & 1) != 0 ? 8 : 0);
+            uint32_t op = op_h1_h2 >> 2;
+
+            // BX Rs, BX Hs
+            if (op == 0b11 && (op_h1_h2 & 2) == 0) {
+                return hs != 15 ? uniform_branch(group, hs) : STEP_SCALAR;
+            }
+
+            // the cpu keeps the watermark of the stack pointer it writes
+            if (hd == 15 || hs == 15 || op == 0b11 || (op_h1_h2 & 3) == 0 || (hd == 13 && op != 0b01)) {
+                return STEP_SCALAR;
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                lane_block &b = block[i];
+                if (op == 0b00) {
+                    b.registers[hd] += b.registers[hs];
+                } else if (op == 0b01) {
+                    lane_vector lhs = b.registers[hd];
+                    lane_vector rhs = b.registers[hs];
+                    lane_vector res = lhs - rhs;
+                    b.z = is_zero(res);
+                    b.n = neg(res);
+                    b.c = sub_carry(lhs, rhs, res);
+                    b.v = sub_overflow(lhs, rhs, res);
+                } else {
+                    b.registers[hd] = b.registers[hs];
+                }
+            }
+            break;
+        }
+
+        // LDR Rd, [PC, #Imm], the PC is the same for the group
+        case PC_RELATIVE_LOAD: {
+
+            uint32_t address = ((group.pc + 4) & 0xFFFFFFFC) + ((instr & 0xFF) << 2);
+            for (size_t i = 0; i < count; ++i) {
+                block[i].address = splat(address);
+            }
+            if (!transfer(group, LOAD_WORD, (instr >> 8) & 7)) {
+                return STEP_SCALAR;
+            }
+            break;
+        }
+
+        // the loads and the stores with a register offset
+        case LOAD_STORE_WITH_REGISTER_OFFSET:
+        case LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD: {
+
+            static const memory_access word_byte[] = {STORE_WORD, STORE_BYTE, LOAD_WORD, LOAD_BYTE};
+            static const memory_access sign_extended[] = {STORE_HALF, LOAD_HALF, LOAD_SIGNED_BYTE, LOAD_SIGNED_HALF};
+            uint32_t op = (instr >> 10) & 3;
+            uint32_t ro = (instr >> 6) & 7;
+
+            for (size_t i = 0; i < count; ++i) {
+                block[i].address = block[i].registers[rs] + block[i].registers[ro];
+            }
+            memory_access access = decode(instr) == LOAD_STORE_WITH_REGISTER_OFFSET ? word_byte[op] : sign_extended[op];
+            if (!transfer(group, access, rd)) {
+                return STEP_SCALAR;
+            }
+            break;
+        }
+
+        // the loads and the stores with an immediate offset, the offsets are taken the way the cpu takes them
+        case LOAD_STORE_WITH_IMMEDIATE_OFFSET:
+        case LOAD_STORE_HALFWORD_IMMEDIATE_OFFSET:
+        case SP_RELATIVE_LOAD_STORE: {
+
+            static const memory_access immediate[] = {STORE_WORD, STORE_BYTE, LOAD_WORD, LOAD_BYTE};
+            uint32_t offset5 = (instr >> 6) & 31;
+            bool flag = ((instr >> 11) & 1) != 0;
+
+            memory_access access;
+            switch (decode(instr)) {
+                case LOAD_STORE_WITH_IMMEDIATE_OFFSET: access = immediate[(instr >> 11) & 3]; break;
+                case LOAD_STORE_HALFWORD_IMMEDIATE_OFFSET: access = flag ? STORE_HALF : STORE_BYTE; break;
+                default: access = flag ? STORE_WORD : LOAD_WORD; break;
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                lane_block &b = block[i];
+                if (decode(instr) == SP_RELATIVE_LOAD_STORE) {
+                    b.address = b.registers[rs] + (offset5 << 2);
+                } else if (access == LOAD_BYTE) {
+                    b.address = b.registers[rs] + offset5;
+                } else {
+                    b.address = b.registers[rs] + b.registers[offset5 & 7];
+                }
+            }
+            if (!transfer(group, access, rd)) {
+                return STEP_SCALAR;
+            }
+            break;
+        }
+
+        // ADD Rd, PC, #Imm and ADD Rd, SP, #Imm
+        case LOAD_ADDRESS: {
+
+            uint32_t offset = (instr & 255) << 2;
+            rd = (instr >> 8) & 7;
+            for (size_t i = 0; i < count; ++i) {
+                lane_block &b = block[i];
+                if (((instr >> 11) & 1) != 0) {
+                    b.registers[rd] = splat(((group.pc + 4) & 0xFFFFFFFC) + offset);
+                } else {
+                    b.registers[rd] = b.registers[13] + offset;
+                }
+            }
+            break;
+        }
+
+        // the branch stays in the group if every cpu goes the same way, the group is split otherwise
+        case CONDITIONAL_BRANCH: {
+
+            uint32_t flag = (instr >> 8) & 15;
+            auto offset = (int8_t) (instr & 0xFF);
+            if (flag >= 0b1110) {
+                return STEP_SCALAR;
+            }
+
+            // the cpu has to run the hooks and the returns
+            uint32_t target = group.pc + 4 + (offset << 1);
+            if (target >= CALL_RETURN_ADDRESS || lanes[group.members[0]]->is_hooked(target)) {
+                return STEP_SCALAR;
+            }
+
+            size_t count_taken = 0;
+            taken.resize(group.members.size());
+            for (size_t i = 0; i < count; ++i) {
+                const lane_block &b = block[i];
+                lane_vector goes;
+                switch (flag) {
+                    case 0b0000: goes = b.z; break;
+                    case 0b0001: goes = b.z ^ 1; break;
+                    case 0b0010: goes = b.c; break;
+                    case 0b0011: goes = b.c ^ 1; break;
+                    case 0b0100: goes = b.n; break;
+                    case 0b0101: goes = b.n ^ 1; break;
+                    case 0b0110: goes = b.v; break;
+                    case 0b0111: goes = b.v ^ 1; break;
+                    case 0b1000: goes = b.c & (b.z ^ 1); break;
+                    case 0b1001: goes = (b.c ^ 1) | b.z; break;
+                    case 0b1010: goes = b.n ^ b.v ^ 1; break;
+                    case 0b1011: goes = b.n ^ b.v; break;
+                    case 0b1100: goes = (b.z ^ 1) & (b.n ^ b.v ^ 1); break;
+                    default: goes = b.z | (b.n ^ b.v); break;
+                }
+
+                for (size_t lane = 0; lane < LOCKSTEP_WIDTH && i * LOCKSTEP_WIDTH + lane < taken.size(); ++lane) {
+                    taken[i * LOCKSTEP_WIDTH + lane] = (uint8_t) goes[lane];
+                    count_taken += goes[lane];
+                }
+            }
+
+            if (count_taken == 0) {
+                break;
+            }
+            if (count_taken == taken.size()) {
+                group.pc = target;
+                return STEP_VECTOR;
+            }
+
+            // the cpus diverge
+            branch_target = target;
+            return STEP_DIVERGED;
+        }
+
+        // B label
+        case UNCONDITIONAL_BRANCH: {
+
+            uint32_t offset = (instr & 0x3FF) << 1;
+            if (instr & 0x0400) {
+                offset |= 0xFFFFF800;
+            }
+
+            uint32_t target = group.pc + 4 + offset;
+            if (target >= CALL_RETURN_ADDRESS || lanes[group.members[0]]->is_hooked(target)) {
+                return STEP_SCALAR;
+            }
+
+            group.pc = target;
+            return STEP_VECTOR;
+        }
+
+        default:
+            return STEP_SCALAR;
+    }
+
+    group.pc += 2;
+    return STEP_VECTOR;
+}
+
+lockstep::step_result lockstep::uniform_branch(lane_group &group, uint32_t rs) {
+
+    // the cpus have to go to the same place in the thumb state
+    uint32_t target = group.blocks[0].registers[rs][0];
+    for (size_t position = 1; position < group.members.size(); ++position) {
+        if (group.blocks[position / LOCKSTEP_WIDTH].registers[rs][position % LOCKSTEP_WIDTH] != target) {
+            return STEP_SCALAR;
+        }
+    }
+
+    // the cpu has to run the hooks and the returns
+    if ((target & 1) == 0 || target >= CALL_RETURN_ADDRESS || lanes[group.members[0]]->is_hooked(target)) {
+        return STEP_SCALAR;
+    }
+
+    group.pc = target & 0xFFFFFFFE;
+    return STEP_VECTOR;
+}
+
+void lockstep::diverge(size_t index) {
+
+    // the branch retired on every cpu
+    lane_group &group = groups[index];
+    ++group.unsynced;
+    ++vector_instructions;
+
+    // the most of the cpus stay in the group, the others move out from the last position down
+    size_t count_taken = 0;
+    for (uint8_t flag : taken) {
+        count_taken += flag;
+    }
+    bool stay = count_taken * 2 >= taken.size();
+    uint32_t other = stay ? group.pc + 2 : branch_target;
+
+    std::vector<size_t> leaving;
+    for (size_t position = taken.size(); position-- != 0;) {
+        if ((taken[position] != 0) != stay) {
+            leaving.push_back(group.members[position]);
+            detach(group, position, other);
+        }
+    }
+    group.pc = stay ? branch_target : group.pc + 2;
+    split_lanes += leaving.size();
+
+    // they join the group that waits at their instruction or start a new one
+    size_t target = find(other);
+    if (target == groups.size()) {
+        groups.push_back({other, {}, {}, 0, UINT64_MAX});
+    } else {
+        rejoined_lanes += leaving.size();
+    }
+    for (size_t member : leaving) {
+        attach(groups[target], member);
+    }
+}
+
+void lockstep::execute_scalar(size_t index) {
+
+    lane_group group = std::move(groups[index]);
+    groups[index] = std::move(groups.back());
+    groups.pop_back();
+
+    sync(group);
+
+    std::vector<size_t> candidates;
+    for (size_t member : group.members) {
+
+        // the cpu takes over the state of the group and executes the instruction
+        cpu *lane = lanes[member];
+        lane->restore_state(states[member]);
+        lane->run(1);
+        --remaining[member];
+        ++scalar_instructions;
+
+        // a halted cpu leaves the group for good
+        if (!lane->is_halted()) {
+            states[member] = lane->save_state();
+            candidates.push_back(member);
+        }
+    }
+
+    count_split(candidates);
+    place(candidates);
+}
+
+void lockstep::run(size_t n_instr) {
+
+    // the cpus start in the groups of their instructions
+    std::vector<size_t> candidates;
+    for (size_t lane = 0; lane < lanes.size(); ++lane) {
+        if (!lanes[lane]->is_halted()) {
+            states[lane] = lanes[lane]->save_state();
+            remaining[lane] = n_instr;
+            candidates.push_back(lane);
+        }
+    }
+    place(candidates);
+
+    while (!groups.empty()) {
+
+        // the group at the lowest instruction runs until it reaches the next one, so the others can catch up
+        size_t index = lowest();
+        lane_group &group = groups[index];
+        uint32_t next = UINT32_MAX;
+        for (const lane_group &other : groups) {
+            if (&other != &group) {
+                next = std::min(next, other.pc);
+            }
+        }
+
+        step_result result = STEP_VECTOR;
+        while (group.unsynced != group.budget && group.pc < next) {
+
+            // the cpus have the same code so we fetch it from the first one
+            auto instr = (uint16_t) memories[group.members[0]]->read16(group.pc);
+
+            result = execute_vector(group, instr);
+            if (result != STEP_VECTOR) {
+                break;
+            }
+            ++group.unsynced;
+            ++vector_instructions;
+        }
+
+        if (result == STEP_DIVERGED) {
+            diverge(index);
+        } else if (result == STEP_SCALAR) {
+            execute_scalar(index);
+        } else if (group.unsynced == group.budget) {
+            // some cpus are done
+            regroup(index);
+        } else if (group.pc == next) {
+            // the group met another one
+            merge(index);
+        }
+    }
+
+    // the cpus that did not halt get their state back
+    for (size_t lane : candidates) {
+        if (!lanes[lane]->is_halted()) {
+            lanes[lane]->restore_state(states[lane]);
+        }
+    }
+}
@@ -0,0 +1,303 @@
+//
+// Created by dimitrije on 10/14/26.
+//
+
+#ifndef EMULATOR_M0_LOCKSTEP_H
+#define EMULATOR_M0_LOCKSTEP_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "cpu.h"
+
+/**
+ * The number of lanes we execute with one vector operation, a 512 bit vector with AVX-512 and a 256 bit one
+ * otherwise (two SSE registers if AVX2 is not enabled either)
+ */
+#if defined(__AVX512F__)
+const size_t LOCKSTEP_WIDTH = 16;
+#else
+const size_t LOCKSTEP_WIDTH = 8;
+#endif
+
+/**
+ * A register of LOCKSTEP_WIDTH lanes, it only needs the alignment of the elements so it can live in a std::vector
+ */
+typedef uint32_t lane_vector __attribute__((vector_size(LOCKSTEP_WIDTH * sizeof(uint32_t)), aligned(sizeof(uint32_t))));
+typedef int32_t signed_lane_vector __attribute__((vector_size(LOCKSTEP_WIDTH * sizeof(uint32_t)), aligned(sizeof(uint32_t))));
+
+/**
+ * Runs many cpus with the same code in lockstep. The cpus that are at the same instruction form a group, the
+ * registers and the flags of the group are kept in structure of arrays form, and the data processing instructions
+ * are executed for LOCKSTEP_WIDTH cpus at once with vector operations. The loads and the stores compute their
+ * addresses for the whole group and access the memory of every cpu in a loop, the branches that send the whole
+ * group to the same place move its PC. The other instructions (the stack operations, the calls, the system
+ * instructions and the accesses of the peripherals or of the slow pages) are executed by each cpu on its own.
+ *
+ * A conditional branch that sends the cpus to different places splits the group. The group at the lowest
+ * instruction runs first, so the others wait for it after the loop or the if it is in and the cpus that meet at an
+ * instruction rejoin into one group.
+ *
+ * The cycles of the vector instructions are added to the cpus at the next instruction they execute on their own,
+ * so the events of their peripherals are not serviced in between. The lockstep is meant for the firmware that
+ * computes on its sram, like a parameter sweep over many inputs.
+ */
+class lockstep {
+
+private:
+
+    /**
+     * The registers and the flags of LOCKSTEP_WIDTH cpus, the flags are 0 or 1 in every lane. The PC is the
+     * same for the whole group so it is not in here. The address is where the load or the store that is executed
+     * goes to.
+     */
+    struct lane_block {
+        lane_vector registers[15];
+        lane_vector n;
+        lane_vector z;
+        lane_vector c;
+        lane_vector v;
+        lane_vector address;
+    };
+
+    /**
+     * The cpus at the same instruction, the cpu at the position N is the lane N % LOCKSTEP_WIDTH of the block
+     * N / LOCKSTEP_WIDTH
+     */
+    struct lane_group {
+
+        /**
+         * The address of the next instruction of the group
+         */
+        uint32_t pc;
+
+        /**
+         * The cpus and their registers
+         */
+        std::vector<size_t> members;
+        std::vector<lane_block> blocks;
+
+        /**
+         * The number of vector instructions since the states of the cpus were updated, and the number of
+         * instructions the group can run before one of its cpus is done
+         */
+        uint64_t unsynced;
+        uint64_t budget;
+    };
+
+    /**
+     * What happened to the group when it executed an instruction
+     *
+     * STEP_VECTOR - the instruction was executed for the whole group
+     * STEP_DIVERGED - the conditional branch sent the cpus of the group to different places
+     * STEP_SCALAR - every cpu has to execute the instruction on its own
+     */
+    enum step_result {
+        STEP_VECTOR,
+        STEP_DIVERGED,
+        STEP_SCALAR
+    };
+
+    /**
+     * The accesses the loads and the stores make, they mirror what the cpu does for each format
+     */
+    enum memory_access {
+        LOAD_WORD,
+        LOAD_HALF,
+        LOAD_SIGNED_HALF,
+        LOAD_BYTE,
+        LOAD_SIGNED_BYTE,
+        STORE_WORD,
+        STORE_HALF,
+        STORE_BYTE
+    };
+
+    /**
+     * The cpus we are running and their memory
+     */
+    std::vector<cpu *> lanes;
+    std::vector<mmu *> memories;
+
+    /**
+     * The state of every cpu when its group was last synced and the number of instructions it still has to run
+     */
+    std::vector<cpu_state> states;
+    std::vector<size_t> remaining;
+
+    /**
+     * The groups of the cpus that are still running
+     */
+    std::vector<lane_group> groups;
+
+    /**
+     * The cpus of a group that took the branch they diverged at and where it goes
+     */
+    std::vector<uint8_t> taken;
+    uint32_t branch_target;
+
+    /**
+     * The statistics of the runs
+     */
+    uint64_t vector_instructions;
+    uint64_t scalar_instructions;
+    uint64_t split_lanes;
+    uint64_t rejoined_lanes;
+
+    /**
+     * Puts the state of the cpu at a position of a group into its blocks
+     * @param group the group
+     * @param position the position
+     */
+    void load(lane_group &group, size_t position);
+
+    /**
+     * Puts the registers of the cpu at a position of a group back into its state, with the cycles of the vector
+     * instructions
+     * @param group the group
+     * @param position the position
+     * @param address the address of the next instruction of the cpu
+     */
+    void save(lane_group &group, size_t position, uint32_t address);
+
+    /**
+     * Puts the registers of the group back into the states of its cpus
+     * @param group the group
+     */
+    void sync(lane_group &group);
+
+    /**
+     * Adds a cpu to a group, its state has to be up to date
+     * @param group the group
+     * @param member the cpu
+     */
+    void attach(lane_group &group, size_t member);
+
+    /**
+     * Takes the cpu at a position out of a group, its state is brought up to date
+     * @param group the group
+     * @param position the position
+     * @param address the address of the next instruction of the cpu
+     */
+    void detach(lane_group &group, size_t position, uint32_t address);
+
+    /**
+     * Returns the index of the group at an instruction
+     * @param address the address of the instruction
+     * @return the index, the number of groups if there is none
+     */
+    size_t find(uint32_t address) const;
+
+    /**
+     * Puts the cpus into the groups of their instructions, they rejoin a group that is already there. The cpus
+     * that are done are left out.
+     * @param candidates the cpus
+     */
+    void place(const std::vector<size_t> &candidates);
+
+    /**
+     * Removes a group, the last one takes its index
+     * @param index the index of the group
+     */
+    void remove(size_t index);
+
+    /**
+     * Takes a group apart and places its cpus again
+     * @param index the index of the group
+     */
+    void regroup(size_t index);
+
+    /**
+     * Merges a group with the other group at its instruction
+     * @param index the index of the group
+     */
+    void merge(size_t index);
+
+    /**
+     * Counts the cpus that do not go on with the most of the others, the states have to be synced
+     * @param candidates the cpus
+     */
+    void count_split(const std::vector<size_t> &candidates);
+
+    /**
+     * Returns the index of the group at the lowest instruction
+     * @return the index
+     */
+    size_t lowest() const;
+
+    /**
+     * Checks that every cpu of the group can access its memory at its address directly and makes the accesses
+     * @param group the group
+     * @param access what the cpus do
+     * @param rd the register that is loaded or stored
+     * @return false if a cpu has to make its access on its own
+     */
+    bool transfer(lane_group &group, memory_access access, uint32_t rd);
+
+    /**
+     * Executes an instruction for the whole group with vector operations
+     * @param group the group
+     * @param instr the instruction
+     * @return what happened to the group
+     */
+    step_result execute_vector(lane_group &group, uint16_t instr);
+
+    /**
+     * Moves the group to the address in a register if every cpu of the group has the same one
+     * @param group the group
+     * @param rs the register
+     * @return STEP_SCALAR if the cpus go to different places or the cpu has to handle the branch
+     */
+    step_result uniform_branch(lane_group &group, uint32_t rs);
+
+    /**
+     * Splits a group at the conditional branch its cpus diverged at
+     * @param index the index of the group
+     */
+    void diverge(size_t index);
+
+    /**
+     * Executes the next instruction on every cpu of a group on its own
+     * @param index the index of the group
+     */
+    void execute_scalar(size_t index);
+
+public:
+
+    /**
+     * Creates the lockstep of cpus, they have to have the same code and they stay owned by the caller
+     * @param lanes the cpus
+     */
+    explicit lockstep(const std::vector<cpu *> &lanes);
+
+    /**
+     * Runs every cpu for N instructions, a cpu that halts stops early like it does in cpu::run
+     * @param n_instr the number of instructions
+     */
+    void run(size_t n_instr);
+
+    /**
+     * Returns the number of instructions that were executed for a group at once
+     * @return the number of instructions
+     */
+    inline uint64_t get_vector_instructions() const { return vector_instructions; }
+
+    /**
+     * Returns the number of instructions the cpus of a group executed on their own
+     * @return the number of instructions
+     */
+    inline uint64_t get_scalar_instructions() const { return scalar_instructions; }
+
+    /**
+     * Returns the number of times a cpu was split out of its group
+     * @return the number of splits
+     */
+    inline uint64_t get_split_lanes() const { return split_lanes; }
+
+    /**
+     * Returns the number of times a cpu rejoined a group that was waiting at its instruction
+     * @return the number of rejoins
+     */
+    inline uint64_t get_rejoined_lanes() const { return rejoined_lanes; }
+};
+
+#endif //EMULATOR_M0_LOCKSTEP_H
@@ -4,17 +4,64 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
 #include "../pheripherals/peripheral.h"
 #include "mmu.h"
 
 
-mmu::mmu(uint8_t *code_region, uint8_t *sram_region) : code_region(code_region), sram_region(sram_region) {}
+mmu::mmu(uint8_t *code_region, uint8_t *sram_region, uint32_t code_size, uint32_t sram_size) : code_region(code_region),
+                                                                                             sram_region(sram_region),
+                                                                                             code_size(code_size),
+                                                                                             sram_size(sram_size),
+                                                                                             slow_marks(0),
+                                                                                             access(&direct_access),
+                                                                                             dispatch(&direct_access),
+                                                                                             flat_base(nullptr),
+                                                                                             flat_enabled(true),
+                                                                                             shared_sram(false),
+                                                                                             origin(ACCESS_CPU) {}
+
+void mmu::map_flat(flat_memory *memory) {
+
+    if (code_size == 0 || sram_size == 0) {
+        throw std::runtime_error("the flat memory needs the sizes of the code and sram regions");
+    }
+
+    // copy the regions into the flat memory
+    std::memcpy(memory->get_base() + CODE_BEGIN, code_region, code_size);
+    std::memcpy(memory->get_base() + SRAM_BEGIN, sram_region, sram_size);
+
+    // from now on the regions are in the flat memory, the offset into a window is the offset from its base
+    code_region = memory->get_base() + CODE_BEGIN;
+    sram_region = memory->get_base() + SRAM_BEGIN;
+
+    // and the accessors of the cpu just add the address to its base
+    flat_base = memory->get_base();
+    update_access();
+}
+
+void mmu::set_flat_access(bool value) {
+    flat_enabled = value;
+    update_access();
+}
 
 void mmu::register_peripheral(peripheral *p) {
 
-    // check if there is a peripheral that is conflicting with this one
-    for (auto r : peripherals) {
-        if (r->in_conflict(p)) {
+    // the peripheral has to be in the peripheral region
+    if (p->get_start_address() > p->get_end_address() || !in_peripheral_region(p->get_start_address()) ||
+        !in_peripheral_region(p->get_end_address())) {
+        throw std::runtime_error("could not register the peripheral : " + p->get_name() +
+                                 " it is not in the peripheral region\n");
+    }
+
+    // find where it goes, only the neighbours can be in conflict with it
+    auto it = std::upper_bound(peripherals.begin(), peripherals.end(), p,
+                               [](const peripheral *a, const peripheral *b) {
+                                   return a->get_start_address() < b->get_start_address();
+                               });
+
+    for (auto r : {it == peripherals.begin() ? nullptr : *(it - 1), it == peripherals.end() ? nullptr : *it}) {
+        if (r != nullptr && r->in_conflict(p)) {
             throw std::runtime_error(
                     "could not register the peripheral peripheral : " + p->get_name() + " in conflict with : " +
                     r->get_name() + "\n");
@@ -22,108 +69,315 @@ void mmu::register_peripheral(peripheral *p) {
     }
 
     // add the peripheral
-    peripherals.push_back(p);
+    peripherals.insert(it, p);
 }
 
-uint32_t mmu::read32(uint32_t address) {
-    // the check if we are writing to code
-    if(address <= CODE_END && address >= CODE_BEGIN) {
-        return*((uint32_t*)(&code_region[address - CODE_BEGIN]));
+void mmu::reset_peripherals() {
+    for (auto p : peripherals) {
+        p->reset();
     }
+}
 
-    // check if we are writing to sram
-    if(address <= SRAM_END && address >= SRAM_BEGIN) {
-        return *((uint32_t*)(&sram_region[address - SRAM_BEGIN]));
+void mmu::mark_slow(uint32_t address, uint32_t length) {
+
+    if (length == 0 || address > SRAM_END || SRAM_END - address < length - 1) {
+        throw std::runtime_error("only the code and sram windows can have slow pages");
     }
 
-    return 0;
+    // the table is allocated the first time it is needed
+    if (slow_pages.empty()) {
+        slow_pages.resize(((uint64_t) SRAM_END + 1) >> MMU_PAGE_SHIFT, 0);
+    }
+
+    for (uint32_t page = address >> MMU_PAGE_SHIFT; page <= (address + length - 1) >> MMU_PAGE_SHIFT; ++page) {
+        ++slow_pages[page];
+        ++slow_marks;
+    }
+
+    // the accesses check the pages from now on
+    update_access();
 }
 
-void mmu::write32(uint32_t address, uint32_t value) {
-    // the check if we are writing to code
-    if(address <= CODE_END && address >= CODE_BEGIN) {
-        *((uint32_t*)(&code_region[address - CODE_BEGIN])) = value;
+void mmu::unmark_slow(uint32_t address, uint32_t length) {
+
+    if (length == 0 || slow_pages.empty() || address > SRAM_END || SRAM_END - address < length - 1) {
         return;
     }
 
-    // check if we are writing to sram
-    if(address <= SRAM_END && address >= SRAM_BEGIN) {
-        *((uint32_t*)(&sram_region[address - SRAM_BEGIN])) = value;
-        return;
+    for (uint32_t page = address >> MMU_PAGE_SHIFT; page <= (address + length - 1) >> MMU_PAGE_SHIFT; ++page) {
+        if (slow_pages[page] != 0) {
+            --slow_pages[page];
+            --slow_marks;
+        }
+    }
+
+    // no page is slow, the accesses can skip the table
+    update_access();
+}
+
+bool mmu::is_slow(uint32_t address, uint32_t length) const {
+
+    if (length == 0 || address > SRAM_END) {
+        return false;
+    }
+
+    // the shared sram can only be accessed through the mmu
+    uint32_t last = SRAM_END - address < length - 1 ? SRAM_END : address + length - 1;
+    if (shared_sram && last >= SRAM_BEGIN) {
+        return true;
+    }
+
+    if (slow_marks == 0) {
+        return false;
     }
+    for (uint32_t page = address >> MMU_PAGE_SHIFT; page <= last >> MMU_PAGE_SHIFT; ++page) {
+        if (slow_pages[page] != 0) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
-void mmu::write16(uint32_t address, uint16_t value) {
-    // the check if we are writing to code
-    if(address <= CODE_END && address >= CODE_BEGIN) {
-        *((uint16_t*)(&code_region[address - CODE_BEGIN])) = value;
-        return;
+void mmu::set_shared(bool value) {
+    shared_sram = value;
+    update_access();
+}
+
+void mmu::update_access() {
+    if (slow_marks != 0) {
+        dispatch = shared_sram ? &checked_shared_access : &checked_access;
+    } else {
+        dispatch = shared_sram ? &shared_access : &direct_access;
     }
 
-    // check if we are writing to sram
-    if(address <= SRAM_END && address >= SRAM_BEGIN) {
-         *((uint16_t*)(&sram_region[address - SRAM_BEGIN])) = value;
+    // the flat memory only replaces the plain accessors of the cpu
+    bool flat = flat_base != nullptr && flat_enabled && origin == ACCESS_CPU && dispatch == &direct_access;
+    access = flat ? &flat_access : dispatch;
+}
+
+void mmu::add_observer(memory_observer *observer) {
+    if (std::find(observers.begin(), observers.end(), observer) == observers.end()) {
+        observers.push_back(observer);
+    }
+}
+
+void mmu::remove_observer(memory_observer *observer) {
+    observers.erase(std::remove(observers.begin(), observers.end(), observer), observers.end());
+}
+
+uint8_t *mmu::resolve_region(uint32_t address, uint32_t &region_begin, uint32_t &region_end) {
+
+    // is it in the code region
+    if (address - CODE_BEGIN < code_size) {
+        region_begin = CODE_BEGIN;
+        region_end = CODE_BEGIN + code_size;
+        return code_region;
+    }
+
+    // is it in the sram region
+    if (address - SRAM_BEGIN < sram_size) {
+        region_begin = SRAM_BEGIN;
+        region_end = SRAM_BEGIN + sram_size;
+        return sram_region;
+    }
+
+    // is it in a peripheral that is a plain register file
+    if (in_peripheral_region(address)) {
+        peripheral *p = find_peripheral(address);
+        if (p != nullptr && p->get_backing() != nullptr) {
+            region_begin = p->get_start_address();
+            region_end = p->get_end_address() + 1;
+            return p->get_backing();
+        }
+    }
+
+    return nullptr;
+}
+
+void mmu::read_block(uint32_t address, uint32_t *values, uint32_t count) {
+
+    uint32_t region_begin, region_end;
+    uint8_t *region = resolve_region(address, region_begin, region_end);
+
+    // the whole block is in one region, so we copy it at once unless it has to be observed
+    if (region != nullptr && region_end - address >= 4 * count && !is_slow(address, 4 * count)) {
+        std::memcpy(values, region + (address - region_begin), 4 * count);
         return;
     }
+
+    // the whole block is in a peripheral, it gets it in one call
+    if (region == nullptr && count != 0 && in_peripheral_region(address)) {
+        peripheral *p = find_peripheral(address);
+        if (p != nullptr && p->get_end_address() - address >= 4 * count - 1) {
+            p->read_block(address, values, count);
+            return;
+        }
+    }
+
+    // the block crosses a region, go word by word through the peripherals
+    for (uint32_t i = 0; i < count; ++i) {
+        values[i] = read_dispatched<uint32_t>(address + 4 * i);
+    }
 }
 
-uint16_t mmu::read16(uint32_t address) {
-    // the check if we are writing to code
-    if(address <= CODE_END && address >= CODE_BEGIN) {
-        return*((uint16_t*)(&code_region[address - CODE_BEGIN]));
+void mmu::write_block(uint32_t address, const uint32_t *values, uint32_t count) {
+
+    uint32_t region_begin, region_end;
+    uint8_t *region = resolve_region(address, region_begin, region_end);
+
+    // the whole block is in one region, so we copy it at once unless it has to be observed
+    if (region != nullptr && region_end - address >= 4 * count && !is_slow(address, 4 * count)) {
+        std::memcpy(region + (address - region_begin), values, 4 * count);
+        return;
     }
 
-    // check if we are writing to sram
-    if(address <= SRAM_END && address >= SRAM_BEGIN) {
-        return *((uint16_t*)(&sram_region[address - SRAM_BEGIN]));
+    // the whole block is in a peripheral, it gets it in one call
+    if (region == nullptr && count != 0 && in_peripheral_region(address)) {
+        peripheral *p = find_peripheral(address);
+        if (p != nullptr && p->get_end_address() - address >= 4 * count - 1) {
+            p->write_block(address, values, count);
+            return;
+        }
     }
 
-    return 0;
+    // the block crosses a region, go word by word through the peripherals
+    for (uint32_t i = 0; i < count; ++i) {
+        write_dispatched<uint32_t>(address + 4 * i, values[i]);
+    }
 }
 
-void mmu::write8(uint32_t address, uint8_t value) {
+void mmu::read_bytes(uint32_t address, uint8_t *data, uint32_t length) {
 
-    // the check if we are writing to code
-    if(address <= CODE_END && address >= CODE_BEGIN) {
-        code_region[address - CODE_BEGIN] = value;
+    uint32_t region_begin, region_end;
+    uint8_t *region = resolve_region(address, region_begin, region_end);
+
+    // the whole buffer is in one region and it does not have to be observed
+    if (region != nullptr && region_end - address >= length && !is_slow(address, length)) {
+        std::memcpy(data, region + (address - region_begin), length);
         return;
     }
 
-    // check if we are writing to sram
-    if(address <= SRAM_END && address >= SRAM_BEGIN) {
-        sram_region[address - SRAM_BEGIN] = value;
+    // byte by byte, the ones outside of the memory are not touched so that we do not fault
+    for (uint32_t i = 0; i < length; ++i) {
+        data[i] = is_backed(address + i) ? read_dispatched<uint8_t>(address + i) : (uint8_t) 0;
+    }
+}
+
+void mmu::write_bytes(uint32_t address, const uint8_t *data, uint32_t length) {
+
+    uint32_t region_begin, region_end;
+    uint8_t *region = resolve_region(address, region_begin, region_end);
+
+    // the whole buffer is in one region and it does not have to be observed
+    if (region != nullptr && region_end - address >= length && !is_slow(address, length)) {
+        std::memcpy(region + (address - region_begin), data, length);
         return;
     }
 
-    // fix the peripherals
+    // byte by byte, the ones outside of the memory are not touched so that we do not fault
+    for (uint32_t i = 0; i < length; ++i) {
+        if (is_backed(address + i)) {
+            write_dispatched<uint8_t>(address + i, data[i]);
+        }
+    }
 }
-uint32_t mmu::read8(uint32_t address) {
 
-    // the check if we are writing to code
+template <typename T, bool shared>
+T mmu::read_direct(uint32_t address) {
+
+    // the check if we are reading code
     if(address <= CODE_END && address >= CODE_BEGIN) {
-        return code_region[address - CODE_BEGIN];
+        return *((T*)(&code_region[address - CODE_BEGIN]));
     }
 
-    // check if we are writing to sram
+    // check if we are reading sram
     if(address <= SRAM_END && address >= SRAM_BEGIN) {
-        return sram_region[address - SRAM_BEGIN];
+        return load<T, shared>((T*)(&sram_region[address - SRAM_BEGIN]));
+    }
+
+    // forward it to the peripheral that has this address
+    if (in_peripheral_region(address)) {
+        return read_peripheral<T>(address);
     }
 
-    // this
     return 0;
 }
 
-uint16_t mmu::read16s(uint32_t address) {
+template <typename T, bool shared>
+void mmu::write_direct(uint32_t address, T value) {
+
     // the check if we are writing to code
     if(address <= CODE_END && address >= CODE_BEGIN) {
-        return*((uint16_t*)(&code_region[address - CODE_BEGIN]));
+        *((T*)(&code_region[address - CODE_BEGIN])) = value;
+        return;
     }
 
     // check if we are writing to sram
     if(address <= SRAM_END && address >= SRAM_BEGIN) {
-        return *((uint16_t*)(&sram_region[address - SRAM_BEGIN]));
+        store<T, shared>((T*)(&sram_region[address - SRAM_BEGIN]), value);
+        return;
     }
 
-    return 0;
+    // forward it to the peripheral that has this address
+    if (in_peripheral_region(address)) {
+        write_peripheral(address, value);
+    }
+}
+
+template <typename T>
+T mmu::read_flat(uint32_t address) {
+    return *((T*)(flat_base + address));
+}
+
+template <typename T>
+void mmu::write_flat(uint32_t address, T value) {
+    *((T*)(flat_base + address)) = value;
 }
 
+template <typename T, bool shared>
+T mmu::read_checked(uint32_t address) {
+
+    // the slow pages are observed
+    if (address <= SRAM_END && slow_pages[address >> MMU_PAGE_SHIFT] != 0) {
+        return read_slow<T, shared>(address);
+    }
+
+    return read_direct<T, shared>(address);
+}
+
+template <typename T, bool shared>
+void mmu::write_checked(uint32_t address, T value) {
+
+    // the slow pages are observed
+    if (address <= SRAM_END && slow_pages[address >> MMU_PAGE_SHIFT] != 0) {
+        write_slow<T, shared>(address, value);
+        return;
+    }
+
+    write_direct<T, shared>(address, value);
+}
+
+const mmu::access_table mmu::direct_access = {&mmu::read_direct<uint32_t, false>, &mmu::read_direct<uint16_t, false>,
+                                              &mmu::read_direct<uint8_t, false>, &mmu::write_direct<uint32_t, false>,
+                                              &mmu::write_direct<uint16_t, false>, &mmu::write_direct<uint8_t, false>};
+
+const mmu::access_table mmu::checked_access = {&mmu::read_checked<uint32_t, false>, &mmu::read_checked<uint16_t, false>,
+                                               &mmu::read_checked<uint8_t, false>, &mmu::write_checked<uint32_t, false>,
+                                               &mmu::write_checked<uint16_t, false>,
+                                               &mmu::write_checked<uint8_t, false>};
+
+const mmu::access_table mmu::shared_access = {&mmu::read_direct<uint32_t, true>, &mmu::read_direct<uint16_t, true>,
+                                              &mmu::read_direct<uint8_t, true>, &mmu::write_direct<uint32_t, true>,
+                                              &mmu::write_direct<uint16_t, true>, &mmu::write_direct<uint8_t, true>};
+
+const mmu::access_table mmu::checked_shared_access = {&mmu::read_checked<uint32_t, true>,
+                                                      &mmu::read_checked<uint16_t, true>,
+                                                      &mmu::read_checked<uint8_t, true>,
+                                                      &mmu::write_checked<uint32_t, true>,
+                                                      &mmu::write_checked<uint16_t, true>,
+                                                      &mmu::write_checked<uint8_t, true>};
+
+const mmu::access_table mmu::flat_access = {&mmu::read_flat<uint32_t>, &mmu::read_flat<uint16_t>, &mmu::read_flat<uint8_t>,
+                                            &mmu::write_flat<uint32_t>, &mmu::write_flat<uint16_t>,
+                                            &mmu::write_flat<uint8_t>};
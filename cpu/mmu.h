@@ -6,7 +6,10 @@
 #define EMULATOR_M0_MMU_H
 
 #include <vector>
+#include <algorithm>
+#include <cstring>
 #include <peripheral.h>
+#include "flat_memory.h"
 
 /**
  * The regions start amd end values
@@ -17,6 +20,54 @@ const uint32_t SRAM_END = 0x3FFFFFFF;
 const uint32_t CODE_BEGIN = 0x00000000;
 const uint32_t CODE_END = 0x1FFFFFFF;
 
+const uint32_t PERIPHERAL_BEGIN = 0x40000000;
+const uint32_t PERIPHERAL_END = 0x5FFFFFFF;
+
+/**
+ * The size of the pages the mmu can mark as slow
+ */
+const uint32_t MMU_PAGE_SHIFT = 12;
+const uint32_t MMU_PAGE_SIZE = 1u << MMU_PAGE_SHIFT;
+
+/**
+ * Who makes the accesses to the memory
+ *
+ * ACCESS_CPU - the instruction the cpu executes
+ * ACCESS_DMA - a transfer of the dma controller
+ * ACCESS_HOST - the host on behalf of the firmware or the user, a library hook, a semihosting call or the debugger
+ */
+enum access_origin {
+    ACCESS_CPU,
+    ACCESS_DMA,
+    ACCESS_HOST
+};
+
+/**
+ * Gets the accesses to the slow pages of the mmu
+ */
+class memory_observer {
+public:
+
+    virtual ~memory_observer() = default;
+
+    /**
+     * Called after a value was read from a slow page
+     * @param address the address of the value
+     * @param size the size of the value in bytes
+     * @param value the value
+     */
+    virtual void on_read(uint32_t address, uint32_t size, uint32_t value) = 0;
+
+    /**
+     * Called after a value was written to a slow page
+     * @param address the address of the value
+     * @param size the size of the value in bytes
+     * @param old_value the value that was overwritten
+     * @param new_value the value that was written
+     */
+    virtual void on_write(uint32_t address, uint32_t size, uint32_t old_value, uint32_t new_value) = 0;
+};
+
 class mmu {
 private:
 
@@ -31,67 +82,558 @@ private:
     uint8_t *sram_region;
 
     /**
-     * The list of all peripheral this cpu has
+     * The number of bytes allocated for the code region
+     */
+    uint32_t code_size;
+
+    /**
+     * The number of bytes allocated for the sram region
+     */
+    uint32_t sram_size;
+
+    /**
+     * The list of all peripheral this cpu has sorted by their start address, they do not overlap so the one
+     * that contains an address is found with a binary search
      */
     std::vector<peripheral *> peripherals;
 
+    /**
+     * Finds the peripheral that contains the address
+     * @param address 32 bit address
+     * @return the peripheral or nullptr if there is none
+     */
+    inline peripheral *find_peripheral(uint32_t address) {
+
+        // the first peripheral that starts after the address, the one before it is the only candidate
+        auto it = std::upper_bound(peripherals.begin(), peripherals.end(), address,
+                                   [](uint32_t a, const peripheral *p) { return a < p->get_start_address(); });
+
+        if (it == peripherals.begin() || address > (*(it - 1))->get_end_address()) {
+            return nullptr;
+        }
+
+        return *(it - 1);
+    }
+
+    /**
+     * Reads a value from the peripheral that contains the address, a peripheral with a backing memory is read directly
+     * @param address 32 bit address
+     * @return the value or 0 if no peripheral contains the address
+     */
+    template <typename T>
+    inline T read_peripheral(uint32_t address) {
+
+        peripheral *p = find_peripheral(address);
+        if (p == nullptr) {
+            return 0;
+        }
+
+        // a plain register file, the bytes past its end read as 0
+        if (p->get_backing() != nullptr) {
+            uint8_t *host = &p->get_backing()[address - p->get_start_address()];
+            if (p->get_end_address() - address >= sizeof(T) - 1) {
+                return *((T*)host);
+            }
+            T value = 0;
+            std::memcpy(&value, host, p->get_end_address() - address + 1);
+            return value;
+        }
+
+        T value;
+        p->read(address, value);
+        return value;
+    }
+
+    /**
+     * Writes a value to the peripheral that contains the address, a peripheral with a backing memory is written directly
+     * @param address 32 bit address
+     * @param value the value we want to write
+     */
+    template <typename T>
+    inline void write_peripheral(uint32_t address, T value) {
+
+        peripheral *p = find_peripheral(address);
+        if (p == nullptr) {
+            return;
+        }
+
+        // a plain register file, the bytes past its end are dropped
+        if (p->get_backing() != nullptr) {
+            uint8_t *host = &p->get_backing()[address - p->get_start_address()];
+            if (p->get_end_address() - address >= sizeof(T) - 1) {
+                *((T*)host) = value;
+            } else {
+                std::memcpy(host, &value, p->get_end_address() - address + 1);
+            }
+            return;
+        }
+
+        p->write(address, value);
+    }
+
+    /**
+     * Checks if the address is in the peripheral region
+     * @param address 32 bit address
+     * @return true if it is
+     */
+    static inline bool in_peripheral_region(uint32_t address) {
+        return address - PERIPHERAL_BEGIN <= PERIPHERAL_END - PERIPHERAL_BEGIN;
+    }
+
+    /**
+     * The number of times each page of the code and sram windows was marked as slow
+     */
+    std::vector<uint16_t> slow_pages;
+
+    /**
+     * The number of marks on all the pages
+     */
+    uint64_t slow_marks;
+
+    /**
+     * The observers of the accesses to the slow pages
+     */
+    std::vector<memory_observer *> observers;
+
+    /**
+     * The accessors of one way to access the memory
+     */
+    struct access_table {
+        uint32_t (mmu::*read32)(uint32_t address);
+        uint16_t (mmu::*read16)(uint32_t address);
+        uint8_t (mmu::*read8)(uint32_t address);
+        void (mmu::*write32)(uint32_t address, uint32_t value);
+        void (mmu::*write16)(uint32_t address, uint16_t value);
+        void (mmu::*write8)(uint32_t address, uint8_t value);
+    };
+
+    /**
+     * The accessors that go straight to the memory and the ones that check the slow pages first, and the same for
+     * an sram that other threads access at the same time
+     */
+    static const access_table direct_access;
+    static const access_table checked_access;
+    static const access_table shared_access;
+    static const access_table checked_shared_access;
+
+    /**
+     * The accessors that add the address to the base of the flat memory and nothing else, everything that is not in
+     * the code or sram region faults
+     */
+    static const access_table flat_access;
+
+    /**
+     * The accessors in use, the checked ones only while a page is slow so that the other accesses do not pay for it
+     */
+    const access_table *access;
+
+    /**
+     * The accessors that look at the windows and dispatch the peripherals, the same as access unless the flat ones
+     * are in use
+     */
+    const access_table *dispatch;
+
+    /**
+     * The host address of the guest address 0 if the regions are mapped into a flat memory, nullptr otherwise
+     */
+    uint8_t *flat_base;
+
+    /**
+     * False while the flat accessors must not be used, see set_flat_access
+     */
+    bool flat_enabled;
+
+    /**
+     * True if other threads access the sram at the same time
+     */
+    bool shared_sram;
+
+    /**
+     * Picks the accessors for the slow pages, the sharing of the sram and the flat memory
+     */
+    void update_access();
+
+    /**
+     * Who makes the accesses right now
+     */
+    access_origin origin;
+
+    /**
+     * Reads a value from the code or sram region or from a peripheral
+     * @param address 32 bit address
+     * @return the value or 0 if nothing is at the address
+     */
+    template <typename T, bool shared>
+    T read_direct(uint32_t address);
+
+    /**
+     * Writes a value to the code or sram region or to a peripheral
+     * @param address 32 bit address
+     * @param value the value we want to write
+     */
+    template <typename T, bool shared>
+    void write_direct(uint32_t address, T value);
+
+    /**
+     * Reads a value from the flat memory
+     * @param address 32 bit address
+     * @return the value
+     */
+    template <typename T>
+    T read_flat(uint32_t address);
+
+    /**
+     * Writes a value to the flat memory
+     * @param address 32 bit address
+     * @param value the value we want to write
+     */
+    template <typename T>
+    void write_flat(uint32_t address, T value);
+
+    /**
+     * Reads a value, through the observers if it is in a slow page
+     * @param address 32 bit address
+     * @return the value or 0 if nothing is at the address
+     */
+    template <typename T, bool shared>
+    T read_checked(uint32_t address);
+
+    /**
+     * Writes a value, through the observers if it is in a slow page
+     * @param address 32 bit address
+     * @param value the value we want to write
+     */
+    template <typename T, bool shared>
+    void write_checked(uint32_t address, T value);
+
+    /**
+     * Checks if the address is in the code or sram region or in the peripheral region, a region whose size is
+     * not known covers its whole window
+     * @param address the address
+     * @return true if it is
+     */
+    inline bool is_backed(uint32_t address) const {
+        if (address <= CODE_END) {
+            return code_size == 0 || address - CODE_BEGIN < code_size;
+        }
+        if (address <= SRAM_END) {
+            return sram_size == 0 || address - SRAM_BEGIN < sram_size;
+        }
+        return in_peripheral_region(address);
+    }
+
+    /**
+     * Returns the host memory of an address in the code or sram window
+     * @param address the address
+     * @return the host memory
+     */
+    template <typename T>
+    inline T *host_address(uint32_t address) {
+        return (T*) (address <= CODE_END ? &code_region[address - CODE_BEGIN] : &sram_region[address - SRAM_BEGIN]);
+    }
+
+    /**
+     * Loads a value from the host memory, with a relaxed atomic load if other threads access it at the same time
+     * @param host the host memory
+     * @return the value
+     */
+    template <typename T, bool shared>
+    static inline T load(const T *host) {
+        return shared ? __atomic_load_n(host, __ATOMIC_RELAXED) : *host;
+    }
+
+    /**
+     * Stores a value to the host memory, with a relaxed atomic store if other threads access it at the same time
+     * @param host the host memory
+     * @param value the value
+     */
+    template <typename T, bool shared>
+    static inline void store(T *host, T value) {
+        if (shared) {
+            __atomic_store_n(host, value, __ATOMIC_RELAXED);
+        } else {
+            *host = value;
+        }
+    }
+
+    /**
+     * Reads a value from a slow page and tells the observers about it
+     * @param address the address
+     * @return the value
+     */
+    template <typename T, bool shared>
+    inline T read_slow(uint32_t address) {
+        T value = address <= CODE_END ? *host_address<T>(address) : load<T, shared>(host_address<T>(address));
+        for (auto observer : observers) {
+            observer->on_read(address, sizeof(T), value);
+        }
+        return value;
+    }
+
+    /**
+     * Writes a value to a slow page and tells the observers about it
+     * @param address the address
+     * @param value the value
+     */
+    template <typename T, bool shared>
+    inline void write_slow(uint32_t address, T value) {
+        T *host = host_address<T>(address);
+        T old_value;
+        if (address <= CODE_END) {
+            old_value = *host;
+            *host = value;
+        } else {
+            old_value = load<T, shared>(host);
+            store<T, shared>(host, value);
+        }
+        for (auto observer : observers) {
+            observer->on_write(address, sizeof(T), old_value, value);
+        }
+    }
+
 public:
 
-    mmu(uint8_t *code_region, uint8_t *sram_region);
+    /**
+     * Creates the mmu over the given regions. If the sizes are not provided they are not known, the accessors
+     * still reach the regions but nothing resolves to their host memory, so the fetch, the block accessors and
+     * the flat memory can not use it directly
+     * @param code_region the memory of the code region
+     * @param sram_region the memory of the sram region
+     * @param code_size the size of the code region in bytes, 0 if it is not known
+     * @param sram_size the size of the sram region in bytes, 0 if it is not known
+     */
+    mmu(uint8_t *code_region, uint8_t *sram_region, uint32_t code_size = 0, uint32_t sram_size = 0);
+
+    /**
+     * Returns the size of the code region
+     * @return the size in bytes, 0 if it is not known
+     */
+    inline uint32_t get_code_size() const { return code_size; }
+
+    /**
+     * Returns the size of the sram region
+     * @return the size in bytes, 0 if it is not known
+     */
+    inline uint32_t get_sram_size() const { return sram_size; }
+
+    /**
+     * Moves the code and sram regions into a flat memory, the current content of the regions is copied over.
+     * After this the accessors of the cpu add the address to the base of the flat memory without looking at it, so
+     * an access to a peripheral or to an unmapped address hits an inaccessible page and faults. The block and byte
+     * accessors and the accesses of the host and the dma still dispatch the peripherals. The flat accessors are not
+     * used while a page is slow or the sram is shared. The sizes of the regions have to be known
+     * @param memory the flat memory, it has to be at least as large as the regions
+     */
+    void map_flat(flat_memory *memory);
+
+    /**
+     * Turns the flat accessors off and on, the cpu turns them off to execute an instruction that faulted on a
+     * peripheral again through the peripherals
+     * @param value false if the accesses have to dispatch the peripherals, true to go back to the flat memory
+     */
+    void set_flat_access(bool value);
 
     /**
-     * Registers a peripheral to the mmu
-     * @param p the peripheral we want to add
+     * Checks if the accessors go straight to the flat memory, an access that faults came from them
+     * @return true if they do
+     */
+    inline bool uses_flat_access() const { return access == &flat_access; }
+
+    /**
+     * Registers a peripheral to the mmu, the accesses to its addresses are forwarded to it
+     * @param p the peripheral we want to add, it has to be in the peripheral region and must not overlap
+     * with the other peripherals
      */
     void register_peripheral(peripheral *p);
 
+    /**
+     * Resets all the peripherals
+     */
+    void reset_peripherals();
+
+    /**
+     * Resolves the region that contains the address to the host memory that backs it
+     * @param address 32 bit address
+     * @param region_begin the first address of the region is stored here
+     * @param region_end the address after the last byte of the region is stored here
+     * @return the host memory of the region or nullptr if the address is not backed by the code or sram region or
+     * by the memory of a peripheral
+     */
+    uint8_t *resolve_region(uint32_t address, uint32_t &region_begin, uint32_t &region_end);
+
+    /**
+     * Marks the pages of a range as slow, the accesses to them go to the observers. While a page is slow the
+     * accessors check the page of every access, otherwise they go straight to the memory. The pages are counted so that every mark has to be removed by unmark_slow.
+     * @param address the start of the range, it has to be in the code or sram window
+     * @param length the length of the range in bytes
+     */
+    void mark_slow(uint32_t address, uint32_t length);
+
+    /**
+     * Removes a mark of mark_slow
+     * @param address the start of the range
+     * @param length the length of the range in bytes
+     */
+    void unmark_slow(uint32_t address, uint32_t length);
+
+    /**
+     * Checks if a range has a slow page or a part of a shared sram, the code that accesses the host memory directly
+     * has to go through the mmu if it does
+     * @param address the start of the range
+     * @param length the length of the range in bytes
+     * @return true if it does
+     */
+    bool is_slow(uint32_t address, uint32_t length) const;
+
+    /**
+     * Makes the sram accesses relaxed atomic accesses, for an sram that the cpus on other host threads access at
+     * the same time. The sram counts as slow for is_slow, so the copies go value by value through the mmu
+     * @param value true if the sram is shared
+     */
+    void set_shared(bool value);
+
+    /**
+     * Adds an observer of the accesses to the slow pages
+     * @param observer the observer
+     */
+    void add_observer(memory_observer *observer);
+
+    /**
+     * Returns who makes the accesses right now, the observers use it to tell the instructions apart from the rest
+     * @return the origin, ACCESS_CPU unless something else set it
+     */
+    inline access_origin get_origin() const { return origin; }
+
+    /**
+     * Sets who makes the accesses from now on, it has to be set back when it is done. Only the cpu uses the flat
+     * accessors, the host and the dma can not execute an access again after a fault
+     * @param new_origin the origin
+     * @return the origin it replaced
+     */
+    inline access_origin set_origin(access_origin new_origin) {
+        access_origin previous = origin;
+        origin = new_origin;
+        update_access();
+        return previous;
+    }
+
+    /**
+     * Removes an observer
+     * @param observer the observer
+     */
+    void remove_observer(memory_observer *observer);
+
     /**
      * Reads a 32 bit value from a given address
      * @param address 32 bit address
      * @return the value that was read
      */
-    uint32_t read32(uint32_t address);
+    inline uint32_t read32(uint32_t address) { return (this->*access->read32)(address); }
 
     /**
      * Reads a 16 bit value from a given address
      * @param address 32 bit address
      * @return the value that was read
      */
-    uint16_t read16(uint32_t address);
+    inline uint16_t read16(uint32_t address) { return (this->*access->read16)(address); }
 
     /**
      * Reads a 8 bit value from a given address
      * @param address 32 bit address
      * @return the value that was read
      */
-    uint32_t read8(uint32_t address);
+    inline uint32_t read8(uint32_t address) { return (this->*access->read8)(address); }
 
     /**
      * Reads a 16 bit signed value from a given address
      * @param address 32 bit address
      * @return the value that was read
      */
-    uint16_t read16s(uint32_t i);
+    inline uint16_t read16s(uint32_t address) { return (this->*access->read16)(address); }
+
+    /**
+     * Reads a value through the accessors that dispatch the peripherals, so it does not fault on a peripheral even
+     * when the flat accessors are in use. For the callers that can not execute the access again, like the
+     * translated blocks
+     * @param address 32 bit address
+     * @return the value that was read
+     */
+    template <typename T>
+    inline T read_dispatched(uint32_t address) {
+        return sizeof(T) == 4 ? (T) (this->*dispatch->read32)(address) :
+               sizeof(T) == 2 ? (T) (this->*dispatch->read16)(address) : (T) (this->*dispatch->read8)(address);
+    }
+
+    /**
+     * Writes a value through the accessors that dispatch the peripherals, see read_dispatched
+     * @param address 32 bit address
+     * @param value the value we want to write
+     */
+    template <typename T>
+    inline void write_dispatched(uint32_t address, T value) {
+        if (sizeof(T) == 4) {
+            (this->*dispatch->write32)(address, (uint32_t) value);
+        } else if (sizeof(T) == 2) {
+            (this->*dispatch->write16)(address, (uint16_t) value);
+        } else {
+            (this->*dispatch->write8)(address, (uint8_t) value);
+        }
+    }
+
+    /**
+     * Reads consecutive 32 bit values starting from a given address, the region is resolved only once
+     * @param address 32 bit address of the first value
+     * @param values the array we are reading into
+     * @param count the number of values
+     */
+    void read_block(uint32_t address, uint32_t *values, uint32_t count);
+
+    /**
+     * Writes consecutive 32 bit values starting from a given address, the region is resolved only once
+     * @param address 32 bit address of the first value
+     * @param values the array we are writing from
+     * @param count the number of values
+     */
+    void write_block(uint32_t address, const uint32_t *values, uint32_t count);
+
+    /**
+     * Copies bytes from the memory into a host buffer, in one go if they are in one region. The bytes that are
+     * not in a region or a peripheral read as 0, so this never faults in a flat memory
+     * @param address 32 bit address of the first byte
+     * @param data the buffer we are copying to
+     * @param length the number of bytes
+     */
+    void read_bytes(uint32_t address, uint8_t *data, uint32_t length);
+
+    /**
+     * Copies bytes from a host buffer into the memory, in one go if they are in one region. The bytes that are
+     * not in a region or a peripheral are dropped, so this never faults in a flat memory
+     * @param address 32 bit address of the first byte
+     * @param data the buffer we are copying from
+     * @param length the number of bytes
+     */
+    void write_bytes(uint32_t address, const uint8_t *data, uint32_t length);
+
     /**
      * Writes a 32 bit value to an 32 bit address
      * @param address the 32 bit address
      * @param value the value we want to write
      */
-    void write32(uint32_t address, uint32_t value);
+    inline void write32(uint32_t address, uint32_t value) { (this->*access->write32)(address, value); }
 
     /**
      * Writes a 16 bit value to an 32 bit address
      * @param address the 32 bit address
      * @param value the value we want to write
      */
-    void write16(uint32_t address, uint16_t value);
+    inline void write16(uint32_t address, uint16_t value) { (this->*access->write16)(address, value); }
 
     /**
      * Writes a 8 bit value to an 32 bit address
      * @param address the 32 bit address
      * @param value the value we want to write
      */
-    void write8(uint32_t address, uint8_t value);
+    inline void write8(uint32_t address, uint8_t value) { (this->*access->write8)(address, value); }
 };
 
 #endif //EMULATOR_M0_MMU_H
@@ -0,0 +1,162 @@
+//
+// Created by dimitrije on 10/15/26.
+//
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include "multicore.h"
+
+namespace {
+
+/**
+ * The read only register that holds the number of the core, the writes to it are ignored
+ */
+class core_number : public peripheral {
+
+private:
+
+    /**
+     * The number of the core
+     */
+    uint32_t number;
+
+public:
+
+    core_number(uint32_t start_address, uint32_t number) :
+            peripheral(start_address, start_address + 3, "cpuid"), number(number) {}
+
+    void write(uint32_t, uint8_t) override {}
+    void write(uint32_t, uint16_t) override {}
+    void write(uint32_t, uint32_t) override {}
+
+    void read(uint32_t address, uint8_t &value) override { value = (uint8_t) (number >> (8 * (address & 3))); }
+    void read(uint32_t address, uint16_t &value) override { value = (uint16_t) (number >> (8 * (address & 2))); }
+    void read(uint32_t, uint32_t &value) override { value = number; }
+};
+
+}
+
+multicore::multicore(size_t count, uint32_t flash_size, uint32_t sram_size, uint64_t quantum) :
+        flash(flash_size), sram(sram_size), quantum(quantum), now(0), arrived(0), done(0), generation(0),
+        all_done(false) {
+
+    if (count == 0 || quantum == 0) {
+        throw std::runtime_error("a multicore needs at least one core and a quantum of at least one cycle");
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+
+        // every core works on the same memory
+        cpu *core = new cpu(flash.data(), flash_size, sram.data(), sram_size);
+        if (count > 1) {
+            core->get_mmu()->set_shared(true);
+        }
+
+        peripheral *id = new core_number(MULTICORE_CPUID_ADDRESS, (uint32_t) i);
+        core->get_mmu()->register_peripheral(id);
+
+        cores.push_back(core);
+        ids.push_back(id);
+    }
+
+    // SEV wakes up every core
+    for (cpu *core : cores) {
+        core->set_event_sender([this]() {
+            for (cpu *other : cores) {
+                other->set_event();
+            }
+        });
+    }
+}
+
+multicore::~multicore() {
+
+    for (cpu *core : cores) {
+        delete core;
+    }
+
+    for (peripheral *id : ids) {
+        delete id;
+    }
+}
+
+void multicore::reset() {
+
+    for (cpu *core : cores) {
+        core->reset();
+    }
+
+    now = 0;
+}
+
+bool multicore::barrier(bool stopped) {
+
+    std::unique_lock<std::mutex> guard(lock);
+
+    if (stopped) {
+        ++done;
+    }
+
+    // the last core to arrive lets the others go
+    if (++arrived == cores.size()) {
+        all_done = done == cores.size();
+        arrived = 0;
+        done = 0;
+        ++generation;
+        passed.notify_all();
+        return all_done;
+    }
+
+    uint64_t current = generation;
+    passed.wait(guard, [&]() { return generation != current; });
+
+    // nobody can pass the next barrier before we arrive at it, so this is still the result of ours
+    return all_done;
+}
+
+void multicore::run_core(cpu *core, uint64_t end) {
+
+    bool failed = false;
+    for (uint64_t start = now; start < end; start += std::min(quantum, end - start)) {
+
+        // run to the end of the quantum unless we are stopped
+        if (!failed && !core->is_halted()) {
+            try {
+                core->run_until(std::min(start + quantum, end));
+            } catch (...) {
+                std::unique_lock<std::mutex> guard(lock);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+
+        if (barrier(failed || core->is_halted())) {
+            return;
+        }
+    }
+}
+
+void multicore::run(uint64_t cycles) {
+
+    uint64_t end = now + cycles;
+    error = nullptr;
+
+    // the first core runs on this thread
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < cores.size(); ++i) {
+        threads.emplace_back(&multicore::run_core, this, cores[i], end);
+    }
+    run_core(cores[0], end);
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    now = end;
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,138 @@
+//
+// Created by dimitrije on 10/15/26.
+//
+
+#ifndef EMULATOR_M0_MULTICORE_H
+#define EMULATOR_M0_MULTICORE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <vector>
+#include "cpu.h"
+
+/**
+ * The number of cycles every core runs before it waits for the others, it is also how late a core that sleeps in WFE
+ * can see an event sent by another core
+ */
+const uint64_t MULTICORE_QUANTUM = 10000;
+
+/**
+ * The address of the read only register that holds the number of the core that reads it
+ */
+const uint32_t MULTICORE_CPUID_ADDRESS = 0x50000000;
+
+/**
+ * A number of cores that share the code and the sram, every core runs on its own host thread.
+ *
+ * The cores run in quanta of cycles, a core that finishes its quantum waits until all the others have finished
+ * theirs, so no core is more than a quantum ahead of another one. Within a quantum the cores run at the same time
+ * and access the shared sram with relaxed atomic accesses through their mmus, and DMB and DSB are a full fence on the
+ * host so the firmware orders its accesses the way it would on the hardware. The end of a quantum orders all the
+ * accesses made before it. The code is not written while the cores run, so it is read directly.
+ *
+ * SEV sets the event register of every core. A core that sleeps in WFE skips to the end of its quantum, so it wakes
+ * up as late as a quantum after the event was sent. The quantum bounds the lag, a smaller one wakes the core sooner
+ * but the cores wait for each other more often. There are no interrupts between the cores, the peripherals of a
+ * core interrupt only that core. The cores must not use a flat memory, it would give every core its own copy.
+ */
+class multicore {
+
+private:
+
+    /**
+     * The code and the sram all the cores share
+     */
+    std::vector<uint8_t> flash;
+    std::vector<uint8_t> sram;
+
+    /**
+     * The cores and the registers that hold their numbers
+     */
+    std::vector<cpu *> cores;
+    std::vector<peripheral *> ids;
+
+    /**
+     * The number of cycles in a quantum
+     */
+    uint64_t quantum;
+
+    /**
+     * The cycle all the cores have reached
+     */
+    uint64_t now;
+
+    /**
+     * The barrier at the end of a quantum, the number of cores that reached it and how many of them are done, the
+     * number of times it was passed, and whether all the cores were done the last time it was passed
+     */
+    std::mutex lock;
+    std::condition_variable passed;
+    size_t arrived;
+    size_t done;
+    uint64_t generation;
+    bool all_done;
+
+    /**
+     * The first error a core ran into during the run
+     */
+    std::exception_ptr error;
+
+    /**
+     * Waits until all the cores reach the end of the quantum
+     * @param stopped true if the core is halted or it failed
+     * @return true if all the cores are
+     */
+    bool barrier(bool stopped);
+
+    /**
+     * Runs a core quantum by quantum, it is the body of the host thread of the core
+     * @param core the core
+     * @param end the cycle the run ends at
+     */
+    void run_core(cpu *core, uint64_t end);
+
+public:
+
+    /**
+     * Creates the cores with the shared memory
+     * @param count the number of cores
+     * @param flash_size the size of the code region in bytes
+     * @param sram_size the size of the sram region in bytes
+     * @param quantum the number of cycles in a quantum, and the most a core in WFE can lag behind an event
+     */
+    multicore(size_t count, uint32_t flash_size, uint32_t sram_size, uint64_t quantum = MULTICORE_QUANTUM);
+
+    /**
+     * Deletes the cores
+     */
+    ~multicore();
+
+    /**
+     * Returns a core, its memory is the memory of all the cores
+     * @param index the number of the core
+     * @return the core
+     */
+    inline cpu *get_core(size_t index) const { return cores[index]; }
+
+    /**
+     * Returns the number of cores
+     * @return the number of cores
+     */
+    inline size_t get_core_count() const { return cores.size(); }
+
+    /**
+     * Resets every core
+     */
+    void reset();
+
+    /**
+     * Runs all the cores for a number of cycles, the run stops early when all the cores are halted. If a core
+     * fails the others finish the run and the error is thrown after it.
+     * @param cycles the number of cycles
+     */
+    void run(uint64_t cycles);
+};
+
+#endif //EMULATOR_M0_MULTICORE_H
@@ -6,6 +6,7 @@
 #define EMULATOR_M0_REGISTERS_H
 
 #include <cstdio>
+#include <cstdint>
 
 /**
  * The enumerations for different registers
@@ -35,4 +36,70 @@ const size_t SP = R13;
 const size_t LR = R14;
 const size_t PC = R15;
 
+struct psr {
+
+    /**
+     * Exception number
+     */
+    uint8_t exception_number;
+
+    /**
+     * Thumb state bit
+     */
+    bool t;
+
+    /**
+     * Overflow flag
+     */
+    bool v;
+
+    /**
+     * Carry or borrow flag
+     */
+    bool c;
+
+    /**
+     * Zero flag
+     */
+    bool z;
+
+    /**
+     * Negative flag
+     */
+    bool n;
+};
+
+/**
+ * The register type
+ */
+union arm_register_t {
+
+  /**
+   * Used to get the bytes (assuming little endian)
+   */
+  struct
+  {
+    uint8_t B0;
+    uint8_t B1;
+    uint8_t B2;
+    uint8_t B3;
+
+  } to_bytes;
+
+  /**
+   * Used to get the 16 words (assuming little endian)
+   */
+  struct
+  {
+    uint16_t W0;
+    uint16_t W1;
+
+  } to_half_words;
+
+  /**
+   * Used to get the unsigned 32-bit word
+   */
+  uint32_t to_uint;
+};
+
 #endif //EMULATOR_M0_REGISTERS_H
@@ -0,0 +1,21 @@
+//
+// Created by dimitrije on 10/7/26.
+//
+
+#include "scheduler.h"
+
+void scheduler::schedule(uint64_t due, std::function<void()> action) {
+    events.push(event{due, scheduled++, std::move(action)});
+}
+
+void scheduler::run_due(uint64_t now) {
+
+    while (!events.empty() && events.top().due <= now) {
+
+        // take the event out before we run it, it might schedule new ones
+        std::function<void()> action = events.top().action;
+        events.pop();
+
+        action();
+    }
+}
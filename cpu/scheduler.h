@@ -0,0 +1,94 @@
+//
+// Created by dimitrije on 10/7/26.
+//
+
+#ifndef EMULATOR_M0_SCHEDULER_H
+#define EMULATOR_M0_SCHEDULER_H
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+/**
+ * Keeps the events the peripherals want to happen at a certain cycle, the cpu runs them once its cycle count
+ * reaches them. Every instruction takes one cycle.
+ */
+class scheduler {
+
+private:
+
+    /**
+     * An event and the cycle it is due at
+     */
+    struct event {
+
+        /**
+         * The cycle the event is due at
+         */
+        uint64_t due;
+
+        /**
+         * The order in which the events were scheduled, the events due at the same cycle run in that order
+         */
+        uint64_t order;
+
+        /**
+         * What the event does
+         */
+        std::function<void()> action;
+
+        /**
+         * The event that is due later goes to the back of the queue
+         */
+        bool operator>(const event &other) const {
+            return due != other.due ? due > other.due : order > other.order;
+        }
+    };
+
+    /**
+     * The events ordered by the cycle they are due at
+     */
+    std::priority_queue<event, std::vector<event>, std::greater<event>> events;
+
+    /**
+     * The number of events scheduled so far
+     */
+    uint64_t scheduled;
+
+public:
+
+    /**
+     * The cycle that is never reached
+     */
+    static const uint64_t NEVER = UINT64_MAX;
+
+    scheduler() : scheduled(0) {}
+
+    /**
+     * Schedules an event
+     * @param due the cycle the event is due at
+     * @param action what the event does
+     */
+    void schedule(uint64_t due, std::function<void()> action);
+
+    /**
+     * Returns the cycle the next event is due at
+     * @return the cycle or NEVER if there are no events
+     */
+    inline uint64_t next_due() const { return events.empty() ? NEVER : events.top().due; }
+
+    /**
+     * Runs all the events that are due at the given cycle or before it, the events they schedule are run too
+     * if they are due
+     * @param now the current cycle
+     */
+    void run_due(uint64_t now);
+
+    /**
+     * Drops all the events
+     */
+    inline void clear() { events = decltype(events)(); }
+};
+
+#endif //EMULATOR_M0_SCHEDULER_H
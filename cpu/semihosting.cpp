@@ -0,0 +1,243 @@
+//
+// Created by dimitrije on 10/9/26.
+//
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "semihosting.h"
+#include "mmu.h"
+#include "input_log.h"
+
+namespace {
+
+/**
+ * The fopen modes of the SYS_OPEN modes
+ */
+const char *OPEN_MODES[] = {"r", "rb", "r+", "r+b", "w", "wb", "w+", "w+b", "a", "ab", "a+", "a+b"};
+
+/**
+ * The value returned by a call that failed
+ */
+const uint32_t FAILED = 0xFFFFFFFF;
+
+}
+
+semihosting::semihosting(mmu *memory) : memory(memory),
+                                        next_handle(1),
+                                        exited(false),
+                                        exit_code(0),
+                                        start(std::chrono::steady_clock::now()),
+                                        inputs(nullptr) {}
+
+semihosting::~semihosting() {
+    for (auto &it : files) {
+        if (it.second != stdin && it.second != stdout && it.second != stderr) {
+            fclose(it.second);
+        }
+    }
+}
+
+uint32_t semihosting::call(uint32_t operation, uint32_t parameters) {
+
+    // only the results of these calls depend on the host
+    bool from_host = operation == SYS_OPEN || operation == SYS_CLOSE || operation == SYS_WRITE ||
+                     operation == SYS_READ || operation == SYS_CLOCK;
+    if (inputs == nullptr || !from_host) {
+        return execute(operation, parameters);
+    }
+
+    // the log has the result followed by the data that was read
+    std::vector<uint8_t> data;
+    uint32_t result;
+
+    if (!inputs->is_replaying()) {
+        result = execute(operation, parameters);
+        data.resize(sizeof(result));
+        memcpy(data.data(), &result, sizeof(result));
+
+        if (operation == SYS_READ) {
+            uint32_t block[3];
+            read_words(parameters, block, 3);
+            uint32_t read = result <= block[2] ? block[2] - result : 0;
+            data.resize(sizeof(result) + read);
+            memory->read_bytes(block[1], data.data() + sizeof(result), read);
+        }
+
+        inputs->input(INPUT_SEMIHOSTING, operation, data);
+        return result;
+    }
+
+    // the other calls still run so that the firmware writes its files
+    if (operation != SYS_READ && operation != SYS_CLOCK) {
+        execute(operation, parameters);
+    }
+
+    inputs->input(INPUT_SEMIHOSTING, operation, data);
+    if (data.size() < sizeof(result)) {
+        throw std::runtime_error("the input log is corrupted");
+    }
+    memcpy(&result, data.data(), sizeof(result));
+
+    if (operation == SYS_READ) {
+        uint32_t buffer;
+        read_words(parameters + 4, &buffer, 1);
+        memory->write_bytes(buffer, data.data() + sizeof(result), (uint32_t) (data.size() - sizeof(result)));
+    }
+
+    return result;
+}
+
+uint32_t semihosting::execute(uint32_t operation, uint32_t parameters) {
+
+    switch (operation) {
+        case SYS_OPEN: return sys_open(parameters);
+        case SYS_CLOSE: return sys_close(parameters);
+        case SYS_WRITE0: return sys_write0(parameters);
+        case SYS_WRITE: return sys_write(parameters);
+        case SYS_READ: return sys_read(parameters);
+        case SYS_CLOCK: return sys_clock();
+        case SYS_EXIT: return sys_exit(parameters, parameters == ADP_STOPPED_APPLICATION_EXIT ? 0 : 1);
+        case SYS_EXIT_EXTENDED: {
+            uint32_t block[2];
+            read_words(parameters, block, 2);
+            return sys_exit(block[0], block[1]);
+        }
+        default:
+            return FAILED;
+    }
+}
+
+std::string semihosting::read_string(uint32_t address) {
+
+    std::string out;
+    uint8_t c;
+    for (memory->read_bytes(address, &c, 1); c != 0; memory->read_bytes(++address, &c, 1)) {
+        out.push_back((char) c);
+    }
+    return out;
+}
+
+void semihosting::read_words(uint32_t address, uint32_t *words, uint32_t count) {
+    // the words are little endian like the host
+    memory->read_bytes(address, (uint8_t *) words, count * sizeof(uint32_t));
+}
+
+FILE *semihosting::file(uint32_t handle) {
+    auto it = files.find(handle);
+    return it == files.end() ? nullptr : it->second;
+}
+
+uint32_t semihosting::sys_open(uint32_t parameters) {
+
+    // | name | mode | name length |
+    uint32_t block[3];
+    read_words(parameters, block, 3);
+
+    if (block[1] >= sizeof(OPEN_MODES) / sizeof(OPEN_MODES[0])) {
+        return FAILED;
+    }
+
+    std::vector<uint8_t> name(block[2]);
+    memory->read_bytes(block[0], name.data(), block[2]);
+    std::string path(name.begin(), name.end());
+
+    // the console is opened as :tt, the mode picks the stream
+    FILE *opened;
+    if (path == ":tt") {
+        opened = block[1] < 4 ? stdin : (block[1] < 8 ? stdout : stderr);
+    } else {
+        opened = fopen(path.c_str(), OPEN_MODES[block[1]]);
+    }
+
+    if (opened == nullptr) {
+        return FAILED;
+    }
+
+    files[next_handle] = opened;
+    return next_handle++;
+}
+
+uint32_t semihosting::sys_close(uint32_t parameters) {
+
+    // | handle |
+    uint32_t handle;
+    read_words(parameters, &handle, 1);
+
+    FILE *f = file(handle);
+    if (f == nullptr) {
+        return FAILED;
+    }
+
+    files.erase(handle);
+    if (f == stdin || f == stdout || f == stderr) {
+        return 0;
+    }
+    return fclose(f) == 0 ? 0 : FAILED;
+}
+
+uint32_t semihosting::sys_write0(uint32_t parameters) {
+
+    std::string text = read_string(parameters);
+    fwrite(text.data(), 1, text.size(), stdout);
+    fflush(stdout);
+
+    return 0;
+}
+
+uint32_t semihosting::sys_write(uint32_t parameters) {
+
+    // | handle | buffer | length |
+    uint32_t block[3];
+    read_words(parameters, block, 3);
+
+    FILE *f = file(block[0]);
+    if (f == nullptr) {
+        return block[2];
+    }
+
+    std::vector<uint8_t> data(block[2]);
+    memory->read_bytes(block[1], data.data(), block[2]);
+
+    // the result is the number of bytes that were not written
+    size_t written = fwrite(data.data(), 1, data.size(), f);
+    if (f == stdout || f == stderr) {
+        fflush(f);
+    }
+
+    return block[2] - (uint32_t) written;
+}
+
+uint32_t semihosting::sys_read(uint32_t parameters) {
+
+    // | handle | buffer | length |
+    uint32_t block[3];
+    read_words(parameters, block, 3);
+
+    FILE *f = file(block[0]);
+    if (f == nullptr) {
+        return block[2];
+    }
+
+    std::vector<uint8_t> data(block[2]);
+    size_t read = fread(data.data(), 1, data.size(), f);
+    memory->write_bytes(block[1], data.data(), (uint32_t) read);
+
+    // the result is the number of bytes that were not read
+    return block[2] - (uint32_t) read;
+}
+
+uint32_t semihosting::sys_clock() {
+
+    // centiseconds since we started
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return (uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / 10;
+}
+
+uint32_t semihosting::sys_exit(uint32_t reason, uint32_t code) {
+
+    exited = true;
+    exit_code = reason == ADP_STOPPED_APPLICATION_EXIT ? (int) code : 1;
+
+    return 0;
+}
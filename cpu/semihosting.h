@@ -0,0 +1,176 @@
+//
+// Created by dimitrije on 10/9/26.
+//
+
+#ifndef EMULATOR_M0_SEMIHOSTING_H
+#define EMULATOR_M0_SEMIHOSTING_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+
+class mmu;
+class input_log;
+
+/**
+ * The immediate of the BKPT instruction that makes a semihosting call
+ */
+const uint32_t SEMIHOSTING_BKPT = 0xAB;
+
+/**
+ * The semihosting operations we support, the number of the operation is in R0
+ */
+const uint32_t SYS_OPEN = 0x01;
+const uint32_t SYS_CLOSE = 0x02;
+const uint32_t SYS_WRITE0 = 0x04;
+const uint32_t SYS_WRITE = 0x05;
+const uint32_t SYS_READ = 0x06;
+const uint32_t SYS_CLOCK = 0x10;
+const uint32_t SYS_EXIT = 0x18;
+const uint32_t SYS_EXIT_EXTENDED = 0x20;
+
+/**
+ * Our own operation (0x100-0x1FF are left to the applications), it switches the run mode of the cpu to the one in R1
+ * (0 is fast, 1 is detailed). The cpu handles it, so it is not recorded in the input log.
+ */
+const uint32_t SYS_RUN_MODE = 0x100;
+
+/**
+ * The reason of SYS_EXIT that means the application finished normally
+ */
+const uint32_t ADP_STOPPED_APPLICATION_EXIT = 0x20026;
+
+/**
+ * Executes the semihosting calls of the firmware on the host. The arguments are read from the parameter block R1
+ * points to and the result goes to R0. The data buffers are read and written directly in the host memory of the
+ * region when they fit in one region.
+ *
+ * The guest memory is only accessed with mmu::read_bytes and mmu::write_bytes. They never fault, so a bad pointer
+ * in a flat memory can not jump out of a call that holds strings and vectors.
+ */
+class semihosting {
+
+private:
+
+    /**
+     * The memory of the cpu
+     */
+    mmu *memory;
+
+    /**
+     * The files the firmware has opened by their handle
+     */
+    std::map<uint32_t, FILE*> files;
+
+    /**
+     * The handle we give to the next opened file
+     */
+    uint32_t next_handle;
+
+    /**
+     * Set when the firmware has called SYS_EXIT
+     */
+    bool exited;
+
+    /**
+     * The exit code the firmware requested
+     */
+    int exit_code;
+
+    /**
+     * The time the clock is measured from
+     */
+    std::chrono::steady_clock::time_point start;
+
+    /**
+     * The log the results of the calls that depend on the host go through, nullptr if there is none
+     */
+    input_log *inputs;
+
+    /**
+     * Executes a semihosting call on the host
+     * @param operation the operation (R0)
+     * @param parameters the parameter or the address of the parameter block (R1)
+     * @return the result
+     */
+    uint32_t execute(uint32_t operation, uint32_t parameters);
+
+    /**
+     * Reads a zero terminated string from the guest memory
+     * @param address the address of the string
+     * @return the string
+     */
+    std::string read_string(uint32_t address);
+
+    /**
+     * Reads the words of a parameter block from the guest memory
+     * @param address the address of the first word
+     * @param words the array we are reading into
+     * @param count the number of words
+     */
+    void read_words(uint32_t address, uint32_t *words, uint32_t count);
+
+    /**
+     * Returns the file of the handle
+     * @param handle the handle
+     * @return the file or nullptr if the handle is not open
+     */
+    FILE *file(uint32_t handle);
+
+    uint32_t sys_open(uint32_t parameters);
+    uint32_t sys_close(uint32_t parameters);
+    uint32_t sys_write0(uint32_t parameters);
+    uint32_t sys_write(uint32_t parameters);
+    uint32_t sys_read(uint32_t parameters);
+    uint32_t sys_clock();
+    uint32_t sys_exit(uint32_t reason, uint32_t code);
+
+public:
+
+    /**
+     * Creates the semihosting over the memory of a cpu
+     * @param memory the memory
+     */
+    explicit semihosting(mmu *memory);
+
+    /**
+     * Closes the files the firmware has left open
+     */
+    ~semihosting();
+
+    /**
+     * Executes a semihosting call
+     * @param operation the operation (R0)
+     * @param parameters the parameter or the address of the parameter block (R1)
+     * @return the result (the new R0)
+     */
+    uint32_t call(uint32_t operation, uint32_t parameters);
+
+    /**
+     * Sets the log the results of the calls that depend on the host (the file operations and the clock) are
+     * recorded to or replayed from. When replaying the reads and the clock are not executed on the host.
+     * @param log the log, nullptr to stop using it
+     */
+    inline void set_input_log(input_log *log) { inputs = log; }
+
+    /**
+     * Returns true if the firmware has called SYS_EXIT
+     * @return true if it has
+     */
+    inline bool has_exited() const { return exited; }
+
+    /**
+     * Returns the exit code the firmware requested
+     * @return the exit code, 0 if it did not exit
+     */
+    inline int get_exit_code() const { return exit_code; }
+
+    /**
+     * Clears the exit so that the firmware can be run again
+     */
+    inline void clear_exit() { exited = false; exit_code = 0; }
+};
+
+#endif //EMULATOR_M0_SEMIHOSTING_H
@@ -0,0 +1,146 @@
+//
+// Created by dimitrije on 10/17/26.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include "shadow_memory.h"
+
+shadow_memory::shadow_memory(cpu *instance) : instance(instance), first(), reads(0), symbols(nullptr) {
+
+    mmu *memory = instance->get_mmu();
+    sram_size = memory->get_sram_size();
+
+    // a bit for every byte of the sram, none of them is written yet
+    shadow.resize(((uint64_t) sram_size + 63) >> 6, 0);
+
+    // the sram accesses go through the observer
+    memory->mark_slow(SRAM_BEGIN, sram_size);
+    memory->add_observer(this);
+}
+
+shadow_memory::~shadow_memory() {
+    mmu *memory = instance->get_mmu();
+    memory->remove_observer(this);
+    memory->unmark_slow(SRAM_BEGIN, sram_size);
+}
+
+void shadow_memory::on_read(uint32_t address, uint32_t size, uint32_t) {
+
+    uint32_t offset = address - SRAM_BEGIN;
+    if (offset >= sram_size) {
+        return;
+    }
+
+    // the bytes are usually in one shadow word, an unaligned access can span two of them
+    if ((offset & 63) + size <= 64) {
+        uint64_t bits = mask(offset, size);
+        if ((shadow[offset >> 6] & bits) == bits) {
+            return;
+        }
+    } else if (is_initialized(address, size)) {
+        return;
+    }
+
+    if (reads++ != 0) {
+        return;
+    }
+
+    // the instruction is at r15 - 4 while it executes, the dma and the host read outside of the instructions
+    access_origin origin = instance->get_mmu()->get_origin();
+    uint32_t pc = origin == ACCESS_CPU ? instance->get_registers()[15].to_uint - 4 : 0;
+    first = {origin, pc, address, size, instance->get_cycles()};
+}
+
+void shadow_memory::on_write(uint32_t address, uint32_t size, uint32_t, uint32_t) {
+
+    uint32_t offset = address - SRAM_BEGIN;
+    if (offset >= sram_size) {
+        return;
+    }
+
+    if ((offset & 63) + size <= 64) {
+        shadow[offset >> 6] |= mask(offset, size);
+        return;
+    }
+
+    mark_initialized(address, size);
+}
+
+void shadow_memory::mark_initialized(uint32_t address, uint32_t length) {
+
+    uint32_t offset = address - SRAM_BEGIN;
+    if (offset >= sram_size) {
+        return;
+    }
+
+    // a shadow word at a time
+    uint32_t remaining = std::min(length, sram_size - offset);
+    while (remaining != 0) {
+        uint32_t bytes = std::min(remaining, 64 - (offset & 63));
+        shadow[offset >> 6] |= mask(offset, bytes);
+        offset += bytes;
+        remaining -= bytes;
+    }
+}
+
+bool shadow_memory::is_initialized(uint32_t address, uint32_t length) const {
+
+    uint32_t offset = address - SRAM_BEGIN;
+    if (offset >= sram_size || sram_size - offset < length) {
+        return false;
+    }
+
+    // a shadow word at a time
+    while (length != 0) {
+        uint32_t bytes = std::min(length, 64 - (offset & 63));
+        uint64_t bits = mask(offset, bytes);
+        if ((shadow[offset >> 6] & bits) != bits) {
+            return false;
+        }
+        offset += bytes;
+        length -= bytes;
+    }
+
+    return true;
+}
+
+void shadow_memory::write_address(std::ostream &output, uint32_t address) const {
+
+    char text[16];
+    snprintf(text, sizeof(text), "0x%08x", address);
+    output << text;
+
+    std::string name;
+    uint32_t offset;
+    if (symbols != nullptr && symbols->nearest(address, name, offset)) {
+        output << " <" << name << "+" << std::dec << offset << ">";
+    }
+}
+
+void shadow_memory::write_report(std::ostream &output) const {
+
+    if (reads == 0) {
+        return;
+    }
+
+    output << "The first read of uninitialized memory : " << std::dec << first.size << " bytes at ";
+    write_address(output, first.address);
+    output << std::endl;
+
+    switch (first.origin) {
+        case ACCESS_CPU:
+            output << "The instruction that read it : ";
+            write_address(output, first.pc);
+            break;
+        case ACCESS_DMA:
+            output << "The dma read it";
+            break;
+        default:
+            output << "The host read it";
+            break;
+    }
+    output << " in the cycle " << std::dec << first.cycle << std::endl;
+
+    output << "The number of reads of uninitialized memory : " << std::dec << reads << std::endl;
+}
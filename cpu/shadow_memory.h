@@ -0,0 +1,158 @@
+//
+// Created by dimitrije on 10/17/26.
+//
+
+#ifndef EMULATOR_M0_SHADOW_MEMORY_H
+#define EMULATOR_M0_SHADOW_MEMORY_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "cpu.h"
+#include "hle.h"
+
+/**
+ * A read of sram that was never written
+ */
+struct uninitialized_read {
+
+    /**
+     * Who made the read and the address of the instruction if it was the cpu, 0 for the dma and the host
+     */
+    access_origin origin;
+    uint32_t pc;
+
+    /**
+     * The address that was read and the size of the read in bytes
+     */
+    uint32_t address;
+    uint32_t size;
+
+    /**
+     * The cycle it happened at
+     */
+    uint64_t cycle;
+};
+
+/**
+ * Finds the reads of the sram that was never written, like the memory checkers of Valgrind. Every byte of the sram
+ * has a bit in the shadow that is set when the byte is written or loaded with the sram image. A read of a byte
+ * whose bit is not set is reported, only the first one is kept and the others are counted.
+ *
+ * The sram pages are marked as slow in the mmu while the checker exists, so the reads and the writes go to it and
+ * the code region keeps its cost. The shadow is packed 64 bytes to a word and an access is checked with one mask.
+ * The values are not tracked through the registers, so an uninitialized value that is copied is only reported
+ * where it is first read. The reads of the dma and of the host (the library hooks, the semihosting calls) are
+ * reported with their origin and without an instruction.
+ */
+class shadow_memory : private memory_observer {
+
+private:
+
+    /**
+     * The cpu we check
+     */
+    cpu *instance;
+
+    /**
+     * The size of the sram region
+     */
+    uint32_t sram_size;
+
+    /**
+     * Bit N is set if the byte N of the sram was written
+     */
+    std::vector<uint64_t> shadow;
+
+    /**
+     * The first uninitialized read and the number of them
+     */
+    uninitialized_read first;
+    uint64_t reads;
+
+    /**
+     * The symbols we name the addresses with in the report, nullptr if there are none
+     */
+    const symbol_table *symbols;
+
+    /**
+     * Checks a read of the sram
+     */
+    void on_read(uint32_t address, uint32_t size, uint32_t value) override;
+
+    /**
+     * Marks a write to the sram
+     */
+    void on_write(uint32_t address, uint32_t size, uint32_t old_value, uint32_t new_value) override;
+
+    /**
+     * Returns the bits of the shadow word of an offset into the sram for a number of bytes
+     * @param offset the offset, the bytes can not go past the shadow word
+     * @param size the number of bytes
+     * @return the mask
+     */
+    static inline uint64_t mask(uint32_t offset, uint32_t size) {
+        return (size >= 64 ? ~0ull : (1ull << size) - 1) << (offset & 63);
+    }
+
+    /**
+     * Writes an address and the symbol it belongs to if we know it
+     * @param output the stream
+     * @param address the address
+     */
+    void write_address(std::ostream &output, uint32_t address) const;
+
+public:
+
+    /**
+     * Starts checking the reads of the sram of a cpu, none of it is initialized
+     * @param instance the cpu
+     */
+    explicit shadow_memory(cpu *instance);
+
+    /**
+     * Stops checking, the sram pages are not slow anymore
+     */
+    ~shadow_memory() override;
+
+    /**
+     * Marks a range of the sram as initialized, for example the part that was loaded from the sram image
+     * @param address the start of the range
+     * @param length the length of the range in bytes
+     */
+    void mark_initialized(uint32_t address, uint32_t length);
+
+    /**
+     * Checks if every byte of a range of the sram was initialized
+     * @param address the start of the range
+     * @param length the length of the range in bytes
+     * @return true if it was
+     */
+    bool is_initialized(uint32_t address, uint32_t length) const;
+
+    /**
+     * Sets the symbols the report names the instruction and the address with
+     * @param table the symbols, they have to outlive the checker
+     */
+    inline void set_symbols(const symbol_table *table) { symbols = table; }
+
+    /**
+     * Returns the number of uninitialized reads so far
+     * @return the number of reads
+     */
+    inline uint64_t get_read_count() const { return reads; }
+
+    /**
+     * Returns the first uninitialized read, only valid if there was one
+     * @return the read
+     */
+    inline const uninitialized_read &get_first_read() const { return first; }
+
+    /**
+     * Writes the report of the first uninitialized read, nothing if there was none
+     * @param output the stream
+     */
+    void write_report(std::ostream &output) const;
+};
+
+#endif //EMULATOR_M0_SHADOW_MEMORY_H
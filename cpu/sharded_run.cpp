@@ -0,0 +1,107 @@
+//
+// Created by dimitrije on 10/16/26.
+//
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "sharded_run.h"
+
+sharded_run::sharded_run(cpu *instance, uint64_t interval, size_t budget) : instance(instance),
+                                                                            saved(instance, interval, budget),
+                                                                            interval(interval), mismatches(0) {}
+
+void sharded_run::update_starts() {
+
+    // an interval goes from a checkpoint to the next one
+    starts.clear();
+    for (size_t index = 0; index + 1 < saved.get_count(); ++index) {
+        uint64_t number = saved.get_state(index).instructions / interval;
+        if (selected.empty() || (number < selected.size() && selected[number])) {
+            starts.push_back(index);
+        }
+    }
+}
+
+void sharded_run::select(const std::vector<uint64_t> &numbers) {
+
+    selected.clear();
+    for (uint64_t number : numbers) {
+        if (number >= selected.size()) {
+            selected.resize(number + 1, false);
+        }
+        selected[number] = true;
+    }
+
+    update_starts();
+}
+
+void sharded_run::run(size_t n_instr) {
+
+    // the end of the run is the end of the last interval
+    saved.run(n_instr);
+    saved.take();
+    update_starts();
+}
+
+void sharded_run::analyze_intervals(const std::vector<cpu *> &workers,
+                                    const std::function<void(size_t, cpu *, uint64_t)> &analyze) {
+
+    if (workers.empty()) {
+        throw std::runtime_error("a sharded run needs at least one worker");
+    }
+
+    for (cpu *worker : workers) {
+        if (worker->get_mmu()->get_sram_size() != instance->get_mmu()->get_sram_size()) {
+            throw std::runtime_error("the workers of a sharded run need the sram size of the cpu");
+        }
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> mismatched(0);
+    std::mutex lock;
+    std::exception_ptr error;
+
+    auto work = [&](cpu *worker) {
+
+        for (size_t index = next++; index < get_interval_count(); index = next++) {
+
+            try {
+
+                // start from the checkpoint and end up where the next interval starts
+                saved.load(starts[index], worker);
+                analyze(index, worker, saved.get_state(starts[index] + 1).instructions - get_interval_start(index));
+
+                if (!saved.matches(starts[index] + 1, worker)) {
+                    mismatched++;
+                }
+            } catch (...) {
+
+                // stop handing out the intervals
+                std::unique_lock<std::mutex> guard(lock);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = get_interval_count();
+            }
+        }
+    };
+
+    // the first worker runs on this thread
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers.size(); ++i) {
+        threads.emplace_back(work, workers[i]);
+    }
+    work(workers[0]);
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    mismatches = mismatched;
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,146 @@
+//
+// Created by dimitrije on 10/16/26.
+//
+
+#ifndef EMULATOR_M0_SHARDED_RUN_H
+#define EMULATOR_M0_SHARDED_RUN_H
+
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+#include "checkpoints.h"
+#include "cpu.h"
+
+/**
+ * Splits one long run into intervals that are analyzed in parallel. The run is first executed on one cpu as fast as
+ * it can go, taking a checkpoint at the start of every interval. Then every interval is executed again from its
+ * checkpoint on one of the worker cpus, each worker on its own host thread, with whatever expensive instrumentation
+ * the analysis needs. The results of the intervals are returned in the order of the run so they can be merged like
+ * the results of one serial run.
+ *
+ * The intervals are counted in retired instructions like the checkpoints, which only keep the sram pages that
+ * changed and stay within their memory budget by dropping the oldest ones, the intervals before the oldest
+ * checkpoint are not replayed. The state of the peripherals and their scheduled events is not in the checkpoints,
+ * the intervals are executed the same way only if the peripherals do not change the run (replay the inputs with an
+ * input log if they do). The end of every interval is compared with the checkpoint of the next one to catch that.
+ */
+class sharded_run {
+
+private:
+
+    /**
+     * The cpu of the fast run and its checkpoints
+     */
+    cpu *instance;
+    checkpoints saved;
+
+    /**
+     * The number of instructions in an interval
+     */
+    uint64_t interval;
+
+    /**
+     * Bit N is set if the interval N is replayed, all of them are if it is empty
+     */
+    std::vector<bool> selected;
+
+    /**
+     * The indices of the checkpoints the replayed intervals start at, the next checkpoint is where they end
+     */
+    std::vector<size_t> starts;
+
+    /**
+     * The number of intervals that did not end in the state the next interval starts from
+     */
+    size_t mismatches;
+
+    /**
+     * Finds the checkpoints the replayed intervals start at
+     */
+    void update_starts();
+
+    /**
+     * Runs the analysis of every interval on the workers
+     * @param workers the cpus the intervals are executed on
+     * @param analyze called on the thread of the worker with the index of the interval, the worker in the state of
+     * the start of the interval and the number of instructions in the interval, it has to retire them
+     */
+    void analyze_intervals(const std::vector<cpu *> &workers,
+                           const std::function<void(size_t index, cpu *worker, uint64_t length)> &analyze);
+
+public:
+
+    /**
+     * Creates the sharded run of a cpu
+     * @param instance the cpu of the fast run
+     * @param interval the number of instructions in an interval
+     * @param budget the memory the checkpoints are allowed to use in bytes
+     */
+    sharded_run(cpu *instance, uint64_t interval, size_t budget);
+
+    /**
+     * Replays only some of the intervals, for example the simulation points of a sampled simulation
+     * @param numbers the numbers of the intervals, the interval N starts at the instruction N * interval
+     */
+    void select(const std::vector<uint64_t> &numbers);
+
+    /**
+     * Runs the cpu for N instructions taking the checkpoints on the way, it can be called again to continue the run
+     * @param n_instr the number of instructions
+     */
+    void run(size_t n_instr);
+
+    /**
+     * Executes every interval again on the workers and returns the results of the analysis in the order of the run.
+     * The workers have to have the same code and sram size as the cpu, they stay owned by the caller and each of
+     * them is used by one thread at a time.
+     * @param workers the cpus the intervals are executed on, one thread for each
+     * @param analyze called on the thread of the worker with the worker in the state of the start of the interval
+     * and the number of instructions in the interval, it has to run the worker until it retires them and return the
+     * result of the interval
+     * @return the results of the intervals
+     */
+    template <typename result>
+    std::vector<result> replay(const std::vector<cpu *> &workers,
+                               const std::function<result(cpu *worker, uint64_t length)> &analyze) {
+
+        // the threads write the results at the same time, the bits of a std::vector<bool> would share words
+        static_assert(!std::is_same<result, bool>::value, "the result of an interval can not be a bool");
+
+        std::vector<result> results(get_interval_count());
+        analyze_intervals(workers, [&](size_t index, cpu *worker, uint64_t length) {
+            results[index] = analyze(worker, length);
+        });
+
+        return results;
+    }
+
+    /**
+     * Returns the number of intervals of the run that are replayed
+     * @return the number of intervals
+     */
+    inline size_t get_interval_count() const { return starts.size(); }
+
+    /**
+     * Returns the instruction an interval starts at
+     * @param index the index of the interval
+     * @return the number of instructions retired before the interval
+     */
+    inline uint64_t get_interval_start(size_t index) const { return saved.get_state(starts[index]).instructions; }
+
+    /**
+     * Returns the number of an interval in the whole run
+     * @param index the index of the interval
+     * @return the number
+     */
+    inline uint64_t get_interval_number(size_t index) const { return get_interval_start(index) / interval; }
+
+    /**
+     * Returns the number of intervals of the last replay that did not end in the state the next one starts from
+     * @return the number of intervals
+     */
+    inline size_t get_mismatches() const { return mismatches; }
+};
+
+#endif //EMULATOR_M0_SHARDED_RUN_H
@@ -0,0 +1,158 @@
+//
+// Created by dimitrije on 10/17/26.
+//
+
+#ifndef EMULATOR_M0_TIMING_H
+#define EMULATOR_M0_TIMING_H
+
+#include <cstdint>
+#include "instructions.h"
+#include "mmu.h"
+
+/**
+ * The number of cycles it takes to refill the 3 stage pipeline (fetch, decode, execute) after a taken branch
+ */
+const uint64_t PIPELINE_REFILL_CYCLES = 2;
+
+/**
+ * A timing model of the Cortex-M0 for cpu::run_timed, it is told about every executed instruction and returns how
+ * many cycles it took. The plain run loops do not use a model, every instruction takes one cycle there.
+ *
+ * The instructions take the cycles the Cortex-M0 technical reference manual gives them : 2 for a load or a store,
+ * 1 + N for the ones that transfer N registers, 3 for a barrier and 1 for the others. A taken branch (anything that
+ * does not continue with the next instruction) refills the pipeline. The code is fetched a 32 bit word at a time,
+ * a fetch from the flash takes the flash wait states and a fetch from the sram the sram wait states. The prefetch
+ * buffer fetches the next word while the current one executes, so with it only the fetches after a taken branch
+ * stall. The literal loads also read the flash and take its wait states.
+ */
+class pipeline_timing {
+
+private:
+
+    /**
+     * The wait states of the flash and of the sram
+     */
+    uint32_t flash_wait_states;
+    uint32_t sram_wait_states;
+
+    /**
+     * True if the sequential fetches are done ahead by the prefetch buffer
+     */
+    bool prefetch_buffer;
+
+    /**
+     * The address of the word in the fetch buffer, an odd value if it is empty
+     */
+    uint32_t fetched_word;
+
+    /**
+     * The cycles spent on the pipeline refills and on waiting for the fetches and the literal loads
+     */
+    uint64_t refill_cycles;
+    uint64_t stall_cycles;
+
+    /**
+     * Returns the wait states of an access to an address
+     * @param address the address
+     * @return the wait states
+     */
+    inline uint32_t wait_states(uint32_t address) const {
+        return address <= CODE_END ? flash_wait_states : (address <= SRAM_END ? sram_wait_states : 0);
+    }
+
+public:
+
+    /**
+     * Creates the model
+     * @param flash_wait_states the wait states of the flash
+     * @param prefetch_buffer true if the sequential fetches are done ahead
+     * @param sram_wait_states the wait states of the sram
+     */
+    explicit pipeline_timing(uint32_t flash_wait_states = 0, bool prefetch_buffer = true,
+                             uint32_t sram_wait_states = 0) : flash_wait_states(flash_wait_states),
+                                                              sram_wait_states(sram_wait_states),
+                                                              prefetch_buffer(prefetch_buffer),
+                                                              fetched_word(1),
+                                                              refill_cycles(0),
+                                                              stall_cycles(0) {}
+
+    /**
+     * Returns the cycles an executed instruction took
+     * @param address the address of the instruction
+     * @param instr the instruction (the first half-word if it is a 32 bit one)
+     * @param next the address of the instruction executed after it
+     * @return the cycles
+     */
+    inline uint64_t instruction(uint32_t address, uint16_t instr, uint32_t next) {
+
+        uint64_t cycles = 1;
+        uint32_t length = 2;
+
+        switch (decode(instr)) {
+            case LOAD_STORE_WITH_REGISTER_OFFSET:
+            case LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD:
+            case LOAD_STORE_HALFWORD_IMMEDIATE_OFFSET:
+            case LOAD_STORE_WITH_IMMEDIATE_OFFSET:
+            case SP_RELATIVE_LOAD_STORE:
+                cycles = 2;
+                break;
+            case PC_RELATIVE_LOAD: {
+                uint32_t wait = wait_states(address);
+                stall_cycles += wait;
+                cycles = 2 + wait;
+                break;
+            }
+            case PUSH_POP_REGISTERS:
+                cycles = 1 + __builtin_popcount(instr & 0x1FF);
+                break;
+            case MULTIPLE_LOAD_STORE:
+                cycles = 1 + __builtin_popcount(instr & 0xFF);
+                break;
+            case MEMORY_BARRIER:
+                cycles = 3;
+                length = 4;
+                break;
+            case WAIT_FOR_INTERUPT_EVENT:
+                // a sleeping cpu executes it again, that is not a branch
+                cycles = 2;
+                length = next == address ? 0 : 2;
+                break;
+            default:
+                break;
+        }
+
+        // fetching the word with the instruction, the prefetch buffer already has the next one
+        uint32_t word = address & ~3u;
+        if (word != fetched_word) {
+            if (!prefetch_buffer || word != fetched_word + 4) {
+                uint32_t wait = wait_states(address);
+                stall_cycles += wait;
+                cycles += wait;
+            }
+            fetched_word = word;
+        }
+
+        // the instructions in the pipeline behind a taken branch are thrown away
+        if (next != address + length) {
+            refill_cycles += PIPELINE_REFILL_CYCLES;
+            cycles += PIPELINE_REFILL_CYCLES;
+            fetched_word = 1;
+        }
+
+        return cycles;
+    }
+
+    /**
+     * Returns the cycles spent on refilling the pipeline after the taken branches
+     * @return the cycles
+     */
+    inline uint64_t get_refill_cycles() const { return refill_cycles; }
+
+    /**
+     * Returns the cycles spent waiting for the flash and the sram
+     * @return the cycles
+     */
+    inline uint64_t get_stall_cycles() const { return stall_cycles; }
+};
+
+#endif //EMULATOR_M0_TIMING_H
@@ -0,0 +1,154 @@
+//
+// Created by dimitrije on 10/4/26.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <vector>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "translation_cache.h"
+#include "translator.h"
+#include "cpu.h"
+#include "util.h"
+#include "aot.h"
+
+namespace {
+
+/**
+ * Marks the end of the checksum appended to a cached library
+ */
+const uint64_t CHECKSUM_MAGIC = 0x6D30636865636B73ull;
+
+/**
+ * The checksum appended to a cached library : the size and the hash of the library before it and the magic. The
+ * dynamic loader only maps what the program headers point to, so the library loads with it.
+ */
+struct library_checksum {
+    uint64_t size;
+    uint64_t hash;
+    uint64_t magic;
+};
+
+/**
+ * Reads a file
+ * @param file the path to the file
+ * @return the content
+ */
+std::vector<uint8_t> read_file(const std::string &file) {
+    std::ifstream in(file, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+}
+
+translation_cache::translation_cache(const std::string &directory) : directory(directory) {
+
+    // make the directory if it is not there
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("could not create the translation cache directory : " + directory);
+    }
+}
+
+std::string translation_cache::key(const uint8_t *code, uint32_t code_size) {
+
+    // the version of the emulator is a part of the key so that a new emulator does not pick up old translations
+    const char version[] = EMULATOR_M0_VERSION;
+    uint64_t hash = fnv1a((const uint8_t *) version, sizeof(version));
+    hash = fnv1a((const uint8_t *) &AOT_ABI_VERSION, sizeof(AOT_ABI_VERSION), hash);
+    hash = fnv1a(code, code_size, hash);
+
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << hash << "-" << std::dec << code_size;
+    return out.str();
+}
+
+std::string translation_cache::library_path(const uint8_t *code, uint32_t code_size) const {
+    return directory + "/" + key(code, code_size) + ".so";
+}
+
+bool translation_cache::valid(const std::string &library) const {
+
+    // the checksum is at the end of the library
+    std::vector<uint8_t> content = read_file(library);
+    if (content.size() < sizeof(library_checksum)) {
+        return false;
+    }
+
+    library_checksum checksum;
+    std::memcpy(&checksum, content.data() + content.size() - sizeof(checksum), sizeof(checksum));
+
+    // the library must be exactly what we wrote
+    uint64_t size = content.size() - sizeof(checksum);
+    return checksum.magic == CHECKSUM_MAGIC && checksum.size == size && checksum.hash == fnv1a(content.data(), size);
+}
+
+bool translation_cache::store(const std::string &library, const uint8_t *code, uint32_t code_size) const {
+
+    // recover the blocks
+    translator t(code, code_size);
+    t.discover();
+
+    // everything is written under a temporary name and renamed at the end so that
+    // another emulator using the same cache never sees a partially written library
+    std::string suffix = "." + std::to_string(getpid()) + ".tmp";
+    std::string source = library + suffix + ".cpp";
+    std::string temporary_library = library + suffix;
+
+    std::ofstream source_file(source);
+    source_file << t.emit();
+    source_file.close();
+
+    bool compiled = translator::compile(source, temporary_library);
+    std::remove(source.c_str());
+
+    if (!compiled) {
+        std::remove(temporary_library.c_str());
+        return false;
+    }
+
+    // append the checksum, the library and its checksum are published by one rename
+    std::vector<uint8_t> content = read_file(temporary_library);
+    library_checksum checksum = {content.size(), fnv1a(content.data(), content.size()), CHECKSUM_MAGIC};
+
+    std::ofstream library_file(temporary_library, std::ios::binary | std::ios::app);
+    library_file.write((const char *) &checksum, sizeof(checksum));
+    library_file.close();
+
+    if (!library_file || std::rename(temporary_library.c_str(), library.c_str()) != 0) {
+        std::remove(temporary_library.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool translation_cache::load(cpu *instance, const uint8_t *code, uint32_t code_size) const {
+
+    std::string library = library_path(code, code_size);
+
+    // try the cached library first
+    if (valid(library)) {
+        try {
+            instance->load_translation(library);
+            return true;
+        } catch (std::runtime_error &e) {
+            // the library does not fit this emulator, we rebuild it
+        }
+    }
+
+    // the entry is missing, stale or corrupt, it is not removed because another emulator might be publishing a
+    // good one right now, the rebuilt library replaces it with one rename
+    if (!store(library, code, code_size)) {
+        throw std::runtime_error("could not translate the code region into : " + library);
+    }
+
+    instance->load_translation(library);
+    return false;
+}
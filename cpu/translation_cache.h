@@ -0,0 +1,78 @@
+//
+// Created by dimitrije on 10/4/26.
+//
+
+#ifndef EMULATOR_M0_TRANSLATION_CACHE_H
+#define EMULATOR_M0_TRANSLATION_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+class cpu;
+
+/**
+ * Keeps the translated libraries of code images in a directory so that the next run of the same image
+ * does not have to translate and compile it again. The entries are keyed by the hash of the code region and the
+ * emulator version, each library has its checksum appended to it so that one rename publishes both. An entry that is
+ * stale or corrupt is a miss, it is rebuilt and replaced.
+ */
+class translation_cache {
+
+private:
+
+    /**
+     * The directory where we keep the cached libraries
+     */
+    std::string directory;
+
+    /**
+     * Checks if the library matches the checksum appended to it
+     * @param library the path of the library
+     * @return true if the library can be loaded
+     */
+    bool valid(const std::string &library) const;
+
+    /**
+     * Translates the code image and stores the library into the cache
+     * @param library the path of the library
+     * @param code the code image
+     * @param code_size the size of the code image
+     * @return true if the library was stored
+     */
+    bool store(const std::string &library, const uint8_t *code, uint32_t code_size) const;
+
+public:
+
+    /**
+     * Creates the cache, the directory is created if it does not exist
+     * @param directory the directory of the cache
+     */
+    explicit translation_cache(const std::string &directory);
+
+    /**
+     * Returns the key of the code image
+     * @param code the code image
+     * @param code_size the size of the code image
+     * @return the key as a hex string
+     */
+    static std::string key(const uint8_t *code, uint32_t code_size);
+
+    /**
+     * Returns the path of the library for the code image
+     * @param code the code image
+     * @param code_size the size of the code image
+     * @return the path
+     */
+    std::string library_path(const uint8_t *code, uint32_t code_size) const;
+
+    /**
+     * Loads the translation of the code image into the cpu, if the cache does not have a valid one it is created
+     * @param instance the cpu that runs the code image
+     * @param code the code image
+     * @param code_size the size of the code image
+     * @return true if the translation was already in the cache
+     */
+    bool load(cpu *instance, const uint8_t *code, uint32_t code_size) const;
+};
+
+#endif //EMULATOR_M0_TRANSLATION_CACHE_H
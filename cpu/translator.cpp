@@ -0,0 +1,775 @@
+//
+// Created by dimitrije on 10/2/26.
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+#include <iomanip>
+#include "translator.h"
+#include "instructions.h"
+#include "cpu.h"
+#include "util.h"
+#include "aot.h"
+
+#ifndef AOT_CXX
+#define AOT_CXX "c++"
+#endif
+
+#ifndef AOT_INCLUDE_DIR
+#define AOT_INCLUDE_DIR "."
+#endif
+
+namespace {
+
+/**
+ * What the translator does with an instruction
+ */
+enum instruction_kind {
+
+    /**
+     * The instruction is translated and the execution continues with the next one
+     */
+    STRAIGHT,
+
+    /**
+     * A conditional branch with a static target
+     */
+    CONDITIONAL,
+
+    /**
+     * A branch with a static target
+     */
+    JUMP,
+
+    /**
+     * The interpreter has to execute the instruction, the execution can continue after it
+     */
+    STOP,
+
+    /**
+     * The interpreter has to execute the instruction, it always transfers the control somewhere we can not know
+     */
+    STOP_INDIRECT
+};
+
+instruction_kind classify(uint16_t instr) {
+
+    switch (decode(instr)) {
+        case NOP:
+        case ADD_SUBTRACT:
+        case MOVE_COMPARE_ADD_SUBTRACT_IMMEDIATE:
+        case ALU_OPERATIONS:
+        case PC_RELATIVE_LOAD:
+        case LOAD_STORE_WITH_REGISTER_OFFSET:
+        case LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD:
+        case LOAD_STORE_WITH_IMMEDIATE_OFFSET:
+        case LOAD_STORE_HALFWORD_IMMEDIATE_OFFSET:
+        case SP_RELATIVE_LOAD_STORE:
+        case LOAD_ADDRESS:
+        case ADD_OFFSET_TO_STACK_POINTER:
+        case MULTIPLE_LOAD_STORE:
+            return STRAIGHT;
+        case MOVE_SHIFTED_REGISTER:
+            // a shift by zero is left to the interpreter
+            return ((instr >> 6) & 31) != 0 ? STRAIGHT : STOP;
+        case HI_REGISTER_OPERATIONS_BRANCH_EXCHANGE: {
+            int op_h1_h2 = (instr >> 6) & 0b1111;
+
+            // BX Rs, BX Hs
+            if (op_h1_h2 == 0b1100 || op_h1_h2 == 0b1101) {
+                return STOP_INDIRECT;
+            }
+
+            // BLX Rs, BLX Hs
+            if (op_h1_h2 == 0b1110 || op_h1_h2 == 0b1111) {
+                return STOP;
+            }
+
+            // ADD Hd, Rs | ADD Hd, Hs | MOV Hd, Rs | MOV Hd, Hs where Hd is the PC
+            bool writes_high = op_h1_h2 == 0b0010 || op_h1_h2 == 0b0011 || op_h1_h2 == 0b1010 || op_h1_h2 == 0b1011;
+            return writes_high && (instr & 7) == 7 ? STOP_INDIRECT : STRAIGHT;
+        }
+        case PUSH_POP_REGISTERS: {
+            int flag = ((instr >> 8) & 0b1) | ((instr >> 1) & 0b10);
+
+            // POP { Rlist, PC }
+            return flag == 0b11 ? STOP_INDIRECT : STRAIGHT;
+        }
+        case CONDITIONAL_BRANCH:
+            return CONDITIONAL;
+        case UNCONDITIONAL_BRANCH:
+            return JUMP;
+        default:
+            return STOP;
+    }
+}
+
+uint32_t branch_target(uint32_t address, uint16_t instr) {
+
+    // the PC is 4 bytes ahead of the instruction when it is executed
+    uint32_t pc = address + 4;
+
+    if (decode(instr) == CONDITIONAL_BRANCH) {
+        auto offset = (int8_t) (instr & 0xFF);
+        return pc + (uint32_t) ((int32_t) offset * 2);
+    }
+
+    // unconditional branch
+    uint32_t offset = (instr & 0x3FF) << 1;
+    if (instr & 0x0400) {
+        offset |= 0xFFFFF800;
+    }
+
+    return pc + offset;
+}
+
+std::string hex(uint32_t value) {
+    std::ostringstream out;
+    out << "0x" << std::hex << std::setw(8) << std::setfill('0') << value << "u";
+    return out.str();
+}
+
+std::string block_name(uint32_t address) {
+    std::ostringstream out;
+    out << "block_" << std::hex << std::setw(8) << std::setfill('0') << address;
+    return out.str();
+}
+
+std::string reg(int n) {
+    return "R(" + std::to_string(n) + ")";
+}
+
+/**
+ * Returns true if the instruction can lower the stack pointer, the cpu is told about it right after the instruction
+ */
+bool lowers_stack(uint16_t instr) {
+
+    switch (decode(instr)) {
+        case ADD_OFFSET_TO_STACK_POINTER:
+            // ADD SP, #-Imm
+            return ((instr >> 7) & 1) == 0;
+        case PUSH_POP_REGISTERS: {
+            int flag = ((instr >> 8) & 0b1) | ((instr >> 1) & 0b10);
+
+            // PUSH { Rlist } | PUSH { Rlist, LR }
+            return flag != 0b10;
+        }
+        case HI_REGISTER_OPERATIONS_BRANCH_EXCHANGE: {
+            int op_h1_h2 = (instr >> 6) & 0b1111;
+
+            // ADD Hd, Rs | ADD Hd, Hs | MOV Hd, Rs | MOV Hd, Hs where Hd is the SP
+            bool writes_high = op_h1_h2 == 0b0010 || op_h1_h2 == 0b0011 || op_h1_h2 == 0b1010 || op_h1_h2 == 0b1011;
+            return writes_high && (instr & 7) == 5;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Returns true if the instruction accesses the memory, the observers of the mmu look at the PC while it does
+ */
+bool accesses_memory(uint16_t instr) {
+
+    switch (decode(instr)) {
+        case LOAD_STORE_WITH_REGISTER_OFFSET:
+        case LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD:
+        case LOAD_STORE_WITH_IMMEDIATE_OFFSET:
+        case LOAD_STORE_HALFWORD_IMMEDIATE_OFFSET:
+        case PC_RELATIVE_LOAD:
+        case SP_RELATIVE_LOAD_STORE:
+        case PUSH_POP_REGISTERS:
+        case MULTIPLE_LOAD_STORE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * The value of a register, reading the PC gives the address of the instruction + 4
+ */
+std::string value_of(int n, uint32_t address) {
+    return n == 15 ? hex(address + 4) : reg(n);
+}
+
+std::string condition(int cond) {
+    switch (cond) {
+        case 0b0000: return "F.z";
+        case 0b0001: return "!F.z";
+        case 0b0010: return "F.c";
+        case 0b0011: return "!F.c";
+        case 0b0100: return "F.n";
+        case 0b0101: return "!F.n";
+        case 0b0110: return "F.v";
+        case 0b0111: return "!F.v";
+        case 0b1000: return "F.c && !F.z";
+        case 0b1001: return "!F.c || F.z";
+        case 0b1010: return "F.n == F.v";
+        case 0b1011: return "F.n != F.v";
+        case 0b1100: return "!F.z && (F.n == F.v)";
+        default: return "F.z || (F.n != F.v)";
+    }
+}
+
+std::string set_nz(const std::string &value) {
+    return "    F.n = (" + value + " & 0x80000000) != 0;\n"
+           "    F.z = " + value + " == 0;\n";
+}
+
+std::string set_add_flags() {
+    return "    F.z = res == 0;\n"
+           "    F.n = neg(res) != 0;\n"
+           "    F.c = add_carry(lhs, rhs, res);\n"
+           "    F.v = add_overflow(lhs, rhs, res);\n";
+}
+
+std::string set_sub_flags() {
+    return "    F.z = res == 0;\n"
+           "    F.n = neg(res) != 0;\n"
+           "    F.c = sub_carry(lhs, rhs, res);\n"
+           "    F.v = sub_overflow(lhs, rhs, res);\n";
+}
+
+std::string compare(const std::string &lhs, const std::string &rhs) {
+    return "    lhs = " + lhs + ";\n"
+           "    rhs = " + rhs + ";\n"
+           "    res = lhs - rhs;\n" + set_sub_flags();
+}
+
+/**
+ * Emits the register transfers of PUSH, POP, STMIA and LDMIA
+ */
+std::string transfer(int rlist, bool load, bool lr) {
+    std::string out;
+    for (int r = 0; r < 8; ++r) {
+        if (rlist & (1 << r)) {
+            out += load ? "    " + reg(r) + " = context->read32(MEMORY, address);\n"
+                        : "    context->write32(MEMORY, address, " + reg(r) + ");\n";
+            out += "    address += 4;\n";
+        }
+    }
+    if (lr) {
+        out += "    context->write32(MEMORY, address, R(14));\n"
+               "    address += 4;\n";
+    }
+    return out;
+}
+
+int bits_set(int value) {
+    int count = 0;
+    for (; value != 0; value >>= 1) {
+        count += value & 1;
+    }
+    return count;
+}
+
+}
+
+translator::translator(const uint8_t *code, uint32_t code_size) : code(code), code_size(code_size) {}
+
+uint16_t translator::fetch(uint32_t address) const {
+    uint16_t value;
+    std::memcpy(&value, code + address, sizeof(value));
+    return value;
+}
+
+void translator::discover() {
+
+    // the entry point is stored at the same place the cpu reads it from when it is reset
+    if (code_size < PC_INIT_ADDRESS + 4) {
+        return;
+    }
+
+    uint32_t entry;
+    std::memcpy(&entry, code + PC_INIT_ADDRESS, sizeof(entry));
+
+    discover(entry & 0xFFFFFFFE);
+}
+
+void translator::discover(uint32_t entry) {
+
+    std::vector<uint32_t> work = {entry};
+    std::set<uint32_t> visited;
+
+    // walk all the paths we can resolve and collect the addresses where the blocks start
+    while (!work.empty()) {
+
+        uint32_t address = work.back();
+        work.pop_back();
+
+        if (!in_code(address) || (address & 1) != 0) {
+            continue;
+        }
+
+        leaders.insert(address);
+
+        for (uint32_t pc = address; in_code(pc) && visited.insert(pc).second; pc += 2) {
+
+            uint16_t instr = fetch(pc);
+            instruction_kind kind = classify(instr);
+
+            if (kind == STRAIGHT) {
+                continue;
+            }
+
+            if (kind == CONDITIONAL || kind == JUMP) {
+                work.push_back(branch_target(pc, instr));
+            }
+
+            // the code after the instruction is reached if the branch is not taken or if the interpreter returns
+            if (kind == CONDITIONAL || kind == STOP) {
+                work.push_back(pc + 2);
+            }
+
+            break;
+        }
+    }
+
+    // cut the code into blocks at the leaders
+    for (auto leader : leaders) {
+        form_block(leader);
+    }
+}
+
+void translator::form_block(uint32_t leader) {
+
+    basic_block block = {leader, 0, INTERPRETER_END, 0, leader};
+
+    for (uint32_t pc = leader; ; pc += 2) {
+
+        // we ran out of code, or reached another block
+        if (!in_code(pc)) {
+            block.end = INTERPRETER_END;
+            block.next = pc;
+            break;
+        }
+        if (pc != leader && leaders.count(pc) != 0) {
+            block.end = FALLTHROUGH_END;
+            block.next = pc;
+            break;
+        }
+
+        uint16_t instr = fetch(pc);
+        instruction_kind kind = classify(instr);
+
+        if (kind == STOP || kind == STOP_INDIRECT) {
+            block.end = INTERPRETER_END;
+            block.next = pc;
+            break;
+        }
+
+        block.length++;
+
+        if (kind == CONDITIONAL || kind == JUMP) {
+            block.end = kind == CONDITIONAL ? CONDITIONAL_END : JUMP_END;
+            block.target = branch_target(pc, instr);
+            block.next = pc + 2;
+            break;
+        }
+    }
+
+    // there is nothing to translate if the first instruction needs the interpreter
+    if (block.length != 0) {
+        blocks[leader] = block;
+    }
+}
+
+std::string translator::emit_instruction(uint32_t address, uint16_t instr) const {
+
+    int rd = instr & 7;
+    int rs = (instr >> 3) & 7;
+    int ro = (instr >> 6) & 7;
+
+    switch (decode(instr)) {
+
+        case MOVE_SHIFTED_REGISTER: {
+            int offset5 = (instr >> 6) & 31;
+            switch ((instr >> 11) & 3) {
+                // LSL Rd, Rs, #Offset5
+                case 0b00 :
+                    return "    F.c = ((" + reg(rs) + " >> " + std::to_string(32 - offset5) + ") & 1) != 0;\n"
+                           "    res = " + reg(rs) + " << " + std::to_string(offset5) + ";\n"
+                           "    " + reg(rd) + " = res;\n" + set_nz("res");
+                // LSR Rd, Rs, #Offset5
+                case 0b01 :
+                    return "    F.c = ((" + reg(rs) + " >> " + std::to_string(offset5 - 1) + ") & 1) != 0;\n"
+                           "    res = " + reg(rs) + " >> " + std::to_string(offset5) + ";\n"
+                           "    " + reg(rd) + " = res;\n" + set_nz("res");
+                // ASR Rd, Rs, #Offset5
+                default :
+                    return "    F.c = (((int32_t) " + reg(rs) + " >> " + std::to_string(offset5 - 1) + ") & 1) != 0;\n"
+                           "    res = (uint32_t) ((int32_t) " + reg(rs) + " >> " + std::to_string(offset5) + ");\n"
+                           "    " + reg(rd) + " = res;\n" + set_nz("res");
+            }
+        }
+        case ADD_SUBTRACT: {
+            // ADD/SUB Rd, Rs, Rn | ADD/SUB Rd, Rs, #Offset3
+            std::string value = ((instr >> 10) & 1) == 0 ? reg(ro) : std::to_string(ro) + "u";
+            std::string op = ((instr >> 9) & 1) == 0 ? " + " : " - ";
+            return "    rhs = " + value + ";\n"
+                   "    " + reg(rd) + " = " + reg(rs) + op + "rhs;\n"
+                   "    F.z = " + reg(rd) + " == 0;\n"
+                   "    F.n = neg(" + reg(rd) + ") != 0;\n"
+                   "    F.c = add_carry(" + reg(rs) + ", rhs, " + reg(rd) + ");\n"
+                   "    F.v = add_overflow(" + reg(rs) + ", rhs, " + reg(rd) + ");\n";
+        }
+        case MOVE_COMPARE_ADD_SUBTRACT_IMMEDIATE: {
+            std::string offset8 = std::to_string(instr & 0xFF) + "u";
+            int rn = (instr >> 8) & 7;
+            switch ((instr >> 11) & 3) {
+                // MOV Rd, #Offset8
+                case 0b00 :
+                    return "    " + reg(rn) + " = " + offset8 + ";\n"
+                           "    F.n = false;\n"
+                           "    F.z = " + reg(rn) + " == 0;\n";
+                // CMP Rd, #Offset8
+                case 0b01 :
+                    return compare(reg(rn), offset8);
+                // ADD Rd, #Offset8
+                case 0b10 :
+                    return "    lhs = " + reg(rn) + ";\n"
+                           "    rhs = " + offset8 + ";\n"
+                           "    res = lhs + rhs;\n"
+                           "    " + reg(rn) + " = res;\n" + set_add_flags();
+                // SUB Rd, #Offset8
+                default :
+                    return "    lhs = " + reg(rn) + ";\n"
+                           "    rhs = " + offset8 + ";\n"
+                           "    res = lhs - rhs;\n"
+                           "    " + reg(rn) + " = res;\n"
+                           "    F.z = res == 0;\n"
+                           "    F.n = neg(res) != 0;\n"
+                           "    F.c = add_carry(lhs, rhs, res);\n"
+                           "    F.v = sub_overflow(lhs, rhs, res);\n";
+            }
+        }
+        case ALU_OPERATIONS: {
+            std::string d = reg(rd);
+            std::string s = reg(rs);
+            switch ((instr >> 6) & 0b1111) {
+                // AND Rd, Rs
+                case 0b0000 :
+                    return "    " + d + " &= " + s + ";\n" + set_nz(d);
+                // EOR Rd, Rs
+                case 0b0001 :
+                    return "    " + d + " ^= " + s + ";\n" + set_nz(d);
+                // LSL Rd, Rs
+                case 0b0010 :
+                    return "    res = " + s + " & 0xFF;\n"
+                           "    if (res) {\n"
+                           "        if (res == 32) {\n"
+                           "            res = 0;\n"
+                           "            F.c = (" + d + " & 1) != 0;\n"
+                           "        } else if (res < 32) {\n"
+                           "            F.c = ((" + d + " >> (32 - res)) & 1) != 0;\n"
+                           "            res = " + d + " << res;\n"
+                           "        } else {\n"
+                           "            res = 0;\n"
+                           "            F.c = false;\n"
+                           "        }\n"
+                           "        " + d + " = res;\n"
+                           "    }\n" + set_nz(d);
+                // LSR Rd, Rs
+                case 0b0011 :
+                    return "    res = " + s + " & 0xFF;\n"
+                           "    if (res) {\n"
+                           "        if (res == 32) {\n"
+                           "            res = 0;\n"
+                           "            F.c = (" + d + " & 0x80000000) != 0;\n"
+                           "        } else if (res < 32) {\n"
+                           "            F.c = ((" + d + " >> (res - 1)) & 1) != 0;\n"
+                           "            res = " + d + " >> res;\n"
+                           "        } else {\n"
+                           "            res = 0;\n"
+                           "            F.c = false;\n"
+                           "        }\n"
+                           "        " + d + " = res;\n"
+                           "    }\n" + set_nz(d);
+                // ASR Rd, Rs
+                case 0b0100 :
+                    return "    res = " + s + " & 0xFF;\n"
+                           "    if (res) {\n"
+                           "        if (res < 32) {\n"
+                           "            F.c = (((int32_t) " + d + " >> (int) (res - 1)) & 1) != 0;\n"
+                           "            " + d + " = (uint32_t) ((int32_t) " + d + " >> (int) res);\n"
+                           "        } else if (" + d + " & 0x80000000) {\n"
+                           "            " + d + " = 0xFFFFFFFF;\n"
+                           "            F.c = true;\n"
+                           "        } else {\n"
+                           "            " + d + " = 0x00000000;\n"
+                           "            F.c = false;\n"
+                           "        }\n"
+                           "    }\n" + set_nz(d);
+                // ADC Rd, Rs
+                case 0b0101 :
+                    return "    lhs = " + d + ";\n"
+                           "    rhs = " + s + ";\n"
+                           "    res = lhs + rhs + (uint32_t) F.c;\n"
+                           "    " + d + " = res;\n" + set_add_flags();
+                // SBC Rd, Rs
+                case 0b0110 :
+                    return "    lhs = " + d + ";\n"
+                           "    rhs = " + s + ";\n"
+                           "    res = lhs - rhs - !((uint32_t) F.c);\n"
+                           "    " + d + " = res;\n" + set_sub_flags();
+                // ROR Rd, Rs
+                case 0b0111 :
+                case 0b1000 :
+                    return "    res = " + s + " & 0xFF;\n"
+                           "    if (res) {\n"
+                           "        res = res & 0x1f;\n"
+                           "        if (res == 0) {\n"
+                           "            F.c = (" + d + " & 0x80000000) != 0;\n"
+                           "        } else {\n"
+                           "            F.c = ((" + d + " >> (res - 1)) & 1) != 0;\n"
+                           "            " + d + " = (" + d + " << (32 - res)) | (" + d + " >> res);\n"
+                           "        }\n"
+                           "    }\n" + set_nz(d);
+                // TST Rd, Rs
+                case 0b1001 :
+                    return "    res = " + d + " & " + s + ";\n" + set_nz("res");
+                // NEG Rd, Rs
+                case 0b1010 :
+                    return "    lhs = 0;\n"
+                           "    rhs = " + s + ";\n"
+                           "    res = lhs - rhs;\n"
+                           "    " + d + " = res;\n" + set_sub_flags();
+                // CMN Rd, Rs
+                case 0b1011 :
+                    return "    lhs = " + d + ";\n"
+                           "    rhs = " + s + ";\n"
+                           "    res = lhs + rhs;\n" + set_add_flags();
+                // ORR Rd, Rs
+                case 0b1100 :
+                    return "    " + d + " |= " + s + ";\n" + set_nz(d);
+                // MULS Rd, Rs
+                case 0b1101 :
+                    return "    " + d + " = " + s + " * " + d + ";\n" + set_nz(d);
+                // BIC Rd, Rs
+                case 0b1110 :
+                    return "    " + d + " &= ~" + s + ";\n" + set_nz(d);
+                // MVN Rd, Rs
+                default :
+                    return "    " + d + " = ~" + s + ";\n" + set_nz(d);
+            }
+        }
+        case HI_REGISTER_OPERATIONS_BRANCH_EXCHANGE: {
+            std::string hs = value_of(rs + 8, address);
+            std::string hd = value_of(rd + 8, address);
+            switch ((instr >> 6) & 0b1111) {
+                // ADD Rd, Hs
+                case 0b0001 : return "    " + reg(rd) + " += " + hs + ";\n";
+                // ADD Hd, Rs
+                case 0b0010 : return "    " + reg(rd + 8) + " += " + reg(rs) + ";\n";
+                // ADD Hd, Hs
+                case 0b0011 : return "    " + reg(rd + 8) + " += " + hs + ";\n";
+                // CMP Rd, Hs
+                case 0b0101 : return compare(reg(rd), hs);
+                // CMP Hd, Rs
+                case 0b0110 : return compare(hd, reg(rs));
+                // CMP Hd, Hs
+                case 0b0111 : return compare(hd, hs);
+                // MOV Rd, Hs
+                case 0b1001 : return "    " + reg(rd) + " = " + hs + ";\n";
+                // MOV Hd, Rs
+                case 0b1010 : return "    " + reg(rd + 8) + " = " + reg(rs) + ";\n";
+                // MOV Hd, Hs
+                case 0b1011 : return "    " + reg(rd + 8) + " = " + hs + ";\n";
+                // the remaining combinations do nothing
+                default : return "";
+            }
+        }
+        case PC_RELATIVE_LOAD: {
+            // LDR Rd, [PC, #Imm]
+            uint32_t location = ((address + 4) & 0xFFFFFFFC) + ((instr & 0xFF) << 2);
+            return "    " + reg((instr >> 8) & 7) + " = context->read32(MEMORY, " + hex(location) + ");\n";
+        }
+        case LOAD_STORE_WITH_REGISTER_OFFSET: {
+            std::string out = "    address = " + reg(rs) + " + " + reg(ro) + ";\n";
+            switch ((instr >> 10) & 3) {
+                // STR Rd, [Rb, Ro]
+                case 0b00 : return out + "    context->write32(MEMORY, address, " + reg(rd) + ");\n";
+                // STRB Rd, [Rb, Ro]
+                case 0b01 : return out + "    context->write8(MEMORY, address, (uint8_t) " + reg(rd) + ");\n";
+                // LDR Rd, [Rb, Ro]
+                case 0b10 : return out + "    " + reg(rd) + " = context->read32(MEMORY, address);\n";
+                // LDRB Rd, [Rb, Ro]
+                default : return out + "    " + reg(rd) + " = context->read8(MEMORY, address);\n";
+            }
+        }
+        case LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD: {
+            std::string out = "    address = " + reg(rs) + " + " + reg(ro) + ";\n";
+            switch ((instr >> 10) & 3) {
+                // STRH Rd, [Rb, Ro]
+                case 0b00 : return out + "    context->write16(MEMORY, address, (uint16_t) " + reg(rd) + ");\n";
+                // LDRH Rd, [Rb, Ro]
+                case 0b01 : return out + "    " + reg(rd) + " = context->read16(MEMORY, address);\n";
+                // LDSB Rd, [Rb, Ro]
+                case 0b10 : return out + "    " + reg(rd) + " = (int8_t) context->read8(MEMORY, address);\n";
+                // LDSH Rd, [Rb, Ro]
+                default : return out + "    " + reg(rd) + " = (int16_t) context->read16(MEMORY, address);\n";
+            }
+        }
+        case LOAD_STORE_WITH_IMMEDIATE_OFFSET: {
+            std::string out = "    address = " + reg(rs) + " + " + reg(ro) + ";\n";
+            switch ((instr >> 11) & 3) {
+                // STR Rd, [Rb, #Imm]
+                case 0b00 : return out + "    context->write32(MEMORY, address, " + reg(rd) + ");\n";
+                // LDR Rd, [Rb, #Imm]
+                case 0b10 : return out + "    " + reg(rd) + " = context->read32(MEMORY, address);\n";
+                // STRB Rd, [Rb, #Imm]
+                case 0b01 : return out + "    context->write8(MEMORY, address, (uint8_t) " + reg(rd) + ");\n";
+                // LDRB Rd, [Rb, #Imm]
+                default :
+                    return "    address = " + reg(rs) + " + " + std::to_string((instr >> 6) & 31) + "u;\n"
+                           "    " + reg(rd) + " = context->read8(MEMORY, address);\n";
+            }
+        }
+        case LOAD_STORE_HALFWORD_IMMEDIATE_OFFSET: {
+            std::string out = "    address = " + reg(rs) + " + " + reg(ro) + ";\n";
+            if (((instr >> 11) & 1) != 0) {
+                return out + "    context->write16(MEMORY, address, (uint16_t) " + reg(rd) + ");\n";
+            }
+            return out + "    context->write8(MEMORY, address, (uint8_t) " + reg(rd) + ");\n";
+        }
+        case SP_RELATIVE_LOAD_STORE: {
+            std::string out = "    address = " + reg(rs) + " + " + std::to_string(((instr >> 6) & 31) << 2) + "u;\n";
+            if (((instr >> 11) & 1) != 0) {
+                // STR Rd, [SP, #Imm]
+                return out + "    context->write32(MEMORY, address, " + reg(rd) + ");\n";
+            }
+            // LDR Rd, [SP, #Imm]
+            return out + "    " + reg(rd) + " = context->read32(MEMORY, address);\n";
+        }
+        case LOAD_ADDRESS: {
+            int rn = (instr >> 8) & 7;
+            uint32_t offset = (instr & 255u) << 2;
+            if (((instr >> 11) & 1) != 0) {
+                // ADD Rd, PC, #Imm
+                return "    " + reg(rn) + " = " + hex(((address + 4) & 0xFFFFFFFC) + offset) + ";\n";
+            }
+            // ADD Rd, SP, #Imm
+            return "    " + reg(rn) + " = R(13) + " + std::to_string(offset) + "u;\n";
+        }
+        case ADD_OFFSET_TO_STACK_POINTER: {
+            // ADD SP, #Imm | ADD SP, #-Imm
+            std::string op = ((instr >> 7) & 1) != 0 ? " += " : " -= ";
+            return "    R(13)" + op + std::to_string((instr & 127u) << 2) + "u;\n";
+        }
+        case PUSH_POP_REGISTERS: {
+            int flag = ((instr >> 8) & 0b1) | ((instr >> 1) & 0b10);
+            int rlist = instr & 0xFF;
+            std::string count = std::to_string(4 * bits_set(rlist));
+
+            // POP { Rlist }
+            if (flag == 0b10) {
+                return "    address = R(13) & 0xFFFFFFFC;\n"
+                       "    res = R(13) + " + count + "u;\n" + transfer(rlist, true, false) +
+                       "    R(13) = res;\n";
+            }
+
+            // PUSH { Rlist } | PUSH { Rlist, LR }
+            std::string lr = flag == 0b01 ? "4u - " : "";
+            return "    res = R(13) - " + lr + count + "u;\n"
+                   "    address = res & 0xFFFFFFFC;\n" + transfer(rlist, false, flag == 0b01) +
+                   "    R(13) = res;\n";
+        }
+        case MULTIPLE_LOAD_STORE: {
+            int rb = (instr >> 8) & 7;
+            int rlist = instr & 0xFF;
+
+            // STMIA Rb!, { Rlist }
+            if (((instr >> 11) & 1) != 0) {
+                return "    address = " + reg(rb) + " & 0xFFFFFFFC;\n"
+                       "    res = " + reg(rb) + " + " + std::to_string(4 * bits_set(rlist)) + "u;\n" +
+                       transfer(rlist, false, false) +
+                       "    " + reg(rb) + " = res;\n";
+            }
+
+            // LDMIA Rb!, { Rlist }
+            std::string out = "    address = " + reg(rb) + " & 0xFFFFFFFC;\n" + transfer(rlist, true, false);
+            if (!(instr & (1 << rb))) {
+                out += "    " + reg(rb) + " = address;\n";
+            }
+            return out;
+        }
+        // the taken branches are marked so the cpu knows a new block starts there
+        case CONDITIONAL_BRANCH:
+            return "    if (" + condition((instr >> 8) & 15) + ") {\n"
+                   "        return " + hex(branch_target(address, instr) | AOT_TAKEN_BRANCH) + ";\n"
+                   "    }\n";
+        case UNCONDITIONAL_BRANCH:
+            return "    return " + hex(branch_target(address, instr) | AOT_TAKEN_BRANCH) + ";\n";
+        default:
+            return "";
+    }
+}
+
+std::string translator::emit() const {
+
+    std::ostringstream out;
+
+    out << "// Translated by aot_m0 from a code image of " << code_size << " bytes, do not edit!\n\n"
+        << "#include \"aot.h\"\n"
+        << "#include \"util.h\"\n\n"
+        << "#define R(n) context->registers[n].to_uint\n"
+        << "#define F (*context->psr_register)\n"
+        << "#define MEMORY context->memory\n\n";
+
+    for (auto &it : blocks) {
+
+        const basic_block &block = it.second;
+
+        out << "static uint32_t " << block_name(block.address) << "(aot_context *context) {\n"
+            << "    uint32_t address, lhs, rhs, res;\n"
+            << "    (void) address; (void) lhs; (void) rhs; (void) res;\n";
+
+        for (uint32_t i = 0; i < block.length; ++i) {
+            uint32_t pc = block.address + 2 * i;
+            uint16_t instr = fetch(pc);
+            out << "    // " << hex(pc) << " : " << std::hex << instr << std::dec << "\n";
+
+            // the blocks do not keep the PC, the accesses set it like the interpreter so the observers see them
+            if (accesses_memory(instr)) {
+                out << "    " << reg(15) << " = " << hex(pc + 4) << ";\n";
+            }
+
+            out << emit_instruction(pc, instr);
+
+            // the watermark and the limit see the stack pointer after the instruction that moved it
+            if (lowers_stack(instr)) {
+                out << "    context->stack_written(context->instance, " << hex(pc) << ");\n";
+            }
+        }
+
+        if (block.end != JUMP_END) {
+            out << "    return " << hex(block.next) << ";\n";
+        }
+
+        out << "}\n\n";
+    }
+
+    out << "extern \"C\" const aot_block " AOT_BLOCKS_SYMBOL "[] = {\n";
+    for (auto &it : blocks) {
+        out << "    {" << hex(it.second.address) << ", " << it.second.length << ", " << block_name(it.second.address) << "},\n";
+    }
+    out << "    {0, 0, nullptr}\n"
+        << "};\n\n"
+        << "extern \"C\" const uint32_t " AOT_BLOCK_COUNT_SYMBOL " = " << blocks.size() << ";\n"
+        << "extern \"C\" const uint32_t " AOT_ABI_VERSION_SYMBOL " = " << AOT_ABI_VERSION << ";\n"
+        << "extern \"C\" const uint32_t " AOT_CODE_SIZE_SYMBOL " = " << code_size << "u;\n"
+        << "extern \"C\" const uint64_t " AOT_CODE_HASH_SYMBOL " = " << fnv1a(code, code_size) << "ull;\n";
+
+    return out.str();
+}
+
+bool translator::compile(const std::string &source_file, const std::string &library_file) {
+
+    std::string command = std::string(AOT_CXX) + " -std=c++14 -O2 -shared -fPIC -w -I \"" AOT_INCLUDE_DIR "\" \"" +
+                          source_file + "\" -o \"" + library_file + "\"";
+
+    return std::system(command.c_str()) == 0;
+}
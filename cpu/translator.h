@@ -0,0 +1,167 @@
+//
+// Created by dimitrije on 10/2/26.
+//
+
+#ifndef EMULATOR_M0_TRANSLATOR_H
+#define EMULATOR_M0_TRANSLATOR_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+
+/**
+ * The way a basic block hands over the control
+ */
+enum block_end {
+
+    /**
+     * The block runs into an instruction that starts another block
+     */
+    FALLTHROUGH_END,
+
+    /**
+     * The block ends with a conditional branch, it continues either at the target or after the branch
+     */
+    CONDITIONAL_END,
+
+    /**
+     * The block ends with a branch to a known target
+     */
+    JUMP_END,
+
+    /**
+     * The block ends before an instruction the translator can not resolve, the interpreter executes it
+     */
+    INTERPRETER_END
+};
+
+/**
+ * A basic block recovered from the code image
+ */
+struct basic_block {
+
+    /**
+     * The address of the first instruction
+     */
+    uint32_t address;
+
+    /**
+     * The number of translated instructions in the block
+     */
+    uint32_t length;
+
+    /**
+     * How the block ends
+     */
+    block_end end;
+
+    /**
+     * The address of the branch target if the block ends with a branch
+     */
+    uint32_t target;
+
+    /**
+     * The address where the execution continues if the block does not branch
+     */
+    uint32_t next;
+};
+
+/**
+ * The translator recovers the control flow graph of a code image and emits C++ code with one function per basic
+ * block. The emitted code is compiled into a shared object that the cpu can load with cpu::load_translation.
+ * Everything that can not be resolved statically (indirect branches, exceptions, system instructions)
+ * ends a block and is left to the interpreter.
+ */
+class translator {
+
+private:
+
+    /**
+     * The code image we are translating
+     */
+    const uint8_t *code;
+
+    /**
+     * The size of the code image in bytes
+     */
+    uint32_t code_size;
+
+    /**
+     * The addresses where a basic block starts
+     */
+    std::set<uint32_t> leaders;
+
+    /**
+     * The recovered basic blocks by their address
+     */
+    std::map<uint32_t, basic_block> blocks;
+
+    /**
+     * Reads a half-word from the code image
+     * @param address the address of the half-word
+     * @return the value
+     */
+    uint16_t fetch(uint32_t address) const;
+
+    /**
+     * Returns true if there is a whole instruction at the address
+     */
+    inline bool in_code(uint32_t address) const { return address < code_size && code_size - address >= 2; }
+
+    /**
+     * Forms the basic block that starts at the leader
+     * @param leader the address of the first instruction
+     */
+    void form_block(uint32_t leader);
+
+    /**
+     * Emits the C++ code of an instruction that can be translated
+     * @param address the address of the instruction
+     * @param instr the instruction
+     * @return the code
+     */
+    std::string emit_instruction(uint32_t address, uint16_t instr) const;
+
+public:
+
+    /**
+     * Creates the translator
+     * @param code the code image
+     * @param code_size the size of the code image in bytes
+     */
+    translator(const uint8_t *code, uint32_t code_size);
+
+    /**
+     * Recovers the control flow graph reachable from the reset vector
+     */
+    void discover();
+
+    /**
+     * Recovers the control flow graph reachable from the entry address
+     * @param entry the address where the execution starts
+     */
+    void discover(uint32_t entry);
+
+    /**
+     * Returns the recovered basic blocks
+     * @return the blocks by their address
+     */
+    inline const std::map<uint32_t, basic_block> &get_blocks() const { return blocks; }
+
+    /**
+     * Emits the C++ source of the translated library
+     * @return the source
+     */
+    std::string emit() const;
+
+    /**
+     * Compiles the emitted source into a shared object
+     * @param source_file the file with the emitted source
+     * @param library_file the shared object we want to create
+     * @return true if the compilation succeeded
+     */
+    static bool compile(const std::string &source_file, const std::string &library_file);
+};
+
+#endif //EMULATOR_M0_TRANSLATOR_H
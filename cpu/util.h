@@ -7,6 +7,7 @@
 
 
 #include <cstdint>
+#include <cstddef>
 
 static inline uint32_t neg(const uint32_t i)
 {
@@ -46,5 +47,15 @@ static inline bool sub_overflow(const uint32_t a, const uint32_t b, const uint32
                              (pos(a) & neg(b) & neg(c)));
 }
 
+// used to fingerprint memory images
+
+static inline uint64_t fnv1a(const uint8_t *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
 
 #endif //EMULATOR_M0_UTIL_H
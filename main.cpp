@@ -3,31 +3,183 @@
 #include <fstream>
 #include <vector>
 #include <queue>
+#include <memory>
+#include <stdexcept>
+#include <unistd.h>
 #include <cpu.h>
+#include <translation_cache.h>
+#include <uart.h>
+#include <hle.h>
+#include <gdb_server.h>
+#include <bbv.h>
+#include <checkpoints.h>
+#include <heatmap.h>
+#include <shadow_memory.h>
+
+/**
+ * The address the uart is mapped at
+ */
+const uint32_t UART_ADDRESS = 0x40004000;
 
 int main(int argc, char *argv[]) {
 
     // by default we are not running in verbose mode.
     int verbose = 0;
 
+    // the translated library we want to load if any
+    std::string translation;
+
+    // the directory where we cache the translations if any
+    std::string cache_directory;
+
+    // do we map the guest memory into a flat host memory
+    bool flat = false;
+
+    // the input of the uart, the uart is mapped only if it is set ("-" is the standard input)
+    std::string uart_input;
+
+    // the number of cycles the uart takes to send a byte
+    uint64_t uart_cycles = 0;
+
+    // the symbols of the firmware (the output of nm) if we want to run the library functions on the host
+    std::string symbols_file;
+
+    // the input log we record to or replay from if any
+    std::string record_file;
+    std::string replay_file;
+
+    // the port or the unix socket we wait for gdb on if we are debugging
+    std::string gdb_address;
+
+    // the file we write the basic block vectors to if any
+    std::string bbv_file;
+
+    // the simulation points we save the checkpoints of or replay from them, PREFIX.simpoints and PREFIX.weights
+    std::string save_points;
+    std::string replay_points;
+
+    // the files we write the histogram of the memory accesses and the working set over time to if any
+    std::string heatmap_file;
+    std::string working_set_file;
+
+    // the number of instructions in the intervals of the basic block vectors or the working set, 0 for the default
+    uint64_t interval = 0;
+
+    // where the detailed mode starts if it does not start with the run, the instruction or the branch target
+    uint64_t detail_instruction = 0;
+    std::string detail_address;
+
+    // the lowest address the stack can use, 0 if there is no limit
+    uint32_t stack_limit = 0;
+
+    // true if we report the reads of the sram that was never written
+    bool check_uninitialized = false;
+
+    // parse the options
+    int option;
+    while ((option = getopt(argc, argv, "vfma:c:u:b:s:r:p:g:B:S:R:H:W:i:d:e:L:")) != -1) {
+        switch (option) {
+            case 'v':
+                std::cout << "Running in the verbose mode" << std::endl;
+                verbose = true;
+                break;
+            case 'f':
+                flat = true;
+                break;
+            case 'm':
+                check_uninitialized = true;
+                break;
+            case 'u':
+                uart_input = optarg;
+                break;
+            case 'b':
+                uart_cycles = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 's':
+                symbols_file = optarg;
+                break;
+            case 'r':
+                record_file = optarg;
+                break;
+            case 'p':
+                replay_file = optarg;
+                break;
+            case 'g':
+                gdb_address = optarg;
+                break;
+            case 'B':
+                bbv_file = optarg;
+                break;
+            case 'S':
+                save_points = optarg;
+                break;
+            case 'R':
+                replay_points = optarg;
+                break;
+            case 'H':
+                heatmap_file = optarg;
+                break;
+            case 'W':
+                working_set_file = optarg;
+                break;
+            case 'i':
+                interval = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 'd':
+                detail_instruction = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 'e':
+                detail_address = optarg;
+                break;
+            case 'L':
+                stack_limit = (uint32_t) std::strtoul(optarg, nullptr, 0);
+                break;
+            case 'a':
+                translation = optarg;
+                break;
+            case 'c':
+                cache_directory = optarg;
+                break;
+            default:
+                return -1;
+        }
+    }
+
     // are the parameters provided if not print help
-    if (argc != 6 && argc != 7) {
-        std::cout << "Usage: emulator_m0 [-v] CODE_SIZE CODE_FILE SRAM_SIZE SRAM_FILE NUM_INSTR" << std::endl;
+    if (argc - optind != 5) {
+        std::cout << "Usage: emulator_m0 [-v] [-f] [-m] [-u RX_FILE [-b CYCLES]] [-s SYMBOLS] [-r LOG | -p LOG] [-g PORT|SOCKET] [-B BBV_FILE | -S SIMPOINTS | -R SIMPOINTS | -H HEATMAP_FILE | -W WS_FILE] [-i INTERVAL] [-d INSTR | -e ADDRESS] [-L LIMIT] [-a LIBRARY] [-c CACHE_DIR] CODE_SIZE CODE_FILE SRAM_SIZE SRAM_FILE NUM_INSTR" << std::endl;
         std::cout << std::endl;
+        std::cout << "-f - map the guest memory into a reserved 4 GB host region, a fault on a peripheral goes to it and any other is a HardFault" << std::endl;
+        std::cout << "-m - report the first read of the sram that was not written or loaded from SRAM_FILE" << std::endl;
+        std::cout << "-u RX_FILE - map a uart at 0x40004000 that prints to the standard output and receives RX_FILE (- for the standard input)" << std::endl;
+        std::cout << "-b CYCLES - the uart takes CYCLES cycles to send a byte" << std::endl;
+        std::cout << "-s SYMBOLS - run memcpy, memmove, memset, strlen and crc32 on the host, SYMBOLS is the output of nm" << std::endl;
+        std::cout << "-r LOG - record the interrupts, the uart input and the semihosting input into LOG" << std::endl;
+        std::cout << "-p LOG - replay the inputs recorded in LOG instead of taking them from the host" << std::endl;
+        std::cout << "-g PORT|SOCKET - wait for gdb on the local TCP PORT or the unix SOCKET instead of running NUM_INSTR instructions" << std::endl;
+        std::cout << "-B BBV_FILE - write the basic block vectors of the run to BBV_FILE in the SimPoint format" << std::endl;
+        std::cout << "-S SIMPOINTS - run to the simulation points in SIMPOINTS.simpoints and SIMPOINTS.weights and save the checkpoint of every point N to SIMPOINTS.N.checkpoint" << std::endl;
+        std::cout << "-R SIMPOINTS - run every simulation point from its checkpoint for an interval and print the cycles of the points and their weighted cycles per instruction" << std::endl;
+        std::cout << "-H HEATMAP_FILE - write the reads, the writes and the fetches of every 32 byte line of the memory to HEATMAP_FILE" << std::endl;
+        std::cout << "-W WS_FILE - write the number of lines touched in every interval of the run to WS_FILE" << std::endl;
+        std::cout << "-i INTERVAL - the number of instructions in an interval of the basic block vectors (10000000 by default) or of the working set (1000000 by default)" << std::endl;
+        std::cout << "-d INSTR - run INSTR instructions in the fast mode and trace the rest in the detailed mode" << std::endl;
+        std::cout << "-e ADDRESS - run in the fast mode until the cpu branches to ADDRESS and trace the rest in the detailed mode" << std::endl;
+        std::cout << "-L LIMIT - halt when the stack pointer goes below the address LIMIT" << std::endl;
+        std::cout << "-a LIBRARY - run the blocks translated by aot_m0 from the LIBRARY" << std::endl;
+        std::cout << "-c CACHE_DIR - translate the code region and keep the translation in CACHE_DIR for the next run" << std::endl;
         std::cout << "CODE_SIZE - has to be larger than 0" << std::endl;
         std::cout << "SRAM_SIZE - has to be larger than 0" << std::endl;
         std::cout << "NUM_INSTR - the number of instructions that need to be executed" << std::endl;
         return 0;
     }
 
-    if(argc == 7 && std::string(argv[1]) == "-v") {
-        std::cout << "Running in the verbose mode" << std::endl;
-        verbose = true;
-    }
+    // the positional arguments
+    char **arguments = argv + optind;
 
     // grab the sizes
-    auto code_size = std::strtoul(argv[1 + verbose], nullptr, 10);
-    auto sram_size = std::strtoul(argv[3 + verbose], nullptr, 10);
+    auto code_size = std::strtoul(arguments[0], nullptr, 10);
+    auto sram_size = std::strtoul(arguments[2], nullptr, 10);
 
     // check the code size
     if (code_size == 0 || code_size == ULONG_MAX) {
@@ -42,57 +194,278 @@ int main(int argc, char *argv[]) {
     }
 
     // allocate the code region
-    auto *code_region = new uint8_t[code_size];
+    auto *code_region = new uint8_t[code_size]();
 
     // read the code region
-    std::ifstream code_file(argv[2 + verbose], std::ios::binary);
+    std::ifstream code_file(arguments[1], std::ios::binary);
 
     // check if we have opened the file
     if(!code_file.is_open()) {
-        std::cout << "Could not open the " <<  argv[2 + verbose] << "file." << std::endl;
+        std::cout << "Could not open the " <<  arguments[1] << "file." << std::endl;
         return -1;
     }
 
-    // copy the code region
-    unsigned long i = 0;
-    while (code_file.good() && i < code_size) {
-        code_region[i++] = (uint8_t)code_file.get();
-    }
+    // copy the code region, the rest of the region stays zeroed so that the translator sees the same image
+    code_file.read((char *) code_region, code_size);
 
     // close the file
     code_file.close();
 
     // allocate the sram region
-    auto *sram_region = new uint8_t[sram_size];
+    auto *sram_region = new uint8_t[sram_size]();
 
     // read the sram region
-    std::ifstream sram_file(argv[4 + verbose], std::ios::binary);
+    std::ifstream sram_file(arguments[3], std::ios::binary);
 
     // copy the sram region
-    i = 0;
-    while (sram_file.good() && i < code_size) {
-        sram_region[i++] = (uint8_t)code_file.get();
-    }
+    sram_file.read((char *) sram_region, sram_size);
+    auto sram_loaded = (uint32_t) sram_file.gcount();
 
     // close the file
     sram_file.close();
 
     // create the cpu
-    auto *instance = new cpu(code_region, sram_region);
+    auto *instance = new cpu(code_region, (uint32_t) code_size, sram_region, (uint32_t) sram_size);
+
+    // map the uart
+    std::unique_ptr<uart> serial;
+    if (!uart_input.empty()) {
+        try {
+            serial.reset(new uart(UART_ADDRESS, instance, std::cout, uart_cycles));
+            serial->open_input(uart_input);
+            instance->get_mmu()->register_peripheral(serial.get());
+        } catch (std::runtime_error &e) {
+            std::cout << e.what() << std::endl;
+            return -1;
+        }
+    }
+
+    // hook the library functions
+    symbol_table symbols;
+    if (!symbols_file.empty()) {
+        try {
+            symbols.load(symbols_file);
+            int hooked = hle::install_library_hooks(instance, symbols);
+
+            if (verbose) {
+                std::cout << "Running " << hooked << " library functions on the host" << std::endl;
+            }
+        } catch (std::runtime_error &e) {
+            std::cout << e.what() << std::endl;
+            return -1;
+        }
+    }
+
+    // map the memory flat
+    if (flat) {
+        try {
+            instance->enable_flat_memory();
+        } catch (std::runtime_error &e) {
+            std::cout << e.what() << std::endl;
+            return -1;
+        }
+    }
+
+    // load the translated blocks
+    if (!translation.empty()) {
+        try {
+            instance->load_translation(translation);
+        } catch (std::runtime_error &e) {
+            std::cout << e.what() << std::endl;
+            return -1;
+        }
+    }
+
+    // load the translation from the cache, translating it if we have not seen this code region before
+    if (translation.empty() && !cache_directory.empty()) {
+        try {
+            translation_cache cache(cache_directory);
+            bool hit = cache.load(instance, code_region, (uint32_t) code_size);
+
+            if (verbose) {
+                std::cout << (hit ? "Loaded the cached translation " : "Cached the new translation ")
+                          << cache.library_path(code_region, (uint32_t) code_size) << std::endl;
+            }
+        } catch (std::runtime_error &e) {
+            // we can still interpret the code
+            std::cout << e.what() << std::endl;
+        }
+    }
+
+    // record or replay the inputs
+    try {
+        if (!record_file.empty()) {
+            instance->record_inputs(record_file);
+        } else if (!replay_file.empty()) {
+            instance->replay_inputs(replay_file);
+        }
+    } catch (std::runtime_error &e) {
+        std::cout << e.what() << std::endl;
+        return -1;
+    }
+
+    // the detailed mode traces the instructions, the firmware can also switch to it through semihosting
+    instance->set_tracer([](cpu *, uint16_t instr) {
+        std::cout << "Executing instruction :" << std::hex << instr << std::endl;
+    });
+
+    if (detail_instruction != 0) {
+        instance->switch_mode_at_instruction(detail_instruction, RUN_DETAILED);
+    }
+
+    if (!detail_address.empty()) {
+        instance->switch_mode_at_pc((uint32_t) std::strtoul(detail_address.c_str(), nullptr, 0), RUN_DETAILED);
+    }
+
+    // the status at the end reports the stack pointer that crossed the limit
+    instance->set_stack_limit(stack_limit);
+
+    // the part of the sram loaded from the image is initialized
+    std::unique_ptr<shadow_memory> checker;
+    if (check_uninitialized) {
+        checker.reset(new shadow_memory(instance));
+        checker->mark_initialized(SRAM_BEGIN, sram_loaded);
+        checker->set_symbols(&symbols);
+    }
 
     // number of instructions
-    auto instr_num = std::strtoul(argv[5 + verbose], nullptr, 10);
+    auto instr_num = std::strtoul(arguments[4], nullptr, 10);
 
     // run the cpu for a number of cycles
-    if(!verbose) {
-        instance->run(instr_num);
+    try {
+        if (!gdb_address.empty()) {
+            gdb_server server(instance);
+            if (gdb_address.find_first_not_of("0123456789") == std::string::npos) {
+                server.listen_tcp((uint16_t) std::strtoul(gdb_address.c_str(), nullptr, 10));
+            } else {
+                server.listen_unix(gdb_address);
+            }
+            server.serve();
+        }
+        else if (!bbv_file.empty()) {
+            std::ofstream output(bbv_file);
+            if (!output.is_open()) {
+                throw std::runtime_error("could not open the basic block vector file : " + bbv_file);
+            }
+
+            bbv_collector collector(instance, interval != 0 ? interval : BBV_INTERVAL);
+            collector.run(instr_num);
+            collector.write(output);
+        }
+        else if (!save_points.empty() || !replay_points.empty()) {
+            std::string prefix = !save_points.empty() ? save_points : replay_points;
+            std::ifstream points(prefix + ".simpoints");
+            std::ifstream weights(prefix + ".weights");
+            if (!points.is_open() || !weights.is_open()) {
+                throw std::runtime_error("could not open the simulation points : " + prefix);
+            }
+
+            uint64_t length = interval != 0 ? interval : BBV_INTERVAL;
+            double weighted_cpi = 0;
+            for (const simulation_point &point : read_simulation_points(points, weights)) {
+
+                std::string checkpoint_file = prefix + "." + std::to_string(point.interval) + ".checkpoint";
+                uint64_t end = (point.interval + 1) * length;
+
+                if (!save_points.empty()) {
+
+                    // run to the start of the point on the fast path, a sleeping cpu can take more than one run
+                    while (instance->get_instructions() < end - length && !instance->is_halted()) {
+                        instance->run(end - length - instance->get_instructions());
+                    }
+
+                    if (instance->get_instructions() < end - length) {
+                        throw std::runtime_error("the cpu halted before the simulation point " +
+                                                 std::to_string(point.interval));
+                    }
+
+                    std::ofstream output(checkpoint_file, std::ios::binary);
+                    if (!output.is_open()) {
+                        throw std::runtime_error("could not open the checkpoint file : " + checkpoint_file);
+                    }
+                    checkpoints::write(instance, output);
+                    continue;
+                }
+
+                std::ifstream input(checkpoint_file, std::ios::binary);
+                if (!input.is_open()) {
+                    throw std::runtime_error("could not open the checkpoint file : " + checkpoint_file);
+                }
+                checkpoints::read(input, instance);
+
+                // run the interval of the point
+                uint64_t cycles = instance->get_cycles();
+                uint64_t instructions = instance->get_instructions();
+                while (instance->get_instructions() < end && !instance->is_halted()) {
+                    instance->run(end - instance->get_instructions());
+                }
+
+                cycles = instance->get_cycles() - cycles;
+                instructions = instance->get_instructions() - instructions;
+                if (instructions != 0) {
+                    weighted_cpi += point.weight * (double) cycles / (double) instructions;
+                }
+
+                std::cout << "Simulation point " << point.interval << " (weight " << point.weight << ") : "
+                          << instructions << " instructions in " << cycles << " cycles" << std::endl;
+            }
+
+            if (!replay_points.empty()) {
+                std::cout << "Weighted cycles per instruction : " << weighted_cpi << std::endl;
+            }
+        }
+        else if (!heatmap_file.empty() || !working_set_file.empty()) {
+            std::ofstream histogram, working_sets;
+            if (!heatmap_file.empty()) {
+                histogram.open(heatmap_file);
+                if (!histogram.is_open()) {
+                    throw std::runtime_error("could not open the heatmap file : " + heatmap_file);
+                }
+            }
+            if (!working_set_file.empty()) {
+                working_sets.open(working_set_file);
+                if (!working_sets.is_open()) {
+                    throw std::runtime_error("could not open the working set file : " + working_set_file);
+                }
+            }
+
+            memory_heatmap heatmap(instance, interval != 0 ? interval : HEATMAP_INTERVAL);
+            heatmap.run(instr_num);
+            if (histogram.is_open()) {
+                heatmap.write_histogram(histogram);
+            }
+            if (working_sets.is_open()) {
+                heatmap.write_working_set(working_sets);
+            }
+        }
+        else if(!verbose) {
+            instance->run(instr_num);
+        }
+        else {
+            instance->verbose_run(instr_num);
+        }
+    } catch (std::runtime_error &e) {
+        // the cpu faulted, we still print where it stopped
+        std::cout << e.what() << std::endl;
     }
-    else {
-        instance->verbose_run(instr_num);
+
+    // everything the firmware sent has to be out before the status
+    if (serial) {
+        serial->flush();
     }
 
+    // write out the recorded inputs
+    instance->close_inputs();
+
     // print the cpu status
     instance->print();
 
-    return 0;
+    // the first read of uninitialized memory
+    if (checker) {
+        checker->write_report(std::cout);
+        checker.reset();
+    }
+
+    // the firmware can pass its exit code through semihosting
+    return instance->get_exit_code();
 }
@@ -0,0 +1,153 @@
+//
+// Created by dimitrije on 10/7/26.
+//
+
+#include <cstring>
+#include "dma.h"
+#include "cpu.h"
+
+dma::dma(uint32_t start_address, cpu *instance, uint32_t irq, uint32_t bytes_per_cycle) :
+        peripheral(start_address, start_address + DMA_STATUS + 3, "dma"),
+        instance(instance),
+        irq(irq),
+        bytes_per_cycle(bytes_per_cycle == 0 ? 1 : bytes_per_cycle),
+        channels(),
+        status(0) {}
+
+void dma::reset() {
+    for (auto &c : channels) {
+        c = channel();
+    }
+    status = 0;
+}
+
+uint32_t dma::read_register(uint32_t offset) {
+
+    // the status register
+    if (offset == DMA_STATUS) {
+        return status;
+    }
+
+    channel &c = channels[offset / DMA_CHANNEL_SIZE];
+    switch (offset % DMA_CHANNEL_SIZE) {
+        case DMA_SOURCE: return c.source;
+        case DMA_DESTINATION: return c.destination;
+        case DMA_LENGTH: return c.length;
+        default: return c.control;
+    }
+}
+
+void dma::write_register(uint32_t offset, uint32_t value) {
+
+    // writing a one clears the status bit
+    if (offset == DMA_STATUS) {
+        status &= ~value;
+        return;
+    }
+
+    uint32_t index = offset / DMA_CHANNEL_SIZE;
+    channel &c = channels[index];
+
+    // the registers can not be changed while the channel is busy
+    if ((c.control & DMA_CONTROL_START) != 0) {
+        return;
+    }
+
+    switch (offset % DMA_CHANNEL_SIZE) {
+        case DMA_SOURCE: c.source = value; break;
+        case DMA_DESTINATION: c.destination = value; break;
+        case DMA_LENGTH: c.length = value; break;
+        default: {
+            c.control = value;
+
+            // start the transfer, it finishes after the time it takes to move the data
+            if ((value & DMA_CONTROL_START) != 0) {
+                instance->schedule((c.length + bytes_per_cycle - 1) / bytes_per_cycle, [this, index] {
+                    transfer(index);
+                });
+            }
+        }
+    }
+}
+
+void dma::write_part(uint32_t address, uint32_t value, uint32_t size) {
+
+    uint32_t offset = address - start_address;
+    uint32_t shift = (offset & 3) * 8;
+    uint32_t mask = (size == 4 ? 0xFFFFFFFF : ((1u << (size * 8)) - 1)) << shift;
+
+    // the status bits are cleared by the ones written, so the rest of the register is written as zeros
+    uint32_t rest = (offset & ~3u) == DMA_STATUS ? 0 : read_register(offset & ~3u) & ~mask;
+    write_register(offset & ~3u, rest | ((value << shift) & mask));
+}
+
+void dma::transfer(uint32_t index) {
+
+    channel &c = channels[index];
+    mmu *memory = instance->get_mmu();
+    access_origin previous = memory->set_origin(ACCESS_DMA);
+
+    if ((c.control & DMA_CONTROL_FIXED_DESTINATION) != 0) {
+
+        // feed the peripheral register word by word
+        for (uint32_t i = 0; i + 4 <= c.length; i += 4) {
+            memory->write32(c.destination, memory->read32(c.source + i));
+        }
+    } else {
+
+        uint32_t source_begin, source_end, destination_begin, destination_end;
+        uint8_t *source = memory->resolve_region(c.source, source_begin, source_end);
+        uint8_t *destination = memory->resolve_region(c.destination, destination_begin, destination_end);
+
+        if (source != nullptr && destination != nullptr &&
+            source_end - c.source >= c.length && destination_end - c.destination >= c.length &&
+            !memory->is_slow(c.source, c.length) && !memory->is_slow(c.destination, c.length)) {
+
+            // both are in host memory and nobody observes them, move it in one go
+            std::memmove(destination + (c.destination - destination_begin), source + (c.source - source_begin),
+                         c.length);
+        } else {
+
+            // go through the mmu byte by byte
+            for (uint32_t i = 0; i < c.length; ++i) {
+                memory->write8(c.destination + i, (uint8_t) memory->read8(c.source + i));
+            }
+        }
+    }
+
+    memory->set_origin(previous);
+
+    // the channel is done
+    c.control &= ~DMA_CONTROL_START;
+    status |= 1u << index;
+
+    if ((c.control & DMA_CONTROL_INTERRUPT) != 0) {
+        instance->set_pending_interrupt(irq);
+    }
+}
+
+void dma::write(uint32_t address, uint8_t value) {
+    write_part(address, value, 1);
+}
+
+void dma::write(uint32_t address, uint16_t value) {
+    write_part(address, value, 2);
+}
+
+void dma::write(uint32_t address, uint32_t value) {
+    write_part(address, value, 4);
+}
+
+void dma::read(uint32_t address, uint8_t &value) {
+    uint32_t offset = address - start_address;
+    value = (uint8_t) (read_register(offset & ~3u) >> ((offset & 3) * 8));
+}
+
+void dma::read(uint32_t address, uint16_t &value) {
+    uint32_t offset = address - start_address;
+    value = (uint16_t) (read_register(offset & ~3u) >> ((offset & 3) * 8));
+}
+
+void dma::read(uint32_t address, uint32_t &value) {
+    value = read_register((address - start_address) & ~3u);
+}
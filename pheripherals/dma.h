@@ -0,0 +1,138 @@
+//
+// Created by dimitrije on 10/7/26.
+//
+
+#ifndef EMULATOR_M0_DMA_H
+#define EMULATOR_M0_DMA_H
+
+#include "peripheral.h"
+
+class cpu;
+
+/**
+ * The number of channels the dma controller has
+ */
+const uint32_t DMA_CHANNELS = 4;
+
+/**
+ * The registers of a channel, channel N starts at the offset N * DMA_CHANNEL_SIZE
+ */
+const uint32_t DMA_SOURCE = 0x0;
+const uint32_t DMA_DESTINATION = 0x4;
+const uint32_t DMA_LENGTH = 0x8;
+const uint32_t DMA_CONTROL = 0xC;
+const uint32_t DMA_CHANNEL_SIZE = 0x10;
+
+/**
+ * The status register, bit N is set when channel N has finished, writing a 1 to it clears it
+ */
+const uint32_t DMA_STATUS = DMA_CHANNELS * DMA_CHANNEL_SIZE;
+
+/**
+ * The bits of the control register
+ *
+ * DMA_CONTROL_START - starts the transfer, reads as 1 while the channel is busy
+ * DMA_CONTROL_INTERRUPT - raise the interrupt of the controller when the transfer is finished
+ * DMA_CONTROL_FIXED_DESTINATION - the destination is a peripheral register, every word is written to the same address
+ */
+const uint32_t DMA_CONTROL_START = 1u << 0;
+const uint32_t DMA_CONTROL_INTERRUPT = 1u << 1;
+const uint32_t DMA_CONTROL_FIXED_DESTINATION = 1u << 2;
+
+/**
+ * A dma controller that copies memory to memory or memory to a peripheral register. A transfer takes
+ * LENGTH / bytes_per_cycle cycles, the data is moved when it finishes. If both the source and the destination
+ * are in a region backed by host memory the data is moved with a single memmove.
+ */
+class dma : public peripheral {
+
+private:
+
+    /**
+     * The registers of a channel
+     */
+    struct channel {
+        uint32_t source;
+        uint32_t destination;
+        uint32_t length;
+        uint32_t control;
+    };
+
+    /**
+     * The cpu we raise the interrupts on and schedule the transfers with
+     */
+    cpu *instance;
+
+    /**
+     * The interrupt the controller raises
+     */
+    uint32_t irq;
+
+    /**
+     * How many bytes the controller moves per cycle
+     */
+    uint32_t bytes_per_cycle;
+
+    /**
+     * The channels of the controller
+     */
+    channel channels[DMA_CHANNELS];
+
+    /**
+     * The finished channels
+     */
+    uint32_t status;
+
+    /**
+     * Reads a register
+     * @param offset the offset of the register from the start address
+     * @return the value
+     */
+    uint32_t read_register(uint32_t offset);
+
+    /**
+     * Writes a register
+     * @param offset the offset of the register from the start address
+     * @param value the value
+     */
+    void write_register(uint32_t offset, uint32_t value);
+
+    /**
+     * Writes a part of a register, the rest of the register is kept
+     * @param address the address of the part
+     * @param value the value of the part
+     * @param size the size of the part in bytes
+     */
+    void write_part(uint32_t address, uint32_t value, uint32_t size);
+
+    /**
+     * Moves the data of the channel and finishes the transfer
+     * @param index the index of the channel
+     */
+    void transfer(uint32_t index);
+
+public:
+
+    /**
+     * Creates the dma controller
+     * @param start_address the address of the first register
+     * @param instance the cpu the controller is connected to
+     * @param irq the interrupt the controller raises
+     * @param bytes_per_cycle how many bytes the controller moves per cycle
+     */
+    dma(uint32_t start_address, cpu *instance, uint32_t irq, uint32_t bytes_per_cycle = 4);
+
+    /**
+     * Stops the transfers and clears the registers
+     */
+    void reset() override;
+
+    void write(uint32_t address, uint8_t value) override;
+    void write(uint32_t address, uint16_t value) override;
+    void write(uint32_t address, uint32_t value) override;
+    void read(uint32_t address, uint8_t &value) override;
+    void read(uint32_t address, uint16_t &value) override;
+    void read(uint32_t address, uint32_t &value) override;
+};
+
+#endif //EMULATOR_M0_DMA_H
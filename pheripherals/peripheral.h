@@ -19,8 +19,8 @@ protected:
     uint32_t start_address;
 
     /**
-     * the address where the peripheral ends, must be between 0x3FFFFFFF and 0x60000000
-     * and greater than the start_address
+     * the last address of the peripheral, must be between 0x3FFFFFFF and 0x60000000
+     * and not less than the start_address
      */
     uint32_t end_address;
 
@@ -29,15 +29,25 @@ protected:
      */
     std::string name;
 
+    /**
+     * the host memory of the peripheral if it is a plain register file, the byte at start_address is the first byte.
+     * If it is set the mmu accesses the memory directly instead of calling read and write, nullptr otherwise
+     */
+    uint8_t *backing = nullptr;
+
 public:
 
-    peripheral(uint32_t start_address, uint32_t end_address) : start_address(start_address), end_address(end_address) {}
+    peripheral(uint32_t start_address, uint32_t end_address, const std::string &name = "") : start_address(start_address),
+                                                                                            end_address(end_address),
+                                                                                            name(name) {}
+
+    virtual ~peripheral() = default;
 
     /**
      * writes a byte to the peripheral
      * @param address
      */
-    virtual void writeWord(uint32_t address, uint8_t value) = 0;
+    virtual void write(uint32_t address, uint8_t value) = 0;
 
     /**
      * writes a half-word to the peripheral
@@ -69,6 +79,42 @@ public:
      */
     virtual void read(uint32_t address, uint32_t &value) = 0;
 
+    /**
+     * reads consecutive words from the peripheral, override it if the peripheral can do it faster than word by word
+     * @param address the address of the first word
+     * @param values the array we are reading into
+     * @param count the number of words
+     */
+    virtual void read_block(uint32_t address, uint32_t *values, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            read(address + 4 * i, values[i]);
+        }
+    }
+
+    /**
+     * writes consecutive words to the peripheral, override it if the peripheral can do it faster than word by word
+     * @param address the address of the first word
+     * @param values the array we are writing from
+     * @param count the number of words
+     */
+    virtual void write_block(uint32_t address, const uint32_t *values, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            write(address + 4 * i, values[i]);
+        }
+    }
+
+    /**
+     * puts the peripheral back into its reset state, the cpu calls it when it is reset and drops the events the
+     * peripheral has scheduled
+     */
+    virtual void reset() {}
+
+    /**
+     * returns the host memory of the peripheral
+     * @return the memory or nullptr if the peripheral is not a plain register file
+     */
+    inline uint8_t *get_backing() const { return backing; }
+
     /**
      * returns the start address of the peripheral
      * @return the start address
@@ -99,7 +145,7 @@ public:
      * true if address is in the peripheral
      */
     inline bool in_range(uint32_t address) {
-        return this->start_address >= address && address < this->end_address;
+        return address >= this->start_address && address <= this->end_address;
     }
 
 };
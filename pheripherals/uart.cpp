@@ -0,0 +1,244 @@
+//
+// Created by dimitrije on 10/8/26.
+//
+
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "uart.h"
+#include "cpu.h"
+
+uart::uart(uint32_t start_address, cpu *instance, std::ostream &output, uint64_t cycles_per_byte) :
+        peripheral(start_address, start_address + UART_STATUS + 3, "uart"),
+        instance(instance),
+        cycles_per_byte(cycles_per_byte),
+        tx_busy(false),
+        tx_handed(0),
+        tx_written(0),
+        output(output),
+        rx_count(0),
+        stopping(false) {
+
+    tx_buffer.reserve(UART_TX_BATCH);
+    output_thread = std::thread(&uart::write_output, this);
+}
+
+uart::~uart() {
+
+    flush();
+
+    // stop the threads
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        stopping = true;
+    }
+    tx_changed.notify_all();
+
+    output_thread.join();
+    if (input_thread.joinable()) {
+        input_thread.join();
+    }
+}
+
+void uart::open_input(const std::string &file) {
+
+    if (input_thread.joinable()) {
+        throw std::runtime_error("the uart already has an input");
+    }
+
+    bool owned = file != "-";
+    int fd = owned ? open(file.c_str(), O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) {
+        throw std::runtime_error("could not open the uart input : " + file);
+    }
+
+    input_thread = std::thread(&uart::read_input, this, fd, owned);
+}
+
+void uart::receive(const std::string &data) {
+    std::unique_lock<std::mutex> guard(lock);
+    rx_fifo.insert(rx_fifo.end(), data.begin(), data.end());
+    rx_count = rx_fifo.size();
+}
+
+void uart::flush() {
+
+    hand_over();
+
+    // wait for the output thread to write everything
+    std::unique_lock<std::mutex> guard(lock);
+    tx_changed.wait(guard, [this] { return tx_written == tx_handed; });
+}
+
+void uart::reset() {
+    tx_busy = false;
+    tx_fifo.clear();
+}
+
+void uart::write_output() {
+
+    std::vector<char> batch;
+
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+
+        tx_changed.wait(guard, [this] { return !tx_queued.empty() || stopping; });
+
+        if (tx_queued.empty()) {
+            return;
+        }
+
+        // take everything that is queued and write it without holding the lock
+        batch.swap(tx_queued);
+        uint64_t handed = tx_handed;
+        guard.unlock();
+
+        output.write(batch.data(), batch.size());
+        output.flush();
+        batch.clear();
+
+        guard.lock();
+        tx_written = handed;
+        tx_changed.notify_all();
+    }
+}
+
+void uart::read_input(int fd, bool owned) {
+
+    char chunk[256];
+    pollfd descriptor = {fd, POLLIN, 0};
+
+    while (!stopping) {
+
+        // wait a bit for the input so that we notice when we are stopped
+        if (poll(&descriptor, 1, 50) <= 0) {
+            continue;
+        }
+
+        ssize_t size = ::read(fd, chunk, sizeof(chunk));
+        if (size <= 0) {
+            break;
+        }
+
+        receive(std::string(chunk, (size_t) size));
+    }
+
+    if (owned) {
+        close(fd);
+    }
+}
+
+void uart::hand_over() {
+
+    if (tx_buffer.empty()) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        tx_queued.insert(tx_queued.end(), tx_buffer.begin(), tx_buffer.end());
+        ++tx_handed;
+    }
+    tx_changed.notify_all();
+
+    tx_buffer.clear();
+}
+
+void uart::send(uint8_t value) {
+
+    // the byte waits for the previous ones, it is dropped if there is no room for it
+    if (tx_busy) {
+        if (tx_fifo.size() < UART_TX_FIFO_SIZE) {
+            tx_fifo.push_back(value);
+        }
+        return;
+    }
+
+    transmit(value);
+}
+
+void uart::transmit(uint8_t value) {
+
+    tx_buffer.push_back((char) value);
+
+    // the output thread gets the bytes at the end of a line or when there are enough of them
+    if (value == '\n' || tx_buffer.size() >= UART_TX_BATCH) {
+        hand_over();
+    }
+
+    // model the time it takes to send the byte
+    if (cycles_per_byte != 0) {
+        tx_busy = true;
+        instance->schedule(cycles_per_byte, [this] { transmitted(); });
+    }
+}
+
+void uart::transmitted() {
+
+    tx_busy = false;
+
+    // the next byte in the FIFO goes out
+    if (!tx_fifo.empty()) {
+        uint8_t value = tx_fifo.front();
+        tx_fifo.pop_front();
+        transmit(value);
+    }
+}
+
+uint8_t uart::take() {
+
+    if (rx_count == 0) {
+        return 0;
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    uint8_t value = rx_fifo.front();
+    rx_fifo.pop_front();
+    rx_count = rx_fifo.size();
+    return value;
+}
+
+uint32_t uart::status() const {
+    return (tx_fifo.size() < UART_TX_FIFO_SIZE ? UART_STATUS_TX_READY : 0) | (rx_count != 0 ? UART_STATUS_RX_READY : 0);
+}
+
+void uart::write(uint32_t address, uint8_t value) {
+    if (address - start_address == UART_DATA) {
+        send(value);
+    }
+}
+
+void uart::write(uint32_t address, uint16_t value) {
+    write(address, (uint8_t) value);
+}
+
+void uart::write(uint32_t address, uint32_t value) {
+    write(address, (uint8_t) value);
+}
+
+void uart::read(uint32_t address, uint8_t &value) {
+    uint32_t result;
+    read(address, result);
+    value = (uint8_t) result;
+}
+
+void uart::read(uint32_t address, uint16_t &value) {
+    uint32_t result;
+    read(address, result);
+    value = (uint16_t) result;
+}
+
+void uart::read(uint32_t address, uint32_t &value) {
+    switch (address - start_address) {
+        case UART_DATA: value = take(); break;
+        case UART_STATUS: value = status(); break;
+        default: value = 0; return;
+    }
+
+    // what we have received depends on the host
+    input_log *log = instance->get_input_log();
+    if (log != nullptr) {
+        value = log->input(address, value);
+    }
+}
@@ -0,0 +1,229 @@
+//
+// Created by dimitrije on 10/8/26.
+//
+
+#ifndef EMULATOR_M0_UART_H
+#define EMULATOR_M0_UART_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "peripheral.h"
+
+class cpu;
+
+/**
+ * The registers of the uart
+ *
+ * UART_DATA - writing sends the low byte, reading takes the next received byte (0 if there is none)
+ * UART_STATUS - the status flags below
+ */
+const uint32_t UART_DATA = 0x0;
+const uint32_t UART_STATUS = 0x4;
+
+/**
+ * The bits of the status register
+ *
+ * UART_STATUS_TX_READY - the TX FIFO has room for the next byte to send
+ * UART_STATUS_RX_READY - there is a received byte to read
+ */
+const uint32_t UART_STATUS_TX_READY = 1u << 0;
+const uint32_t UART_STATUS_RX_READY = 1u << 1;
+
+/**
+ * The number of bytes that wait in the TX FIFO while a byte is being sent
+ */
+const size_t UART_TX_FIFO_SIZE = 16;
+
+/**
+ * The number of sent bytes we collect before we hand them to the output thread
+ */
+const size_t UART_TX_BATCH = 4096;
+
+/**
+ * A uart that sends to a host stream and receives from a host file or the standard input.
+ *
+ * The sent bytes are collected in a buffer that is handed to an output thread at the end of each line or when it
+ * fills up, so the emulation never waits for the host stream. The received bytes are read by an input thread into
+ * the RX FIFO. If cycles_per_byte is set sending a byte takes that many cycles, the bytes written in the meantime
+ * wait in the TX FIFO and are sent one after another. TX_READY is clear while the TX FIFO is full, the firmware has
+ * to wait for it like on the hardware, a byte written to a full FIFO is dropped.
+ */
+class uart : public peripheral {
+
+private:
+
+    /**
+     * The cpu we schedule the baud rate timing with
+     */
+    cpu *instance;
+
+    /**
+     * The number of cycles it takes to send a byte, 0 if sending is instant
+     */
+    uint64_t cycles_per_byte;
+
+    /**
+     * Set while a byte is being sent
+     */
+    bool tx_busy;
+
+    /**
+     * The bytes that wait until the one being sent is out
+     */
+    std::deque<uint8_t> tx_fifo;
+
+    /**
+     * The sent bytes that were not handed to the output thread yet, only touched by the emulation
+     */
+    std::vector<char> tx_buffer;
+
+    /**
+     * The bytes handed to the output thread
+     */
+    std::vector<char> tx_queued;
+
+    /**
+     * The number of batches handed to the output thread and the number of batches it has written
+     */
+    uint64_t tx_handed;
+    uint64_t tx_written;
+
+    /**
+     * The stream the output thread writes to
+     */
+    std::ostream &output;
+
+    /**
+     * Guards the queued bytes, the counters and the RX FIFO
+     */
+    std::mutex lock;
+
+    /**
+     * Wakes up the output thread and the ones waiting for it in flush
+     */
+    std::condition_variable tx_changed;
+
+    /**
+     * The received bytes that were not read yet
+     */
+    std::deque<uint8_t> rx_fifo;
+
+    /**
+     * The number of bytes in the RX FIFO, so that polling the status does not take the lock
+     */
+    std::atomic<size_t> rx_count;
+
+    /**
+     * Tells the threads to finish
+     */
+    std::atomic<bool> stopping;
+
+    /**
+     * The thread writing the sent bytes to the output
+     */
+    std::thread output_thread;
+
+    /**
+     * The thread reading the input into the RX FIFO
+     */
+    std::thread input_thread;
+
+    /**
+     * Writes the queued batches to the output until we stop
+     */
+    void write_output();
+
+    /**
+     * Reads the file descriptor into the RX FIFO until the end of the input or until we stop
+     * @param fd the file descriptor
+     * @param owned true if we have to close it
+     */
+    void read_input(int fd, bool owned);
+
+    /**
+     * Hands the buffered bytes to the output thread
+     */
+    void hand_over();
+
+    /**
+     * Sends a byte, or queues it if we are still sending the previous one
+     * @param value the byte
+     */
+    void send(uint8_t value);
+
+    /**
+     * Starts sending a byte
+     * @param value the byte
+     */
+    void transmit(uint8_t value);
+
+    /**
+     * Finishes sending a byte and starts the next one from the TX FIFO
+     */
+    void transmitted();
+
+    /**
+     * Takes the next received byte
+     * @return the byte or 0 if there is none
+     */
+    uint8_t take();
+
+    /**
+     * Returns the status register
+     * @return the status
+     */
+    uint32_t status() const;
+
+public:
+
+    /**
+     * Creates the uart
+     * @param start_address the address of the first register
+     * @param instance the cpu the uart is connected to
+     * @param output the stream the sent bytes go to
+     * @param cycles_per_byte the number of cycles it takes to send a byte, 0 to send instantly
+     */
+    uart(uint32_t start_address, cpu *instance, std::ostream &output, uint64_t cycles_per_byte = 0);
+
+    /**
+     * Flushes the output and stops the threads
+     */
+    ~uart() override;
+
+    /**
+     * Starts feeding the RX FIFO from a file
+     * @param file the path of the file or "-" for the standard input
+     */
+    void open_input(const std::string &file);
+
+    /**
+     * Adds bytes to the RX FIFO as if they were received
+     * @param data the bytes
+     */
+    void receive(const std::string &data);
+
+    /**
+     * Waits until everything that was sent is written to the output
+     */
+    void flush();
+
+    /**
+     * Stops the byte that is being sent and empties the TX FIFO, the received bytes are kept
+     */
+    void reset() override;
+
+    void write(uint32_t address, uint8_t value) override;
+    void write(uint32_t address, uint16_t value) override;
+    void write(uint32_t address, uint32_t value) override;
+    void read(uint32_t address, uint8_t &value) override;
+    void read(uint32_t address, uint16_t &value) override;
+    void read(uint32_t address, uint32_t &value) override;
+};
+
+#endif //EMULATOR_M0_UART_H
@@ -0,0 +1,259 @@
+//
+// Created by dimitrije on 10/16/26.
+//
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "bbv.h"
+#include "sharded_run.h"
+#include "translator.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * The number of instructions in an interval
+ */
+const uint64_t INTERVAL = 100;
+
+/**
+ * Loads the Collatz sequence of 27 into a cpu, the number of steps is counted in R3.
+ *
+ *        MOV R1, #1
+ *        LSL R1, R1, #29
+ *        MOV R0, #0
+ *        LDR R2, [R1, R0]
+ *        MOV R3, #0
+ *        MOV R6, #check + 1
+ * loop:  ADD R3, #1
+ *        LSR R4, R2, #1
+ *        LSL R5, R2, #31
+ *        CMP R5, #0
+ *        BEQ even
+ *        ADD R4, R2, R2
+ *        ADD R2, R4, R2
+ *        ADD R2, #1
+ *        BX R6
+ * even:  ADD R2, R4, #0
+ * check: CMP R2, #1
+ *        BNE loop
+ *        BKPT
+ */
+static void load(cpu *target) {
+
+    std::vector<uint16_t> code = {0x2101, 0x0749, 0x2000, 0x580A, 0x2300, 0x2679, 0x3301, 0x0854, 0x07D5, 0x2D00,
+                                  0xD003, 0x1894, 0x18A2, 0x3201, 0x4730, 0x1C22, 0x2A01, 0xD1F3, 0xBE00};
+
+    mmu *memory = target->get_mmu();
+    for (uint32_t i = 0; i < 256u; ++i) {
+        memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+        memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+    }
+
+    memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+    for (uint32_t i = 0; i < code.size(); ++i) {
+        memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+    }
+    memory->write32(SRAM_BEGIN, 27);
+
+    target->reset();
+}
+
+/**
+ * Returns the instruction counts of a vector from the largest to the smallest
+ */
+static std::vector<uint64_t> counts_of(const std::vector<std::pair<uint32_t, uint64_t>> &vector) {
+    std::vector<uint64_t> counts;
+    for (const auto &entry : vector) {
+        counts.push_back(entry.second);
+    }
+    std::sort(counts.rbegin(), counts.rend());
+    return counts;
+}
+
+/**
+ * Every interval should have all of its instructions in the blocks of the loop
+ */
+TEST(test_bbv, test_bbv_collect)
+{
+    cpu instance(1024u, 1024u);
+    load(&instance);
+
+    bbv_collector collector(&instance, INTERVAL);
+    collector.run(50);
+    collector.run(100000);
+
+    ASSERT_TRUE(instance.is_halted());
+    EXPECT_EQ(instance.get_registers()[3].to_uint, 111);
+    EXPECT_EQ(collector.get_interval_count(), instance.get_instructions() / INTERVAL);
+
+    // the start, the loop, the odd step, even step and the check are the blocks
+    EXPECT_EQ(collector.get_block_count(), 4);
+
+    for (size_t i = 0; i < collector.get_interval_count(); ++i) {
+        uint64_t total = 0;
+        for (const auto &entry : collector.get_vector(i)) {
+            EXPECT_GE(entry.first, 1);
+            EXPECT_LE(entry.first, collector.get_block_count());
+            total += entry.second;
+        }
+        EXPECT_EQ(total, INTERVAL) << "interval " << i;
+    }
+
+    // a line for every interval and one for the unfinished one
+    std::stringstream output;
+    collector.write(output);
+
+    std::string line;
+    size_t lines = 0;
+    while (std::getline(output, line)) {
+        EXPECT_EQ(line.substr(0, 2), "T:");
+        lines++;
+    }
+    EXPECT_EQ(lines, collector.get_interval_count() + (instance.get_instructions() % INTERVAL != 0 ? 1 : 0));
+}
+
+/**
+ * The simulation points picked from the vectors should be the only intervals that are replayed
+ */
+TEST(test_bbv, test_bbv_simulation_points)
+{
+    std::stringstream points("7 1\n3 0\n");
+    std::stringstream weights("0.75 0\n0.25 1\n");
+
+    std::vector<simulation_point> chosen = read_simulation_points(points, weights);
+    ASSERT_EQ(chosen.size(), 2);
+    EXPECT_EQ(chosen[0].interval, 3);
+    EXPECT_EQ(chosen[0].weight, 0.75);
+    EXPECT_EQ(chosen[1].interval, 7);
+    EXPECT_EQ(chosen[1].weight, 0.25);
+
+    // the vectors of the whole run
+    cpu instance(1024u, 1024u);
+    load(&instance);
+    bbv_collector collector(&instance, INTERVAL);
+    collector.run(100000);
+
+    // the run that only replays the points
+    cpu fast(1024u, 1024u);
+    cpu worker(1024u, 1024u);
+    load(&fast);
+    load(&worker);
+
+    sharded_run sampled(&fast, INTERVAL, 1u << 20);
+    sampled.select({chosen[0].interval, chosen[1].interval});
+    sampled.run(100000);
+
+    ASSERT_EQ(sampled.get_interval_count(), 2);
+    EXPECT_EQ(sampled.get_interval_number(0), 3);
+    EXPECT_EQ(sampled.get_interval_number(1), 7);
+
+    // the detailed run of a point executes the instructions of its interval
+    typedef std::vector<std::pair<uint32_t, uint64_t>> vector;
+    std::vector<vector> details = sampled.replay<vector>({&worker}, [](cpu *point, uint64_t length) {
+        bbv_collector detail(point, INTERVAL);
+        detail.run(length);
+        return detail.get_vector(0);
+    });
+
+    EXPECT_EQ(sampled.get_mismatches(), 0);
+    for (size_t i = 0; i < details.size(); ++i) {
+
+        // the block the point starts in is counted from the start of the point
+        std::vector<uint64_t> expected = counts_of(collector.get_vector(chosen[i].interval));
+        std::vector<uint64_t> detailed = counts_of(details[i]);
+        ASSERT_GE(detailed.size(), expected.size());
+
+        uint64_t total = 0;
+        for (uint64_t count : detailed) {
+            total += count;
+        }
+        EXPECT_EQ(total, INTERVAL);
+        EXPECT_LE(detailed.size(), expected.size() + 1);
+    }
+}
+
+/**
+ * The cycles a sleeping cpu skips should not be counted in the vectors.
+ *
+ * MOV R1, #1
+ * WFE
+ * MOV R2, #2
+ * BKPT
+ */
+TEST(test_bbv, test_bbv_sleep)
+{
+    cpu instance(1024u, 1024u);
+
+    std::vector<uint16_t> code = {0x2101, 0xBF20, 0x2202, 0xBE00};
+    mmu *memory = instance.get_mmu();
+    memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+    for (uint32_t i = 0; i < code.size(); ++i) {
+        memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+    }
+    instance.reset();
+    instance.schedule(50, [&instance] { instance.set_event(); });
+
+    bbv_collector collector(&instance, INTERVAL);
+    collector.run(10);
+
+    ASSERT_TRUE(instance.is_halted());
+    EXPECT_GT(instance.get_cycles(), 50);
+
+    // the four instructions are in the block the run started in
+    std::stringstream output;
+    collector.write(output);
+    EXPECT_EQ(output.str(), "T:1:4 \n");
+}
+
+/**
+ * A translated run should give the same vectors as an interpreted one, the blocks it leaves without a taken branch
+ * are not the start of a basic block
+ */
+TEST(test_bbv, test_bbv_translated)
+{
+    cpu interpreted(1024u, 1024u);
+    cpu translated(1024u, 1024u);
+    load(&interpreted);
+    load(&translated);
+
+    // translate the code region
+    std::vector<uint8_t> image(1024u);
+    for (uint32_t i = 0; i < image.size(); ++i) {
+        image[i] = (uint8_t) translated.get_mmu()->read8(CODE_BEGIN + i);
+    }
+
+    translator t(image.data(), (uint32_t) image.size());
+    t.discover();
+
+    std::string source = testing::TempDir() + "test-bbv.cpp";
+    std::string library = testing::TempDir() + "test-bbv.so";
+
+    std::ofstream out(source);
+    out << t.emit();
+    out.close();
+
+    ASSERT_TRUE(translator::compile(source, library));
+    translated.load_translation(library);
+
+    std::stringstream interpreted_output, translated_output;
+    {
+        bbv_collector collector(&interpreted, INTERVAL);
+        collector.run(100000);
+        collector.write(interpreted_output);
+    }
+    {
+        bbv_collector collector(&translated, INTERVAL);
+        collector.run(100000);
+        EXPECT_EQ(collector.get_block_count(), 4);
+        collector.write(translated_output);
+    }
+
+    ASSERT_TRUE(translated.is_halted());
+    EXPECT_EQ(translated.get_instructions(), interpreted.get_instructions());
+    EXPECT_EQ(translated_output.str(), interpreted_output.str());
+}
@@ -0,0 +1,202 @@
+//
+// Created by dimitrije on 10/12/26.
+//
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include "checkpoints.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * The address of the store in the loop
+ */
+const uint32_t STORE_ADDRESS = 0x00000060;
+
+/**
+ * Sets up a code image that counts in R2 and stores the count to the start of the sram :
+ *
+ *       MOV R1, #1
+ *       LSL R1, R1, #29
+ *       MOV R3, #loop + 1
+ * loop: ADD R2, #1
+ *       STR R2, [R1, R0]
+ *       BX R3
+ *
+ * After the first three instructions the loop does ADD as the instruction 3k + 1, STR as 3k + 2 and BX as 3k + 3
+ */
+class test_checkpoints: public testing::Test {
+public:
+
+    // the cpu
+    cpu *instance;
+
+    test_checkpoints() {
+        instance = new cpu(1024u, 1024u);
+    }
+
+    void SetUp() override {
+
+        mmu *memory = instance->get_mmu();
+
+        // clear the code and the sram
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+            memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+
+        uint16_t code[] = {0x2101, 0x0749, 0x235F, 0x3201, 0x500A, 0x4718};
+        for (uint32_t i = 0; i < sizeof(code) / sizeof(code[0]); ++i) {
+            memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+        }
+
+        instance->reset();
+    }
+
+    ~test_checkpoints() override {
+        delete instance;
+    }
+};
+
+/**
+ * Going back should restore the registers and the sram of the earlier instruction
+ */
+TEST_F(test_checkpoints, test_checkpoints_run_back)
+{
+    checkpoints saved(instance, 30, 1u << 20);
+    saved.run(300);
+
+    EXPECT_EQ(instance->get_instructions(), 300);
+    EXPECT_EQ(instance->get_registers()[2].to_uint, 99);
+    EXPECT_EQ(saved.get_count(), 10);
+
+    // 33 adds and 32 stores were done by the instruction 100
+    saved.run_back_to(100);
+    EXPECT_EQ(instance->get_instructions(), 100);
+    EXPECT_EQ(instance->get_registers()[2].to_uint, 33);
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN), 32);
+
+    saved.reverse_step();
+    EXPECT_EQ(instance->get_instructions(), 99);
+    EXPECT_EQ(instance->get_registers()[2].to_uint, 32);
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN), 32);
+
+    // the last store before the instruction 99 is the 98th instruction
+    EXPECT_TRUE(saved.reverse_continue([](cpu *instance) {
+        return instance->get_registers()[15].to_uint - 2 == STORE_ADDRESS;
+    }));
+    EXPECT_EQ(instance->get_instructions(), 97);
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN), 31);
+
+    // and forward again to the same end
+    saved.run(203);
+    EXPECT_EQ(instance->get_instructions(), 300);
+    EXPECT_EQ(instance->get_registers()[2].to_uint, 99);
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN), 99);
+}
+
+/**
+ * The oldest checkpoints should be dropped to stay in the memory budget
+ */
+TEST_F(test_checkpoints, test_checkpoints_budget)
+{
+    checkpoints saved(instance, 30, 8u * 1024u);
+    saved.run(300);
+
+    EXPECT_LT(saved.get_count(), 10);
+    EXPECT_LE(saved.get_memory(), 8u * 1024u);
+    EXPECT_GT(saved.get_oldest(), 0);
+
+    // we can still go back to any instruction after the oldest checkpoint
+    saved.run_back_to(saved.get_oldest() + 10);
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN), (saved.get_oldest() + 10 + 1) / 3 - 1);
+
+    EXPECT_THROW(saved.run_back_to(0), std::runtime_error);
+}
+
+/**
+ * Runs the loop with a WFE before it :
+ *
+ *       MOV R1, #1
+ *       LSL R1, R1, #29
+ *       MOV R3, #loop + 1
+ *       WFE
+ * loop: ADD R2, #1
+ *       STR R2, [R1, R0]
+ *       BX R3
+ *
+ * The cpu sleeps in the WFE until the event, so the cycles are ahead of the instructions and the checkpoints
+ * should still go back to the right instruction
+ */
+TEST_F(test_checkpoints, test_checkpoints_sleep)
+{
+    uint16_t code[] = {0x2101, 0x0749, 0x2361, 0xBF20, 0x3201, 0x500A, 0x4718};
+    for (uint32_t i = 0; i < sizeof(code) / sizeof(code[0]); ++i) {
+        instance->get_mmu()->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+    }
+
+    instance->schedule(50, [this] { instance->set_event(); });
+    instance->run(5);
+
+    // the WFE retired after the sleep
+    EXPECT_EQ(instance->get_instructions(), 4);
+    EXPECT_GT(instance->get_cycles(), 50);
+
+    checkpoints saved(instance, 30, 1u << 20);
+    saved.run(296);
+    EXPECT_EQ(instance->get_instructions(), 300);
+    EXPECT_EQ(instance->get_registers()[2].to_uint, 99);
+
+    // the adds are the instructions 3k + 2
+    saved.run_back_to(101);
+    EXPECT_EQ(instance->get_instructions(), 101);
+    EXPECT_EQ(instance->get_registers()[2].to_uint, 33);
+
+    saved.reverse_step();
+    EXPECT_EQ(instance->get_instructions(), 100);
+    EXPECT_EQ(instance->get_registers()[2].to_uint, 32);
+}
+
+/**
+ * A written checkpoint should start another cpu with the same code where the first one was
+ */
+TEST_F(test_checkpoints, test_checkpoints_file)
+{
+    instance->run(100);
+
+    std::stringstream file;
+    checkpoints::write(instance, file);
+    instance->run(200);
+
+    // the other cpu only has the code
+    cpu other(1024u, 1024u);
+    for (uint32_t i = 0; i < 256u; ++i) {
+        other.get_mmu()->write32(CODE_BEGIN + i * sizeof(uint32_t),
+                                 instance->get_mmu()->read32(CODE_BEGIN + i * sizeof(uint32_t)));
+    }
+
+    checkpoints::read(file, &other);
+    EXPECT_EQ(other.get_instructions(), 100);
+    EXPECT_EQ(other.get_registers()[2].to_uint, 33);
+    EXPECT_EQ(other.get_mmu()->read32(SRAM_BEGIN), 32);
+
+    // and continues the same run
+    other.run(200);
+    EXPECT_EQ(other.get_instructions(), 300);
+    EXPECT_EQ(other.get_registers()[2].to_uint, instance->get_registers()[2].to_uint);
+    EXPECT_EQ(other.get_mmu()->read32(SRAM_BEGIN), instance->get_mmu()->read32(SRAM_BEGIN));
+
+    // the sram has to fit and the file has to be a checkpoint
+    cpu larger(1024u, 2048u);
+    file.clear();
+    file.seekg(0);
+    EXPECT_THROW(checkpoints::read(file, &larger), std::runtime_error);
+
+    std::stringstream garbage("not a checkpoint");
+    EXPECT_THROW(checkpoints::read(garbage, &other), std::runtime_error);
+}
@@ -213,4 +213,251 @@ TEST_F(test_cpu, test_cpu_loop)
     EXPECT_EQ(psr_register.c, false);
     EXPECT_EQ(psr_register.v, false);
     EXPECT_EQ(psr_register.t, true);
-}
\ No newline at end of file
+}
+
+/**
+ * This test executes the following instructions from the sram :
+ *
+ * MOV R0, #12
+ * MOV R1, #1
+ * ADD R0, R1
+ *
+ * The results should be :
+ * R0 = 13
+ * R1 = 1
+ */
+TEST_F(test_cpu, test_cpu_run_from_sram)
+{
+    // store the init address and instructions
+    instance->get_mmu()->write32(PC_INIT_ADDRESS, SRAM_BEGIN);
+
+    // MOV R0, #12
+    instance->get_mmu()->write16(SRAM_BEGIN, 0x200C);
+
+    // MOV R1, #1
+    instance->get_mmu()->write16(SRAM_BEGIN + 2, 0x2101);
+
+    // ADD R0, R1
+    instance->get_mmu()->write16(SRAM_BEGIN + 4, 0x1840);
+
+    // reset the cpu
+    instance->reset();
+
+    // run the instructions one at the time, each run picks up where the previous one stopped
+    instance->run(1);
+    instance->run(1);
+    instance->run(1);
+
+    // grab the registers from the cpu
+    arm_register_t* regs = instance->get_registers();
+
+    // check the results
+    EXPECT_EQ(regs[0].to_uint, 13);
+    EXPECT_EQ(regs[1].to_uint, 1);
+    EXPECT_EQ(regs[15].to_uint, SRAM_BEGIN + 8);
+}
+
+TEST_F(test_cpu, test_cpu_push_pop)
+{
+    // store the init address and instructions
+    instance->get_mmu()->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+
+    // MOV R0, #1
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS, 0x2001);
+
+    // MOV R1, #2
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS + 2, 0x2102);
+
+    // PUSH { R0, R1 }
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS + 4, 0xB403);
+
+    // POP { R2, R3 }
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS + 6, 0xBC0C);
+
+    // reset the cpu and set up the stack
+    instance->reset();
+    instance->get_registers()[13].to_uint = SRAM_BEGIN + 256;
+
+    // run the instructions
+    instance->run(4);
+
+    // grab the registers from the cpu
+    arm_register_t* regs = instance->get_registers();
+
+    // the pushed values are on the stack in ascending order
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN + 248), 1);
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN + 252), 2);
+
+    // and they are popped into the other registers
+    EXPECT_EQ(regs[2].to_uint, 1);
+    EXPECT_EQ(regs[3].to_uint, 2);
+    EXPECT_EQ(regs[13].to_uint, SRAM_BEGIN + 256);
+}
+
+/**
+ * This test executes the following instructions with the flat memory :
+ *
+ * MOV R0, #12
+ * LDR R0, [R1, #0]
+ *
+ * R1 points after the code region, so the load should stop the run with a HardFault
+ */
+TEST_F(test_cpu, test_cpu_flat_memory_hard_fault)
+{
+    // store the init address and instructions
+    instance->get_mmu()->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+
+    // MOV R0, #12
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS, 0x200C);
+
+    // LDR R0, [R1, #0]
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS + 2, 0x6808);
+
+    // map the memory and reset the cpu
+    instance->enable_flat_memory();
+    instance->reset();
+    instance->get_registers()[1].to_uint = CODE_BEGIN + 0x100000;
+
+    // the move runs through the flat memory
+    instance->run(1);
+    EXPECT_EQ(instance->get_registers()[0].to_uint, 12);
+
+    // the load faults
+    EXPECT_THROW(instance->run(1), std::runtime_error);
+
+    // the registers can still be accessed after the fault
+    EXPECT_EQ(instance->get_registers()[0].to_uint, 12);
+}
+
+/**
+ * Four registers at the start of the peripheral region
+ */
+class flat_test_peripheral : public peripheral {
+public:
+
+    uint32_t registers[4] = {};
+
+    flat_test_peripheral() : peripheral(PERIPHERAL_BEGIN, PERIPHERAL_BEGIN + sizeof(registers) - 1, "registers") {}
+
+    uint32_t &reg(uint32_t address) { return registers[(address - start_address) / 4]; }
+
+    void write(uint32_t address, uint8_t value) override { reg(address) = value; }
+    void write(uint32_t address, uint16_t value) override { reg(address) = value; }
+    void write(uint32_t address, uint32_t value) override { reg(address) = value; }
+    void read(uint32_t address, uint8_t &value) override { value = (uint8_t) reg(address); }
+    void read(uint32_t address, uint16_t &value) override { value = (uint16_t) reg(address); }
+    void read(uint32_t address, uint32_t &value) override { value = reg(address); }
+};
+
+/**
+ * This test executes the following instructions with the flat memory :
+ *
+ * STR R3, [R1, R2]
+ * LDR R0, [R1, R2]
+ * LDR R4, [R5, R2]
+ *
+ * R1 points to a peripheral, so the store and the first load should fault and be executed again through it, R5
+ * points after the code region, so the second load should fault and stop the run with a HardFault
+ */
+TEST_F(test_cpu, test_cpu_flat_memory_peripheral_fault)
+{
+    instance->get_mmu()->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS, 0x508B);
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS + 2, 0x5888);
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS + 4, 0x58AC);
+
+    flat_test_peripheral device;
+    instance->get_mmu()->register_peripheral(&device);
+
+    // map the memory and reset the cpu
+    instance->enable_flat_memory();
+    instance->reset();
+    instance->get_registers()[1].to_uint = PERIPHERAL_BEGIN;
+    instance->get_registers()[2].to_uint = 4;
+    instance->get_registers()[3].to_uint = 0x1234;
+    instance->get_registers()[5].to_uint = CODE_BEGIN + 0x100000;
+
+    // the loads and the stores go straight to the flat memory
+    EXPECT_TRUE(instance->get_mmu()->uses_flat_access());
+
+    // the store faults and reaches the peripheral once
+    instance->run(1);
+    EXPECT_EQ(device.registers[1], 0x1234);
+    EXPECT_EQ(instance->get_peripheral_faults(), 1);
+    EXPECT_EQ(instance->get_instructions(), 1);
+    EXPECT_TRUE(instance->get_mmu()->uses_flat_access());
+
+    // the same for the load
+    instance->run(1);
+    EXPECT_EQ(instance->get_registers()[0].to_uint, 0x1234);
+    EXPECT_EQ(instance->get_peripheral_faults(), 2);
+    EXPECT_EQ(instance->get_instructions(), 2);
+    EXPECT_TRUE(instance->get_mmu()->uses_flat_access());
+
+    // the unmapped address is a HardFault
+    EXPECT_THROW(instance->run(1), std::runtime_error);
+    EXPECT_EQ(instance->get_peripheral_faults(), 2);
+    EXPECT_EQ(instance->get_instructions(), 2);
+}
+
+/**
+ * Calls the functions from the host :
+ *
+ * add:   ADD R0, R0, R1
+ *        BX LR
+ * fifth: MOV R0, SP
+ *        MOV R1, #0
+ *        LDR R0, [R0, R1]
+ *        BX LR
+ * spin:  CMP R0, #0
+ *        BEQ spin
+ *        BX LR
+ *
+ * The state saved before the calls should be restored after them.
+ */
+TEST_F(test_cpu, test_cpu_call)
+{
+    mmu *memory = instance->get_mmu();
+
+    uint16_t code[] = {0x1840, 0x4770, 0x4668, 0x2100, 0x5840, 0x4770, 0x2800, 0xD0FD, 0x4770};
+    for (uint32_t i = 0; i < sizeof(code) / sizeof(code[0]); ++i) {
+        memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+    }
+
+    instance->set_call_stack(SRAM_BEGIN + 1024);
+    instance->reset();
+    cpu_state state = instance->save_state();
+
+    EXPECT_EQ(instance->call(CODE_INIT_ADDRESS | 1, {2, 3}), 5);
+    EXPECT_EQ(instance->call(CODE_INIT_ADDRESS, {40, 2}), 42);
+
+    // the fifth argument is on the stack
+    EXPECT_EQ(instance->call(CODE_INIT_ADDRESS + 4, {1, 2, 3, 4, 5}), 5);
+    EXPECT_EQ(instance->get_registers()[13].to_uint, SRAM_BEGIN + 1024 - 8);
+
+    // the function returns unless the argument is zero
+    EXPECT_EQ(instance->call(CODE_INIT_ADDRESS + 12, {7}, 100), 7);
+    EXPECT_THROW(instance->call(CODE_INIT_ADDRESS + 12, {0}, 100), std::runtime_error);
+
+    // back to where we were
+    instance->restore_state(state);
+    EXPECT_EQ(instance->get_cycles(), 0);
+    EXPECT_EQ(instance->get_registers()[15].to_uint, state.registers[15].to_uint);
+}
+
+/**
+ * BX LR
+ *
+ * An exception return value in the thread mode is not a return, the branch should fault
+ */
+TEST_F(test_cpu, test_cpu_exception_return_in_thread_mode)
+{
+    instance->get_mmu()->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS, 0x4770);
+
+    instance->reset();
+    instance->get_registers()[14].to_uint = EXC_RETURN_THREAD;
+
+    EXPECT_THROW(instance->run(1), std::runtime_error);
+    EXPECT_EQ(instance->get_mode(), THREAD_MODE);
+}
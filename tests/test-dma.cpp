@@ -0,0 +1,202 @@
+//
+// Created by dimitrije on 10/7/26.
+//
+
+#include <gtest/gtest.h>
+#include "cpu.h"
+#include "dma.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * The address of the interrupt handler
+ */
+const uint32_t HANDLER_ADDRESS = 0x00000100;
+
+/**
+ * The addresses we copy from and to
+ */
+const uint32_t SOURCE_ADDRESS = SRAM_BEGIN + 0x100;
+const uint32_t DESTINATION_ADDRESS = SRAM_BEGIN + 0x200;
+
+/**
+ * Sets up a cpu with the dma controller on IRQ 0, the handler of the interrupt is :
+ *
+ * MOV R5, #1
+ * BX LR
+ */
+class test_dma: public testing::Test {
+public:
+
+    // the cpu
+    cpu *instance;
+
+    // the dma controller
+    dma *controller;
+
+    test_dma() {
+        instance = new cpu(1024u, 1024u);
+        controller = new dma(PERIPHERAL_BEGIN, instance, 0);
+        instance->get_mmu()->register_peripheral(controller);
+    }
+
+    void SetUp() override {
+
+        mmu *memory = instance->get_mmu();
+
+        // clear the memory
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+            memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        // the reset vector and the vector of IRQ 0
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+        memory->write32(IRQ_VECTOR_ADDRESS, HANDLER_ADDRESS | 1);
+
+        // the handler
+        memory->write16(HANDLER_ADDRESS, 0x2501);
+        memory->write16(HANDLER_ADDRESS + 2, 0x4770);
+
+        // the data we copy
+        for (uint32_t i = 0; i < 16; ++i) {
+            memory->write32(SOURCE_ADDRESS + 4 * i, 0x1000 + i);
+        }
+    }
+
+    /**
+     * Resets the cpu and puts the stack at the end of the sram
+     */
+    void reset() {
+        instance->reset();
+        instance->get_registers()[13].to_uint = SRAM_BEGIN + 1024u;
+    }
+
+    /**
+     * Programs the channel 0 of the controller the way the firmware would
+     */
+    void start(uint32_t length, uint32_t control) {
+        mmu *memory = instance->get_mmu();
+        memory->write32(PERIPHERAL_BEGIN + DMA_SOURCE, SOURCE_ADDRESS);
+        memory->write32(PERIPHERAL_BEGIN + DMA_DESTINATION, DESTINATION_ADDRESS);
+        memory->write32(PERIPHERAL_BEGIN + DMA_LENGTH, length);
+        memory->write32(PERIPHERAL_BEGIN + DMA_CONTROL, control);
+    }
+
+    ~test_dma() override {
+        delete instance;
+        delete controller;
+    }
+};
+
+/**
+ * The copy should finish after 16 cycles (64 bytes at 4 bytes per cycle) and raise the interrupt
+ */
+TEST_F(test_dma, test_dma_memory_to_memory)
+{
+    reset();
+    start(64, DMA_CONTROL_START | DMA_CONTROL_INTERRUPT);
+
+    mmu *memory = instance->get_mmu();
+
+    // the transfer is still running
+    instance->run(10);
+    EXPECT_EQ(memory->read32(DESTINATION_ADDRESS), 0);
+    EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + DMA_STATUS), 0);
+    EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + DMA_CONTROL) & DMA_CONTROL_START, DMA_CONTROL_START);
+
+    // the transfer finishes and the handler runs
+    instance->run(10);
+    for (uint32_t i = 0; i < 16; ++i) {
+        EXPECT_EQ(memory->read32(DESTINATION_ADDRESS + 4 * i), 0x1000 + i);
+    }
+    EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + DMA_STATUS), 1);
+    EXPECT_EQ(instance->get_registers()[5].to_uint, 1);
+
+    // we are back in the thread mode with the stack restored
+    EXPECT_EQ(instance->get_mode(), THREAD_MODE);
+    EXPECT_EQ(instance->get_registers()[13].to_uint, SRAM_BEGIN + 1024u);
+    EXPECT_LT(instance->get_registers()[15].to_uint, HANDLER_ADDRESS);
+
+    // clear the status
+    memory->write32(PERIPHERAL_BEGIN + DMA_STATUS, 1);
+    EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + DMA_STATUS), 0);
+}
+
+/**
+ * With CPSID I the interrupt should stay pending
+ */
+TEST_F(test_dma, test_dma_interrupt_masked)
+{
+    // CPSID I
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS, 0xB672);
+
+    reset();
+    start(64, DMA_CONTROL_START | DMA_CONTROL_INTERRUPT);
+
+    instance->run(30);
+
+    EXPECT_EQ(instance->get_mmu()->read32(DESTINATION_ADDRESS + 60), 0x100F);
+    EXPECT_EQ(instance->get_pending_interrupts(), 1);
+    EXPECT_EQ(instance->get_registers()[5].to_uint, 0);
+    EXPECT_EQ(instance->get_mode(), THREAD_MODE);
+}
+
+/**
+ * A reset should stop the transfer that is running
+ */
+TEST_F(test_dma, test_dma_reset)
+{
+    reset();
+    start(64, DMA_CONTROL_START | DMA_CONTROL_INTERRUPT);
+
+    instance->run(10);
+    reset();
+    instance->run(20);
+
+    EXPECT_EQ(instance->get_mmu()->read32(DESTINATION_ADDRESS), 0);
+    EXPECT_EQ(instance->get_mmu()->read32(PERIPHERAL_BEGIN + DMA_CONTROL), 0);
+    EXPECT_EQ(instance->get_pending_interrupts(), 0);
+}
+
+/**
+ * With a fixed destination every word goes to the same address
+ */
+TEST_F(test_dma, test_dma_fixed_destination)
+{
+    reset();
+    start(16, DMA_CONTROL_START | DMA_CONTROL_FIXED_DESTINATION);
+
+    instance->run(10);
+
+    EXPECT_EQ(instance->get_mmu()->read32(DESTINATION_ADDRESS), 0x1003);
+    EXPECT_EQ(instance->get_mmu()->read32(DESTINATION_ADDRESS + 4), 0);
+    EXPECT_EQ(instance->get_pending_interrupts(), 0);
+}
+
+/**
+ * A transfer into a watched range should hit the watchpoint as an access of the dma
+ */
+TEST_F(test_dma, test_dma_watchpoint)
+{
+    reset();
+    instance->add_watchpoint(DESTINATION_ADDRESS, 4);
+    start(16, DMA_CONTROL_START);
+
+    EXPECT_EQ(instance->debug_run(20), STOP_WATCHPOINT);
+
+    const watch_hit &hit = instance->get_watch_hit();
+    EXPECT_EQ(hit.origin, ACCESS_DMA);
+    EXPECT_EQ(hit.access_address, DESTINATION_ADDRESS);
+
+    // it goes byte by byte through the slow page
+    EXPECT_EQ(hit.size, 1);
+    EXPECT_TRUE(hit.write);
+
+    // the instructions are the cpu again
+    EXPECT_EQ(instance->get_mmu()->get_origin(), ACCESS_CPU);
+    instance->remove_watchpoint(DESTINATION_ADDRESS, 4);
+}
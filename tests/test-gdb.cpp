@@ -0,0 +1,254 @@
+//
+// Created by dimitrije on 10/13/26.
+//
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "gdb_server.h"
+#include "uart.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * Sets up a code image that counts in R2 and stores the count to the start of the sram :
+ *
+ *       MOV R1, #1
+ *       LSL R1, R1, #29
+ *       MOV R3, #loop + 1
+ * loop: ADD R2, #1
+ *       STR R2, [R1, R0]
+ *       BX R3
+ */
+class test_gdb: public testing::Test {
+public:
+
+    // the cpu
+    cpu *instance;
+
+    // the server
+    gdb_server *server;
+
+    test_gdb() {
+        instance = new cpu(1024u, 1024u);
+        server = new gdb_server(instance);
+    }
+
+    void SetUp() override {
+
+        mmu *memory = instance->get_mmu();
+
+        // clear the code and the sram
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+            memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+
+        uint16_t code[] = {0x2101, 0x0749, 0x235F, 0x3201, 0x500A, 0x4718};
+        for (uint32_t i = 0; i < sizeof(code) / sizeof(code[0]); ++i) {
+            memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+        }
+
+        instance->reset();
+    }
+
+    ~test_gdb() override {
+        delete server;
+        delete instance;
+    }
+};
+
+/**
+ * The registers and the memory should be readable and writable
+ */
+TEST_F(test_gdb, test_gdb_registers_memory)
+{
+    // R0-R15 and xPSR, the PC is the next instruction and the thumb bit is set
+    std::string registers = server->handle("g");
+    EXPECT_EQ(registers.size(), 17 * 8);
+    EXPECT_EQ(registers.substr(15 * 8, 8), "58000000");
+    EXPECT_EQ(registers.substr(16 * 8, 8), "00000001");
+
+    EXPECT_EQ(server->handle("P1=78563412"), "OK");
+    EXPECT_EQ(server->handle("p1"), "78563412");
+    EXPECT_EQ(instance->get_registers()[1].to_uint, 0x12345678);
+
+    EXPECT_EQ(server->handle("M20000010,4:01020304"), "OK");
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN + 0x10), 0x04030201);
+    EXPECT_EQ(server->handle("m20000010,4"), "01020304");
+
+    // the unmapped memory can not be accessed
+    EXPECT_EQ(server->handle("m30000000,4"), "E14");
+
+    // reading the registers of a peripheral does not take the received byte
+    std::ostringstream output;
+    uart serial(PERIPHERAL_BEGIN, instance, output);
+    instance->get_mmu()->register_peripheral(&serial);
+    serial.receive("a");
+    EXPECT_EQ(server->handle("m40000000,4"), "00000000");
+    EXPECT_EQ(instance->get_mmu()->read8(PERIPHERAL_BEGIN + UART_DATA), 'a');
+
+    // the register description
+    EXPECT_EQ(server->handle("qXfer:features:read:target.xml:0,a"), "m<?xml vers");
+}
+
+/**
+ * The cpu should stop at the breakpoints and the watchpoints
+ */
+TEST_F(test_gdb, test_gdb_breakpoints)
+{
+    // stop before the store
+    EXPECT_EQ(server->handle("Z0,60,2"), "OK");
+    EXPECT_EQ(server->handle("c"), "S05");
+    EXPECT_EQ(instance->get_pc(), 0x60);
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN), 0);
+
+    EXPECT_EQ(server->handle("s"), "S05");
+    EXPECT_EQ(instance->get_pc(), 0x62);
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN), 1);
+
+    // and again in the next iteration
+    EXPECT_EQ(server->handle("c"), "S05");
+    EXPECT_EQ(instance->get_pc(), 0x60);
+    EXPECT_EQ(instance->get_registers()[2].to_uint, 2);
+    EXPECT_EQ(server->handle("z0,60,2"), "OK");
+
+    // stop after the store changes the count
+    EXPECT_EQ(server->handle("Z2,20000000,4"), "OK");
+    EXPECT_EQ(server->handle("c"), "T05watch:20000000;");
+    EXPECT_EQ(instance->get_pc(), 0x62);
+    EXPECT_EQ(instance->get_mmu()->read32(SRAM_BEGIN), 2);
+
+    // the hit has the store and the values
+    const watch_hit &hit = instance->get_watch_hit();
+    EXPECT_EQ(hit.pc, 0x60);
+    EXPECT_EQ(hit.origin, ACCESS_CPU);
+    EXPECT_TRUE(hit.write);
+    EXPECT_EQ(hit.old_value, 1);
+    EXPECT_EQ(hit.new_value, 2);
+    EXPECT_EQ(server->handle("z2,20000000,4"), "OK");
+
+    // only the code and the sram can be watched
+    EXPECT_EQ(server->handle("Z2,40000000,4"), "E01");
+}
+
+/**
+ * The breakpoints in the sram should stop the code copied there, a breakpoint at the top of the address space
+ * should not get in the way
+ */
+TEST_F(test_gdb, test_gdb_breakpoint_addresses)
+{
+    mmu *memory = instance->get_mmu();
+    for (uint32_t i = 0; i < 6; ++i) {
+        memory->write16(SRAM_BEGIN + 0x100 + 2 * i, memory->read16(CODE_INIT_ADDRESS + 2 * i));
+    }
+    instance->set_pc(SRAM_BEGIN + 0x100);
+
+    EXPECT_EQ(server->handle("Z0,fffffffe,2"), "OK");
+    EXPECT_EQ(server->handle("Z0,20000106,2"), "OK");
+    EXPECT_EQ(server->handle("c"), "S05");
+    EXPECT_EQ(instance->get_pc(), SRAM_BEGIN + 0x106);
+    EXPECT_EQ(instance->get_registers()[3].to_uint, 0x5F);
+
+    // the loop goes on in the code
+    EXPECT_EQ(server->handle("z0,20000106,2"), "OK");
+    EXPECT_EQ(server->handle("Z0,60,2"), "OK");
+    EXPECT_EQ(server->handle("c"), "S05");
+    EXPECT_EQ(instance->get_pc(), 0x60);
+    EXPECT_EQ(server->handle("z0,fffffffe,2"), "OK");
+}
+
+/**
+ * The read and access watchpoints should stop at the loads, the other pages should not stop the cpu
+ *
+ *       MOV R1, #1
+ *       LSL R1, R1, #29
+ *       MOV R3, #loop + 1
+ * loop: LDR R4, [R1, R0]
+ *       ADD R4, #1
+ *       STR R4, [R1, R0]
+ *       BX R3
+ */
+TEST_F(test_gdb, test_gdb_watch_kinds)
+{
+    uint16_t code[] = {0x2101, 0x0749, 0x235F, 0x580C, 0x3401, 0x500C, 0x4718};
+    for (uint32_t i = 0; i < sizeof(code) / sizeof(code[0]); ++i) {
+        instance->get_mmu()->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+    }
+
+    // a watchpoint on another page
+    EXPECT_EQ(server->handle("Z4,20001000,4"), "OK");
+    EXPECT_EQ(instance->debug_run(100), STOP_BUDGET);
+    EXPECT_EQ(server->handle("z4,20001000,4"), "OK");
+
+    // the load reads the count
+    EXPECT_EQ(server->handle("Z3,20000000,4"), "OK");
+    EXPECT_EQ(server->handle("c"), "T05rwatch:20000000;");
+    EXPECT_EQ(instance->get_pc(), 0x60);
+    EXPECT_EQ(instance->get_watch_hit().pc, 0x5E);
+    EXPECT_FALSE(instance->get_watch_hit().write);
+    uint32_t count = instance->get_watch_hit().new_value;
+    EXPECT_EQ(server->handle("z3,20000000,4"), "OK");
+
+    // the store does not stop a read watchpoint but an access one
+    EXPECT_EQ(server->handle("Z4,20000000,4"), "OK");
+    EXPECT_EQ(server->handle("c"), "T05awatch:20000000;");
+    EXPECT_EQ(instance->get_watch_hit().pc, 0x62);
+    EXPECT_TRUE(instance->get_watch_hit().write);
+    EXPECT_EQ(instance->get_watch_hit().old_value, count);
+    EXPECT_EQ(instance->get_watch_hit().new_value, count + 1);
+
+    EXPECT_EQ(server->handle("c"), "T05awatch:20000000;");
+    EXPECT_EQ(instance->get_watch_hit().pc, 0x5E);
+    EXPECT_FALSE(instance->get_watch_hit().write);
+}
+
+/**
+ * The packets should be framed and acknowledged on the connection
+ */
+TEST_F(test_gdb, test_gdb_connection)
+{
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    std::thread serving([&] { server->serve(fds[0]); });
+
+    auto exchange = [&](const std::string &packet) {
+
+        uint8_t sum = 0;
+        for (char c : packet) {
+            sum += (uint8_t) c;
+        }
+        char framed[64];
+        int length = snprintf(framed, sizeof(framed), "$%s#%02x", packet.c_str(), sum);
+        EXPECT_EQ(write(fds[1], framed, (size_t) length), length);
+
+        // the ack and then the reply
+        std::string reply;
+        char c;
+        while (read(fds[1], &c, 1) == 1) {
+            reply.push_back(c);
+            if (reply.size() > 3 && reply[reply.size() - 3] == '#') {
+                break;
+            }
+        }
+        EXPECT_EQ(write(fds[1], "+", 1), 1);
+        return reply;
+    };
+
+    EXPECT_EQ(exchange("p0"), "+$00000000#80");
+    EXPECT_EQ(exchange("qAttached"), "+$1#31");
+
+    // kill ends the session
+    EXPECT_EQ(write(fds[1], "$k#6b", 5), 5);
+    serving.join();
+    close(fds[1]);
+}
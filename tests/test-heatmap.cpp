@@ -0,0 +1,151 @@
+//
+// Created by dimitrije on 10/17/26.
+//
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include "bbv.h"
+#include "heatmap.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * The number of instructions in an interval of the working set
+ */
+const uint64_t INTERVAL = 20;
+
+/**
+ * Loads a loop that clears the first 64 bytes of the sram into a cpu and reads the first word back.
+ *
+ *        MOV R1, #1
+ *        LSL R1, R1, #29
+ *        MOV R0, #0
+ *        MOV R2, #0
+ * loop:  STR R0, [R1, R2]
+ *        ADD R2, #4
+ *        CMP R2, #64
+ *        BNE loop
+ *        LDR R3, [R1, R0]
+ *        BKPT
+ */
+static void load(cpu *target) {
+
+    std::vector<uint16_t> code = {0x2101, 0x0749, 0x2000, 0x2200, 0x5088, 0x3204, 0x2A40, 0xD1FB, 0x580B, 0xBE00};
+
+    mmu *memory = target->get_mmu();
+    for (uint32_t i = 0; i < 256u; ++i) {
+        memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+        memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+    }
+
+    memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+    for (uint32_t i = 0; i < code.size(); ++i) {
+        memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+    }
+
+    target->reset();
+}
+
+/**
+ * The reads, the writes and the fetches should be counted on the lines they went to
+ */
+TEST(test_heatmap, test_heatmap_counts)
+{
+    cpu instance(1024u, 1024u);
+    load(&instance);
+
+    {
+        memory_heatmap heatmap(&instance);
+        heatmap.run(1000);
+
+        ASSERT_TRUE(instance.is_halted());
+
+        // the loop stores to the first two lines, the first one is read back
+        EXPECT_EQ(heatmap.get_line(SRAM_BEGIN).writes, 8);
+        EXPECT_EQ(heatmap.get_line(SRAM_BEGIN).reads, 1);
+        EXPECT_EQ(heatmap.get_line(SRAM_BEGIN + HEATMAP_LINE_SIZE).writes, 8);
+        EXPECT_EQ(heatmap.get_line(SRAM_BEGIN + HEATMAP_LINE_SIZE).reads, 0);
+        EXPECT_EQ(heatmap.get_line(SRAM_BEGIN + 2 * HEATMAP_LINE_SIZE).writes, 0);
+
+        // the first four instructions are in the line before the loop, every instruction is fetched once
+        EXPECT_EQ(heatmap.get_line(CODE_INIT_ADDRESS).fetches, 4);
+        EXPECT_EQ(heatmap.get_line(CODE_INIT_ADDRESS).reads, 0);
+        EXPECT_EQ(heatmap.get_line(CODE_INIT_ADDRESS + 8).fetches, instance.get_instructions() - 4);
+
+        std::stringstream output;
+        heatmap.write_histogram(output);
+        EXPECT_EQ(output.str(), "# address reads writes fetches\n"
+                                "0x00000040 0 0 4\n"
+                                "0x00000060 0 0 " + std::to_string(instance.get_instructions() - 4) + "\n"
+                                "0x20000000 1 8 0\n"
+                                "0x20000020 0 8 0\n");
+    }
+
+    // the pages are fast again
+    EXPECT_FALSE(instance.get_mmu()->is_slow(CODE_BEGIN, 1024u));
+    EXPECT_FALSE(instance.get_mmu()->is_slow(SRAM_BEGIN, 1024u));
+}
+
+/**
+ * Every interval should count the lines it touched once
+ */
+TEST(test_heatmap, test_heatmap_working_set)
+{
+    cpu instance(1024u, 1024u);
+    load(&instance);
+
+    memory_heatmap heatmap(&instance, INTERVAL);
+    heatmap.run(1000);
+
+    ASSERT_TRUE(instance.is_halted());
+    const std::vector<working_set> &sets = heatmap.get_working_sets();
+    ASSERT_EQ(sets.size(), instance.get_instructions() / INTERVAL);
+
+    // the first interval has the start and the loop over the first line
+    EXPECT_EQ(sets[0].start, 0);
+    EXPECT_EQ(sets[0].code_lines, 2);
+    EXPECT_EQ(sets[0].sram_lines, 1);
+
+    // the second one only runs the loop over the second line
+    EXPECT_EQ(sets[1].start, INTERVAL);
+    EXPECT_EQ(sets[1].code_lines, 1);
+    EXPECT_EQ(sets[1].sram_lines, 2);
+
+    // a line for every interval and one for the unfinished one
+    std::stringstream output;
+    heatmap.write_working_set(output);
+
+    std::string line;
+    size_t lines = 0;
+    while (std::getline(output, line)) {
+        lines++;
+    }
+    EXPECT_EQ(lines, 1 + sets.size() + (instance.get_instructions() % INTERVAL != 0 ? 1 : 0));
+}
+
+/**
+ * The heatmap and the basic block vectors should both get the branches of the cpu
+ */
+TEST(test_heatmap, test_heatmap_with_bbv)
+{
+    cpu instance(1024u, 1024u);
+    load(&instance);
+
+    memory_heatmap heatmap(&instance);
+    {
+        bbv_collector collector(&instance, INTERVAL);
+        collector.run(INTERVAL);
+        EXPECT_EQ(collector.get_interval_count(), 1);
+        EXPECT_EQ(collector.get_block_count(), 2);
+    }
+
+    // the heatmap keeps getting them after the vectors are gone
+    heatmap.run(1000);
+
+    ASSERT_TRUE(instance.is_halted());
+    EXPECT_EQ(heatmap.get_line(CODE_INIT_ADDRESS).fetches, 4);
+    EXPECT_EQ(heatmap.get_line(CODE_INIT_ADDRESS + 8).fetches, instance.get_instructions() - 4);
+}
@@ -0,0 +1,166 @@
+//
+// Created by dimitrije on 10/10/26.
+//
+
+#include <gtest/gtest.h>
+#include <fstream>
+#include "cpu.h"
+#include "hle.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * The address of the library function the firmware calls
+ */
+const uint32_t FUNCTION_ADDRESS = 0x00000200;
+
+/**
+ * Sets up a code image that calls the function at R4 :
+ *
+ * BLX R4
+ * MOV R5, #1
+ *
+ * The function itself is a BKPT, so the cpu halts if it is not hooked
+ */
+class test_hle: public testing::Test {
+public:
+
+    // the cpu
+    cpu *instance;
+
+    test_hle() {
+        instance = new cpu(1024u, 1024u);
+    }
+
+    void SetUp() override {
+
+        mmu *memory = instance->get_mmu();
+
+        // clear the memory
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+            memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+        memory->write16(CODE_INIT_ADDRESS, 0x47A0);
+        memory->write16(CODE_INIT_ADDRESS + 2, 0x2501);
+        memory->write16(FUNCTION_ADDRESS, 0xBE00);
+    }
+
+    /**
+     * Calls the function with the arguments the way the firmware does
+     */
+    uint32_t call(uint32_t r0, uint32_t r1, uint32_t r2) {
+        instance->reset();
+        arm_register_t *r = instance->get_registers();
+        r[0].to_uint = r0;
+        r[1].to_uint = r1;
+        r[2].to_uint = r2;
+        r[4].to_uint = FUNCTION_ADDRESS | 1;
+        instance->run(2);
+        return r[0].to_uint;
+    }
+
+    /**
+     * Writes a string into the memory
+     */
+    void write_string(uint32_t address, const std::string &text) {
+        for (uint32_t i = 0; i < text.size(); ++i) {
+            instance->get_mmu()->write8(address + i, (uint8_t) text[i]);
+        }
+    }
+
+    ~test_hle() override {
+        delete instance;
+    }
+};
+
+/**
+ * The memcpy found in the symbols should run on the host and return to the caller
+ */
+TEST_F(test_hle, test_hle_memcpy_from_symbols)
+{
+    // the output of nm
+    std::string file = testing::TempDir() + "test-hle.nm";
+    std::ofstream(file) << "00000201 T memcpy\n         U abort\n00000301 T strlen\n";
+
+    symbol_table symbols;
+    symbols.load(file);
+    EXPECT_EQ(hle::install_library_hooks(instance, symbols), 2);
+
+    write_string(SRAM_BEGIN, "copy me");
+    EXPECT_EQ(call(SRAM_BEGIN + 0x100, SRAM_BEGIN, 8), SRAM_BEGIN + 0x100);
+
+    // the copy was done and we are back after the call
+    for (uint32_t i = 0; i < 8; ++i) {
+        EXPECT_EQ(instance->get_mmu()->read8(SRAM_BEGIN + 0x100 + i), instance->get_mmu()->read8(SRAM_BEGIN + i));
+    }
+    EXPECT_EQ(instance->get_registers()[5].to_uint, 1);
+    EXPECT_EQ(instance->get_registers()[15].to_uint, CODE_INIT_ADDRESS + 6);
+
+    // without the hook the firmware function runs
+    instance->remove_hook(FUNCTION_ADDRESS);
+    call(SRAM_BEGIN + 0x100, SRAM_BEGIN, 8);
+    EXPECT_EQ(instance->get_registers()[5].to_uint, 0);
+}
+
+/**
+ * The other library functions
+ */
+TEST_F(test_hle, test_hle_library)
+{
+    mmu *memory = instance->get_mmu();
+
+    instance->add_hook(FUNCTION_ADDRESS, hle::memset);
+    call(SRAM_BEGIN + 16, 0xAB, 8);
+    EXPECT_EQ(memory->read32(SRAM_BEGIN + 16), 0xABABABAB);
+    EXPECT_EQ(memory->read32(SRAM_BEGIN + 20), 0xABABABAB);
+    EXPECT_EQ(memory->read32(SRAM_BEGIN + 24), 0);
+
+    instance->add_hook(FUNCTION_ADDRESS, hle::strlen);
+    write_string(SRAM_BEGIN + 64, "hello");
+    EXPECT_EQ(call(SRAM_BEGIN + 64, 0, 0), 5);
+
+    instance->add_hook(FUNCTION_ADDRESS, hle::crc32);
+    write_string(SRAM_BEGIN + 128, "123456789");
+    EXPECT_EQ(call(0, SRAM_BEGIN + 128, 9), 0xCBF43926);
+}
+
+/**
+ * The hooks in the sram and outside of the memory regions should be found as well as the ones in the code
+ */
+TEST_F(test_hle, test_hle_hook_addresses)
+{
+    mmu *memory = instance->get_mmu();
+
+    // the function is copied to the sram
+    memory->write16(SRAM_BEGIN + 0x200, 0xBE00);
+    instance->add_hook(SRAM_BEGIN + 0x200, hle::memset);
+    instance->add_hook(0xFFFFFFF0, hle::strlen);
+    instance->add_hook(0x00001000, hle::strlen);
+
+    EXPECT_TRUE(instance->is_hooked(SRAM_BEGIN + 0x200));
+    EXPECT_TRUE(instance->is_hooked(0xFFFFFFF0));
+    EXPECT_TRUE(instance->is_hooked(0x00001000));
+    EXPECT_FALSE(instance->is_hooked(FUNCTION_ADDRESS));
+    EXPECT_FALSE(instance->is_hooked(0xFFFFFFF2));
+
+    instance->reset();
+    arm_register_t *r = instance->get_registers();
+    r[0].to_uint = SRAM_BEGIN + 16;
+    r[1].to_uint = 0xAB;
+    r[2].to_uint = 4;
+    r[4].to_uint = (SRAM_BEGIN + 0x200) | 1;
+    instance->run(2);
+
+    EXPECT_EQ(memory->read32(SRAM_BEGIN + 16), 0xABABABAB);
+    EXPECT_EQ(r[5].to_uint, 1);
+
+    instance->remove_hook(0xFFFFFFF0);
+    EXPECT_FALSE(instance->is_hooked(0xFFFFFFF0));
+    EXPECT_TRUE(instance->is_hooked(0x00001000));
+}
@@ -0,0 +1,125 @@
+//
+// Created by dimitrije on 10/11/26.
+//
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include "cpu.h"
+#include "uart.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * Sets up two cpus with a code image that reads the uart at PERIPHERAL_BEGIN twice :
+ *
+ * CPSID I
+ * MOV R1, #1
+ * LSL R1, R1, #30
+ * LDR R2, [R1, R0]
+ * LDR R3, [R1, R0]
+ *
+ * One records the run and the other one replays it
+ */
+class test_input_log: public testing::Test {
+public:
+
+    // the recording and the replaying cpu
+    cpu *recording;
+    cpu *replaying;
+
+    // the path of the log
+    std::string log;
+
+    test_input_log() {
+        recording = new cpu(1024u, 1024u);
+        replaying = new cpu(1024u, 1024u);
+        log = testing::TempDir() + "test-input-log.bin";
+    }
+
+    void load(cpu *instance, uint16_t first) {
+
+        mmu *memory = instance->get_mmu();
+
+        // clear the code
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+
+        uint16_t code[] = {first, 0x2101, 0x0789, 0x580A, 0x580B};
+        for (uint32_t i = 0; i < sizeof(code) / sizeof(code[0]); ++i) {
+            memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+        }
+
+        instance->reset();
+    }
+
+    void record() {
+
+        std::ostringstream output;
+        uart serial(PERIPHERAL_BEGIN, recording, output);
+        recording->get_mmu()->register_peripheral(&serial);
+
+        load(recording, 0xB672);
+        serial.receive("ab");
+
+        recording->record_inputs(log);
+        recording->run(5);
+        recording->set_pending_interrupt(3);
+        recording->close_inputs();
+    }
+
+    ~test_input_log() override {
+        delete recording;
+        delete replaying;
+    }
+};
+
+/**
+ * The replay should read the same bytes and get the same interrupt without any input
+ */
+TEST_F(test_input_log, test_input_log_replay)
+{
+    record();
+    EXPECT_EQ(recording->get_registers()[2].to_uint, 'a');
+    EXPECT_EQ(recording->get_registers()[3].to_uint, 'b');
+
+    std::ostringstream output;
+    uart serial(PERIPHERAL_BEGIN, replaying, output);
+    replaying->get_mmu()->register_peripheral(&serial);
+
+    load(replaying, 0xB672);
+    replaying->replay_inputs(log);
+    replaying->run(5);
+
+    EXPECT_EQ(replaying->get_registers()[2].to_uint, 'a');
+    EXPECT_EQ(replaying->get_registers()[3].to_uint, 'b');
+
+    // the interrupts come only from the log, the recorded one is pending after the next cycle
+    replaying->set_pending_interrupt(5);
+    EXPECT_EQ(replaying->get_pending_interrupts(), 0);
+    replaying->run(1);
+    EXPECT_EQ(replaying->get_pending_interrupts(), 1u << 3);
+}
+
+/**
+ * A firmware that reads a different input than the recorded one can not be replayed
+ */
+TEST_F(test_input_log, test_input_log_diverged)
+{
+    record();
+
+    std::ostringstream output;
+    uart serial(PERIPHERAL_BEGIN, replaying, output);
+    replaying->get_mmu()->register_peripheral(&serial);
+
+    // MOV R0, #4 makes it read the status register
+    load(replaying, 0x2004);
+    replaying->replay_inputs(log);
+
+    EXPECT_THROW(replaying->run(5), std::runtime_error);
+}
@@ -0,0 +1,279 @@
+//
+// Created by dimitrije on 10/14/26.
+//
+
+#include <gtest/gtest.h>
+#include <random>
+#include "lockstep.h"
+#include "instructions.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * The number of cpus we run, it is not a multiple of the vector width so the last block is not full
+ */
+const size_t LANE_COUNT = 4 * LOCKSTEP_WIDTH - 3;
+
+/**
+ * Runs the same code on the cpus in lockstep and on reference cpus on their own, they have to end up in the
+ * same state
+ */
+class test_lockstep: public testing::Test {
+public:
+
+    // the cpus in lockstep and the reference ones
+    std::vector<cpu *> lanes;
+    std::vector<cpu *> references;
+
+    test_lockstep() {
+        for (size_t i = 0; i < LANE_COUNT; ++i) {
+            lanes.push_back(new cpu(1024u, 1024u));
+            references.push_back(new cpu(1024u, 1024u));
+        }
+    }
+
+    /**
+     * Loads the code into every cpu and puts the input at the start of the sram
+     */
+    void load(const std::vector<uint16_t> &code) {
+        for (size_t i = 0; i < LANE_COUNT; ++i) {
+            for (cpu *instance : {lanes[i], references[i]}) {
+
+                mmu *memory = instance->get_mmu();
+                for (uint32_t j = 0; j < 256u; ++j) {
+                    memory->write32(CODE_BEGIN + j * sizeof(uint32_t), 0u);
+                    memory->write32(SRAM_BEGIN + j * sizeof(uint32_t), 0u);
+                }
+
+                memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+                for (uint32_t j = 0; j < code.size(); ++j) {
+                    memory->write16(CODE_INIT_ADDRESS + 2 * j, code[j]);
+                }
+                memory->write32(SRAM_BEGIN, (uint32_t) i + 1);
+
+                instance->reset();
+            }
+        }
+    }
+
+    /**
+     * Checks that every cpu in lockstep has the state of its reference
+     */
+    void compare() {
+        for (size_t i = 0; i < LANE_COUNT; ++i) {
+            for (int r = 0; r < 16; ++r) {
+                EXPECT_EQ(lanes[i]->get_registers()[r].to_uint, references[i]->get_registers()[r].to_uint)
+                                    << "lane " << i << " register " << r;
+            }
+            EXPECT_EQ(lanes[i]->get_xpsr(), references[i]->get_xpsr()) << "lane " << i;
+            EXPECT_EQ(lanes[i]->get_cycles(), references[i]->get_cycles()) << "lane " << i;
+            EXPECT_EQ(lanes[i]->is_halted(), references[i]->is_halted()) << "lane " << i;
+        }
+    }
+
+    ~test_lockstep() override {
+        for (size_t i = 0; i < LANE_COUNT; ++i) {
+            delete lanes[i];
+            delete references[i];
+        }
+    }
+};
+
+/**
+ * Random data processing instructions on random registers should give the same results as the cpu, all the cpus
+ * stay at the same instruction
+ */
+TEST_F(test_lockstep, test_lockstep_alu)
+{
+    std::mt19937 random(42);
+
+    // the formats 1 to 5 without the ones that touch the PC
+    std::vector<uint16_t> code;
+    while (code.size() < 300) {
+        auto instr = (uint16_t) (random() % 0x4700);
+        bool hi = decode(instr) == HI_REGISTER_OPERATIONS_BRANCH_EXCHANGE;
+        if (hi && ((instr & 0x87) == 0x87 || (instr & 0x78) == 0x78)) {
+            continue;
+        }
+        code.push_back(instr);
+    }
+    code.push_back(0xBE00);
+    load(code);
+
+    // every cpu starts with different registers
+    for (size_t i = 0; i < LANE_COUNT; ++i) {
+        cpu_state state = lanes[i]->save_state();
+        for (int r = 0; r < 15; ++r) {
+            state.registers[r].to_uint = random();
+        }
+        state.psr_register.c = (random() & 1) != 0;
+        lanes[i]->restore_state(state);
+        references[i]->restore_state(state);
+    }
+
+    lockstep together(lanes);
+    together.run(1000);
+    for (cpu *reference : references) {
+        reference->run(1000);
+    }
+
+    compare();
+    EXPECT_GT(together.get_vector_instructions(), 200);
+    EXPECT_EQ(together.get_split_lanes(), 0);
+}
+
+/**
+ * The ALU operations 8 to 15 should decode the whole 4 bit operation like the cpu, the registers and the flags of
+ * every operation are compared
+ */
+TEST_F(test_lockstep, test_lockstep_alu_operations)
+{
+    std::mt19937 random(7);
+
+    for (uint16_t op = 8; op < 16; ++op) {
+
+        // OP R0, R1 and BKPT
+        load({(uint16_t) (0x4000 | (op << 6) | (1 << 3)), 0xBE00});
+
+        for (size_t i = 0; i < LANE_COUNT; ++i) {
+            cpu_state state = lanes[i]->save_state();
+            state.registers[0].to_uint = i == 0 ? 0x12340000 : (uint32_t) random();
+            state.registers[1].to_uint = i == 0 ? 3 : (uint32_t) random();
+            state.psr_register.c = (random() & 1) != 0;
+            lanes[i]->restore_state(state);
+            references[i]->restore_state(state);
+        }
+
+        lockstep together(lanes);
+        together.run(1);
+        for (cpu *reference : references) {
+            reference->run(1);
+        }
+
+        for (size_t i = 0; i < LANE_COUNT; ++i) {
+            EXPECT_EQ(lanes[i]->get_registers()[0].to_uint, references[i]->get_registers()[0].to_uint)
+                                << "op " << op << " lane " << i;
+            EXPECT_EQ(lanes[i]->get_xpsr(), references[i]->get_xpsr()) << "op " << op << " lane " << i;
+        }
+    }
+}
+
+/**
+ * The Collatz sequence of the input at the start of the sram, the number of steps is counted in R3. The cpus
+ * diverge at the branch on the lowest bit and they stop at different times.
+ *
+ *        MOV R1, #1
+ *        LSL R1, R1, #29
+ *        MOV R0, #0
+ *        LDR R2, [R1, R0]
+ *        MOV R3, #0
+ *        MOV R6, #check + 1
+ * loop:  ADD R3, #1
+ *        LSR R4, R2, #1
+ *        LSL R5, R2, #31
+ *        CMP R5, #0
+ *        BEQ even
+ *        ADD R4, R2, R2
+ *        ADD R2, R4, R2
+ *        ADD R2, #1
+ *        BX R6
+ * even:  ADD R2, R4, #0
+ * check: CMP R2, #1
+ *        BNE loop
+ *        BKPT
+ */
+TEST_F(test_lockstep, test_lockstep_divergence)
+{
+    load({0x2101, 0x0749, 0x2000, 0x580A, 0x2300, 0x2679, 0x3301, 0x0854, 0x07D5, 0x2D00, 0xD003, 0x1894,
+          0x18A2, 0x3201, 0x4730, 0x1C22, 0x2A01, 0xD1F3, 0xBE00});
+
+    // run it in two parts so that the second one starts from the split cpus
+    lockstep together(lanes);
+    together.run(50);
+    together.run(10000);
+    for (cpu *reference : references) {
+        reference->run(50);
+        reference->run(10000);
+    }
+
+    compare();
+    EXPECT_GT(together.get_split_lanes(), 0);
+
+    // the cpus meet again after the if
+    EXPECT_GT(together.get_rejoined_lanes(), 0);
+
+    // the Collatz sequence of 27 takes 111 steps
+    EXPECT_TRUE(lanes[26]->is_halted());
+    EXPECT_EQ(lanes[26]->get_registers()[3].to_uint, 111);
+}
+
+/**
+ * The cpus with the same input should stay together until they halt
+ */
+TEST_F(test_lockstep, test_lockstep_same_input)
+{
+    load({0x2101, 0x0749, 0x2000, 0x580A, 0x2300, 0x2679, 0x3301, 0x0854, 0x07D5, 0x2D00, 0xD003, 0x1894,
+          0x18A2, 0x3201, 0x4730, 0x1C22, 0x2A01, 0xD1F3, 0xBE00});
+
+    for (cpu *lane : lanes) {
+        lane->get_mmu()->write32(SRAM_BEGIN, 27);
+    }
+
+    lockstep together(lanes);
+    together.run(10000);
+
+    EXPECT_EQ(together.get_split_lanes(), 0);
+    EXPECT_GT(together.get_vector_instructions(), together.get_scalar_instructions() / LANE_COUNT);
+    for (cpu *lane : lanes) {
+        EXPECT_TRUE(lane->is_halted());
+        EXPECT_EQ(lane->get_registers()[3].to_uint, 111);
+    }
+}
+
+/**
+ * The loads and the stores should be executed for the group, every cpu accesses its own sram
+ *
+ *       MOV R1, #1
+ *       LSL R1, R1, #29
+ *       MOV R0, #0
+ *       LDR R2, [R1, R0]
+ *       MOV R3, #4
+ * loop: ADD R2, #3
+ *       STR R2, [R1, R3]
+ *       LDRH R4, [R1, R3]
+ *       ADD R0, R0, R4
+ *       ADD R3, #4
+ *       CMP R3, #64
+ *       BNE loop
+ *       LDR R5, [PC, #4]
+ *       BKPT
+ *       .word 0
+ *       .word 0x12345678
+ */
+TEST_F(test_lockstep, test_lockstep_memory)
+{
+    load({0x2101, 0x0749, 0x2000, 0x580A, 0x2304, 0x3203, 0x50CA, 0x5ACC, 0x1900, 0x3304, 0x2B40, 0xD1F8,
+          0x4D01, 0xBE00, 0x0000, 0x0000, 0x5678, 0x1234});
+
+    lockstep together(lanes);
+    together.run(1000);
+    for (cpu *reference : references) {
+        reference->run(1000);
+    }
+
+    compare();
+    for (size_t i = 0; i < LANE_COUNT; ++i) {
+        for (uint32_t address = SRAM_BEGIN; address < SRAM_BEGIN + 64; address += 4) {
+            EXPECT_EQ(lanes[i]->get_mmu()->read32(address), references[i]->get_mmu()->read32(address))
+                                << "lane " << i << " address " << std::hex << address;
+        }
+        EXPECT_EQ(lanes[i]->get_registers()[5].to_uint, 0x12345678);
+    }
+
+    // only the BKPT needs the cpus
+    EXPECT_EQ(together.get_scalar_instructions(), LANE_COUNT);
+    EXPECT_EQ(together.get_split_lanes(), 0);
+}
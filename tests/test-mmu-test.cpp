@@ -2,6 +2,48 @@
 #include <cstring>
 #include "mmu.h"
 
+/**
+ * A peripheral that is just a few registers, the last access is recorded
+ */
+class test_peripheral : public peripheral {
+public:
+
+    // the registers of the peripheral
+    uint32_t registers[4] = {};
+
+    // the width of the last access
+    int last_width = 0;
+
+    test_peripheral(uint32_t start_address, const std::string &name) : peripheral(start_address,
+                                                                                  start_address + sizeof(registers) - 1,
+                                                                                  name) {}
+
+    uint32_t &reg(uint32_t address) { return registers[(address - start_address) / 4]; }
+
+    void write(uint32_t address, uint8_t value) override { last_width = 8; reg(address) = value; }
+    void write(uint32_t address, uint16_t value) override { last_width = 16; reg(address) = value; }
+    void write(uint32_t address, uint32_t value) override { last_width = 32; reg(address) = value; }
+    void read(uint32_t address, uint8_t &value) override { last_width = 8; value = (uint8_t) reg(address); }
+    void read(uint32_t address, uint16_t &value) override { last_width = 16; value = (uint16_t) reg(address); }
+    void read(uint32_t address, uint32_t &value) override { last_width = 32; value = reg(address); }
+
+    // the number of block accesses
+    int block_calls = 0;
+
+    void read_block(uint32_t address, uint32_t *values, uint32_t count) override {
+        ++block_calls;
+        std::memcpy(values, &reg(address), 4 * count);
+    }
+
+    void write_block(uint32_t address, const uint32_t *values, uint32_t count) override {
+        ++block_calls;
+        std::memcpy(&reg(address), values, 4 * count);
+    }
+
+    // makes the registers the backing memory so the mmu skips the calls
+    void map_registers() { backing = (uint8_t *) registers; }
+};
+
 
 class test_mmu: public testing::Test {
 public:
@@ -118,3 +160,245 @@ TEST_F(test_mmu, code_write_read_32)
         EXPECT_EQ(this->instance->read32(CODE_BEGIN + i * sizeof(uint32_t)), i);
     }
 }
+
+TEST_F(test_mmu, resolve_region)
+{
+    // the sized mmu over the same regions
+    mmu sized(code_region, sram_region, 1024u, 512u);
+
+    uint32_t begin, end;
+
+    // the code region
+    EXPECT_EQ(sized.resolve_region(CODE_BEGIN + 100, begin, end), code_region);
+    EXPECT_EQ(begin, CODE_BEGIN);
+    EXPECT_EQ(end, CODE_BEGIN + 1024u);
+
+    // the sram region
+    EXPECT_EQ(sized.resolve_region(SRAM_BEGIN + 511, begin, end), sram_region);
+    EXPECT_EQ(begin, SRAM_BEGIN);
+    EXPECT_EQ(end, SRAM_BEGIN + 512u);
+
+    // outside of the regions
+    EXPECT_EQ(sized.resolve_region(CODE_BEGIN + 1024u, begin, end), nullptr);
+    EXPECT_EQ(sized.resolve_region(SRAM_BEGIN + 512u, begin, end), nullptr);
+    EXPECT_EQ(sized.resolve_region(0x40000000, begin, end), nullptr);
+}
+
+TEST_F(test_mmu, read_write_block)
+{
+    uint32_t values[4] = {1, 2, 3, 4};
+    uint32_t result[4] = {};
+
+    // the block is in the sram region
+    instance->write_block(SRAM_BEGIN + 16, values, 4);
+    instance->read_block(SRAM_BEGIN + 16, result, 4);
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(instance->read32(SRAM_BEGIN + 16 + 4 * i), values[i]);
+        EXPECT_EQ(result[i], values[i]);
+    }
+}
+
+TEST_F(test_mmu, map_flat)
+{
+    // put something in the regions before we map them
+    instance->write32(CODE_BEGIN + 8, 0xCAFEBABE);
+    instance->write32(SRAM_BEGIN + 8, 0xDEADBEEF);
+
+    flat_memory memory(1024u, 1024u);
+    mmu flat(code_region, sram_region, 1024u, 1024u);
+    flat.map_flat(&memory);
+
+    // the content is copied over
+    EXPECT_EQ(flat.read32(CODE_BEGIN + 8), 0xCAFEBABE);
+    EXPECT_EQ(flat.read32(SRAM_BEGIN + 8), 0xDEADBEEF);
+
+    // the accesses go to the flat memory
+    flat.write16(SRAM_BEGIN + 100, 0x1234);
+    EXPECT_EQ(*((uint16_t *) (memory.get_base() + SRAM_BEGIN + 100)), 0x1234);
+
+    // and the regions resolve to it
+    uint32_t begin, end;
+    EXPECT_EQ(flat.resolve_region(SRAM_BEGIN, begin, end), memory.get_base() + SRAM_BEGIN);
+
+    // the bytes past the code region read as 0 and are not written instead of faulting
+    uint8_t data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    flat.write_bytes(CODE_BEGIN + 1020u, data, 8);
+    flat.read_bytes(CODE_BEGIN + 1020u, data, 8);
+    EXPECT_EQ(data[3], 4);
+    EXPECT_EQ(data[4], 0);
+}
+
+TEST_F(test_mmu, map_flat_unsized)
+{
+    // the regions of an mmu that does not know their sizes can not be moved
+    flat_memory memory(1024u, 1024u);
+    EXPECT_THROW(instance->map_flat(&memory), std::runtime_error);
+}
+
+TEST_F(test_mmu, peripheral_dispatch)
+{
+    // register the peripherals out of order
+    std::vector<test_peripheral *> devices;
+    for (uint32_t i = 0; i < 32; ++i) {
+        devices.push_back(new test_peripheral(PERIPHERAL_BEGIN + ((i * 7) % 32) * 0x100, "device" + std::to_string(i)));
+        instance->register_peripheral(devices.back());
+    }
+
+    // each access goes to the right peripheral with the right width
+    for (uint32_t i = 0; i < 32; ++i) {
+        uint32_t address = devices[i]->get_start_address() + 4;
+
+        instance->write32(address, i);
+        EXPECT_EQ(devices[i]->registers[1], i);
+        EXPECT_EQ(devices[i]->last_width, 32);
+
+        EXPECT_EQ(instance->read16(address), i);
+        EXPECT_EQ(devices[i]->last_width, 16);
+
+        instance->write8(address + 4, (uint8_t) (i + 1));
+        EXPECT_EQ(instance->read8(address + 4), i + 1);
+        EXPECT_EQ(devices[i]->last_width, 8);
+    }
+
+    // the gaps between the peripherals read as zero
+    EXPECT_EQ(instance->read32(PERIPHERAL_BEGIN + 0x80), 0);
+
+    // an overlapping peripheral or one outside of the peripheral region is rejected
+    test_peripheral overlapping(PERIPHERAL_BEGIN + 0x108, "overlapping");
+    test_peripheral outside(SRAM_BEGIN, "outside");
+    EXPECT_THROW(instance->register_peripheral(&overlapping), std::runtime_error);
+    EXPECT_THROW(instance->register_peripheral(&outside), std::runtime_error);
+
+    for (auto device : devices) {
+        delete device;
+    }
+}
+
+TEST_F(test_mmu, peripheral_block_and_backing)
+{
+    test_peripheral device(PERIPHERAL_BEGIN, "device");
+    instance->register_peripheral(&device);
+
+    // a block goes to the peripheral in one call
+    uint32_t values[3] = {7, 8, 9};
+    uint32_t result[3] = {};
+    instance->write_block(PERIPHERAL_BEGIN + 4, values, 3);
+    instance->read_block(PERIPHERAL_BEGIN + 4, result, 3);
+
+    EXPECT_EQ(device.block_calls, 2);
+    EXPECT_EQ(device.last_width, 0);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(device.registers[i + 1], values[i]);
+        EXPECT_EQ(result[i], values[i]);
+    }
+
+    // with the backing memory the peripheral is not called at all
+    device.map_registers();
+    instance->write16(PERIPHERAL_BEGIN, 0x1234);
+    EXPECT_EQ(instance->read32(PERIPHERAL_BEGIN), 0x1234);
+    EXPECT_EQ(instance->read8(PERIPHERAL_BEGIN + 4), 7);
+    EXPECT_EQ(device.last_width, 0);
+
+    uint32_t begin, end;
+    EXPECT_EQ(instance->resolve_region(PERIPHERAL_BEGIN + 8, begin, end), (uint8_t *) device.registers);
+    EXPECT_EQ(begin, PERIPHERAL_BEGIN);
+    EXPECT_EQ(end, PERIPHERAL_BEGIN + 16);
+
+    // a word that starts in the last register only reaches the bytes of the peripheral
+    instance->write32(PERIPHERAL_BEGIN + 12, 0x11223344);
+    instance->write32(PERIPHERAL_BEGIN + 14, 0xAABBCCDD);
+    EXPECT_EQ(device.registers[3], 0xCCDD3344);
+    EXPECT_EQ(instance->read32(PERIPHERAL_BEGIN + 14), 0xCCDD);
+}
+
+/**
+ * Records the accesses it is told about
+ */
+class test_observer : public memory_observer {
+public:
+
+    // the accesses as address, size, old value, new value and if it was a write
+    struct access {
+        uint32_t address, size, old_value, new_value;
+        bool write;
+    };
+    std::vector<access> accesses;
+
+    void on_read(uint32_t address, uint32_t size, uint32_t value) override {
+        accesses.push_back({address, size, value, value, false});
+    }
+
+    void on_write(uint32_t address, uint32_t size, uint32_t old_value, uint32_t new_value) override {
+        accesses.push_back({address, size, old_value, new_value, true});
+    }
+};
+
+TEST_F(test_mmu, slow_pages)
+{
+    test_observer observer;
+    instance->add_observer(&observer);
+
+    // only the code page is slow
+    instance->mark_slow(CODE_BEGIN + 16, 4);
+    EXPECT_TRUE(instance->is_slow(CODE_BEGIN, MMU_PAGE_SIZE));
+    EXPECT_FALSE(instance->is_slow(SRAM_BEGIN, 1024u));
+
+    instance->write32(SRAM_BEGIN + 16, 7);
+    EXPECT_EQ(instance->read32(SRAM_BEGIN + 16), 7);
+    EXPECT_TRUE(observer.accesses.empty());
+
+    // the whole page is observed with the old and the new values
+    instance->write32(CODE_BEGIN + 16, 0x11223344);
+    instance->write16(CODE_BEGIN + 100, 0x5566);
+    EXPECT_EQ(instance->read8(CODE_BEGIN + 17), 0x33);
+
+    ASSERT_EQ(observer.accesses.size(), 3);
+    EXPECT_TRUE(observer.accesses[0].write);
+    EXPECT_EQ(observer.accesses[0].address, CODE_BEGIN + 16);
+    EXPECT_EQ(observer.accesses[0].size, 4);
+    EXPECT_EQ(observer.accesses[0].old_value, 0);
+    EXPECT_EQ(observer.accesses[0].new_value, 0x11223344);
+    EXPECT_EQ(observer.accesses[1].address, CODE_BEGIN + 100);
+    EXPECT_FALSE(observer.accesses[2].write);
+    EXPECT_EQ(observer.accesses[2].size, 1);
+    EXPECT_EQ(observer.accesses[2].new_value, 0x33);
+
+    // the blocks go through the observed path too
+    uint32_t values[2] = {};
+    instance->read_block(CODE_BEGIN + 16, values, 2);
+    EXPECT_EQ(values[0], 0x11223344);
+    EXPECT_EQ(observer.accesses.size(), 5);
+
+    // the marks are counted
+    instance->mark_slow(CODE_BEGIN, 8);
+    instance->unmark_slow(CODE_BEGIN + 16, 4);
+    EXPECT_TRUE(instance->is_slow(CODE_BEGIN, 1));
+    instance->unmark_slow(CODE_BEGIN, 8);
+    EXPECT_FALSE(instance->is_slow(CODE_BEGIN, MMU_PAGE_SIZE));
+
+    instance->read32(CODE_BEGIN + 16);
+    EXPECT_EQ(observer.accesses.size(), 5);
+
+    // the peripherals can not be slow
+    EXPECT_THROW(instance->mark_slow(PERIPHERAL_BEGIN, 4), std::runtime_error);
+
+    // a shared sram keeps its values but it is not copied directly
+    instance->set_shared(true);
+    EXPECT_TRUE(instance->is_slow(SRAM_BEGIN + 16, 4));
+    EXPECT_FALSE(instance->is_slow(CODE_BEGIN, 4));
+    instance->write_block(SRAM_BEGIN + 16, values, 2);
+    instance->write8(SRAM_BEGIN + 17, 0x55);
+    EXPECT_EQ(instance->read32(SRAM_BEGIN + 16), 0x11225544);
+    EXPECT_EQ(instance->read32(SRAM_BEGIN + 20), values[1]);
+    instance->set_shared(false);
+    EXPECT_FALSE(instance->is_slow(SRAM_BEGIN + 16, 4));
+
+    // the origin stays until it is set back
+    EXPECT_EQ(instance->get_origin(), ACCESS_CPU);
+    EXPECT_EQ(instance->set_origin(ACCESS_HOST), ACCESS_CPU);
+    EXPECT_EQ(instance->get_origin(), ACCESS_HOST);
+    instance->set_origin(ACCESS_CPU);
+
+    instance->remove_observer(&observer);
+}
@@ -0,0 +1,178 @@
+//
+// Created by dimitrije on 10/15/26.
+//
+
+#include <gtest/gtest.h>
+#include "multicore.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * The address of the interrupt handler
+ */
+const uint32_t HANDLER_ADDRESS = 0x00000080;
+
+/**
+ * Writes the code at CODE_INIT_ADDRESS and points the reset vector to it
+ */
+static void load(mmu *memory, const std::vector<uint16_t> &code) {
+
+    for (uint32_t i = 0; i < 256u; ++i) {
+        memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+        memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+    }
+
+    memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+    for (uint32_t i = 0; i < code.size(); ++i) {
+        memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+    }
+}
+
+/**
+ * The core 0 writes a value to the shared sram and sets a flag after it, then it sends an event. The other cores
+ * wait for the flag in WFE and read the value.
+ *
+ *           MOV R1, #5
+ *           LSL R1, R1, #28
+ *           MOV R0, #0
+ *           LDR R2, [R1, R0]     ; the number of the core
+ *           MOV R1, #1
+ *           LSL R1, R1, #29
+ *           CMP R2, #0
+ *           BNE consumer
+ *           MOV R3, #42
+ *           MOV R0, #4
+ *           STR R3, [R1, R0]     ; the value
+ *           DMB
+ *           MOV R3, #1
+ *           MOV R0, #0
+ *           STR R3, [R1, R0]     ; the flag
+ *           SEV
+ *           BKPT
+ * consumer: MOV R6, #loop + 1
+ *           MOV R0, #0
+ * loop:     LDR R3, [R1, R0]
+ *           CMP R3, #0
+ *           BNE done
+ *           WFE
+ *           BX R6
+ * done:     MOV R0, #4
+ *           LDR R5, [R1, R0]
+ *           BKPT
+ */
+TEST(test_multicore, test_multicore_send_event)
+{
+    multicore cores(4, 1024u, 1024u, 1000);
+
+    load(cores.get_core(0)->get_mmu(), {0x2105, 0x0709, 0x2000, 0x580A, 0x2101, 0x0749, 0x2A00, 0xD109, 0x232A,
+                                        0x2004, 0x500B, 0xF3BF, 0x8F5F, 0x2301, 0x2000, 0x500B, 0xBF40, 0xBE00,
+                                        0x2681, 0x2000, 0x580B, 0x2B00, 0xD101, 0xBF20, 0x4730, 0x2004, 0x580D,
+                                        0xBE00});
+
+    // the memory is shared, every core sees the code
+    EXPECT_EQ(cores.get_core(3)->get_mmu()->read16(CODE_INIT_ADDRESS), 0x2105);
+
+    // the sram is only accessed through the mmus
+    EXPECT_TRUE(cores.get_core(3)->get_mmu()->is_slow(SRAM_BEGIN, 4));
+    EXPECT_FALSE(cores.get_core(3)->get_mmu()->is_slow(CODE_BEGIN, 4));
+
+    cores.reset();
+    cores.run(1000000);
+
+    for (size_t i = 0; i < cores.get_core_count(); ++i) {
+        cpu *core = cores.get_core(i);
+        EXPECT_TRUE(core->is_halted()) << "core " << i;
+        EXPECT_EQ(core->get_registers()[2].to_uint, i) << "core " << i;
+        if (i != 0) {
+            EXPECT_EQ(core->get_registers()[5].to_uint, 42) << "core " << i;
+        }
+    }
+}
+
+/**
+ * A core that waits for an event nobody sends sleeps through the whole run, the others halt
+ */
+TEST(test_multicore, test_multicore_sleeping)
+{
+    multicore cores(2, 1024u, 1024u, 1000);
+
+    // core 1 : WFE, BX R6 (R6 is the WFE) - core 0 : BKPT
+    load(cores.get_core(0)->get_mmu(), {0x2105, 0x0709, 0x2000, 0x580A, 0x2A00, 0xD100, 0xBE00, 0x2669, 0xBF20,
+                                        0x4730});
+    cores.reset();
+    cores.run(10000);
+
+    EXPECT_TRUE(cores.get_core(0)->is_halted());
+    EXPECT_FALSE(cores.get_core(1)->is_halted());
+    EXPECT_TRUE(cores.get_core(1)->is_sleeping());
+
+    // the idle cycles are skipped, not executed
+    EXPECT_GE(cores.get_core(1)->get_cycles(), 10000);
+    EXPECT_LT(cores.get_core(1)->get_cycles(), 10010);
+}
+
+/**
+ * WFI sleeps until the scheduled interrupt, the handler returns after the WFI
+ *
+ *          WFI
+ *          MOV R6, #1
+ *          BKPT
+ * handler: MOV R5, #1
+ *          BX LR
+ */
+TEST(test_multicore, test_multicore_wait_for_interrupt)
+{
+    cpu instance(1024u, 1024u);
+    mmu *memory = instance.get_mmu();
+
+    load(memory, {0xBF30, 0x2601, 0xBE00});
+    memory->write32(IRQ_VECTOR_ADDRESS, HANDLER_ADDRESS | 1);
+    memory->write16(HANDLER_ADDRESS, 0x2501);
+    memory->write16(HANDLER_ADDRESS + 2, 0x4770);
+
+    instance.reset();
+    instance.get_registers()[13].to_uint = SRAM_BEGIN + 1024u;
+    instance.schedule(1000, [&]() { instance.set_pending_interrupt(0); });
+    instance.run(10);
+
+    EXPECT_TRUE(instance.is_halted());
+    EXPECT_EQ(instance.get_registers()[5].to_uint, 1);
+    EXPECT_EQ(instance.get_registers()[6].to_uint, 1);
+    EXPECT_GE(instance.get_cycles(), 1000);
+    EXPECT_LT(instance.get_cycles(), 1010);
+}
+
+/**
+ * SEV sets the event register of the cpu so WFE does not sleep, DMB and DSB are 32 bit instructions
+ *
+ * SEV
+ * DMB
+ * DSB
+ * WFE
+ * MOV R6, #1
+ * BKPT
+ */
+TEST(test_multicore, test_multicore_own_event)
+{
+    cpu instance(1024u, 1024u);
+
+    load(instance.get_mmu(), {0xBF40, 0xF3BF, 0x8F5F, 0xF3BF, 0x8F4F, 0xBF20, 0x2601, 0xBE00});
+    instance.reset();
+    instance.run(10);
+
+    EXPECT_TRUE(instance.is_halted());
+    EXPECT_FALSE(instance.is_sleeping());
+    EXPECT_EQ(instance.get_registers()[6].to_uint, 1);
+
+    // without an event and with nothing scheduled the cpu waits forever
+    instance.reset();
+    instance.get_mmu()->write16(CODE_INIT_ADDRESS, 0x46C0);
+    instance.run(10);
+
+    EXPECT_TRUE(instance.is_halted());
+    EXPECT_TRUE(instance.is_sleeping());
+    EXPECT_EQ(instance.get_registers()[6].to_uint, 0);
+}
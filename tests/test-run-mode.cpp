@@ -0,0 +1,210 @@
+//
+// Created by dimitrije on 10/16/26.
+//
+
+#include <gtest/gtest.h>
+#include "cpu.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * Sets up a cpu that records the instructions it traces and the modes it switches to
+ */
+class test_run_mode: public testing::Test {
+public:
+
+    // the cpu
+    cpu *instance;
+
+    // the traced instructions and the modes the listener was told about
+    std::vector<uint16_t> traced;
+    std::vector<run_mode> switches;
+
+    test_run_mode() {
+        instance = new cpu(1024u, 1024u);
+    }
+
+    /**
+     * Loads the code and resets the cpu
+     */
+    void load(const std::vector<uint16_t> &code) {
+
+        mmu *memory = instance->get_mmu();
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+            memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+        for (uint32_t i = 0; i < code.size(); ++i) {
+            memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+        }
+
+        instance->reset();
+        instance->set_tracer([this](cpu *, uint16_t instr) { traced.push_back(instr); });
+        instance->set_mode_listener([this](cpu *, run_mode mode) { switches.push_back(mode); });
+    }
+
+    ~test_run_mode() override {
+        delete instance;
+    }
+};
+
+/**
+ * The instructions after the switch cycle are traced
+ *
+ *       MOV R6, #loop + 1
+ * loop: ADD R0, #1
+ *       BX R6
+ */
+TEST_F(test_run_mode, test_run_mode_cycle)
+{
+    load({0x265B, 0x3001, 0x4730});
+
+    instance->switch_mode_at_cycle(40, RUN_DETAILED);
+    instance->run(100);
+
+    EXPECT_EQ(instance->get_run_mode(), RUN_DETAILED);
+    EXPECT_EQ(traced.size(), 60);
+    EXPECT_EQ(switches, std::vector<run_mode>({RUN_DETAILED}));
+
+    // the fast mode traces nothing
+    instance->set_run_mode(RUN_FAST);
+    instance->run(100);
+    EXPECT_EQ(traced.size(), 60);
+    EXPECT_EQ(switches, std::vector<run_mode>({RUN_DETAILED, RUN_FAST}));
+}
+
+/**
+ * The switch after a number of retired instructions does not move with the cycles the WFE sleeps through
+ *
+ *       WFE
+ *       MOV R6, #loop + 1
+ * loop: ADD R0, #1
+ *       BX R6
+ */
+TEST_F(test_run_mode, test_run_mode_instruction)
+{
+    load({0xBF20, 0x265D, 0x3001, 0x4730});
+
+    // the event wakes the cpu up at the cycle 50
+    instance->schedule(50, [this]() { instance->set_event(); });
+    instance->switch_mode_at_instruction(40, RUN_DETAILED);
+    instance->run(100);
+
+    // the WFE that sleeps is executed again without retiring
+    EXPECT_GT(instance->get_cycles(), instance->get_instructions());
+    EXPECT_EQ(instance->get_instructions(), 99);
+    EXPECT_EQ(traced.size(), 59);
+    EXPECT_EQ(switches, std::vector<run_mode>({RUN_DETAILED}));
+}
+
+/**
+ * Only the function is traced
+ *
+ *       MOV R6, #function + 1
+ *       MOV R5, #back + 1
+ *       MOV LR, R5
+ *       BX R6
+ * back: BKPT
+ * function:
+ *       MOV R0, #1
+ *       MOV R1, #2
+ *       BX LR
+ */
+TEST_F(test_run_mode, test_run_mode_pc)
+{
+    load({0x2663, 0x2561, 0x46AE, 0x4730, 0xBE00, 0x2001, 0x2102, 0x4770});
+
+    instance->switch_mode_at_pc(CODE_INIT_ADDRESS + 10, RUN_DETAILED);
+    instance->switch_mode_at_pc(CODE_INIT_ADDRESS + 8, RUN_FAST);
+    instance->run(100);
+
+    EXPECT_TRUE(instance->is_halted());
+    EXPECT_EQ(traced, std::vector<uint16_t>({0x2001, 0x2102, 0x4770}));
+    EXPECT_EQ(switches, std::vector<run_mode>({RUN_DETAILED, RUN_FAST}));
+}
+
+/**
+ * A switch at a branch target in the sram is found like one in the code
+ *
+ * MOV R6, #1
+ * LSL R6, R6, #29
+ * ADD R6, #1
+ * BX R6
+ *
+ * The code in the sram :
+ *
+ * MOV R0, #1
+ * BKPT
+ */
+TEST_F(test_run_mode, test_run_mode_sram_pc)
+{
+    load({0x2601, 0x0776, 0x3601, 0x4730});
+    instance->get_mmu()->write16(SRAM_BEGIN, 0x2001);
+    instance->get_mmu()->write16(SRAM_BEGIN + 2, 0xBE00);
+
+    instance->switch_mode_at_pc(SRAM_BEGIN, RUN_DETAILED);
+    instance->run(100);
+
+    EXPECT_TRUE(instance->is_halted());
+    EXPECT_EQ(traced, std::vector<uint16_t>({0x2001, 0xBE00}));
+    EXPECT_EQ(switches, std::vector<run_mode>({RUN_DETAILED}));
+}
+
+/**
+ * The firmware marks the region it wants traced with the semihosting calls
+ *
+ * MOV R0, #1
+ * LSL R0, R0, #8
+ * MOV R1, #1
+ * BKPT 0xAB        ; the detailed mode
+ * MOV R2, #5
+ * MOV R3, #6
+ * MOV R0, #1
+ * LSL R0, R0, #8
+ * MOV R1, #0
+ * BKPT 0xAB        ; the fast mode
+ * BKPT
+ */
+TEST_F(test_run_mode, test_run_mode_semihosting)
+{
+    load({0x2001, 0x0200, 0x2101, 0xBEAB, 0x2205, 0x2306, 0x2001, 0x0200, 0x2100, 0xBEAB, 0xBE00});
+
+    instance->run(100);
+
+    EXPECT_TRUE(instance->is_halted());
+    EXPECT_EQ(instance->get_run_mode(), RUN_FAST);
+    EXPECT_EQ(instance->get_registers()[0].to_uint, 0);
+    EXPECT_EQ(traced, std::vector<uint16_t>({0x2205, 0x2306, 0x2001, 0x0200, 0x2100, 0xBEAB}));
+}
+
+/**
+ * The tracer that switches to the fast mode stops the traced loop, the run goes on in the fast loop without halting
+ *
+ *       MOV R6, #loop + 1
+ * loop: ADD R0, #1
+ *       BX R6
+ */
+TEST_F(test_run_mode, test_run_mode_loop_switch)
+{
+    load({0x265B, 0x3001, 0x4730});
+
+    instance->set_tracer([this](cpu *target, uint16_t instr) {
+        traced.push_back(instr);
+        if (traced.size() == 5) {
+            target->set_run_mode(RUN_FAST);
+        }
+    });
+    instance->set_run_mode(RUN_DETAILED);
+    instance->run(100);
+
+    EXPECT_FALSE(instance->is_halted());
+    EXPECT_EQ(traced.size(), 5);
+    EXPECT_EQ(switches, std::vector<run_mode>({RUN_DETAILED, RUN_FAST}));
+    EXPECT_EQ(instance->get_instructions(), 100);
+    EXPECT_EQ(instance->get_registers()[0].to_uint, 50);
+}
@@ -0,0 +1,173 @@
+//
+// Created by dimitrije on 10/9/26.
+//
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <fstream>
+#include "cpu.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * Where we put the parameter blocks and the buffers
+ */
+const uint32_t PARAMETERS_ADDRESS = SRAM_BEGIN;
+const uint32_t NAME_ADDRESS = SRAM_BEGIN + 0x40;
+const uint32_t BUFFER_ADDRESS = SRAM_BEGIN + 0x100;
+
+/**
+ * Sets up a code image that is a single BKPT 0xAB
+ */
+class test_semihosting: public testing::Test {
+public:
+
+    // the cpu
+    cpu *instance;
+
+    test_semihosting() {
+        instance = new cpu(1024u, 1024u);
+    }
+
+    void SetUp() override {
+
+        mmu *memory = instance->get_mmu();
+
+        // clear the memory
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+            memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+        memory->write16(CODE_INIT_ADDRESS, 0xBEAB);
+    }
+
+    /**
+     * Executes the semihosting call the way the firmware does
+     */
+    uint32_t call(uint32_t operation, uint32_t parameters) {
+        instance->reset();
+        instance->get_registers()[0].to_uint = operation;
+        instance->get_registers()[1].to_uint = parameters;
+        instance->run(1);
+        return instance->get_registers()[0].to_uint;
+    }
+
+    /**
+     * Writes a parameter block
+     */
+    void parameters(uint32_t a, uint32_t b, uint32_t c) {
+        uint32_t block[3] = {a, b, c};
+        instance->get_mmu()->write_block(PARAMETERS_ADDRESS, block, 3);
+    }
+
+    /**
+     * Opens a file, the name is copied into the guest memory
+     */
+    uint32_t open(const std::string &name, uint32_t mode) {
+        for (uint32_t i = 0; i < name.size(); ++i) {
+            instance->get_mmu()->write8(NAME_ADDRESS + i, (uint8_t) name[i]);
+        }
+        parameters(NAME_ADDRESS, mode, (uint32_t) name.size());
+        return call(SYS_OPEN, PARAMETERS_ADDRESS);
+    }
+
+    ~test_semihosting() override {
+        delete instance;
+    }
+};
+
+/**
+ * The firmware writes a file and reads it back
+ */
+TEST_F(test_semihosting, test_semihosting_files)
+{
+    std::string file = testing::TempDir() + "test-semihosting.bin";
+    mmu *memory = instance->get_mmu();
+
+    // write the buffer into the file
+    const char text[] = "input vector";
+    for (uint32_t i = 0; i < sizeof(text) - 1; ++i) {
+        memory->write8(BUFFER_ADDRESS + i, (uint8_t) text[i]);
+    }
+
+    uint32_t handle = open(file, 5);
+    ASSERT_NE(handle, 0xFFFFFFFF);
+
+    parameters(handle, BUFFER_ADDRESS, sizeof(text) - 1);
+    EXPECT_EQ(call(SYS_WRITE, PARAMETERS_ADDRESS), 0);
+
+    parameters(handle, 0, 0);
+    EXPECT_EQ(call(SYS_CLOSE, PARAMETERS_ADDRESS), 0);
+
+    // the file has what we wrote
+    std::ifstream in(file);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(content, "input vector");
+
+    // read it back into another buffer, asking for more than there is
+    handle = open(file, 1);
+    ASSERT_NE(handle, 0xFFFFFFFF);
+
+    parameters(handle, BUFFER_ADDRESS + 0x80, 20);
+    EXPECT_EQ(call(SYS_READ, PARAMETERS_ADDRESS), 20 - (sizeof(text) - 1));
+
+    for (uint32_t i = 0; i < sizeof(text) - 1; ++i) {
+        EXPECT_EQ(memory->read8(BUFFER_ADDRESS + 0x80 + i), (uint8_t) text[i]);
+    }
+
+    parameters(handle, 0, 0);
+    EXPECT_EQ(call(SYS_CLOSE, PARAMETERS_ADDRESS), 0);
+
+    // the handle is gone
+    EXPECT_EQ(call(SYS_CLOSE, PARAMETERS_ADDRESS), 0xFFFFFFFF);
+
+    // a file that is not there can not be opened
+    EXPECT_EQ(open(testing::TempDir() + "test-semihosting-missing/file", 0), 0xFFFFFFFF);
+}
+
+/**
+ * The firmware stops the cpu with its exit code
+ */
+TEST_F(test_semihosting, test_semihosting_exit)
+{
+    // the application exit is a success
+    call(SYS_EXIT, ADP_STOPPED_APPLICATION_EXIT);
+    EXPECT_TRUE(instance->has_exited());
+    EXPECT_EQ(instance->get_exit_code(), 0);
+
+    // the cpu does not run after it
+    uint32_t pc = instance->get_registers()[15].to_uint;
+    instance->run(10);
+    EXPECT_EQ(instance->get_registers()[15].to_uint, pc);
+
+    // the extended exit passes the code
+    parameters(ADP_STOPPED_APPLICATION_EXIT, 3, 0);
+    call(SYS_EXIT_EXTENDED, PARAMETERS_ADDRESS);
+    EXPECT_TRUE(instance->has_exited());
+    EXPECT_EQ(instance->get_exit_code(), 3);
+
+    // the reset clears it
+    instance->reset();
+    EXPECT_FALSE(instance->has_exited());
+}
+
+/**
+ * The clock starts from zero and the other breakpoints halt the cpu
+ */
+TEST_F(test_semihosting, test_semihosting_clock_and_breakpoint)
+{
+    EXPECT_LT(call(SYS_CLOCK, 0), 100);
+
+    // BKPT 0x00
+    instance->get_mmu()->write16(CODE_INIT_ADDRESS, 0xBE00);
+    instance->reset();
+    instance->run(10);
+
+    EXPECT_EQ(instance->get_registers()[15].to_uint, CODE_INIT_ADDRESS + 4);
+    EXPECT_FALSE(instance->has_exited());
+}
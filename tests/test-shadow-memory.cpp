@@ -0,0 +1,194 @@
+//
+// Created by dimitrije on 10/17/26.
+//
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include <fstream>
+#include "shadow_memory.h"
+#include "translator.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * Stores a word at the start of the sram, reads it back and then reads the word after it that was never written.
+ *
+ * MOV R1, #1
+ * LSL R1, R1, #29
+ * MOV R0, #7
+ * MOV R2, #0
+ * STR R0, [R1, R2]
+ * LDR R3, [R1, R2]
+ * MOV R2, #8
+ * LDR R3, [R1, R2]
+ * BKPT
+ */
+class test_shadow_memory: public testing::Test {
+public:
+
+    // the cpu
+    cpu *instance;
+
+    test_shadow_memory() {
+
+        instance = new cpu(1024u, 1024u);
+
+        std::vector<uint16_t> code = {0x2101, 0x0749, 0x2007, 0x2200, 0x5088, 0x588B, 0x2208, 0x588B, 0xBE00};
+
+        mmu *memory = instance->get_mmu();
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+            memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+        for (uint32_t i = 0; i < code.size(); ++i) {
+            memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+        }
+
+        instance->reset();
+    }
+
+    ~test_shadow_memory() override {
+        delete instance;
+    }
+};
+
+/**
+ * The first read of a word that was never written should be reported with the instruction and the symbols
+ */
+TEST_F(test_shadow_memory, test_shadow_memory_report)
+{
+    symbol_table symbols;
+    symbols.add("main", CODE_INIT_ADDRESS);
+    symbols.add("buffer", SRAM_BEGIN);
+
+    {
+        shadow_memory checker(instance);
+        checker.set_symbols(&symbols);
+        instance->run(100);
+
+        ASSERT_TRUE(instance->is_halted());
+        ASSERT_EQ(checker.get_read_count(), 1);
+
+        // the second LDR read it
+        const uninitialized_read &read = checker.get_first_read();
+        EXPECT_EQ(read.origin, ACCESS_CPU);
+        EXPECT_EQ(read.pc, CODE_INIT_ADDRESS + 14);
+        EXPECT_EQ(read.address, SRAM_BEGIN + 8);
+        EXPECT_EQ(read.size, 4);
+        EXPECT_EQ(read.cycle, 7);
+
+        std::stringstream report;
+        checker.write_report(report);
+        EXPECT_EQ(report.str(), "The first read of uninitialized memory : 4 bytes at 0x20000008 <buffer+8>\n"
+                                "The instruction that read it : 0x00000066 <main+14> in the cycle 7\n"
+                                "The number of reads of uninitialized memory : 1\n");
+    }
+
+    // the sram is fast again
+    EXPECT_FALSE(instance->get_mmu()->is_slow(SRAM_BEGIN, 1024u));
+}
+
+/**
+ * Only the bytes that were written or loaded should be initialized
+ */
+TEST_F(test_shadow_memory, test_shadow_memory_bytes)
+{
+    shadow_memory checker(instance);
+    mmu *memory = instance->get_mmu();
+
+    // a loaded range that spans two shadow words
+    checker.mark_initialized(SRAM_BEGIN + 60, 8);
+    EXPECT_TRUE(checker.is_initialized(SRAM_BEGIN + 60, 8));
+    EXPECT_FALSE(checker.is_initialized(SRAM_BEGIN + 59, 2));
+    EXPECT_FALSE(checker.is_initialized(SRAM_BEGIN + 68, 1));
+
+    // a byte store only initializes its byte
+    memory->write8(SRAM_BEGIN + 129, 1);
+    EXPECT_TRUE(checker.is_initialized(SRAM_BEGIN + 129, 1));
+    EXPECT_FALSE(checker.is_initialized(SRAM_BEGIN + 128, 2));
+
+    memory->read8(SRAM_BEGIN + 129);
+    memory->read32(SRAM_BEGIN + 64);
+    EXPECT_EQ(checker.get_read_count(), 0);
+
+    // the half-word has a byte that was never written
+    memory->read16(SRAM_BEGIN + 128);
+    EXPECT_EQ(checker.get_read_count(), 1);
+    EXPECT_EQ(checker.get_first_read().address, SRAM_BEGIN + 128);
+    EXPECT_EQ(checker.get_first_read().size, 2);
+
+    // the block accesses are checked word by word
+    uint32_t values[4] = {1, 2, 3, 4};
+    memory->write_block(SRAM_BEGIN + 256, values, 4);
+    memory->read_block(SRAM_BEGIN + 256, values, 4);
+    memory->read_block(SRAM_BEGIN + 264, values, 4);
+    EXPECT_EQ(checker.get_read_count(), 3);
+
+    // the code region is not checked
+    memory->read32(CODE_BEGIN + 512);
+    EXPECT_EQ(checker.get_read_count(), 3);
+}
+
+/**
+ * A read of the dma or of the host should not be blamed on the instruction the cpu is at
+ */
+TEST_F(test_shadow_memory, test_shadow_memory_origin)
+{
+    shadow_memory checker(instance);
+    mmu *memory = instance->get_mmu();
+
+    access_origin previous = memory->set_origin(ACCESS_DMA);
+    memory->read32(SRAM_BEGIN + 16);
+    memory->set_origin(previous);
+
+    ASSERT_EQ(checker.get_read_count(), 1);
+    EXPECT_EQ(checker.get_first_read().origin, ACCESS_DMA);
+    EXPECT_EQ(checker.get_first_read().pc, 0);
+
+    std::stringstream report;
+    checker.write_report(report);
+    EXPECT_EQ(report.str(), "The first read of uninitialized memory : 4 bytes at 0x20000010\n"
+                            "The dma read it in the cycle 0\n"
+                            "The number of reads of uninitialized memory : 1\n");
+}
+
+/**
+ * A read in a translated block should be blamed on its instruction, the blocks set the PC of the accesses
+ */
+TEST_F(test_shadow_memory, test_shadow_memory_translated)
+{
+    // translate the code region of the cpu
+    std::vector<uint8_t> image(1024u);
+    for (uint32_t i = 0; i < image.size(); ++i) {
+        image[i] = (uint8_t) instance->get_mmu()->read8(CODE_BEGIN + i);
+    }
+
+    translator t(image.data(), (uint32_t) image.size());
+    t.discover();
+
+    std::string source = testing::TempDir() + "test-shadow-memory.cpp";
+    std::string library = testing::TempDir() + "test-shadow-memory.so";
+
+    std::ofstream out(source);
+    out << t.emit();
+    out.close();
+
+    ASSERT_TRUE(translator::compile(source, library));
+    instance->load_translation(library);
+
+    // the watchpoint on the same word sees the same instruction
+    instance->add_watchpoint(SRAM_BEGIN + 8, 4, WATCH_READ);
+
+    shadow_memory checker(instance);
+    instance->run(100);
+
+    ASSERT_TRUE(instance->is_halted());
+    ASSERT_EQ(checker.get_read_count(), 1);
+    EXPECT_EQ(checker.get_first_read().pc, CODE_INIT_ADDRESS + 14);
+    EXPECT_EQ(instance->get_watch_hit().pc, CODE_INIT_ADDRESS + 14);
+}
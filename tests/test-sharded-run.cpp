@@ -0,0 +1,193 @@
+//
+// Created by dimitrije on 10/16/26.
+//
+
+#include <gtest/gtest.h>
+#include "sharded_run.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * The address of the first instruction of the loop
+ */
+const uint32_t LOOP_ADDRESS = CODE_INIT_ADDRESS + 12;
+
+/**
+ * The number of workers we replay the intervals on
+ */
+const size_t WORKER_COUNT = 4;
+
+/**
+ * The memory the checkpoints can use, it holds the whole run
+ */
+const size_t BUDGET = 1u << 20;
+
+/**
+ * The Collatz sequence of the input at the start of the sram, the number of steps is counted in R3.
+ *
+ *        MOV R1, #1
+ *        LSL R1, R1, #29
+ *        MOV R0, #0
+ *        LDR R2, [R1, R0]
+ *        MOV R3, #0
+ *        MOV R6, #check + 1
+ * loop:  ADD R3, #1
+ *        LSR R4, R2, #1
+ *        LSL R5, R2, #31
+ *        CMP R5, #0
+ *        BEQ even
+ *        ADD R4, R2, R2
+ *        ADD R2, R4, R2
+ *        ADD R2, #1
+ *        BX R6
+ * even:  ADD R2, R4, #0
+ * check: CMP R2, #1
+ *        BNE loop
+ *        BKPT
+ */
+class test_sharded_run: public testing::Test {
+public:
+
+    // the cpu of the fast run and the workers
+    cpu *instance;
+    std::vector<cpu *> workers;
+
+    test_sharded_run() {
+        instance = new cpu(1024u, 1024u);
+        load(instance);
+        for (size_t i = 0; i < WORKER_COUNT; ++i) {
+            workers.push_back(new cpu(1024u, 1024u));
+            load(workers.back());
+        }
+    }
+
+    /**
+     * Loads the code, the sram is only set on the cpu of the fast run and comes to the workers with the checkpoints
+     */
+    static void load(cpu *target) {
+
+        std::vector<uint16_t> code = {0x2101, 0x0749, 0x2000, 0x580A, 0x2300, 0x2679, 0x3301, 0x0854, 0x07D5,
+                                      0x2D00, 0xD003, 0x1894, 0x18A2, 0x3201, 0x4730, 0x1C22, 0x2A01, 0xD1F3,
+                                      0xBE00};
+
+        mmu *memory = target->get_mmu();
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+            memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+        for (uint32_t i = 0; i < code.size(); ++i) {
+            memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+        }
+
+        target->reset();
+    }
+
+    /**
+     * The analysis of an interval, it steps through it and counts the iterations of the loop
+     */
+    static uint64_t count_iterations(cpu *worker, uint64_t length) {
+        uint64_t iterations = 0;
+        for (uint64_t i = 0; i < length; ++i) {
+            if (worker->get_registers()[15].to_uint - 2 == LOOP_ADDRESS) {
+                iterations++;
+            }
+            worker->run(1);
+        }
+        return iterations;
+    }
+
+    ~test_sharded_run() override {
+        delete instance;
+        for (cpu *worker : workers) {
+            delete worker;
+        }
+    }
+};
+
+/**
+ * The intervals analyzed in parallel should add up to the analysis of the whole run
+ */
+TEST_F(test_sharded_run, test_sharded_run_merge)
+{
+    instance->get_mmu()->write32(SRAM_BEGIN, 27);
+
+    // the run halts before it uses all the instructions
+    sharded_run sharded(instance, 50, BUDGET);
+    sharded.run(100);
+    sharded.run(100000);
+
+    EXPECT_TRUE(instance->is_halted());
+    EXPECT_EQ(instance->get_registers()[3].to_uint, 111);
+    EXPECT_GT(sharded.get_interval_count(), WORKER_COUNT);
+
+    // the intervals start every 50 instructions
+    for (size_t i = 0; i < sharded.get_interval_count(); ++i) {
+        EXPECT_EQ(sharded.get_interval_start(i), 50 * i);
+    }
+
+    std::vector<uint64_t> iterations = sharded.replay<uint64_t>(workers, count_iterations);
+    ASSERT_EQ(iterations.size(), sharded.get_interval_count());
+    EXPECT_EQ(sharded.get_mismatches(), 0);
+
+    uint64_t total = 0;
+    for (uint64_t count : iterations) {
+        total += count;
+    }
+    EXPECT_EQ(total, 111);
+
+    // the results are in the order of the run
+    cpu serial(1024u, 1024u);
+    load(&serial);
+    serial.get_mmu()->write32(SRAM_BEGIN, 27);
+    for (size_t i = 0; i < sharded.get_interval_count(); ++i) {
+        uint64_t length = (i + 1 < sharded.get_interval_count() ? sharded.get_interval_start(i + 1) :
+                           instance->get_instructions()) - sharded.get_interval_start(i);
+        EXPECT_EQ(iterations[i], count_iterations(&serial, length)) << "interval " << i;
+    }
+}
+
+/**
+ * An analysis that does not execute the whole interval does not end where the next one starts
+ */
+TEST_F(test_sharded_run, test_sharded_run_mismatch)
+{
+    instance->get_mmu()->write32(SRAM_BEGIN, 7);
+
+    sharded_run sharded(instance, 20, BUDGET);
+    sharded.run(100000);
+
+    sharded.replay<uint64_t>(workers, [](cpu *worker, uint64_t length) -> uint64_t {
+        worker->run(length - 1);
+        return 0;
+    });
+    EXPECT_EQ(sharded.get_mismatches(), sharded.get_interval_count());
+
+    // an error in the analysis is thrown after the workers stop
+    EXPECT_THROW(sharded.replay<uint64_t>(workers, [](cpu *, uint64_t) -> uint64_t {
+        throw std::runtime_error("failed");
+    }), std::runtime_error);
+}
+
+/**
+ * The intervals whose checkpoints went over the budget should not be replayed
+ */
+TEST_F(test_sharded_run, test_sharded_run_budget)
+{
+    instance->get_mmu()->write32(SRAM_BEGIN, 27);
+
+    sharded_run sharded(instance, 50, 4096);
+    sharded.run(100000);
+
+    ASSERT_TRUE(instance->is_halted());
+    ASSERT_GT(sharded.get_interval_count(), 0);
+    EXPECT_GT(sharded.get_interval_start(0), 0);
+
+    // the ones that are left start from the sram they had in the run
+    sharded.replay<uint64_t>(workers, count_iterations);
+    EXPECT_EQ(sharded.get_mismatches(), 0);
+}
@@ -0,0 +1,193 @@
+//
+// Created by dimitrije on 10/17/26.
+//
+
+#include <gtest/gtest.h>
+#include <fstream>
+#include "cpu.h"
+#include "translator.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * The address of the handler of the interrupt 0
+ */
+const uint32_t HANDLER_ADDRESS = 0x00000080;
+
+/**
+ * The top of the stack
+ */
+const uint32_t STACK_TOP = SRAM_BEGIN + 1024u;
+
+/**
+ * Sets the stack pointer to the end of the sram and uses 24 bytes of the stack.
+ *
+ * MOV R0, #1
+ * LSL R0, R0, #29
+ * MOV R1, #1
+ * LSL R1, R1, #10
+ * ADD R0, R0, R1
+ * MOV SP, R0
+ * PUSH {R0, R1}
+ * ADD SP, #-16
+ * ADD SP, #16
+ * ADD SP, #8
+ * BKPT
+ *
+ * The handler of the interrupt 0 uses 8 bytes after the stacked frame.
+ *
+ * ADD SP, #-8
+ * BKPT
+ */
+class test_stack: public testing::Test {
+public:
+
+    // the cpu
+    cpu *instance;
+
+    test_stack() {
+
+        instance = new cpu(1024u, 1024u);
+
+        std::vector<uint16_t> code = {0x2001, 0x0740, 0x2101, 0x0289, 0x1840, 0x4685, 0xB403, 0xB004, 0xB084,
+                                      0xB082, 0xBE00};
+
+        mmu *memory = instance->get_mmu();
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+            memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+        for (uint32_t i = 0; i < code.size(); ++i) {
+            memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+        }
+
+        memory->write32(IRQ_VECTOR_ADDRESS, HANDLER_ADDRESS | 1);
+        memory->write16(HANDLER_ADDRESS, 0xB002);
+        memory->write16(HANDLER_ADDRESS + 2, 0xBE00);
+
+        instance->reset();
+    }
+
+    ~test_stack() override {
+        delete instance;
+    }
+};
+
+/**
+ * The lowest stack pointer should be remembered after the stack is released
+ */
+TEST_F(test_stack, test_stack_watermark)
+{
+    EXPECT_EQ(instance->get_stack_low(THREAD_MODE), UINT32_MAX);
+
+    instance->run(100);
+
+    ASSERT_TRUE(instance->is_halted());
+    EXPECT_FALSE(instance->is_stack_overflowed());
+    EXPECT_EQ(instance->get_registers()[13].to_uint, STACK_TOP);
+    EXPECT_EQ(instance->get_stack_low(THREAD_MODE), STACK_TOP - 24);
+    EXPECT_EQ(instance->get_stack_low(HANDLER_MODE), UINT32_MAX);
+
+    // the reset starts over
+    instance->reset();
+    EXPECT_EQ(instance->get_stack_low(THREAD_MODE), UINT32_MAX);
+}
+
+/**
+ * The instruction that crosses the limit should halt the cpu
+ */
+TEST_F(test_stack, test_stack_limit)
+{
+    instance->set_stack_limit(STACK_TOP - 16);
+    instance->run(100);
+
+    ASSERT_TRUE(instance->is_halted());
+    ASSERT_TRUE(instance->is_stack_overflowed());
+
+    // the ADD SP, #-16 crossed it
+    const stack_overflow &overflow = instance->get_stack_overflow();
+    EXPECT_EQ(overflow.pc, CODE_INIT_ADDRESS + 14);
+    EXPECT_EQ(overflow.sp, STACK_TOP - 24);
+    EXPECT_EQ(overflow.limit, STACK_TOP - 16);
+    EXPECT_EQ(overflow.in_mode, THREAD_MODE);
+    EXPECT_EQ(overflow.cycle, 7);
+    EXPECT_EQ(instance->get_registers()[13].to_uint, STACK_TOP - 24);
+}
+
+/**
+ * A limit set after the stack already went below it should halt at the next instruction that lowers the stack
+ */
+TEST_F(test_stack, test_stack_limit_late)
+{
+    // the stack went down to STACK_TOP - 24 and was released again
+    instance->run(10);
+    EXPECT_EQ(instance->get_registers()[13].to_uint, STACK_TOP);
+
+    // the PUSH again is not a new low but it is below the limit
+    instance->set_stack_limit(STACK_TOP - 4);
+    instance->set_pc(CODE_INIT_ADDRESS + 12);
+    instance->run(100);
+
+    ASSERT_TRUE(instance->is_stack_overflowed());
+    EXPECT_EQ(instance->get_stack_overflow().pc, CODE_INIT_ADDRESS + 12);
+    EXPECT_EQ(instance->get_stack_overflow().sp, STACK_TOP - 8);
+    EXPECT_EQ(instance->get_stack_low(THREAD_MODE), STACK_TOP - 24);
+}
+
+/**
+ * The exception entry should count on the stack of the handler mode
+ */
+TEST_F(test_stack, test_stack_exception)
+{
+    // the stack pointer is set up after the 6th instruction, the interrupt is taken after the PUSH
+    instance->run(6);
+    instance->set_pending_interrupt(0);
+    instance->run(100);
+
+    ASSERT_TRUE(instance->is_halted());
+    EXPECT_EQ(instance->get_stack_low(THREAD_MODE), STACK_TOP - 8);
+    EXPECT_EQ(instance->get_stack_low(HANDLER_MODE), STACK_TOP - 8 - 32 - 8);
+}
+
+/**
+ * A translated block should report the instruction in it that crossed the limit, not where the block ends
+ */
+TEST_F(test_stack, test_stack_limit_translated)
+{
+    // translate the code region of the cpu
+    std::vector<uint8_t> image(1024u);
+    for (uint32_t i = 0; i < image.size(); ++i) {
+        image[i] = (uint8_t) instance->get_mmu()->read8(CODE_BEGIN + i);
+    }
+
+    translator t(image.data(), (uint32_t) image.size());
+    t.discover();
+
+    std::string source = testing::TempDir() + "test-stack.cpp";
+    std::string library = testing::TempDir() + "test-stack.so";
+
+    std::ofstream out(source);
+    out << t.emit();
+    out.close();
+
+    ASSERT_TRUE(translator::compile(source, library));
+    instance->load_translation(library);
+
+    instance->set_stack_limit(STACK_TOP - 16);
+    instance->run(100);
+
+    ASSERT_TRUE(instance->is_halted());
+    ASSERT_TRUE(instance->is_stack_overflowed());
+
+    // the ADD SP, #-16 in the middle of the block crossed it, the block runs to its end
+    const stack_overflow &overflow = instance->get_stack_overflow();
+    EXPECT_EQ(overflow.pc, CODE_INIT_ADDRESS + 14);
+    EXPECT_EQ(overflow.sp, STACK_TOP - 24);
+    EXPECT_EQ(instance->get_stack_low(THREAD_MODE), STACK_TOP - 24);
+    EXPECT_EQ(instance->get_registers()[13].to_uint, STACK_TOP);
+}
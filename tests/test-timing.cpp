@@ -0,0 +1,110 @@
+//
+// Created by dimitrije on 10/17/26.
+//
+
+#include <gtest/gtest.h>
+#include "cpu.h"
+#include "timing.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * Sets up a cpu with the code of a test
+ */
+class test_timing: public testing::Test {
+public:
+
+    // the cpu
+    cpu *instance;
+
+    test_timing() {
+        instance = new cpu(1024u, 1024u);
+    }
+
+    /**
+     * Loads the code and resets the cpu
+     */
+    void load(const std::vector<uint16_t> &code) {
+
+        mmu *memory = instance->get_mmu();
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+            memory->write32(SRAM_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+        for (uint32_t i = 0; i < code.size(); ++i) {
+            memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+        }
+
+        instance->reset();
+    }
+
+    ~test_timing() override {
+        delete instance;
+    }
+};
+
+/**
+ * The loads and the stores take 2 cycles, a push of N registers 1 + N and the other instructions 1
+ *
+ * MOV R1, #1
+ * LSL R1, R1, #29
+ * MOV R0, #0
+ * STR R1, [R1, R0]
+ * LDR R2, [R1, R0]
+ * PUSH {R0, R1}
+ */
+TEST_F(test_timing, test_timing_instructions)
+{
+    load({0x2101, 0x0749, 0x2000, 0x5009, 0x580A, 0xB403});
+    instance->get_registers()[13].to_uint = SRAM_BEGIN + 1024u;
+
+    pipeline_timing model;
+    instance->run_timed(6, model);
+
+    EXPECT_EQ(instance->get_registers()[13].to_uint, SRAM_BEGIN + 1024u - 8u);
+    EXPECT_EQ(instance->get_cycles(), 1 + 1 + 1 + 2 + 2 + 3);
+    EXPECT_EQ(model.get_refill_cycles(), 0);
+    EXPECT_EQ(model.get_stall_cycles(), 0);
+}
+
+/**
+ * Every taken branch refills the pipeline, with the wait states the fetch after it stalls too
+ *
+ *       MOV R6, #loop + 1
+ * loop: ADD R0, #1
+ *       BX R6
+ */
+TEST_F(test_timing, test_timing_wait_states)
+{
+    load({0x265B, 0x3001, 0x4730});
+
+    // the plain run has no model
+    instance->run(21);
+    EXPECT_EQ(instance->get_cycles(), 21);
+
+    // the branch takes 3 cycles
+    load({0x265B, 0x3001, 0x4730});
+    pipeline_timing no_wait;
+    instance->run_timed(21, no_wait);
+    EXPECT_EQ(instance->get_cycles(), 1 + 10 * 4);
+    EXPECT_EQ(no_wait.get_refill_cycles(), 20);
+
+    // the prefetch buffer hides the wait states of the sequential fetch of the BX
+    load({0x265B, 0x3001, 0x4730});
+    pipeline_timing prefetched(2, true);
+    instance->run_timed(21, prefetched);
+    EXPECT_EQ(instance->get_cycles(), 3 + 4 + 9 * 6);
+    EXPECT_EQ(prefetched.get_stall_cycles(), 2 + 9 * 2);
+
+    // without it every fetch from the flash stalls
+    load({0x265B, 0x3001, 0x4730});
+    pipeline_timing slow(2, false);
+    instance->run_timed(21, slow);
+    EXPECT_EQ(instance->get_cycles(), 3 + 6 + 9 * 8);
+    EXPECT_EQ(slow.get_refill_cycles(), 20);
+}
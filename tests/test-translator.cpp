@@ -0,0 +1,254 @@
+//
+// Created by dimitrije on 10/2/26.
+//
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <fstream>
+#include "cpu.h"
+#include "translator.h"
+#include "translation_cache.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * Sets up a code image with the following loop :
+ *
+ * 1. MOV R0, #12
+ * 2. MOV R1, #1
+ * 3. loop: SUB R0, R0, R1
+ * 4. BNE loop
+ * 5. MOV R3, #7
+ */
+class test_translator: public testing::Test {
+public:
+
+    // the code image
+    uint8_t code[1024];
+
+    void write16(uint32_t address, uint16_t value) {
+        std::memcpy(&code[address], &value, sizeof(value));
+    }
+
+    void SetUp() override {
+
+        // clear the code
+        std::memset(code, 0, sizeof(code));
+
+        // store the init address and instructions
+        uint32_t entry = CODE_INIT_ADDRESS;
+        std::memcpy(&code[PC_INIT_ADDRESS], &entry, sizeof(entry));
+
+        write16(CODE_INIT_ADDRESS, 0x200C);
+        write16(CODE_INIT_ADDRESS + 2, 0x2101);
+        write16(CODE_INIT_ADDRESS + 4, 0x1A40);
+        write16(CODE_INIT_ADDRESS + 6, 0xD1FD);
+        write16(CODE_INIT_ADDRESS + 8, 0x2307);
+    }
+};
+
+/**
+ * The blocks should be cut at the loop head and after the branch
+ */
+TEST_F(test_translator, test_translator_discover)
+{
+    translator t(code, sizeof(code));
+    t.discover();
+
+    auto &blocks = t.get_blocks();
+    ASSERT_EQ(blocks.size(), 3);
+
+    // the two moves run into the loop head
+    EXPECT_EQ(blocks.at(CODE_INIT_ADDRESS).length, 2);
+    EXPECT_EQ(blocks.at(CODE_INIT_ADDRESS).end, FALLTHROUGH_END);
+
+    // the loop body branches back to itself
+    EXPECT_EQ(blocks.at(CODE_INIT_ADDRESS + 4).length, 2);
+    EXPECT_EQ(blocks.at(CODE_INIT_ADDRESS + 4).end, CONDITIONAL_END);
+    EXPECT_EQ(blocks.at(CODE_INIT_ADDRESS + 4).target, CODE_INIT_ADDRESS + 4);
+    EXPECT_EQ(blocks.at(CODE_INIT_ADDRESS + 4).next, CODE_INIT_ADDRESS + 8);
+
+    // the empty instruction after the move is left to the interpreter
+    EXPECT_EQ(blocks.at(CODE_INIT_ADDRESS + 8).length, 1);
+    EXPECT_EQ(blocks.at(CODE_INIT_ADDRESS + 8).end, INTERPRETER_END);
+    EXPECT_EQ(blocks.at(CODE_INIT_ADDRESS + 8).next, CODE_INIT_ADDRESS + 10);
+}
+
+/**
+ * The translated code has to leave the cpu in the same state as the interpreter
+ */
+TEST_F(test_translator, test_translator_matches_interpreter)
+{
+    translator t(code, sizeof(code));
+    t.discover();
+
+    // write out the library
+    std::string source = testing::TempDir() + "test-translator.cpp";
+    std::string library = testing::TempDir() + "test-translator.so";
+
+    std::ofstream out(source);
+    out << t.emit();
+    out.close();
+
+    ASSERT_TRUE(translator::compile(source, library));
+
+    // the interpreted and the translated cpu
+    uint8_t interpreted_sram[1024] = {};
+    uint8_t translated_sram[1024] = {};
+    cpu interpreted(code, sizeof(code), interpreted_sram, sizeof(interpreted_sram));
+    cpu translated(code, sizeof(code), translated_sram, sizeof(translated_sram));
+    translated.load_translation(library);
+
+    // two moves, 12 iterations of the loop and the last move
+    interpreted.run(27);
+    translated.run(27);
+
+    for (int i = 0; i < 16; ++i) {
+        EXPECT_EQ(interpreted.get_registers()[i].to_uint, translated.get_registers()[i].to_uint);
+    }
+
+    EXPECT_EQ(translated.get_registers()[0].to_uint, 0);
+    EXPECT_EQ(translated.get_registers()[3].to_uint, 7);
+
+    EXPECT_EQ(interpreted.get_psr().n, translated.get_psr().n);
+    EXPECT_EQ(interpreted.get_psr().z, translated.get_psr().z);
+    EXPECT_EQ(interpreted.get_psr().c, translated.get_psr().c);
+    EXPECT_EQ(interpreted.get_psr().v, translated.get_psr().v);
+}
+
+/**
+ * A library translated from a different image must be rejected
+ */
+TEST_F(test_translator, test_translator_rejects_other_image)
+{
+    translator t(code, sizeof(code));
+    t.discover();
+
+    std::string source = testing::TempDir() + "test-translator-other.cpp";
+    std::string library = testing::TempDir() + "test-translator-other.so";
+
+    std::ofstream out(source);
+    out << t.emit();
+    out.close();
+
+    ASSERT_TRUE(translator::compile(source, library));
+
+    // change the image
+    write16(CODE_INIT_ADDRESS + 8, 0x2308);
+
+    uint8_t sram[1024] = {};
+    cpu instance(code, sizeof(code), sram, sizeof(sram));
+    EXPECT_THROW(instance.load_translation(library), std::runtime_error);
+}
+
+/**
+ * The second load of the same image should come from the cache, a corrupt entry should be rebuilt
+ */
+TEST_F(test_translator, test_translation_cache)
+{
+    std::string directory = testing::TempDir() + "test-translation-cache";
+    translation_cache cache(directory);
+
+    // start from an empty cache
+    std::string library = cache.library_path(code, sizeof(code));
+    std::remove(library.c_str());
+
+    uint8_t sram[1024] = {};
+
+    // the first run translates the image
+    {
+        cpu instance(code, sizeof(code), sram, sizeof(sram));
+        EXPECT_FALSE(cache.load(&instance, code, sizeof(code)));
+    }
+
+    // the second run starts hot
+    {
+        cpu instance(code, sizeof(code), sram, sizeof(sram));
+        EXPECT_TRUE(cache.load(&instance, code, sizeof(code)));
+
+        instance.run(27);
+        EXPECT_EQ(instance.get_registers()[3].to_uint, 7);
+    }
+
+    // corrupt the library
+    {
+        std::ofstream out(library, std::ios::binary | std::ios::trunc);
+        out << "not a library";
+    }
+
+    // the corrupt entry is ignored and rebuilt
+    {
+        cpu instance(code, sizeof(code), sram, sizeof(sram));
+        EXPECT_FALSE(cache.load(&instance, code, sizeof(code)));
+    }
+
+    // one changed byte in the library does not match the checksum at its end
+    {
+        std::fstream out(library, std::ios::binary | std::ios::in | std::ios::out);
+        out.seekg(64);
+        auto byte = (char) out.get();
+        out.seekp(64);
+        out.put((char) ~byte);
+    }
+
+    {
+        cpu instance(code, sizeof(code), sram, sizeof(sram));
+        EXPECT_FALSE(cache.load(&instance, code, sizeof(code)));
+    }
+
+    // the rebuilt entry is hot again
+    {
+        cpu instance(code, sizeof(code), sram, sizeof(sram));
+        EXPECT_TRUE(cache.load(&instance, code, sizeof(code)));
+    }
+
+    // a different image gets a different entry
+    write16(CODE_INIT_ADDRESS + 8, 0x2308);
+    EXPECT_NE(cache.library_path(code, sizeof(code)), library);
+}
+
+/**
+ * The translated ALU operations 8 to 15 have to decode the whole 4 bit operation like the interpreter
+ */
+TEST_F(test_translator, test_translator_alu_operations)
+{
+    for (uint16_t op = 8; op < 16; ++op) {
+
+        // OP R0, R1 and BKPT
+        write16(CODE_INIT_ADDRESS, (uint16_t) (0x4000 | (op << 6) | (1 << 3)));
+        write16(CODE_INIT_ADDRESS + 2, 0xBE00);
+
+        translator t(code, sizeof(code));
+        t.discover();
+
+        std::string source = testing::TempDir() + "test-translator-alu.cpp";
+        std::string library = testing::TempDir() + "test-translator-alu.so";
+
+        std::ofstream out(source);
+        out << t.emit();
+        out.close();
+
+        ASSERT_TRUE(translator::compile(source, library));
+
+        uint8_t interpreted_sram[1024] = {};
+        uint8_t translated_sram[1024] = {};
+        cpu interpreted(code, sizeof(code), interpreted_sram, sizeof(interpreted_sram));
+        cpu translated(code, sizeof(code), translated_sram, sizeof(translated_sram));
+        translated.load_translation(library);
+
+        cpu_state state = interpreted.save_state();
+        state.registers[0].to_uint = 0x12340000;
+        state.registers[1].to_uint = 3;
+        interpreted.restore_state(state);
+        translated.restore_state(state);
+
+        interpreted.run(1);
+        translated.run(1);
+
+        EXPECT_EQ(interpreted.get_registers()[0].to_uint, translated.get_registers()[0].to_uint) << "op " << op;
+        EXPECT_EQ(interpreted.get_xpsr(), translated.get_xpsr()) << "op " << op;
+    }
+}
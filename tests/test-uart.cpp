@@ -0,0 +1,161 @@
+//
+// Created by dimitrije on 10/8/26.
+//
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "cpu.h"
+#include "uart.h"
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * Sets up a code image that prints "hi\n" to the uart at PERIPHERAL_BEGIN :
+ *
+ * MOV R1, #1
+ * LSL R1, R1, #30
+ * MOV R2, #'h'
+ * STR R2, [R1, #0]
+ * MOV R2, #'i'
+ * STR R2, [R1, #0]
+ * MOV R2, #'\n'
+ * STR R2, [R1, #0]
+ *
+ * The interpreter adds R0 as the offset of the store so R0 stays zero
+ */
+class test_uart: public testing::Test {
+public:
+
+    // the cpu
+    cpu *instance;
+
+    test_uart() {
+        instance = new cpu(1024u, 1024u);
+    }
+
+    void SetUp() override {
+
+        mmu *memory = instance->get_mmu();
+
+        // clear the code
+        for (uint32_t i = 0; i < 256u; ++i) {
+            memory->write32(CODE_BEGIN + i * sizeof(uint32_t), 0u);
+        }
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+
+        uint16_t code[] = {0x2101, 0x0789, 0x2268, 0x600A, 0x2269, 0x600A, 0x220A, 0x600A};
+        for (uint32_t i = 0; i < sizeof(code) / sizeof(code[0]); ++i) {
+            memory->write16(CODE_INIT_ADDRESS + 2 * i, code[i]);
+        }
+    }
+
+    ~test_uart() override {
+        delete instance;
+    }
+};
+
+/**
+ * The firmware output should end up in the stream
+ */
+TEST_F(test_uart, test_uart_output)
+{
+    std::ostringstream output;
+    uart serial(PERIPHERAL_BEGIN, instance, output);
+    instance->get_mmu()->register_peripheral(&serial);
+
+    instance->reset();
+    instance->run(8);
+
+    serial.flush();
+    EXPECT_EQ(output.str(), "hi\n");
+}
+
+/**
+ * With the baud rate timing the bytes written while the uart is busy wait in the TX FIFO
+ */
+TEST_F(test_uart, test_uart_baud_rate)
+{
+    std::ostringstream output;
+    uart serial(PERIPHERAL_BEGIN, instance, output, 10);
+    instance->get_mmu()->register_peripheral(&serial);
+
+    instance->reset();
+    instance->run(8);
+
+    // the uart is still sending the first byte
+    serial.flush();
+    EXPECT_EQ(output.str(), "h");
+
+    // the others follow it a byte every 10 cycles
+    instance->run(20);
+    serial.flush();
+    EXPECT_EQ(output.str(), "hi\n");
+}
+
+/**
+ * The bytes written to a full TX FIFO are dropped, TX_READY tells the firmware when to wait
+ */
+TEST_F(test_uart, test_uart_tx_fifo_full)
+{
+    std::ostringstream output;
+    uart serial(PERIPHERAL_BEGIN, instance, output, 1000);
+    instance->get_mmu()->register_peripheral(&serial);
+
+    mmu *memory = instance->get_mmu();
+    instance->reset();
+
+    // one byte is being sent and the FIFO fills up behind it
+    for (uint32_t i = 0; i <= UART_TX_FIFO_SIZE; ++i) {
+        EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + UART_STATUS) & UART_STATUS_TX_READY, UART_STATUS_TX_READY);
+        memory->write32(PERIPHERAL_BEGIN + UART_DATA, 'a' + i);
+    }
+    EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + UART_STATUS) & UART_STATUS_TX_READY, 0);
+    memory->write32(PERIPHERAL_BEGIN + UART_DATA, '!');
+
+    // the reset empties the FIFO
+    instance->reset();
+    EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + UART_STATUS) & UART_STATUS_TX_READY, UART_STATUS_TX_READY);
+
+    serial.flush();
+    EXPECT_EQ(output.str(), "a");
+}
+
+/**
+ * The received bytes should come out of the data register in order
+ */
+TEST_F(test_uart, test_uart_input)
+{
+    std::ostringstream output;
+    uart serial(PERIPHERAL_BEGIN, instance, output);
+    instance->get_mmu()->register_peripheral(&serial);
+
+    mmu *memory = instance->get_mmu();
+
+    // nothing was received yet
+    EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + UART_STATUS) & UART_STATUS_RX_READY, 0);
+
+    // feed it from a file
+    std::string file = testing::TempDir() + "test-uart-input.txt";
+    std::ofstream(file) << "ab";
+    serial.open_input(file);
+
+    // wait for the input thread
+    for (int i = 0; i < 200 && (memory->read32(PERIPHERAL_BEGIN + UART_STATUS) & UART_STATUS_RX_READY) == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    EXPECT_EQ(memory->read8(PERIPHERAL_BEGIN + UART_DATA), 'a');
+    EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + UART_DATA), 'b');
+    EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + UART_STATUS) & UART_STATUS_RX_READY, 0);
+
+    // and directly
+    serial.receive("c");
+    EXPECT_EQ(memory->read32(PERIPHERAL_BEGIN + UART_DATA), 'c');
+}
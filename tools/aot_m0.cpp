@@ -0,0 +1,62 @@
+#include <iostream>
+#include <climits>
+#include <fstream>
+#include <vector>
+#include <translator.h>
+
+int main(int argc, char *argv[]) {
+
+    // are the parameters provided if not print help
+    if (argc != 4) {
+        std::cout << "Usage: aot_m0 CODE_SIZE CODE_FILE LIBRARY" << std::endl;
+        std::cout << std::endl;
+        std::cout << "CODE_SIZE - has to be larger than 0" << std::endl;
+        std::cout << "LIBRARY - the shared object we want to create, the generated source is stored next to it" << std::endl;
+        return 0;
+    }
+
+    // grab the size
+    auto code_size = std::strtoul(argv[1], nullptr, 10);
+
+    // check the code size
+    if (code_size == 0 || code_size == ULONG_MAX) {
+        std::cout << "CODE_SIZE is wrong" << std::endl;
+        return -1;
+    }
+
+    // read the code region
+    std::ifstream code_file(argv[2], std::ios::binary);
+
+    // check if we have opened the file
+    if (!code_file.is_open()) {
+        std::cout << "Could not open the " << argv[2] << " file." << std::endl;
+        return -1;
+    }
+
+    // copy the code region
+    std::vector<uint8_t> code_region(code_size, 0);
+    code_file.read((char *) code_region.data(), code_size);
+    code_file.close();
+
+    // recover the control flow graph from the reset vector
+    translator t(code_region.data(), (uint32_t) code_size);
+    t.discover();
+
+    std::cout << "Recovered " << t.get_blocks().size() << " basic blocks" << std::endl;
+
+    // write out the source
+    std::string library = argv[3];
+    std::string source = library + ".cpp";
+
+    std::ofstream source_file(source);
+    source_file << t.emit();
+    source_file.close();
+
+    // compile it
+    if (!translator::compile(source, library)) {
+        std::cout << "Could not compile " << source << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
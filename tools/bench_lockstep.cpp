@@ -0,0 +1,131 @@
+#include <chrono>
+#include <climits>
+#include <iostream>
+#include <vector>
+#include <lockstep.h>
+
+/**
+ * The address where the the code begins
+ */
+const uint32_t CODE_INIT_ADDRESS = 0x00000058;
+
+/**
+ * Counts the steps of the Collatz sequences of the numbers from the input at the start of the sram up, the count
+ * is stored back after every sequence. The cpus diverge at the branch on the lowest bit and meet again after it.
+ *
+ *        MOV R1, #1
+ *        LSL R1, R1, #29
+ *        MOV R0, #0
+ *        LDR R7, [R1, R0]
+ *        MOV R3, #0
+ *        MOV R6, #check + 1
+ * outer: ADD R2, R7, #0
+ * loop:  ADD R3, #1
+ *        LSR R4, R2, #1
+ *        LSL R5, R2, #31
+ *        CMP R5, #0
+ *        BEQ even
+ *        ADD R4, R2, R2
+ *        ADD R2, R4, R2
+ *        ADD R2, #1
+ *        BX R6
+ * even:  ADD R2, R4, #0
+ * check: CMP R2, #1
+ *        BNE loop
+ *        STR R3, [R1, R0]
+ *        ADD R7, #1
+ *        B outer
+ */
+const std::vector<uint16_t> CODE = {0x2101, 0x0749, 0x2000, 0x580F, 0x2300, 0x267B, 0x1C3A, 0x3301, 0x0854, 0x07D5,
+                                    0x2D00, 0xD003, 0x1894, 0x18A2, 0x3201, 0x4730, 0x1C22, 0x2A01, 0xD1F3, 0x500B,
+                                    0x3701, 0x77EF};
+
+/**
+ * Creates the cpus with the code, every one of them starts from a different number
+ */
+std::vector<cpu *> create(size_t count) {
+
+    std::vector<cpu *> cpus;
+    for (size_t i = 0; i < count; ++i) {
+
+        auto instance = new cpu(1024u, 1024u);
+        mmu *memory = instance->get_mmu();
+
+        memory->write32(PC_INIT_ADDRESS, CODE_INIT_ADDRESS);
+        for (uint32_t j = 0; j < CODE.size(); ++j) {
+            memory->write16(CODE_INIT_ADDRESS + 2 * j, CODE[j]);
+        }
+        memory->write32(SRAM_BEGIN, (uint32_t) i + 1);
+
+        instance->reset();
+        cpus.push_back(instance);
+    }
+
+    return cpus;
+}
+
+/**
+ * Returns the seconds a function takes
+ */
+template <typename F>
+double measure(F &&body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc > 3) {
+        std::cout << "Usage: bench_lockstep [LANES] [INSTRUCTIONS]" << std::endl;
+        std::cout << std::endl;
+        std::cout << "LANES - the number of cpus, 256 by default" << std::endl;
+        std::cout << "INSTRUCTIONS - the number of instructions every cpu runs, 1000000 by default" << std::endl;
+        return 0;
+    }
+
+    size_t lane_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+    size_t n_instr = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+
+    if (lane_count == 0 || lane_count == ULONG_MAX || n_instr == ULONG_MAX) {
+        std::cout << "LANES or INSTRUCTIONS is wrong" << std::endl;
+        return -1;
+    }
+
+    // the same sweep on the cpus one after the other and in lockstep
+    std::vector<cpu *> serial = create(lane_count);
+    std::vector<cpu *> lanes = create(lane_count);
+
+    double serial_time = measure([&] {
+        for (cpu *instance : serial) {
+            instance->run(n_instr);
+        }
+    });
+
+    lockstep together(lanes);
+    double lockstep_time = measure([&] { together.run(n_instr); });
+
+    // the runs have to agree
+    size_t mismatches = 0;
+    for (size_t i = 0; i < lane_count; ++i) {
+        for (int r = 0; r < 16; ++r) {
+            mismatches += serial[i]->get_registers()[r].to_uint != lanes[i]->get_registers()[r].to_uint;
+        }
+    }
+
+    std::cout << "Serial runs : " << serial_time << " s" << std::endl;
+    std::cout << "Lockstep run : " << lockstep_time << " s" << std::endl;
+    std::cout << "Speedup : " << serial_time / lockstep_time << std::endl;
+    std::cout << "Vector instructions : " << together.get_vector_instructions() << std::endl;
+    std::cout << "Scalar instructions : " << together.get_scalar_instructions() << std::endl;
+    std::cout << "Split lanes : " << together.get_split_lanes() << std::endl;
+    std::cout << "Rejoined lanes : " << together.get_rejoined_lanes() << std::endl;
+    std::cout << "Mismatched registers : " << mismatches << std::endl;
+
+    for (size_t i = 0; i < lane_count; ++i) {
+        delete serial[i];
+        delete lanes[i];
+    }
+
+    return mismatches == 0 ? 0 : -1;
+}